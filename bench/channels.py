@@ -0,0 +1,55 @@
+"""Measures channel throughput in messages per second across a range of isolate counts, for sizing worker pools.
+
+Usage: python bench/channels.py path/to/feline [--isolates 2,4,8,16] [--runs N]
+
+Runs each script in bench/channels/ with every isolate count, and reports the median of the rate each run prints.
+fan_in has every isolate but one sending to it; fan_out has one isolate handing jobs to the rest.
+"""
+
+import os
+import statistics
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SCRIPTS = ["fan_in", "fan_out"]
+
+
+def run(feline, script, isolates):
+	result = subprocess.run([feline, "--isolates=%d" % isolates, os.path.join(HERE, "channels", script + ".fn")],
+		capture_output=True, text=True)
+	if result.returncode != 0:
+		print("%s with %d isolates failed with status %d:" % (script, isolates, result.returncode))
+		print(result.stdout + result.stderr)
+		sys.exit(2)
+	return float(result.stdout.split()[-1])
+
+
+def main():
+	args = sys.argv[1:]
+	isolateCounts = [2, 4, 8, 16]
+	runs = 3
+
+	if "--isolates" in args:
+		index = args.index("--isolates")
+		isolateCounts = [int(count) for count in args[index + 1].split(",")]
+		del args[index:index + 2]
+	if "--runs" in args:
+		index = args.index("--runs")
+		runs = int(args[index + 1])
+		del args[index:index + 2]
+
+	if len(args) != 1:
+		print(__doc__)
+		sys.exit(1)
+
+	feline = args[0]
+	print("%-10s %9s %15s" % ("script", "isolates", "messages/sec"))
+	for script in SCRIPTS:
+		for isolates in isolateCounts:
+			rate = statistics.median(run(feline, script, isolates) for _ in range(runs))
+			print("%-10s %9d %15.0f" % (script, isolates, rate))
+
+
+if __name__ == "__main__":
+	main()
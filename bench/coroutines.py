@@ -0,0 +1,53 @@
+"""Compares fibers with async tasks, for choosing between them: the memory each takes while suspended, and what a
+switch into one and back costs.
+
+Usage: python bench/coroutines.py path/to/feline [--runs N]
+
+Runs bench/coroutines/fibers.fn and tasks.fn, which print the bytes per suspended coroutine and then the nanoseconds
+per switch, and reports the median of each over the runs. A fiber keeps a stack of its own, where a task keeps only
+its one frame, so the difference grows with how deep a fiber is when it yields.
+"""
+
+import os
+import statistics
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+MODELS = ["fibers", "tasks"]
+
+
+def run(feline, model):
+	result = subprocess.run([feline, os.path.join(HERE, "coroutines", model + ".fn")], capture_output=True, text=True)
+	if result.returncode != 0:
+		print("%s failed with status %d:" % (model, result.returncode))
+		print(result.stdout + result.stderr)
+		sys.exit(2)
+	bytesPer, nanosPer = result.stdout.split()[-2:]
+	return float(bytesPer), float(nanosPer)
+
+
+def main():
+	args = sys.argv[1:]
+	runs = 5
+
+	if "--runs" in args:
+		index = args.index("--runs")
+		runs = int(args[index + 1])
+		del args[index:index + 2]
+
+	if len(args) != 1:
+		print(__doc__)
+		sys.exit(1)
+
+	feline = args[0]
+	print("%-8s %20s %16s" % ("model", "bytes per suspended", "ns per switch"))
+	for model in MODELS:
+		results = [run(feline, model) for _ in range(runs)]
+		bytesPer = statistics.median(result[0] for result in results)
+		nanosPer = statistics.median(result[1] for result in results)
+		print("%-8s %20.0f %16.1f" % (model, bytesPer, nanosPer))
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,97 @@
+"""Runs the GC benchmarks across a grid of heap settings, reporting time and peak memory for each.
+
+Usage: python bench/gc_sweep.py path/to/feline [benchmark.fn ...] [--runs N]
+
+Peak memory is the largest resident set of any run, which needs the resource module (Unix) or psutil.
+"""
+
+import itertools
+import os
+import statistics
+import subprocess
+import sys
+import time
+
+INITIAL_HEAPS = ["1M", "8M", "64M"]
+GROWTH_FACTORS = ["1.5", "2", "3"]
+PAUSE_TARGETS = ["0", "1000"]
+
+
+def peakMemory():
+	try:
+		import resource
+		peak = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss
+		# Reported in kilobytes on Linux, bytes on macOS
+		return peak * 1024 if sys.platform != "darwin" else peak
+	except ImportError:
+		return None
+
+
+def run(feline, benchmark, flags, runs):
+	times = []
+	peak = None
+	for _ in range(runs):
+		start = time.perf_counter()
+
+		try:
+			import psutil
+			process = psutil.Popen([feline] + flags + [benchmark], stdout=subprocess.DEVNULL)
+			processPeak = 0
+			while process.poll() is None:
+				processPeak = max(processPeak, process.memory_info().rss)
+				time.sleep(0.005)
+			peak = max(peak or 0, processPeak)
+		except ImportError:
+			subprocess.run([feline] + flags + [benchmark], stdout=subprocess.DEVNULL, check=True)
+
+		times.append(time.perf_counter() - start)
+
+	childPeak = peakMemory()
+	if childPeak is not None:
+		peak = childPeak
+
+	return statistics.median(times), peak
+
+
+def main():
+	args = sys.argv[1:]
+	runs = 3
+	if "--runs" in args:
+		index = args.index("--runs")
+		runs = int(args[index + 1])
+		del args[index:index + 2]
+
+	if not args:
+		print(__doc__)
+		sys.exit(1)
+
+	feline = args[0]
+	here = os.path.dirname(os.path.abspath(__file__))
+	benchmarks = args[1:] or [os.path.join(here, name) for name in ("gc_batch_script.fn", "gc_large_heap.fn")]
+
+	for benchmark in benchmarks:
+		print(os.path.basename(benchmark))
+		print("  %-8s %-7s %-7s %10s %10s" % ("initial", "growth", "pause", "median s", "peak MB"))
+
+		for initial, growth, pause in itertools.product(INITIAL_HEAPS, GROWTH_FACTORS, PAUSE_TARGETS):
+			flags = ["--gc-initial-heap=" + initial, "--gc-growth-factor=" + growth, "--gc-pause-target=" + pause]
+
+			# Each setting runs in its own process, so that RUSAGE_CHILDREN only covers its runs
+			if peakMemory() is not None:
+				output = subprocess.run([sys.executable, __file__, "--child", feline, benchmark, str(runs)] + flags,
+					capture_output=True, text=True, check=True).stdout.split()
+				seconds, peak = float(output[0]), int(output[1])
+			else:
+				seconds, peak = run(feline, benchmark, flags, runs)
+
+			peakText = "%.0f" % (peak / (1024 * 1024)) if peak else "n/a"
+			print("  %-8s %-7s %-7s %10.3f %10s" % (initial, growth, pause, seconds, peakText))
+
+
+if __name__ == "__main__":
+	if len(sys.argv) > 1 and sys.argv[1] == "--child":
+		feline, benchmark, runs = sys.argv[2], sys.argv[3], int(sys.argv[4])
+		seconds, peak = run(feline, benchmark, sys.argv[5:], runs)
+		print(seconds, peak)
+	else:
+		main()
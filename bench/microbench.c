@@ -0,0 +1,393 @@
+// Times the runtime's C primitives in isolation, reporting nanoseconds per operation for each.
+//
+// Build it as the interpreter is built, with optimisations on and this file in place of src/main.c,
+// and run it as `microbench [filter]`, where only benchmarks whose names contain filter are run.
+//
+// The benchmarks are natives called from a small Feline script, so they run with a frame on the stack as any
+// native does, and the heap shapes given to the collector are built by ordinary Feline code.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/vm.h"
+#include "../src/memory.h"
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/module.h"
+#include "../src/file.h"
+#include "../src/timer.h"
+#include "../src/builtin/natives.h"
+
+// Each benchmark is timed this many times, and the fastest kept, to shed noise from the rest of the system
+#define REPEATS 5
+
+static const char* filter = NULL;
+
+static bool selected(const char* name) {
+	return filter == NULL || strstr(name, filter) != NULL;
+}
+
+static void report(const char* name, uint64_t nanos, size_t operations) {
+	printf("%-48s %12.2f ns/op\n", name, (double)nanos / (double)operations);
+}
+
+static uint64_t fastest(uint64_t best, uint64_t start) {
+	uint64_t elapsed = monotonicNanoseconds() - start;
+	return best == 0 || elapsed < best ? elapsed : best;
+}
+
+// ========= Tables =========
+
+// The keys are kept in a list on the stack, so that the collector neither frees nor moves them
+static ObjList* makeKeys(VM* vm, const char* prefix, size_t count) {
+	ValueArray items;
+	initValueArray(&items);
+	ObjList* keys = newList(vm, items);
+	push(vm, OBJ_VAL(keys));
+
+	char buffer[64];
+	for (size_t i = 0; i < count; i++) {
+		int length = snprintf(buffer, sizeof(buffer), "%s%zu", prefix, i);
+		push(vm, OBJ_VAL(copyString(vm, buffer, (size_t)length)));
+		writeValueArray(vm, &keys->items, peek(vm, 0));
+		writeBarrier(vm, (Obj*)keys, peek(vm, 0));
+		pop(vm);
+	}
+	return keys;
+}
+
+// Sized up front, rather than grown by tableSet(), so that it holds count keys at exactly the wanted load
+static void fillTable(VM* vm, Table* table, size_t capacity, ObjList* keys, size_t count) {
+	table->entries = ALLOCATE(vm, Entry, capacity);
+	table->capacity = capacity;
+	table->count = 0;
+	for (size_t i = 0; i < capacity; i++) {
+		table->entries[i].key = NULL;
+		table->entries[i].value = NULL_VAL;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		tableSet(vm, table, AS_STRING(keys->items.items[i]), NUMBER_VAL((double)i));
+	}
+}
+
+static void benchTableLoad(VM* vm, ObjList* keys, ObjList* missing, double load) {
+	size_t capacity = 1 << 14;
+	size_t count = (size_t)(capacity * load);
+	char name[64];
+
+	Table table;
+	initTable(&table);
+	fillTable(vm, &table, capacity, keys, count);
+
+	Value value;
+	uint64_t best = 0;
+
+	snprintf(name, sizeof(name), "tableGet hit, load %.2f", load);
+	if (selected(name)) {
+		for (int r = 0; r < REPEATS; r++) {
+			uint64_t start = monotonicNanoseconds();
+			for (size_t i = 0; i < count; i++) {
+				tableGet(&table, AS_STRING(keys->items.items[i]), &value);
+			}
+			best = fastest(best, start);
+		}
+		report(name, best, count);
+	}
+
+	best = 0;
+	snprintf(name, sizeof(name), "tableGet miss, load %.2f", load);
+	if (selected(name)) {
+		for (int r = 0; r < REPEATS; r++) {
+			uint64_t start = monotonicNanoseconds();
+			for (size_t i = 0; i < count; i++) {
+				tableGet(&table, AS_STRING(missing->items.items[i]), &value);
+			}
+			best = fastest(best, start);
+		}
+		report(name, best, count);
+	}
+
+	best = 0;
+	snprintf(name, sizeof(name), "tableSet existing key, load %.2f", load);
+	if (selected(name)) {
+		for (int r = 0; r < REPEATS; r++) {
+			uint64_t start = monotonicNanoseconds();
+			for (size_t i = 0; i < count; i++) {
+				tableSet(vm, &table, AS_STRING(keys->items.items[i]), NUMBER_VAL((double)r));
+			}
+			best = fastest(best, start);
+		}
+		report(name, best, count);
+	}
+
+	best = 0;
+	snprintf(name, sizeof(name), "tableFindString hit, load %.2f", load);
+	if (selected(name)) {
+		for (int r = 0; r < REPEATS; r++) {
+			uint64_t start = monotonicNanoseconds();
+			for (size_t i = 0; i < count; i++) {
+				ObjString* key = AS_STRING(keys->items.items[i]);
+				tableFindString(&table, key->str, key->length, key->hash);
+			}
+			best = fastest(best, start);
+		}
+		report(name, best, count);
+	}
+
+	freeTable(vm, &table);
+}
+
+static void benchTables(VM* vm) {
+	size_t count = 1 << 14;
+	ObjList* keys = makeKeys(vm, "key", count);
+	ObjList* missing = makeKeys(vm, "missing", count);
+
+	benchTableLoad(vm, keys, missing, 0.25);
+	benchTableLoad(vm, keys, missing, 0.50);
+	benchTableLoad(vm, keys, missing, 0.75);
+
+	// From empty, so that growth is included
+	uint64_t best = 0;
+	if (selected("tableSet insert, growing from empty")) {
+		for (int r = 0; r < REPEATS; r++) {
+			Table table;
+			initTable(&table);
+			uint64_t start = monotonicNanoseconds();
+			for (size_t i = 0; i < count; i++) {
+				tableSet(vm, &table, AS_STRING(keys->items.items[i]), NULL_VAL);
+			}
+			best = fastest(best, start);
+			freeTable(vm, &table);
+		}
+		report("tableSet insert, growing from empty", best, count);
+	}
+
+	pop(vm);
+	pop(vm);
+}
+
+// ========= Strings =========
+
+static void benchStrings(VM* vm) {
+	static const size_t lengths[] = { 8, 32, 256, 4096 };
+	size_t iterations = 20000;
+	char name[64];
+
+	char* buffer = (char*)malloc(4096 + 32);
+	if (buffer == NULL) exit(1);
+	memset(buffer, 'x', 4096 + 32);
+
+	for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+		size_t length = lengths[l];
+		uint64_t best = 0;
+
+		snprintf(name, sizeof(name), "hashString, %zu bytes", length);
+		if (selected(name)) {
+			volatile uint32_t sink = 0;
+			for (int r = 0; r < REPEATS; r++) {
+				uint64_t start = monotonicNanoseconds();
+				for (size_t i = 0; i < iterations; i++) {
+					sink ^= hashString(buffer, length);
+				}
+				best = fastest(best, start);
+			}
+			report(name, best, iterations);
+		}
+
+		best = 0;
+		snprintf(name, sizeof(name), "copyString already interned, %zu bytes", length);
+		if (selected(name)) {
+			push(vm, OBJ_VAL(copyString(vm, buffer, length)));
+			for (int r = 0; r < REPEATS; r++) {
+				uint64_t start = monotonicNanoseconds();
+				for (size_t i = 0; i < iterations; i++) {
+					copyString(vm, buffer, length);
+				}
+				best = fastest(best, start);
+			}
+			pop(vm);
+			report(name, best, iterations);
+		}
+
+		// Each string is made unique by a counter at its start; they become garbage at once, so collection is included
+		best = 0;
+		snprintf(name, sizeof(name), "copyString new, %zu bytes", length);
+		if (selected(name)) {
+			size_t unique = 0;
+			for (int r = 0; r < REPEATS; r++) {
+				uint64_t start = monotonicNanoseconds();
+				for (size_t i = 0; i < iterations; i++) {
+					memcpy(buffer, &unique, sizeof(unique));
+					unique++;
+					copyString(vm, buffer, length);
+				}
+				best = fastest(best, start);
+			}
+			memset(buffer, 'x', sizeof(unique));
+			report(name, best, iterations);
+		}
+	}
+
+	free(buffer);
+}
+
+// ========= Value Arrays =========
+
+static void benchValueArrays(VM* vm) {
+	static const size_t sizes[] = { 16, 1024, 1 << 20 };
+	char name[64];
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		size_t size = sizes[s];
+		size_t rounds = (1 << 20) / size;
+
+		snprintf(name, sizeof(name), "writeValueArray, growing to %zu", size);
+		if (!selected(name)) continue;
+
+		uint64_t best = 0;
+		for (int r = 0; r < REPEATS; r++) {
+			uint64_t start = monotonicNanoseconds();
+			for (size_t round = 0; round < rounds; round++) {
+				ValueArray array;
+				initValueArray(&array);
+				for (size_t i = 0; i < size; i++) {
+					writeValueArray(vm, &array, NUMBER_VAL((double)i));
+				}
+				freeValueArray(vm, &array);
+			}
+			best = fastest(best, start);
+		}
+		report(name, best, rounds * size);
+	}
+}
+
+static Value runPrimitivesNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	benchTables(vm);
+	benchStrings(vm);
+	benchValueArrays(vm);
+	return NULL_VAL;
+}
+
+// ========= Collection =========
+
+static size_t liveObjects(VM* vm) {
+	GCStats stats;
+	getGCStats(vm, &stats);
+
+	size_t count = 0;
+	for (size_t i = 0; i < OBJ_TYPE_COUNT; i++) {
+		count += stats.objects[i].count;
+	}
+	return count;
+}
+
+// args[1] keeps the shape alive while it is collected; the time is given per live object
+static Value collectShapeNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	char name[96];
+	snprintf(name, sizeof(name), "collectGarbage, %s", AS_STRING(args[0])->str);
+	if (!selected(name)) return NULL_VAL;
+
+	collectGarbage(vm);
+	size_t objects = liveObjects(vm);
+
+	uint64_t best = 0;
+	for (int r = 0; r < REPEATS; r++) {
+		uint64_t start = monotonicNanoseconds();
+		collectGarbage(vm);
+		best = fastest(best, start);
+	}
+
+	printf("%-48s %12.2f ns/op  (%.3f ms for %zu objects)\n", name, (double)best / (double)objects, (double)best / 1e6, objects);
+	return NULL_VAL;
+}
+
+// ========= Calls =========
+
+// Calls args[1] with args[2] null arguments, as a native calling back into Feline does
+static Value callDispatchNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	char name[96];
+	snprintf(name, sizeof(name), "callValue, %s", AS_STRING(args[0])->str);
+	if (!selected(name)) return NULL_VAL;
+
+	Value callee = args[1];
+	uint8_t calleeArgs = (uint8_t)AS_NUMBER(args[2]);
+	size_t iterations = 200000;
+
+	uint64_t best = 0;
+	for (int r = 0; r < REPEATS; r++) {
+		uint64_t start = monotonicNanoseconds();
+		for (size_t i = 0; i < iterations; i++) {
+			for (uint8_t a = 0; a < calleeArgs; a++) push(vm, NULL_VAL);
+			callFromNative(vm, callee, calleeArgs);
+		}
+		best = fastest(best, start);
+	}
+
+	report(name, best, iterations);
+	return NULL_VAL;
+}
+
+static const char* driver =
+	"class Point {\n"
+	"	new(x, y) { this.x = x; this.y = y; }\n"
+	"	getX() { return this.x; }\n"
+	"}\n"
+	"class Empty {}\n"
+	"function none() { return null; }\n"
+	"function three(a, b, c) { return a; }\n"
+	"\n"
+	"runPrimitives();\n"
+	"\n"
+	"callDispatch(\"closure, 0 arguments\", none, 0);\n"
+	"callDispatch(\"closure, 3 arguments\", three, 3);\n"
+	"callDispatch(\"bound method\", Point(1, 2).getX, 0);\n"
+	"callDispatch(\"class with initializer\", Point, 2);\n"
+	"callDispatch(\"class without initializer\", Empty, 0);\n"
+	"callDispatch(\"native\", clock, 0);\n"
+	"\n"
+	"function wide(n) { var l = []; for (var i = 0; i < n; i = i + 1) l.push([i, i, i, i]); return l; }\n"
+	"class Node { new(next) { this.next = next; } }\n"
+	"function chain(n) { var head = null; for (var i = 0; i < n; i = i + 1) head = Node(head); return head; }\n"
+	"class Tree { new(left, right) { this.left = left; this.right = right; } }\n"
+	"function tree(depth) { if (depth == 0) return Tree(null, null); return Tree(tree(depth - 1), tree(depth - 1)); }\n"
+	"function strings(n) {\n"
+	"	var letters = [\"a\", \"b\", \"c\", \"d\", \"e\", \"f\", \"g\", \"h\", \"i\", \"j\", \"k\", \"l\", \"m\", \"n\", \"o\", \"p\"];\n"
+	"	var l = [];\n"
+	"	for (var i = 0; i < 16 && len(l) < n; i = i + 1)\n"
+	"		for (var j = 0; j < 16; j = j + 1)\n"
+	"			for (var k = 0; k < 16; k = k + 1)\n"
+	"				for (var m = 0; m < 16; m = m + 1) l.push(letters[i] + letters[j] + letters[k] + letters[m]);\n"
+	"	return l;\n"
+	"}\n"
+	"\n"
+	"collectShape(\"empty heap\", null);\n"
+	"collectShape(\"100000 small lists in a list\", wide(100000));\n"
+	"collectShape(\"chain of 100000 instances\", chain(100000));\n"
+	"collectShape(\"binary tree of depth 16\", tree(16));\n"
+	"collectShape(\"65536 strings in a list\", strings(65536));\n";
+
+int main(int argc, const char** argv) {
+	if (argc > 2) {
+		fprintf(stderr, "Usage:\nmicrobench [filter]\n");
+		return 1;
+	}
+	if (argc == 2) filter = argv[1];
+
+	VM vm;
+	initVM(&vm);
+
+	Module* mainModule = ALLOCATE(&vm, Module, 1);
+	initModule(&vm, mainModule);
+	splitPathToNameAndDirectory(&vm, mainModule, "microbench.fn");
+	vm.baseDirectory = mainModule->directory;
+
+	defineNative(&vm, NULL, &mainModule->globals, "runPrimitives", runPrimitivesNative, 0);
+	defineNative(&vm, NULL, &mainModule->globals, "collectShape", collectShapeNative, 2);
+	defineNative(&vm, NULL, &mainModule->globals, "callDispatch", callDispatchNative, 3);
+
+	InterpreterResult result = interpret(&vm, driver);
+	freeVM(&vm);
+
+	return result == INTERPRETER_OK ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+"""Measures the speedup of parallel.map() over the sequential list.map() across a range of worker counts and chunk sizes.
+
+Usage: python bench/parallel_map.py path/to/feline [--workers 1,2,4,8] [--runs N]
+
+Runs bench/parallel/map.fn with every worker count, and reports the median time of each way of mapping over the runs,
+with its speedup over list.map(). The chunk size "auto" is parallel.map()'s own choice.
+"""
+
+import os
+import statistics
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SCRIPT = os.path.join(HERE, "parallel", "map.fn")
+# As listed in CHUNK_SIZES in the script, after the sequential time
+CHUNK_SIZES = ["auto", "1", "16", "256", "4096"]
+
+
+def run(feline, workers):
+	result = subprocess.run([feline, "--workers=%d" % workers, SCRIPT], capture_output=True, text=True)
+	if result.returncode != 0:
+		print("map with %d workers failed with status %d:" % (workers, result.returncode))
+		print(result.stdout + result.stderr)
+		sys.exit(2)
+	return [float(line) for line in result.stdout.split()]
+
+
+def main():
+	args = sys.argv[1:]
+	workerCounts = [1, 2, 4, 8]
+	runs = 3
+
+	if "--workers" in args:
+		index = args.index("--workers")
+		workerCounts = [int(count) for count in args[index + 1].split(",")]
+		del args[index:index + 2]
+	if "--runs" in args:
+		index = args.index("--runs")
+		runs = int(args[index + 1])
+		del args[index:index + 2]
+
+	if len(args) != 1:
+		print(__doc__)
+		sys.exit(1)
+
+	feline = args[0]
+	print("%8s %11s %10s %8s" % ("workers", "chunk size", "ms", "speedup"))
+	for workers in workerCounts:
+		times = [run(feline, workers) for _ in range(runs)]
+		medians = [statistics.median(column) for column in zip(*times)]
+		sequential = medians[0]
+
+		print("%8d %11s %10.1f %8s" % (workers, "list.map", sequential, "1.00x"))
+		for chunkSize, elapsed in zip(CHUNK_SIZES, medians[1:]):
+			print("%8d %11s %10.1f %7.2fx" % (workers, chunkSize, elapsed, sequential / elapsed))
+
+
+if __name__ == "__main__":
+	main()
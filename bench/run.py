@@ -0,0 +1,126 @@
+"""Runs the benchmarks in bench/ and reports the median, minimum and standard deviation of each one's time.
+
+Usage: python bench/run.py path/to/feline [name ...] [--runs N] [--save results.json] [--baseline results.json] [--threshold P]
+
+Benchmarks are named without .fn. By default every .fn file in bench/ runs, each in a fresh process so startup is counted.
+
+--runs       timed runs of each benchmark (default 5), after one untimed run to warm the file cache
+--save       write the results to a JSON file, to be given as --baseline later
+--baseline   compare against saved results, and exit with status 1 if any benchmark regressed or its output changed
+--threshold  how much slower than the baseline's median, in percent, counts as a regression (default 5)
+
+A benchmark only counts as slower if it is beyond the threshold and the difference is more than twice the larger
+standard deviation of the two sets of runs, so that noisy benchmarks are not flagged at random.
+"""
+
+import hashlib
+import json
+import os
+import statistics
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def benchmarkNames():
+	return sorted(name[:-3] for name in os.listdir(HERE) if name.endswith(".fn"))
+
+
+def runOnce(feline, name):
+	start = time.perf_counter()
+	result = subprocess.run([feline, os.path.join(HERE, name + ".fn")], capture_output=True)
+	elapsed = time.perf_counter() - start
+	if result.returncode != 0:
+		print("%s failed with status %d:" % (name, result.returncode))
+		print(result.stdout.decode(errors="replace") + result.stderr.decode(errors="replace"))
+		sys.exit(2)
+	return elapsed, hashlib.sha1(result.stdout).hexdigest()
+
+
+def measure(feline, name, runs):
+	_, output = runOnce(feline, name)
+	times = []
+	for _ in range(runs):
+		elapsed, runOutput = runOnce(feline, name)
+		if runOutput != output:
+			print("%s printed different output between runs" % name)
+			sys.exit(2)
+		times.append(elapsed)
+
+	return {
+		"median": statistics.median(times),
+		"min": min(times),
+		"stddev": statistics.stdev(times) if len(times) > 1 else 0.0,
+		"times": times,
+		"output": output,
+	}
+
+
+def compare(name, result, base, threshold):
+	"""Returns a note on how the result differs from the baseline, and whether it is a regression."""
+	if base is None:
+		return "new", False
+	if result["output"] != base["output"]:
+		return "OUTPUT CHANGED", True
+
+	change = (result["median"] - base["median"]) / base["median"] * 100.0
+	noise = 2 * max(result["stddev"], base["stddev"])
+	beyondNoise = abs(result["median"] - base["median"]) > noise
+
+	if change > threshold and beyondNoise:
+		return "%+.1f%% REGRESSION" % change, True
+	if change < -threshold and beyondNoise:
+		return "%+.1f%% faster" % change, False
+	return "%+.1f%%" % change, False
+
+
+def main():
+	args = sys.argv[1:]
+	options = {"--runs": 5, "--save": None, "--baseline": None, "--threshold": 5.0}
+	for option in list(options):
+		if option in args:
+			index = args.index(option)
+			value = args[index + 1]
+			options[option] = value if options[option] is None else type(options[option])(value)
+			del args[index:index + 2]
+
+	if not args:
+		print(__doc__)
+		sys.exit(1)
+
+	feline = args[0]
+	names = args[1:] or benchmarkNames()
+
+	baseline = {}
+	if options["--baseline"] is not None:
+		with open(options["--baseline"]) as file:
+			baseline = json.load(file)["benchmarks"]
+
+	print("%-18s %10s %10s %10s  %s" % ("benchmark", "median s", "min s", "stddev", "vs baseline" if baseline else ""))
+
+	results = {}
+	regressed = False
+	for name in names:
+		result = measure(feline, name, options["--runs"])
+		results[name] = result
+
+		note = ""
+		if baseline:
+			note, isRegression = compare(name, result, baseline.get(name), options["--threshold"])
+			regressed = regressed or isRegression
+
+		print("%-18s %10.3f %10.3f %10.4f  %s" % (name, result["median"], result["min"], result["stddev"], note))
+
+	if options["--save"] is not None:
+		with open(options["--save"], "w") as file:
+			json.dump({"feline": feline, "runs": options["--runs"], "benchmarks": results}, file, indent=2)
+
+	if regressed:
+		print("Regressions found against %s" % options["--baseline"])
+		sys.exit(1)
+
+
+if __name__ == "__main__":
+	main()
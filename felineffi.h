@@ -56,10 +56,11 @@ typedef enum InternalExceptionType {
 	INTERNAL_EXCEPTION_STACK_OVERFLOW,
 	INTERNAL_EXCEPTION_LINK_FAILURE,
 	INTERNAL_EXCEPTION_VALUE,
+	INTERNAL_EXCEPTION_OUT_OF_MEMORY,
 	INTERNAL_EXCEPTION__COUNT
 } InternalExceptionType;
 
-typedef Value(*NativeFunction)(VM* vm, uint8_t argCount, Value* value);
+typedef Value(*NativeFunction)(VM* vm, Value bound, uint8_t argCount, Value* value);
 
 #define BOOL_VAL(value) ((Value){VAL_BOOL, { .boolean = value }})
 #define NULL_VAL ((Value){VAL_NULL, { .number = 0 }})
@@ -75,6 +76,8 @@ typedef Value(*NativeFunction)(VM* vm, uint8_t argCount, Value* value);
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 
+// Filled in once, when the library is loaded, and the same for every VM: each call is given the VM to act on.
+// A library is loaded once per process, so isolates running on other threads share it, and may call its natives at once.
 ObjClass* (*feline_getInternalException)(VM* vm, InternalExceptionType type);
 void (*feline_throwException)(VM* vm, ObjClass* exceptionType, const char* format, ...);
 bool (*feline_isInstance)(Value value);
@@ -86,6 +89,8 @@ bool (*feline_setInstanceField)(VM* vm, ObjInstance* instance, const char* name,
 char* (*feline_getStringCharacters)(ObjString* string);
 size_t(*feline_getStringLength)(ObjString* string);
 void (*feline_setInstanceNativeData)(ObjInstance* instance, InstanceData* data);
+// freeData normally runs on the garbage collector's sweeper thread; data set with this is freed on the VM's thread instead
+void (*feline_setInstanceNativeDataSync)(ObjInstance* instance, InstanceData* data);
 InstanceData* (*feline_getInstanceNativeData)(ObjInstance* instance);
 
 ObjString* (*feline_takeString)(VM* vm, char* str, size_t length);
@@ -112,6 +117,7 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpReserved) {
 		feline_getStringCharacters = (char* (*)(ObjString * string))GetProcAddress(hostFelineApp, "export_getStringCharacters");
 		feline_getStringLength = (size_t(*)(ObjString * string))GetProcAddress(hostFelineApp, "export_getStringLength");
 		feline_setInstanceNativeData = (void (*)(ObjInstance * instance, InstanceData * data))GetProcAddress(hostFelineApp, "export_setInstanceNativeData");
+		feline_setInstanceNativeDataSync = (void (*)(ObjInstance * instance, InstanceData * data))GetProcAddress(hostFelineApp, "export_setInstanceNativeDataSync");
 		feline_getInstanceNativeData = (InstanceData * (*)(ObjInstance * instance))GetProcAddress(hostFelineApp, "export_getInstanceNativeData");
 		feline_takeString = (ObjString * (*)(VM * vm, char* str, size_t length))GetProcAddress(hostFelineApp, "takeString");
 		feline_copyString = (ObjString * (*)(VM * vm, const char* str, size_t length))GetProcAddress(hostFelineApp, "copyString");
@@ -0,0 +1,225 @@
+#include "allocprofile.h"
+#include "object.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALLOC_PROFILE_MAX_LOAD 0.75
+
+typedef struct AllocationSite {
+	// Sites are keyed by function, line and type; a NULL function is allocation with no frame, such as while compiling.
+	// A function freed while profiling may have its address reused by another, whose allocations would then share its sites.
+	ObjFunction* function;
+	size_t line;
+	ObjType type;
+	char* label;
+
+	double bytes;
+	double count;
+} AllocationSite;
+
+struct AllocProfiler {
+	size_t interval;
+	size_t untilSample;
+	uint64_t random;
+	size_t top;
+
+	size_t totalBytes;
+	size_t totalCount;
+
+	AllocationSite* sites;
+	size_t siteCount;
+	size_t siteCapacity;
+};
+
+static size_t nextInterval(AllocProfiler* profiler) {
+	// xorshift64, to land samples between half and one and a half intervals apart so periodic allocation is not aliased
+	profiler->random ^= profiler->random << 13;
+	profiler->random ^= profiler->random >> 7;
+	profiler->random ^= profiler->random << 17;
+	return profiler->interval / 2 + (size_t)(profiler->random % (profiler->interval + 1));
+}
+
+void startAllocationProfile(VM* vm, size_t interval, size_t top) {
+	AllocProfiler* profiler = (AllocProfiler*)malloc(sizeof(AllocProfiler));
+	if (profiler == NULL) exit(1);
+
+	profiler->interval = interval;
+	profiler->random = 0x9E3779B97F4A7C15ull;
+	profiler->untilSample = interval == 0 ? 0 : nextInterval(profiler);
+	profiler->top = top;
+	profiler->totalBytes = 0;
+	profiler->totalCount = 0;
+	profiler->sites = NULL;
+	profiler->siteCount = 0;
+	profiler->siteCapacity = 0;
+
+	vm->allocProfiler = profiler;
+}
+
+static size_t hashSite(ObjFunction* function, size_t line, ObjType type) {
+	uint64_t hash = (uint64_t)(uintptr_t)function * 0x9E3779B97F4A7C15ull;
+	hash ^= (uint64_t)line * 0xC2B2AE3D27D4EB4Full + (uint64_t)type;
+	return (size_t)(hash ^ (hash >> 29));
+}
+
+static AllocationSite* findSite(AllocationSite* sites, size_t capacity, ObjFunction* function, size_t line, ObjType type) {
+	size_t index = hashSite(function, line, type) & (capacity - 1);
+	while (true) {
+		AllocationSite* site = &sites[index];
+		if (site->label == NULL || (site->function == function && site->line == line && site->type == type)) {
+			return site;
+		}
+		index = (index + 1) & (capacity - 1);
+	}
+}
+
+static void growSites(AllocProfiler* profiler) {
+	size_t capacity = profiler->siteCapacity < 64 ? 64 : profiler->siteCapacity * 2;
+	AllocationSite* sites = (AllocationSite*)calloc(capacity, sizeof(AllocationSite));
+	if (sites == NULL) exit(1);
+
+	for (size_t i = 0; i < profiler->siteCapacity; i++) {
+		AllocationSite* site = &profiler->sites[i];
+		if (site->label == NULL) continue;
+		*findSite(sites, capacity, site->function, site->line, site->type) = *site;
+	}
+
+	free(profiler->sites);
+	profiler->sites = sites;
+	profiler->siteCapacity = capacity;
+}
+
+static char* siteLabel(VM* vm, CallFrame* frame, size_t line) {
+	char buffer[512];
+
+	if (frame == NULL) {
+		snprintf(buffer, sizeof(buffer), "<no frame>");
+	}
+	else {
+		ObjFunction* function = frame->closure->function;
+		Module* owner = frame->closure->owner;
+		snprintf(buffer, sizeof(buffer), "%s%s.fn:%zu in %s",
+			owner != NULL && owner->directory != NULL ? owner->directory->str : "",
+			owner != NULL && owner->name != NULL ? owner->name->str : "?",
+			line, function->name != NULL ? function->name->str : "<script>");
+	}
+
+	char* label = (char*)malloc(strlen(buffer) + 1);
+	if (label == NULL) exit(1);
+	strcpy(label, buffer);
+	return label;
+}
+
+static void recordSample(VM* vm, AllocProfiler* profiler, ObjType type, double bytes, double count) {
+	CallFrame* frame = vm->frames.length > 0 ? &vm->frames.items[vm->frames.length - 1] : NULL;
+
+	ObjFunction* function = NULL;
+	size_t line = 0;
+	if (frame != NULL) {
+		function = frame->closure->function;
+		// The ip has already moved past the instruction being run, unless the frame has only just been pushed
+		size_t instruction = frame->ip - function->chunk.bytecode.items;
+		line = getLineOfInstruction(&function->chunk, instruction > 0 ? instruction - 1 : 0);
+	}
+
+	if (profiler->siteCount + 1 > profiler->siteCapacity * ALLOC_PROFILE_MAX_LOAD) {
+		growSites(profiler);
+	}
+
+	AllocationSite* site = findSite(profiler->sites, profiler->siteCapacity, function, line, type);
+	if (site->label == NULL) {
+		site->function = function;
+		site->line = line;
+		site->type = type;
+		site->label = siteLabel(vm, frame, line);
+		site->bytes = 0;
+		site->count = 0;
+		profiler->siteCount++;
+	}
+
+	site->bytes += bytes;
+	site->count += count;
+}
+
+void profileAllocation(VM* vm, size_t size, ObjType type) {
+	AllocProfiler* profiler = vm->allocProfiler;
+	profiler->totalBytes += size;
+	profiler->totalCount++;
+
+	if (profiler->interval == 0) {
+		recordSample(vm, profiler, type, (double)size, 1);
+		return;
+	}
+
+	if (size < profiler->untilSample) {
+		profiler->untilSample -= size;
+		return;
+	}
+
+	// The sample stands for every byte since the last one
+	recordSample(vm, profiler, type, (double)profiler->interval, (double)profiler->interval / (double)size);
+	profiler->untilSample = nextInterval(profiler);
+}
+
+// Per thread, as isolates may report at once
+static _Thread_local AllocationSite* sortSites;
+
+static int compareBytes(const void* a, const void* b) {
+	double difference = sortSites[*(const size_t*)b].bytes - sortSites[*(const size_t*)a].bytes;
+	return (difference > 0) - (difference < 0);
+}
+
+static int compareCount(const void* a, const void* b) {
+	double difference = sortSites[*(const size_t*)b].count - sortSites[*(const size_t*)a].count;
+	return (difference > 0) - (difference < 0);
+}
+
+static void printTop(AllocProfiler* profiler, size_t* order, size_t count, const char* title) {
+	fprintf(stderr, "%s\n", title);
+	fprintf(stderr, "  %14s %6s %12s %6s  %-14s %s\n", "bytes", "%", "objects", "%", "type", "site");
+
+	for (size_t i = 0; i < count && i < profiler->top; i++) {
+		AllocationSite* site = &profiler->sites[order[i]];
+		fprintf(stderr, "  %14.0f %5.1f%% %12.0f %5.1f%%  %-14s %s\n",
+			site->bytes, 100.0 * site->bytes / (double)(profiler->totalBytes ? profiler->totalBytes : 1),
+			site->count, 100.0 * site->count / (double)(profiler->totalCount ? profiler->totalCount : 1),
+			objTypeName(site->type), site->label);
+	}
+}
+
+void finishAllocationProfile(VM* vm) {
+	AllocProfiler* profiler = vm->allocProfiler;
+	if (profiler == NULL) return;
+	vm->allocProfiler = NULL;
+
+	size_t* order = (size_t*)malloc(sizeof(size_t) * (profiler->siteCount + 1));
+	if (order == NULL) exit(1);
+
+	size_t count = 0;
+	for (size_t i = 0; i < profiler->siteCapacity; i++) {
+		if (profiler->sites[i].label != NULL) order[count++] = i;
+	}
+
+	fprintf(stderr, "-- Allocation Profile\n");
+	if (profiler->interval == 0) {
+		fprintf(stderr, "   %zu objects, %zu bytes, every allocation recorded\n", profiler->totalCount, profiler->totalBytes);
+	}
+	else {
+		fprintf(stderr, "   %zu objects, %zu bytes, sampled about every %zu bytes (site figures are estimates)\n",
+			profiler->totalCount, profiler->totalBytes, profiler->interval);
+	}
+
+	sortSites = profiler->sites;
+	qsort(order, count, sizeof(size_t), compareBytes);
+	printTop(profiler, order, count, "   By bytes:");
+	qsort(order, count, sizeof(size_t), compareCount);
+	printTop(profiler, order, count, "   By count:");
+
+	for (size_t i = 0; i < profiler->siteCapacity; i++) {
+		free(profiler->sites[i].label);
+	}
+	free(profiler->sites);
+	free(order);
+	free(profiler);
+}
\ No newline at end of file
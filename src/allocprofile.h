@@ -0,0 +1,13 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// Attributes object allocations to the function, line and object type that made them, reporting the heaviest sites.
+// With an interval of 0 every allocation is recorded; otherwise one is sampled about every interval bytes,
+// and each sample stands for interval bytes' worth of that site's objects.
+// Nothing is recorded unless startAllocationProfile() has been called.
+
+void startAllocationProfile(VM* vm, size_t interval, size_t top);
+void profileAllocation(VM* vm, size_t size, ObjType type);
+// Prints the top sites by bytes and by count to stderr, and frees the profile
+void finishAllocationProfile(VM* vm);
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include "benchmodule.h"
+#include "natives.h"
+#include "../vm.h"
+#include "../memory.h"
+#include "../timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Calls are timed in batches at least this long, so the timer's own cost stays out of the results
+#define BENCH_SAMPLE_NANOS 1000000
+
+typedef struct BenchSamples {
+	size_t length;
+	size_t capacity;
+	// Nanoseconds per call, averaged over each batch
+	double* items;
+} BenchSamples;
+
+static void addSample(BenchSamples* samples, double nanos) {
+	if (samples->capacity < samples->length + 1) {
+		samples->capacity = samples->capacity < 64 ? 64 : samples->capacity * 2;
+		samples->items = realloc(samples->items, sizeof(double) * samples->capacity);
+		if (samples->items == NULL) exit(1);
+	}
+	samples->items[samples->length++] = nanos;
+}
+
+static int compareSamples(const void* a, const void* b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(BenchSamples* samples, double fraction) {
+	size_t index = (size_t)(fraction * (double)(samples->length - 1) + 0.5);
+	return samples->items[index];
+}
+
+static bool expectDuration(VM* vm, Value value, const char* name) {
+	if (!IS_NUMBER(value) || AS_NUMBER(value) < 0) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected %s to be a non-negative number of milliseconds", name);
+		return false;
+	}
+	return true;
+}
+
+static bool runOnce(VM* vm, Value function) {
+	callFromNative(vm, function, 0);
+	return !vm->hasException;
+}
+
+// run(function, warmupMs, durationMs)
+// Calls the function for warmupMs, then samples batches of calls for durationMs with a full collection before each,
+// so garbage left by one batch is not paid for by the next. Collections are not counted in the times.
+static Value benchRunNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (!expectDuration(vm, args[1], "warm-up") || !expectDuration(vm, args[2], "duration")) return NULL_VAL;
+
+	Value function = args[0];
+	uint64_t warmupNanos = (uint64_t)(AS_NUMBER(args[1]) * 1e6);
+	uint64_t durationNanos = (uint64_t)(AS_NUMBER(args[2]) * 1e6);
+
+	// The warm-up also finds how many calls make up a batch
+	uint64_t warmupCalls = 0;
+	uint64_t warmupStart = monotonicNanoseconds();
+	uint64_t now = warmupStart;
+	do {
+		if (!runOnce(vm, function)) return NULL_VAL;
+		warmupCalls++;
+		now = monotonicNanoseconds();
+	} while (now - warmupStart < warmupNanos);
+
+	uint64_t callNanos = (now - warmupStart) / warmupCalls;
+	uint64_t batch = callNanos >= BENCH_SAMPLE_NANOS ? 1 : BENCH_SAMPLE_NANOS / (callNanos + 1);
+
+	BenchSamples samples = { 0, 0, NULL };
+	uint64_t calls = 0;
+	uint64_t timed = 0;
+	uint64_t measureStart = monotonicNanoseconds();
+	do {
+		collectGarbage(vm);
+
+		uint64_t start = monotonicNanoseconds();
+		for (uint64_t i = 0; i < batch; i++) {
+			if (!runOnce(vm, function)) {
+				free(samples.items);
+				return NULL_VAL;
+			}
+		}
+		uint64_t end = monotonicNanoseconds();
+
+		addSample(&samples, (double)(end - start) / (double)batch);
+		calls += batch;
+		timed += end - start;
+	} while (monotonicNanoseconds() - measureStart < durationNanos);
+
+	qsort(samples.items, samples.length, sizeof(double), compareSamples);
+
+	ObjInstance* result = pushObject(vm);
+	setField(vm, result, "iterations", NUMBER_VAL((double)calls));
+	setField(vm, result, "samples", NUMBER_VAL((double)samples.length));
+	setField(vm, result, "opsPerSecond", NUMBER_VAL((double)calls / ((double)timed / 1e9)));
+	setField(vm, result, "meanNs", NUMBER_VAL((double)timed / (double)calls));
+	setField(vm, result, "minNs", NUMBER_VAL(samples.items[0]));
+	setField(vm, result, "p50Ns", NUMBER_VAL(percentile(&samples, 0.50)));
+	setField(vm, result, "p90Ns", NUMBER_VAL(percentile(&samples, 0.90)));
+	setField(vm, result, "p99Ns", NUMBER_VAL(percentile(&samples, 0.99)));
+	setField(vm, result, "maxNs", NUMBER_VAL(samples.items[samples.length - 1]));
+	free(samples.items);
+
+	return pop(vm);
+}
+
+static bool getNumberField(VM* vm, ObjInstance* instance, const char* name, double* number) {
+	ObjString* key = copyString(vm, name, strlen(name));
+	Value value;
+	if (!tableGet(&instance->fields, key, &value) || !IS_NUMBER(value)) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected a result from bench.run() with a number '%s'", name);
+		return false;
+	}
+	*number = AS_NUMBER(value);
+	return true;
+}
+
+static void formatNanos(char* buffer, size_t size, double nanos) {
+	if (nanos < 1e3) snprintf(buffer, size, "%.0f ns", nanos);
+	else if (nanos < 1e6) snprintf(buffer, size, "%.2f us", nanos / 1e3);
+	else if (nanos < 1e9) snprintf(buffer, size, "%.2f ms", nanos / 1e6);
+	else snprintf(buffer, size, "%.2f s", nanos / 1e9);
+}
+
+// report(name, result) prints a result of run() on one line
+static Value benchReportNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (!IS_STRING(args[0])) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected benchmark name to be a string");
+		return NULL_VAL;
+	}
+	if (!IS_INSTANCE(args[1])) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected a result from bench.run()");
+		return NULL_VAL;
+	}
+
+	ObjInstance* result = AS_INSTANCE(args[1]);
+	double ops, iterations, stats[4];
+	const char* statNames[] = { "meanNs", "p50Ns", "p90Ns", "p99Ns" };
+	if (!getNumberField(vm, result, "opsPerSecond", &ops) || !getNumberField(vm, result, "iterations", &iterations)) return NULL_VAL;
+	for (size_t i = 0; i < 4; i++) {
+		if (!getNumberField(vm, result, statNames[i], &stats[i])) return NULL_VAL;
+	}
+
+	char formatted[4][32];
+	for (size_t i = 0; i < 4; i++) formatNanos(formatted[i], sizeof(formatted[i]), stats[i]);
+
+	printf("%s: %.0f ops/s, mean %s, p50 %s, p90 %s, p99 %s (%.0f iterations)\n",
+		AS_CSTRING(args[0]), ops, formatted[0], formatted[1], formatted[2], formatted[3], iterations);
+	return NULL_VAL;
+}
+
+void defineBenchModule(VM* vm) {
+	ObjInstance* bench = newInstance(vm, vm->internalClasses[INTERNAL_CLASS_IMPORT]);
+	vm->builtinModules[BUILTIN_MODULE_BENCH] = bench;
+
+	defineNative(vm, (Obj*)bench, &bench->fields, "run", benchRunNative, 3);
+	defineNative(vm, (Obj*)bench, &bench->fields, "report", benchReportNative, 2);
+}
+
+void bindBenchModule(VM* vm, Module* mod) {
+	tableSet(vm, &mod->globals, vm->internalStrings[INTERNAL_STR_BENCH], OBJ_VAL(vm->builtinModules[BUILTIN_MODULE_BENCH]));
+}
\ No newline at end of file
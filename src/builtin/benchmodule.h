@@ -0,0 +1,5 @@
+#pragma once
+#include "../vm.h"
+
+void defineBenchModule(VM* vm);
+void bindBenchModule(VM* vm, Module* mod);
\ No newline at end of file
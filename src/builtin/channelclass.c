@@ -0,0 +1,122 @@
+#include "channelclass.h"
+#include "natives.h"
+#include "../vm.h"
+#include "../memory.h"
+#include "../channel.h"
+#include <stdlib.h>
+
+typedef struct ChannelData {
+	InstanceData data;
+	Channel* channel;
+} ChannelData;
+
+static void freeChannelData(InstanceData* data) {
+	releaseChannel(((ChannelData*)data)->channel);
+	free(data);
+}
+
+static Channel* getChannel(VM* vm, Value bound) {
+	ObjInstance* instance = AS_INSTANCE(bound);
+	if (instance->nativeData == NULL) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_VALUE], "Channel has not been opened");
+		return NULL;
+	}
+	return ((ChannelData*)instance->nativeData)->channel;
+}
+
+// new(name, capacity)
+static Value channelNew(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (!IS_STRING(args[0])) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected channel name to be a string");
+		return NULL_VAL;
+	}
+	if (!IS_NUMBER(args[1]) || AS_NUMBER(args[1]) < 1) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected channel capacity to be a positive number");
+		return NULL_VAL;
+	}
+
+	ObjInstance* instance = AS_INSTANCE(bound);
+	if (instance->nativeData != NULL) {
+		instance->nativeData->freeData(instance->nativeData);
+		instance->nativeData = NULL;
+	}
+
+	ChannelData* data = malloc(sizeof(ChannelData));
+	if (data == NULL) exit(1);
+	data->data.freeData = freeChannelData;
+	data->channel = openChannel(AS_CSTRING(args[0]), AS_STRING(args[0])->length, (size_t)AS_NUMBER(args[1]));
+
+	// Releasing the channel is safe from the sweeper's thread
+	instance->nativeData = (InstanceData*)data;
+	instance->obj.finalizeOnVMThread = false;
+	return bound;
+}
+
+static Value send(VM* vm, Value bound, Value value, bool wait) {
+	Channel* channel = getChannel(vm, bound);
+	if (channel == NULL) return NULL_VAL;
+
+	Message* message = encodeMessage(vm, value);
+	if (message == NULL) return NULL_VAL;
+
+	ChannelStatus status = channelSend(channel, message, wait);
+	if (status != CHANNEL_OK) freeMessage(message);
+	if (status == CHANNEL_CLOSED) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_VALUE], "Cannot send on a closed channel");
+		return NULL_VAL;
+	}
+	return BOOL_VAL(status == CHANNEL_OK);
+}
+
+// send(value) waits while the channel is full, and throws if it is closed
+static Value channelSendNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	send(vm, bound, args[0], true);
+	return NULL_VAL;
+}
+
+// trySend(value) returns false rather than waiting if the channel is full
+static Value channelTrySend(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return send(vm, bound, args[0], false);
+}
+
+static Value receive(VM* vm, Value bound, bool wait) {
+	Channel* channel = getChannel(vm, bound);
+	if (channel == NULL) return NULL_VAL;
+
+	Message* message;
+	if (channelReceive(channel, &message, wait) != CHANNEL_OK) return NULL_VAL;
+	return decodeMessage(vm, message);
+}
+
+// receive() waits while the channel is empty, and returns null once it is closed and empty
+static Value channelReceiveNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return receive(vm, bound, true);
+}
+
+// tryReceive() returns null rather than waiting if the channel is empty
+static Value channelTryReceive(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return receive(vm, bound, false);
+}
+
+static Value channelClose(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	Channel* channel = getChannel(vm, bound);
+	if (channel != NULL) closeChannel(channel);
+	return NULL_VAL;
+}
+
+void defineChannelClass(VM* vm) {
+	ObjClass* channelClass = newClass(vm, vm->internalStrings[INTERNAL_STR_CHANNEL]);
+	vm->internalClasses[INTERNAL_CLASS_CHANNEL] = channelClass;
+	inheritClasses(vm, channelClass, vm->internalClasses[INTERNAL_CLASS_OBJECT]);
+
+	defineNative(vm, (Obj*)channelClass, &channelClass->methods, "new", channelNew, 2);
+	defineNative(vm, (Obj*)channelClass, &channelClass->methods, "send", channelSendNative, 1);
+	defineNative(vm, (Obj*)channelClass, &channelClass->methods, "trySend", channelTrySend, 1);
+	defineNative(vm, (Obj*)channelClass, &channelClass->methods, "receive", channelReceiveNative, 0);
+	defineNative(vm, (Obj*)channelClass, &channelClass->methods, "tryReceive", channelTryReceive, 0);
+	defineNative(vm, (Obj*)channelClass, &channelClass->methods, "close", channelClose, 0);
+}
+
+void bindChannelClass(VM* vm, Module* mod) {
+	tableSet(vm, &mod->globals, vm->internalStrings[INTERNAL_STR_CHANNEL], OBJ_VAL(vm->internalClasses[INTERNAL_CLASS_CHANNEL]));
+}
\ No newline at end of file
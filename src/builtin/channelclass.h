@@ -0,0 +1,9 @@
+#pragma once
+
+#include "../common.h"
+#include "../module.h"
+
+typedef struct VM VM;
+
+void defineChannelClass(VM* vm);
+void bindChannelClass(VM* vm, Module* mod);
\ No newline at end of file
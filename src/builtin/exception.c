@@ -20,6 +20,8 @@ void defineExceptionClasses(VM* vm) {
 	defineExceptionSubclass(vm, INTERNAL_EXCEPTION_STACK_OVERFLOW,     INTERNAL_STR_STACK_OVERFLOW_EXCEPTION);
 	defineExceptionSubclass(vm, INTERNAL_EXCEPTION_LINK_FAILURE,       INTERNAL_STR_LINK_FAILURE_EXCEPTION);
 	defineExceptionSubclass(vm, INTERNAL_EXCEPTION_VALUE,              INTERNAL_STR_VALUE_EXCEPTION);
+	defineExceptionSubclass(vm, INTERNAL_EXCEPTION_OUT_OF_MEMORY,      INTERNAL_STR_OUT_OF_MEMORY_EXCEPTION);
+	defineExceptionSubclass(vm, INTERNAL_EXCEPTION_IO,                 INTERNAL_STR_IO_EXCEPTION);
 }
 
 static void bindExceptionSubclass(VM* vm, Module* mod, InternalExceptionType type, InternalString name) {
@@ -37,4 +39,6 @@ void bindExceptionClasses(VM* vm, Module* mod) {
 	bindExceptionSubclass(vm, mod, INTERNAL_EXCEPTION_STACK_OVERFLOW,     INTERNAL_STR_STACK_OVERFLOW_EXCEPTION);
 	bindExceptionSubclass(vm, mod, INTERNAL_EXCEPTION_LINK_FAILURE,       INTERNAL_STR_LINK_FAILURE_EXCEPTION);
 	bindExceptionSubclass(vm, mod, INTERNAL_EXCEPTION_VALUE,              INTERNAL_STR_VALUE_EXCEPTION);
+	bindExceptionSubclass(vm, mod, INTERNAL_EXCEPTION_OUT_OF_MEMORY,      INTERNAL_STR_OUT_OF_MEMORY_EXCEPTION);
+	bindExceptionSubclass(vm, mod, INTERNAL_EXCEPTION_IO,                 INTERNAL_STR_IO_EXCEPTION);
 }
\ No newline at end of file
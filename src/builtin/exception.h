@@ -14,6 +14,8 @@ typedef enum InternalExceptionType {
 	INTERNAL_EXCEPTION_STACK_OVERFLOW,
 	INTERNAL_EXCEPTION_LINK_FAILURE,
 	INTERNAL_EXCEPTION_VALUE,
+	INTERNAL_EXCEPTION_OUT_OF_MEMORY,
+	INTERNAL_EXCEPTION_IO,
 	INTERNAL_EXCEPTION__COUNT
 } InternalExceptionType;
 
@@ -0,0 +1,125 @@
+#include "fibernatives.h"
+#include "natives.h"
+#include "../memory.h"
+#include "../opcode.h"
+
+// The switch itself happens once the native has returned into callValue(), which is only
+// the interpreter loop's own call when nothing else native is between them
+static bool canSwitchFiber(VM* vm) {
+	if (vm->nativeDepth != 1) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_BASE], "Fibers cannot switch inside a call made by a native function");
+		return false;
+	}
+	return true;
+}
+
+Value fiberNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (!IS_CLOSURE(args[0])) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected a function for the fiber to run");
+		return NULL_VAL;
+	}
+
+	ObjClosure* entry = AS_CLOSURE(args[0]);
+	if (entry->function->isAsync) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected the fiber's function not to be async");
+		return NULL_VAL;
+	}
+	if (entry->function->arity > 1) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_ARITY], "Expected the fiber's function to take 0 or 1 arguments but it takes %zu", entry->function->arity);
+		return NULL_VAL;
+	}
+
+	return OBJ_VAL(newFiber(vm, entry));
+}
+
+bool canSuspendFiber(VM* vm) {
+	return vm->fiber != NULL && vm->nativeDepth == 1 && vm->fiber != vm->loopFiber;
+}
+
+void suspendFiber(VM* vm) {
+	ObjFiber* fiber = vm->fiber;
+	fiber->state = FIBER_SUSPENDED;
+	vm->fiber = fiber->caller;
+	fiber->caller = NULL;
+	vm->fiberSwitch = fiber;
+}
+
+Value yieldNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (vm->fiber == NULL) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_BASE], "Cannot yield outside of a fiber");
+		return NULL_VAL;
+	}
+	if (!canSwitchFiber(vm)) return NULL_VAL;
+	if (vm->fiber == vm->loopFiber) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_BASE], "Cannot yield while the fiber is inside a call made by a native function or an import");
+		return NULL_VAL;
+	}
+
+	suspendFiber(vm);
+	return args[0];
+}
+
+static Value fiberResumeNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	ObjFiber* fiber = AS_FIBER(bound);
+
+	if (fiber->state == FIBER_DONE) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_BASE], "Cannot resume a fiber which has finished");
+		return NULL_VAL;
+	}
+	if (fiber->state == FIBER_RUNNING) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_BASE], "Cannot resume a fiber which is already running");
+		return NULL_VAL;
+	}
+	if (!canSwitchFiber(vm)) return NULL_VAL;
+
+	fiber->state = FIBER_RUNNING;
+	fiber->caller = vm->fiber;
+	vm->fiber = fiber;
+	vm->fiberSwitch = fiber;
+	return args[0];
+}
+
+static Value fiberIsDoneNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return BOOL_VAL(AS_FIBER(bound)->state == FIBER_DONE);
+}
+
+// The trampoline is called with the fiber and the value, and resumes one with the other.
+// Its frame is what the loop returns to when the fiber yields, so that callFromNative() can finish.
+Value resumeFiberFromNative(VM* vm, ObjFiber* fiber, Value value, bool raise) {
+	push(vm, OBJ_VAL(fiber));
+	push(vm, value);
+
+	// Traces through the trampoline name the module which called the native
+	Module* owner = vm->frames.items[vm->frames.length - 1].closure->owner;
+	if (vm->resumeTrampoline == NULL || vm->resumeTrampoline->owner != owner) {
+		vm->resumeTrampoline = newClosure(vm, owner, vm->resumeFunction);
+	}
+
+	vm->fiberSwitchRaises = raise;
+	Value result = callFromNative(vm, OBJ_VAL(vm->resumeTrampoline), 2);
+	vm->fiberSwitchRaises = false;
+	return result;
+}
+
+static void defineResumeFunction(VM* vm) {
+	ObjFunction* function = newFunction(vm);
+	vm->resumeFunction = function;
+	function->arity = 2;
+	function->name = copyString(vm, "resume", 6);
+	writeBarrier(vm, (Obj*)function, OBJ_VAL(function->name));
+
+	Chunk* chunk = &function->chunk;
+	size_t name = addConstant(vm, chunk, OBJ_VAL(function->name), 0);
+	writeOperand(vm, chunk, OP_ACCESS_LOCAL, 1, 0);
+	writeOperand(vm, chunk, OP_ACCESS_LOCAL, 2, 0);
+	writeOperand(vm, chunk, OP_INVOKE, (uint16_t)name, 0);
+	writeByteArray(vm, &chunk->bytecode, 1);
+	writeOpcode(vm, chunk, OP_RETURN, 0);
+}
+
+void defineFiberNativeMethods(VM* vm) {
+	defineNative(vm, NULL, &vm->fiberMethods, "isDone", fiberIsDoneNative, 0);
+	defineNative(vm, NULL, &vm->fiberMethods, "resume", fiberResumeNative, 1);
+
+	defineResumeFunction(vm);
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+#include "../vm.h"
+
+void defineFiberNativeMethods(VM* vm);
+
+// Fiber(function) makes a fiber which calls function, with the value given to its first resume() if it takes one
+Value fiberNative(VM* vm, Value bound, uint8_t argCount, Value* args);
+// Suspends the running fiber, returning the value from its resume() call; the next resume() returns its value here
+Value yieldNative(VM* vm, Value bound, uint8_t argCount, Value* args);
+
+// Whether the running fiber could be suspended by the native being called, as yield() would
+bool canSuspendFiber(VM* vm);
+// Suspends it once the native returns, which gives its result to whatever resumed the fiber
+void suspendFiber(VM* vm);
+// Runs a fiber until it next yields or finishes, from native code, and returns what it gave back.
+// If raise is set the value is thrown in the fiber instead of being returned from its yield().
+Value resumeFiberFromNative(VM* vm, ObjFiber* fiber, Value value, bool raise);
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "gcmodule.h"
+#include "natives.h"
+#include "../vm.h"
+#include "../memory.h"
+#include "../snapshot.h"
+#include <string.h>
+
+static Value gcStatsNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	GCStats stats;
+	getGCStats(vm, &stats);
+
+	ObjInstance* result = pushObject(vm);
+	setField(vm, result, "majorCollections", NUMBER_VAL((double)stats.counters.majorCollections));
+	setField(vm, result, "minorCollections", NUMBER_VAL((double)stats.counters.minorCollections));
+	setField(vm, result, "totalPauseMs", NUMBER_VAL((double)stats.counters.totalPauseNanos / 1e6));
+	setField(vm, result, "maxPauseMs", NUMBER_VAL((double)stats.counters.maxPauseNanos / 1e6));
+	setField(vm, result, "totalAllocated", NUMBER_VAL((double)stats.counters.totalAllocated));
+	setField(vm, result, "liveBytes", NUMBER_VAL((double)stats.counters.liveBytes));
+	setField(vm, result, "heapBytes", NUMBER_VAL((double)stats.heapBytes));
+	setField(vm, result, "internedStrings", NUMBER_VAL((double)stats.internedStrings));
+	setField(vm, result, "internTableCapacity", NUMBER_VAL((double)stats.internTableCapacity));
+
+	ObjInstance* objects = pushObject(vm);
+	for (size_t i = 0; i < OBJ_TYPE_COUNT; i++) {
+		ObjInstance* type = pushObject(vm);
+		setField(vm, type, "count", NUMBER_VAL((double)stats.objects[i].count));
+		setField(vm, type, "bytes", NUMBER_VAL((double)stats.objects[i].bytes));
+		setField(vm, objects, objTypeName((ObjType)i), OBJ_VAL(type));
+		pop(vm);
+	}
+	setField(vm, result, "objects", OBJ_VAL(objects));
+	pop(vm);
+
+	return pop(vm);
+}
+
+static Value gcSnapshotNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (!IS_STRING(args[0])) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected snapshot path to be a string");
+		return NULL_VAL;
+	}
+
+	if (!writeHeapSnapshot(vm, AS_CSTRING(args[0]))) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_VALUE], "Could not write heap snapshot to '%s'", AS_CSTRING(args[0]));
+	}
+	return NULL_VAL;
+}
+
+void defineGCModule(VM* vm) {
+	ObjInstance* gc = newInstance(vm, vm->internalClasses[INTERNAL_CLASS_IMPORT]);
+	vm->builtinModules[BUILTIN_MODULE_GC] = gc;
+
+	defineNative(vm, (Obj*)gc, &gc->fields, "stats", gcStatsNative, 0);
+	defineNative(vm, (Obj*)gc, &gc->fields, "snapshot", gcSnapshotNative, 1);
+}
+
+void bindGCModule(VM* vm, Module* mod) {
+	tableSet(vm, &mod->globals, vm->internalStrings[INTERNAL_STR_GC], OBJ_VAL(vm->builtinModules[BUILTIN_MODULE_GC]));
+}
\ No newline at end of file
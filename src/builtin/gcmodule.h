@@ -0,0 +1,5 @@
+#pragma once
+#include "../vm.h"
+
+void defineGCModule(VM* vm);
+void bindGCModule(VM* vm, Module* mod);
\ No newline at end of file
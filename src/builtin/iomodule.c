@@ -0,0 +1,292 @@
+// For pipe2(), which must be asked for before any system header
+#define _GNU_SOURCE
+#include "iomodule.h"
+#include "natives.h"
+#include "fibernatives.h"
+#include "../vm.h"
+#include "../memory.h"
+#include "../eventloop.h"
+
+#ifdef __linux__
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <threads.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static once_flag signalsIgnored = ONCE_FLAG_INIT;
+
+// A write to a closed pipe or socket should throw, rather than end the process
+static void ignoreBrokenPipes(void) {
+	signal(SIGPIPE, SIG_IGN);
+}
+
+static Value throwIOError(VM* vm, int error) {
+	throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_IO], "%s", strerror(error));
+	return NULL_VAL;
+}
+
+static IoHandle* getHandle(VM* vm, Value bound, IoHandleKind kind, const char* action) {
+	IoHandle* handle = (IoHandle*)AS_INSTANCE(bound)->nativeData;
+	if (handle == NULL) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_VALUE], "Handle has not been opened");
+		return NULL;
+	}
+
+	// Files and streams are read and written alike
+	bool matches = handle->kind == kind || (kind == IO_HANDLE_STREAM && handle->kind == IO_HANDLE_FILE);
+	if (!matches) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Cannot %s this handle", action);
+		return NULL;
+	}
+	return handle;
+}
+
+// Made by a task, read(), write(), accept(), wait() and io.sleep() return a task to await for the result instead.
+
+// read(maxBytes) returns up to maxBytes as a string, or null at the end of the stream
+static Value handleReadNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (getHandle(vm, bound, IO_HANDLE_STREAM, "read from") == NULL) return NULL_VAL;
+	if (!IS_NUMBER(args[0]) || AS_NUMBER(args[0]) < 1) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected the number of bytes to read to be a positive number");
+		return NULL_VAL;
+	}
+	return handleRead(vm, AS_INSTANCE(bound), (size_t)AS_NUMBER(args[0]));
+}
+
+// write(string) returns once all of string has been written
+static Value handleWriteNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (getHandle(vm, bound, IO_HANDLE_STREAM, "write to") == NULL) return NULL_VAL;
+	if (!IS_STRING(args[0])) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected a string to write");
+		return NULL_VAL;
+	}
+	return handleWrite(vm, AS_INSTANCE(bound), AS_STRING(args[0]));
+}
+
+// accept() returns a handle for the next connection to a listener
+static Value handleAcceptNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (getHandle(vm, bound, IO_HANDLE_LISTENER, "accept on") == NULL) return NULL_VAL;
+	return handleAccept(vm, AS_INSTANCE(bound));
+}
+
+// notify() wakes one wait() on an event, now or when one is next made
+static Value handleNotifyNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	IoHandle* handle = getHandle(vm, bound, IO_HANDLE_EVENT, "notify");
+	if (handle == NULL) return NULL_VAL;
+	if (handle->fd < 0) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_IO], "Handle is closed");
+		return NULL_VAL;
+	}
+
+	uint64_t one = 1;
+	if (write(handle->fd, &one, sizeof(one)) < 0) return throwIOError(vm, errno);
+	return NULL_VAL;
+}
+
+static Value handleWaitNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (getHandle(vm, bound, IO_HANDLE_EVENT, "wait on") == NULL) return NULL_VAL;
+	return handleWait(vm, AS_INSTANCE(bound));
+}
+
+static Value handleCloseNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (AS_INSTANCE(bound)->nativeData != NULL) closeHandle(vm, AS_INSTANCE(bound));
+	return NULL_VAL;
+}
+
+static bool expectPath(VM* vm, Value path, struct sockaddr_un* address) {
+	if (!IS_STRING(path)) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected a path to be a string");
+		return false;
+	}
+	if (AS_STRING(path)->length >= sizeof(address->sun_path)) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_VALUE], "Socket path is too long");
+		return false;
+	}
+
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	memcpy(address->sun_path, AS_CSTRING(path), AS_STRING(path)->length);
+	return true;
+}
+
+// Both handles are made before either is pushed onto the list, so are rooted on the stack in between
+static Value pairList(VM* vm, int fds[2]) {
+	push(vm, OBJ_VAL(newHandle(vm, fds[0], IO_HANDLE_STREAM)));
+	push(vm, OBJ_VAL(newHandle(vm, fds[1], IO_HANDLE_STREAM)));
+
+	ValueArray items;
+	initValueArray(&items);
+	ObjList* list = newList(vm, items);
+	push(vm, OBJ_VAL(list));
+	writeValueArray(vm, &list->items, peek(vm, 2));
+	writeValueArray(vm, &list->items, peek(vm, 1));
+
+	pop(vm);
+	pop(vm);
+	pop(vm);
+	return OBJ_VAL(list);
+}
+
+// open(path, mode) opens a file to read ("r"), write from the start ("w") or append to ("a")
+static Value ioOpen(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (!IS_STRING(args[0])) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected a path to be a string");
+		return NULL_VAL;
+	}
+	if (!IS_STRING(args[1]) || AS_STRING(args[1])->length != 1) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected mode to be one of \"r\", \"w\" or \"a\"");
+		return NULL_VAL;
+	}
+
+	int flags;
+	switch (AS_CSTRING(args[1])[0]) {
+		case 'r': flags = O_RDONLY; break;
+		case 'w': flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+		case 'a': flags = O_WRONLY | O_CREAT | O_APPEND; break;
+		default:
+			throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected mode to be one of \"r\", \"w\" or \"a\"");
+			return NULL_VAL;
+	}
+
+	int fd = open(AS_CSTRING(args[0]), flags | O_NONBLOCK | O_CLOEXEC, 0666);
+	if (fd < 0) return throwIOError(vm, errno);
+	return OBJ_VAL(newHandle(vm, fd, IO_HANDLE_FILE));
+}
+
+// pipe() returns a list of the read and write ends of a new pipe
+static Value ioPipe(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	int fds[2];
+	if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) return throwIOError(vm, errno);
+	return pairList(vm, fds);
+}
+
+// socketPair() returns a list of two local sockets connected to each other
+static Value ioSocketPair(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) != 0) return throwIOError(vm, errno);
+	return pairList(vm, fds);
+}
+
+// listen(path) makes a Unix socket at path to accept() connections on
+static Value ioListen(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	struct sockaddr_un address;
+	if (!expectPath(vm, args[0], &address)) return NULL_VAL;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) return throwIOError(vm, errno);
+	if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+		int error = errno;
+		close(fd);
+		return throwIOError(vm, error);
+	}
+	return OBJ_VAL(newHandle(vm, fd, IO_HANDLE_LISTENER));
+}
+
+// connect(path) connects to a Unix socket; a local connection is made at once, so this does not wait in the loop
+static Value ioConnect(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	struct sockaddr_un address;
+	if (!expectPath(vm, args[0], &address)) return NULL_VAL;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return throwIOError(vm, errno);
+
+	int result;
+	do result = connect(fd, (struct sockaddr*)&address, sizeof(address)); while (result != 0 && errno == EINTR);
+	if (result != 0 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+		int error = errno;
+		close(fd);
+		return throwIOError(vm, error);
+	}
+	return OBJ_VAL(newHandle(vm, fd, IO_HANDLE_STREAM));
+}
+
+// event() makes a handle which fibers wait() on until another notify()s it, each notification waking one
+static Value ioEvent(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE);
+	if (fd < 0) return throwIOError(vm, errno);
+	return OBJ_VAL(newHandle(vm, fd, IO_HANDLE_EVENT));
+}
+
+// sleep(milliseconds)
+static Value ioSleep(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (!IS_NUMBER(args[0])) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected the time to sleep to be a number");
+		return NULL_VAL;
+	}
+	return sleepFor(vm, AS_NUMBER(args[0]));
+}
+
+// spawn(function) makes a fiber which calls function, and queues it to be run by the loop; a fiber may be given too
+static Value ioSpawn(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	Value fiber = args[0];
+	if (!IS_FIBER(fiber)) {
+		fiber = fiberNative(vm, NULL_VAL, 1, args);
+		if (vm->hasException) return NULL_VAL;
+	}
+	if (AS_FIBER(fiber)->state != FIBER_NEW && AS_FIBER(fiber)->state != FIBER_SUSPENDED) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_VALUE], "Cannot spawn a fiber which is running or has finished");
+		return NULL_VAL;
+	}
+
+	push(vm, fiber);
+	spawnFiber(vm, AS_FIBER(fiber));
+	pop(vm);
+	return vm->hasException ? NULL_VAL : fiber;
+}
+
+// run() runs spawned fibers until all have finished, and they wait on nothing
+static Value ioRun(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	runEventLoop(vm);
+	return NULL_VAL;
+}
+
+static void defineHandleClass(VM* vm) {
+	ObjClass* handleClass = newClass(vm, vm->internalStrings[INTERNAL_STR_HANDLE]);
+	vm->internalClasses[INTERNAL_CLASS_HANDLE] = handleClass;
+	inheritClasses(vm, handleClass, vm->internalClasses[INTERNAL_CLASS_OBJECT]);
+
+	defineNative(vm, (Obj*)handleClass, &handleClass->methods, "read", handleReadNative, 1);
+	defineNative(vm, (Obj*)handleClass, &handleClass->methods, "write", handleWriteNative, 1);
+	defineNative(vm, (Obj*)handleClass, &handleClass->methods, "accept", handleAcceptNative, 0);
+	defineNative(vm, (Obj*)handleClass, &handleClass->methods, "notify", handleNotifyNative, 0);
+	defineNative(vm, (Obj*)handleClass, &handleClass->methods, "wait", handleWaitNative, 0);
+	defineNative(vm, (Obj*)handleClass, &handleClass->methods, "close", handleCloseNative, 0);
+}
+
+void defineIOModule(VM* vm) {
+	call_once(&signalsIgnored, ignoreBrokenPipes);
+	defineHandleClass(vm);
+
+	ObjInstance* io = newInstance(vm, vm->internalClasses[INTERNAL_CLASS_IMPORT]);
+	vm->builtinModules[BUILTIN_MODULE_IO] = io;
+
+	defineNative(vm, (Obj*)io, &io->fields, "open", ioOpen, 2);
+	defineNative(vm, (Obj*)io, &io->fields, "pipe", ioPipe, 0);
+	defineNative(vm, (Obj*)io, &io->fields, "socketPair", ioSocketPair, 0);
+	defineNative(vm, (Obj*)io, &io->fields, "listen", ioListen, 1);
+	defineNative(vm, (Obj*)io, &io->fields, "connect", ioConnect, 1);
+	defineNative(vm, (Obj*)io, &io->fields, "event", ioEvent, 0);
+	defineNative(vm, (Obj*)io, &io->fields, "sleep", ioSleep, 1);
+	defineNative(vm, (Obj*)io, &io->fields, "spawn", ioSpawn, 1);
+	defineNative(vm, (Obj*)io, &io->fields, "run", ioRun, 0);
+}
+
+#else
+
+// There is no event loop but on Linux, so the module is left empty
+void defineIOModule(VM* vm) {
+	vm->builtinModules[BUILTIN_MODULE_IO] = newInstance(vm, vm->internalClasses[INTERNAL_CLASS_IMPORT]);
+}
+
+#endif
+
+void bindIOModule(VM* vm, Module* mod) {
+	tableSet(vm, &mod->globals, vm->internalStrings[INTERNAL_STR_IO], OBJ_VAL(vm->builtinModules[BUILTIN_MODULE_IO]));
+}
\ No newline at end of file
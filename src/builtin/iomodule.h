@@ -0,0 +1,5 @@
+#pragma once
+#include "../vm.h"
+
+void defineIOModule(VM* vm);
+void bindIOModule(VM* vm, Module* mod);
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "listnatives.h"
 #include "natives.h"
+#include "../memory.h"
 #include <math.h>
 
 /*
@@ -62,7 +63,7 @@ static void mergeSort(VM* vm, ObjList* list, size_t l, size_t m, size_t r, Value
 	initValueArray(&right);
 
 	for (size_t i = 0; i < arrLen1; i++) {
-		writeValueArray(vm, &left, array.items[l + 1]);
+		writeValueArray(vm, &left, array.items[l + i]);
 	}
 
 	for (size_t i = 0; i < arrLen2; i++) {
@@ -85,17 +86,20 @@ static void mergeSort(VM* vm, ObjList* list, size_t l, size_t m, size_t r, Value
 		k++;
 	}
 
-	while (j < arrLen1) {
-		array.items[k] = array.items[i];
+	while (i < arrLen1) {
+		array.items[k] = left.items[i];
 		k++;
 		i++;
 	}
 
 	while (j < arrLen2) {
-		array.items[k] = array.items[j];
+		array.items[k] = right.items[j];
 		k++;
 		j++;
 	}
+
+	freeValueArray(vm, &left);
+	freeValueArray(vm, &right);
 }
 
 /*
@@ -159,6 +163,7 @@ static Value listConcatNative(VM* vm, Value bound, uint8_t argCount, Value* args
 	for (size_t i = 0; i < listB->items.length; i++) {
 		writeValueArray(vm, &nList->items, listB->items.items[i]);
 	}
+	rememberObject(vm, (Obj*)nList);
 
 	pop(vm);
 
@@ -206,6 +211,7 @@ static Value listExtendNative(VM* vm, Value bound, uint8_t argCount, Value* args
 	for (size_t i = 0; i < listB->items.length; i++) {
 		writeValueArray(vm, &list->items, listB->items.items[i]);
 	}
+	rememberObject(vm, (Obj*)list);
 
 	return NULL_VAL;
 }
@@ -217,6 +223,7 @@ static Value listFillNative(VM* vm, Value bound, uint8_t argCount, Value* args)
 	for (size_t i = 0; i < list->items.length; i++) {
 		list->items.items[i] = filler;
 	}
+	writeBarrier(vm, (Obj*)list, filler);
 	return bound;
 }
 
@@ -245,8 +252,10 @@ static Value listFilterNative(VM* vm, Value bound, uint8_t argCount, Value* args
 		if (vm->hasException) {
 			return NULL_VAL;
 		}
-		if(!isFalsey(vm, pass))
+		if (!isFalsey(vm, pass)) {
 			writeValueArray(vm, &filteredList->items, list->items.items[i]);
+			writeBarrier(vm, (Obj*)filteredList, list->items.items[i]);
+		}
 	}
 
 	pop(vm);
@@ -325,7 +334,11 @@ static Value listMapNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
 		if (vm->hasException) {
 			return NULL_VAL;
 		}
+		// Growing the list may collect, and nothing else refers to the result yet
+		push(vm, mapped);
 		writeValueArray(vm, &mappedList->items, mapped);
+		writeBarrier(vm, (Obj*)mappedList, mapped);
+		pop(vm);
 	}
 
 	pop(vm);
@@ -368,6 +381,7 @@ static Value listOfLengthNative(VM* vm, Value bound, uint8_t argCount, Value* ar
 			writeValueArray(vm, &ofLength->items, NULL_VAL);
 		}
 	}
+	rememberObject(vm, (Obj*)ofLength);
 
 	pop(vm);
 
@@ -381,6 +395,7 @@ static Value listPopNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
 
 static Value listPushNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
 	writeValueArray(vm, &AS_LIST(bound)->items, args[0]);
+	writeBarrier(vm, AS_OBJ(bound), args[0]);
 	return args[0];
 }
 
@@ -428,6 +443,7 @@ static Value listReverseNative(VM* vm, Value bound, uint8_t argCount, Value* arg
 	for (size_t i = list->items.length; i > 0; i--) {
 		writeValueArray(vm, &reversedList->items, list->items.items[i - 1]);
 	}
+	rememberObject(vm, (Obj*)reversedList);
 
 	pop(vm);
 
@@ -447,6 +463,7 @@ static Value listSortNative(VM* vm, Value bound, uint8_t argCount, Value* args)
 	for (size_t i = 0; i < list->items.length; i++) {
 		writeValueArray(vm, &sortedList->items, list->items.items[i]);
 	}
+	rememberObject(vm, (Obj*)sortedList);
 
 	Value comparator = args[0];
 
@@ -481,22 +498,22 @@ static Value listSortNative(VM* vm, Value bound, uint8_t argCount, Value* args)
 }
 
 void defineListNativeMethods(VM* vm) {
-	defineNative(vm, &vm->listMethods, "any", listAnyNative, 1);
-	defineNative(vm, &vm->listMethods, "clear", listClearNative, 0);
-	defineNative(vm, &vm->listMethods, "concat", listConcatNative, 1);
-	defineNative(vm, &vm->listMethods, "every", listEveryNative, 1);
-	defineNative(vm, &vm->listMethods, "extend", listExtendNative, 1);
-	defineNative(vm, &vm->listMethods, "fill", listFillNative, 1);
-	defineNative(vm, &vm->listMethods, "filter", listFilterNative, 1);
-	defineNative(vm, &vm->listMethods, "forEach", listForEachNative, 1);
-	defineNative(vm, &vm->listMethods, "indexOf", listIndexOfNative, 1);
-	defineNative(vm, &vm->listMethods, "lastIndexOf", listLastIndexOfNative, 1);
-	defineNative(vm, &vm->listMethods, "length", listLengthNative, 0);
-	defineNative(vm, &vm->listMethods, "map", listMapNative, 1);
-	defineNative(vm, &vm->listMethods, "ofLength", listOfLengthNative, 1);
-	defineNative(vm, &vm->listMethods, "pop", listPopNative, 0);
-	defineNative(vm, &vm->listMethods, "push", listPushNative, 1);
-	defineNative(vm, &vm->listMethods, "reduce", listReduceNative, 1);
-	defineNative(vm, &vm->listMethods, "reverse", listReverseNative, 0);
-	defineNative(vm, &vm->listMethods, "sort", listSortNative, 1);
-}
+	defineNative(vm, NULL, &vm->listMethods, "any", listAnyNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "clear", listClearNative, 0);
+	defineNative(vm, NULL, &vm->listMethods, "concat", listConcatNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "every", listEveryNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "extend", listExtendNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "fill", listFillNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "filter", listFilterNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "forEach", listForEachNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "indexOf", listIndexOfNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "lastIndexOf", listLastIndexOfNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "length", listLengthNative, 0);
+	defineNative(vm, NULL, &vm->listMethods, "map", listMapNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "ofLength", listOfLengthNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "pop", listPopNative, 0);
+	defineNative(vm, NULL, &vm->listMethods, "push", listPushNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "reduce", listReduceNative, 1);
+	defineNative(vm, NULL, &vm->listMethods, "reverse", listReverseNative, 0);
+	defineNative(vm, NULL, &vm->listMethods, "sort", listSortNative, 1);
+}
\ No newline at end of file
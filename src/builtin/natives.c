@@ -1,20 +1,50 @@
 #include "natives.h"
+#include "../memory.h"
+#include "../timer.h"
 #include <time.h>
+#include <string.h>
 
-void defineNative(VM* vm, Table* table, const char* name, NativeFunction function, size_t arity) {
+void defineNative(VM* vm, Obj* owner, Table* table, const char* name, NativeFunction function, size_t arity) {
 	push(vm, OBJ_VAL(copyString(vm, name, strlen(name))));
-	push(vm, OBJ_VAL(newNative(vm, function, arity)));
+	push(vm, OBJ_VAL(newNative(vm, AS_STRING(peek(vm, 0)), function, arity)));
 	tableSet(vm, table, AS_STRING(peek(vm, 1)), peek(vm, 0));
+	if (owner != NULL) {
+		writeBarrier(vm, owner, peek(vm, 1));
+		writeBarrier(vm, owner, peek(vm, 0));
+	}
+	pop(vm);
 	pop(vm);
+}
+
+void setField(VM* vm, ObjInstance* instance, const char* name, Value value) {
+	push(vm, OBJ_VAL(copyString(vm, name, strlen(name))));
+	tableSet(vm, &instance->fields, AS_STRING(peek(vm, 0)), value);
+	writeBarrier(vm, (Obj*)instance, peek(vm, 0));
+	writeBarrier(vm, (Obj*)instance, value);
 	pop(vm);
 }
 
+ObjInstance* pushObject(VM* vm) {
+	ObjInstance* object = newInstance(vm, vm->internalClasses[INTERNAL_CLASS_OBJECT]);
+	push(vm, OBJ_VAL(object));
+	return object;
+}
+
+// The arguments are expected on the stack; the callee is slotted in beneath them, where a call from bytecode has it
 Value callFromNative(VM* vm, Value value, uint8_t argCount) {
+	push(vm, NULL_VAL);
+	size_t calleeSlot = vm->stack.length - argCount - 1;
+	Value* slots = &vm->stack.items[calleeSlot];
+	memmove(slots + 1, slots, sizeof(Value) * argCount);
+	slots[0] = value;
+
+	size_t frameCount = vm->frames.length;
 	if (!callValue(vm, value, argCount)) {
 		return NULL_VAL;
 	}
 
-	if (!IS_NATIVE(value)) {
+	// Natives and classes without an initializer have already finished
+	if (vm->frames.length > frameCount) {
 		executeVM(vm, vm->frames.length - 1);
 	}
 
@@ -22,13 +52,25 @@ Value callFromNative(VM* vm, Value value, uint8_t argCount) {
 		return NULL_VAL;
 	}
 
-	return pop(vm);
+	// A function returning into a native leaves its locals behind, so the stack is put back as it was before the call
+	Value result = pop(vm);
+	vm->stack.length = calleeSlot;
+	return result;
 }
 
 Value clockNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
 	return NUMBER_VAL((double)clock() / 1000);
 }
 
+// Counted from when the VM started, so the result stays exact as a double for as long as a program could run
+Value nanoTimeNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return NUMBER_VAL((double)(monotonicNanoseconds() - vm->startTime));
+}
+
+Value microTimeNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return NUMBER_VAL((double)(monotonicNanoseconds() - vm->startTime) / 1e3);
+}
+
 Value lenNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
 	if (IS_LIST(args[0])) {
 		return NUMBER_VAL((double)AS_LIST(args[0])->items.length);
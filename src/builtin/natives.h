@@ -2,10 +2,20 @@
 #include "../vm.h"
 #include "../value.h"
 
-void defineNative(VM* vm, Table* table, const char* name, NativeFunction function, size_t arity);
+// owner is the object the table belongs to, for the write barrier, or NULL if the table is a root, like a module's
+// globals or the VM's list methods
+void defineNative(VM* vm, Obj* owner, Table* table, const char* name, NativeFunction function, size_t arity);
 Value callFromNative(VM* vm, Value value, uint8_t argCount);
 
+// Pushes a new plain object, for natives that build one up field by field
+ObjInstance* pushObject(VM* vm);
+// The instance and the value must both be rooted
+void setField(VM* vm, ObjInstance* instance, const char* name, Value value);
+
 Value clockNative(VM* vm, Value bound, uint8_t argCount, Value* args);
+// Wall clock time from a monotonic source, unlike clock()
+Value nanoTimeNative(VM* vm, Value bound, uint8_t argCount, Value* args);
+Value microTimeNative(VM* vm, Value bound, uint8_t argCount, Value* args);
 
 //TODO:
 //  len() is temporary until we can access methods on lists & strings :-)
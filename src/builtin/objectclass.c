@@ -1,6 +1,7 @@
 #include "objectclass.h"
 #include "natives.h"
 #include "../vm.h"
+#include "../memory.h"
 
 Value objectKeys(VM* vm, Value bound, uint8_t argCount, Value* args) {
 	ObjInstance* instance = AS_INSTANCE(bound);
@@ -38,8 +39,8 @@ Value objectValues(VM* vm, Value bound, uint8_t argCount, Value* args) {
 
 void defineObjectClass(VM* vm) {
 	vm->internalClasses[INTERNAL_CLASS_OBJECT] = newClass(vm, vm->internalStrings[INTERNAL_STR_OBJECT]);
-	defineNative(vm, &vm->internalClasses[INTERNAL_CLASS_OBJECT]->methods, "keys", objectKeys, 0);
-	defineNative(vm, &vm->internalClasses[INTERNAL_CLASS_OBJECT]->methods, "values", objectValues, 0);
+	defineNative(vm, (Obj*)vm->internalClasses[INTERNAL_CLASS_OBJECT], &vm->internalClasses[INTERNAL_CLASS_OBJECT]->methods, "keys", objectKeys, 0);
+	defineNative(vm, (Obj*)vm->internalClasses[INTERNAL_CLASS_OBJECT], &vm->internalClasses[INTERNAL_CLASS_OBJECT]->methods, "values", objectValues, 0);
 }
 
 void bindObjectClass(VM* vm, Module* mod) {
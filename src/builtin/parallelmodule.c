@@ -0,0 +1,556 @@
+#include "parallelmodule.h"
+#include "natives.h"
+#include "../vm.h"
+#include "../memory.h"
+#include "../channel.h"
+#include "../codesegment.h"
+#include "../taskpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+// Enough chunks for each thread that one which finishes early finds another's left to steal
+#define PARALLEL_CHUNKS_PER_THREAD 4
+
+typedef struct ShippedFunction {
+	SharedFunction* function;
+	// What the closure had captured, as a list; each VM closes over copies of its own
+	Message* upvalues;
+} ShippedFunction;
+
+// A global the mapped function may refer to, defined again in the module each worker runs it in
+typedef struct ShippedGlobal {
+	char* name;
+	size_t length;
+	bool isFunction;
+	ShippedFunction function;
+	Message* value;
+} ShippedGlobal;
+
+typedef struct ParallelJob ParallelJob;
+
+typedef struct ParallelChunk {
+	Task task;
+	ParallelJob* job;
+	size_t start;
+	size_t end;
+	// Whichever of the workers and the caller sets this first runs the chunk
+	atomic_bool claimed;
+	Message* input;
+
+	// Left by a worker which ran the chunk: the mapped items as a list, or what was thrown, and at which item
+	Message* output;
+	char* error;
+	size_t errorIndex;
+} ParallelChunk;
+
+struct ParallelJob {
+	// Tells jobs apart in the workers, which keep the last one loaded, as a job's address may be reused
+	uint64_t serial;
+	ShippedFunction function;
+	ShippedGlobal* globals;
+	size_t globalCount;
+	size_t globalCapacity;
+	char* moduleName;
+	char* moduleDirectory;
+
+	ParallelChunk* chunks;
+	size_t chunkCount;
+	// Once set, chunks not yet run are skipped
+	atomic_bool failed;
+
+	// Chunks still on the workers' queues, counting those the caller ran itself, which still refer to the job
+	mtx_t lock;
+	cnd_t done;
+	size_t outstanding;
+};
+
+static atomic_uint_least64_t nextSerial = 1;
+
+// The job a worker last ran, whose module and function are kept for its next chunk
+static _Thread_local uint64_t loadedSerial = 0;
+static _Thread_local Module* loadedModule = NULL;
+
+static char* copyChars(const char* chars, size_t length) {
+	char* copy = malloc(length + 1);
+	if (copy == NULL) exit(1);
+	memcpy(copy, chars, length);
+	copy[length] = '\0';
+	return copy;
+}
+
+static void clearException(VM* vm) {
+	vm->hasException = false;
+	vm->exception = NULL_VAL;
+}
+
+static char* describeException(VM* vm) {
+	const char* className = "Exception";
+	const char* reason = "thrown without reason";
+
+	if (IS_INSTANCE(vm->exception)) {
+		ObjInstance* exception = AS_INSTANCE(vm->exception);
+		className = exception->clazz->name->str;
+
+		Value value;
+		if (tableGet(&exception->fields, vm->internalStrings[INTERNAL_STR_REASON], &value) && IS_STRING(value)) {
+			reason = AS_CSTRING(value);
+		}
+	}
+
+	size_t size = strlen(className) + strlen(reason) + 3;
+	char* description = malloc(size);
+	if (description == NULL) exit(1);
+	snprintf(description, size, "%s: %s", className, reason);
+	return description;
+}
+
+// ========= Shipping =========
+
+// Returns false, with an exception thrown, if the closure captured anything which cannot be sent between isolates
+static bool shipFunction(VM* vm, ObjClosure* closure, ShippedFunction* shipped) {
+	Value* values = malloc(sizeof(Value) * (closure->upvalueCount + 1));
+	if (values == NULL) exit(1);
+	for (size_t i = 0; i < closure->upvalueCount; i++) {
+		values[i] = *closure->upvalues[i]->location;
+	}
+	shipped->upvalues = encodeMessageItems(vm, values, closure->upvalueCount);
+	free(values);
+
+	if (shipped->upvalues == NULL) return false;
+	shipped->function = shareFunction(closure->function);
+	return true;
+}
+
+static void freeShippedFunction(ShippedFunction* shipped) {
+	if (shipped->function != NULL) freeSharedFunction(shipped->function);
+	if (shipped->upvalues != NULL) freeMessage(shipped->upvalues);
+}
+
+static ShippedGlobal* addGlobal(ParallelJob* job, ObjString* name) {
+	if (job->globalCapacity < job->globalCount + 1) {
+		job->globalCapacity = GROW_CAPACITY(job->globalCapacity);
+		job->globals = realloc(job->globals, sizeof(ShippedGlobal) * job->globalCapacity);
+		if (job->globals == NULL) exit(1);
+	}
+
+	ShippedGlobal* global = &job->globals[job->globalCount++];
+	global->name = copyChars(name->str, name->length);
+	global->length = name->length;
+	global->isFunction = false;
+	global->value = NULL;
+	return global;
+}
+
+typedef struct SeenNames {
+	size_t count;
+	size_t capacity;
+	ObjString** items;
+} SeenNames;
+
+static bool seeName(SeenNames* seen, ObjString* name) {
+	// Strings are interned, so names compare by address
+	for (size_t i = 0; i < seen->count; i++) {
+		if (seen->items[i] == name) return true;
+	}
+
+	if (seen->capacity < seen->count + 1) {
+		seen->capacity = GROW_CAPACITY(seen->capacity);
+		seen->items = realloc(seen->items, sizeof(ObjString*) * seen->capacity);
+		if (seen->items == NULL) exit(1);
+	}
+	seen->items[seen->count++] = name;
+	return false;
+}
+
+// Ships every global of the module named by one of the function's string constants, and those the functions shipped
+// name in turn. Some of those strings are only property names or text, so anything which cannot be sent is left out,
+// for the worker to report as undefined should the function turn out to need it.
+static void shipGlobals(VM* vm, ParallelJob* job, Module* mod, ObjFunction* function, SeenNames* seen) {
+	ValueArray* constants = &function->chunk.constants;
+
+	for (size_t i = 0; i < constants->length; i++) {
+		Value constant = constants->items[i];
+
+		if (IS_FUNCTION(constant)) {
+			shipGlobals(vm, job, mod, AS_FUNCTION(constant), seen);
+			continue;
+		}
+		if (!IS_STRING(constant) || seeName(seen, AS_STRING(constant))) continue;
+
+		Value value;
+		if (!tableGet(&mod->globals, AS_STRING(constant), &value)) continue;
+
+		if (IS_CLOSURE(value)) {
+			ShippedFunction shipped;
+			if (!shipFunction(vm, AS_CLOSURE(value), &shipped)) {
+				clearException(vm);
+				continue;
+			}
+
+			ShippedGlobal* global = addGlobal(job, AS_STRING(constant));
+			global->isFunction = true;
+			global->function = shipped;
+			shipGlobals(vm, job, mod, AS_CLOSURE(value)->function, seen);
+		}
+		else if (!IS_NATIVE(value) && !IS_CLASS(value)) {
+			Message* message = encodeMessage(vm, value);
+			if (message == NULL) {
+				clearException(vm);
+				continue;
+			}
+			addGlobal(job, AS_STRING(constant))->value = message;
+		}
+	}
+}
+
+static void freeJob(ParallelJob* job) {
+	freeShippedFunction(&job->function);
+
+	for (size_t i = 0; i < job->globalCount; i++) {
+		ShippedGlobal* global = &job->globals[i];
+		if (global->isFunction) freeShippedFunction(&global->function);
+		else freeMessage(global->value);
+		free(global->name);
+	}
+	free(job->globals);
+
+	for (size_t i = 0; i < job->chunkCount; i++) {
+		ParallelChunk* chunk = &job->chunks[i];
+		if (chunk->input != NULL) freeMessage(chunk->input);
+		if (chunk->output != NULL) freeMessage(chunk->output);
+		free(chunk->error);
+	}
+	free(job->chunks);
+
+	free(job->moduleName);
+	free(job->moduleDirectory);
+	mtx_destroy(&job->lock);
+	cnd_destroy(&job->done);
+	free(job);
+}
+
+// ========= Workers =========
+
+static Value instantiateClosure(VM* vm, Module* mod, ShippedFunction* shipped) {
+	push(vm, OBJ_VAL(instantiateSharedFunction(vm, shipped->function)));
+	ObjClosure* closure = newClosure(vm, mod, AS_FUNCTION(peek(vm, 0)));
+	pop(vm);
+	push(vm, OBJ_VAL(closure));
+
+	ObjList* upvalues = AS_LIST(readMessage(vm, shipped->upvalues));
+	push(vm, OBJ_VAL(upvalues));
+
+	for (size_t i = 0; i < closure->upvalueCount; i++) {
+		ObjUpvalue* upvalue = newUpvalue(vm, NULL);
+		upvalue->closed = upvalues->items.items[i];
+		upvalue->location = &upvalue->closed;
+		writeBarrier(vm, (Obj*)upvalue, upvalue->closed);
+
+		closure->upvalues[i] = upvalue;
+		writeBarrier(vm, (Obj*)closure, OBJ_VAL(upvalue));
+	}
+
+	pop(vm);
+	pop(vm);
+	return OBJ_VAL(closure);
+}
+
+static void unloadJob(VM* vm) {
+	vm->frames.length = 0;
+	vm->stack.length = 0;
+	if (loadedModule == NULL) return;
+
+	Module** link = &vm->modules;
+	while (*link != loadedModule) link = &(*link)->next;
+	*link = loadedModule->next;
+
+	freeModule(vm, loadedModule);
+	FREE(vm, Module, loadedModule);
+	loadedModule = NULL;
+	loadedSerial = 0;
+}
+
+// Leaves the job's closure in the first slot of the stack, under a frame of its own which never runs,
+// for the items' calls to return into as if called from a script
+static void loadJob(VM* vm, ParallelJob* job) {
+	if (loadedSerial == job->serial) return;
+	unloadJob(vm);
+
+	Module* mod = ALLOCATE(vm, Module, 1);
+	initModule(vm, mod);
+	loadedModule = mod;
+	mod->name = copyString(vm, job->moduleName, strlen(job->moduleName));
+	mod->directory = copyString(vm, job->moduleDirectory, strlen(job->moduleDirectory));
+
+	for (size_t i = 0; i < job->globalCount; i++) {
+		ShippedGlobal* global = &job->globals[i];
+		push(vm, OBJ_VAL(copyString(vm, global->name, global->length)));
+		push(vm, global->isFunction ? instantiateClosure(vm, mod, &global->function) : readMessage(vm, global->value));
+		tableSet(vm, &mod->globals, AS_STRING(peek(vm, 1)), peek(vm, 0));
+		pop(vm);
+		pop(vm);
+	}
+
+	push(vm, instantiateClosure(vm, mod, &job->function));
+	writeCallFrameArray(vm, &vm->frames, (CallFrame) { 0 });
+	CallFrame* frame = &vm->frames.items[0];
+	frame->closure = AS_CLOSURE(vm->stack.items[0]);
+	frame->ip = frame->closure->function->chunk.bytecode.items;
+	frame->slotsOffset = 0;
+
+	loadedSerial = job->serial;
+}
+
+static void mapChunk(VM* vm, ParallelChunk* chunk) {
+	Value input = decodeMessage(vm, chunk->input);
+	chunk->input = NULL;
+	push(vm, input);
+
+	ValueArray items;
+	initValueArray(&items);
+	ObjList* results = newList(vm, items);
+	push(vm, OBJ_VAL(results));
+
+	ObjList* list = AS_LIST(input);
+	for (size_t i = 0; i < list->items.length; i++) {
+		push(vm, list->items.items[i]);
+		Value mapped = callFromNative(vm, vm->stack.items[0], 1);
+		if (vm->hasException) {
+			chunk->error = describeException(vm);
+			chunk->errorIndex = chunk->start + i;
+			clearException(vm);
+			vm->stack.length = 1;
+			return;
+		}
+
+		push(vm, mapped);
+		writeValueArray(vm, &results->items, mapped);
+		writeBarrier(vm, (Obj*)results, mapped);
+		pop(vm);
+	}
+
+	chunk->output = encodeMessage(vm, OBJ_VAL(results));
+	if (chunk->output == NULL) {
+		chunk->error = describeException(vm);
+		chunk->errorIndex = chunk->start;
+		clearException(vm);
+	}
+	vm->stack.length = 1;
+}
+
+static void runChunk(VM* vm, Task* task) {
+	ParallelChunk* chunk = (ParallelChunk*)task;
+	ParallelJob* job = chunk->job;
+
+	if (!atomic_exchange(&chunk->claimed, true) && !atomic_load(&job->failed)) {
+		loadJob(vm, job);
+		mapChunk(vm, chunk);
+		if (chunk->error != NULL) atomic_store(&job->failed, true);
+	}
+
+	mtx_lock(&job->lock);
+	if (--job->outstanding == 0) cnd_signal(&job->done);
+	mtx_unlock(&job->lock);
+}
+
+// ========= Calling Thread =========
+
+// Maps items from start up to end straight into the results, in the caller's own VM
+static bool mapRange(VM* vm, ObjClosure* closure, ObjList* list, ObjList* results, size_t start, size_t end) {
+	// The function may shrink the list as it goes
+	for (size_t i = start; i < end && i < list->items.length; i++) {
+		push(vm, list->items.items[i]);
+		Value mapped = callFromNative(vm, OBJ_VAL(closure), 1);
+		if (vm->hasException) return false;
+
+		results->items.items[i] = mapped;
+		writeBarrier(vm, (Obj*)results, mapped);
+	}
+	return true;
+}
+
+// Returns NULL, with an exception thrown, if the closure or the items cannot be sent to the workers
+static ParallelJob* newJob(VM* vm, ObjClosure* closure, ObjList* list, size_t chunkSize) {
+	ParallelJob* job = malloc(sizeof(ParallelJob));
+	if (job == NULL) exit(1);
+
+	job->serial = atomic_fetch_add(&nextSerial, 1);
+	job->function.function = NULL;
+	job->function.upvalues = NULL;
+	job->globals = NULL;
+	job->globalCount = 0;
+	job->globalCapacity = 0;
+	Module* owner = closure->owner;
+	job->moduleName = owner->name != NULL ? copyChars(owner->name->str, owner->name->length) : copyChars("", 0);
+	job->moduleDirectory = owner->directory != NULL ? copyChars(owner->directory->str, owner->directory->length) : copyChars("", 0);
+	atomic_init(&job->failed, false);
+	mtx_init(&job->lock, mtx_plain);
+	cnd_init(&job->done);
+
+	size_t length = list->items.length;
+	job->chunkCount = (length + chunkSize - 1) / chunkSize;
+	job->chunks = malloc(sizeof(ParallelChunk) * job->chunkCount);
+	if (job->chunks == NULL) exit(1);
+	job->outstanding = job->chunkCount;
+
+	for (size_t i = 0; i < job->chunkCount; i++) {
+		ParallelChunk* chunk = &job->chunks[i];
+		chunk->task.run = runChunk;
+		chunk->job = job;
+		chunk->start = i * chunkSize;
+		chunk->end = chunk->start + chunkSize < length ? chunk->start + chunkSize : length;
+		atomic_init(&chunk->claimed, false);
+		chunk->input = NULL;
+		chunk->output = NULL;
+		chunk->error = NULL;
+		chunk->errorIndex = 0;
+	}
+
+	if (!shipFunction(vm, closure, &job->function)) goto failed;
+
+	SeenNames seen = { 0, 0, NULL };
+	shipGlobals(vm, job, owner, closure->function, &seen);
+	free(seen.items);
+
+	for (size_t i = 0; i < job->chunkCount; i++) {
+		ParallelChunk* chunk = &job->chunks[i];
+		chunk->input = encodeMessageItems(vm, list->items.items + chunk->start, chunk->end - chunk->start);
+		if (chunk->input == NULL) goto failed;
+	}
+
+	return job;
+
+failed:
+	freeJob(job);
+	return NULL;
+}
+
+static void waitForJob(ParallelJob* job) {
+	mtx_lock(&job->lock);
+	while (job->outstanding != 0) {
+		cnd_wait(&job->done, &job->lock);
+	}
+	mtx_unlock(&job->lock);
+}
+
+// Copies what the workers mapped into the results, or throws the first exception one of them hit
+static void collectResults(VM* vm, ParallelJob* job, ObjList* results) {
+	for (size_t i = 0; i < job->chunkCount; i++) {
+		ParallelChunk* chunk = &job->chunks[i];
+
+		if (chunk->error != NULL) {
+			throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_BASE], "parallel.map() failed on item %zu with %s", chunk->errorIndex, chunk->error);
+			return;
+		}
+		if (chunk->output == NULL) continue;
+
+		ObjList* mapped = AS_LIST(decodeMessage(vm, chunk->output));
+		chunk->output = NULL;
+		for (size_t j = 0; j < mapped->items.length && chunk->start + j < results->items.length; j++) {
+			results->items.items[chunk->start + j] = mapped->items.items[j];
+			writeBarrier(vm, (Obj*)results, mapped->items.items[j]);
+		}
+	}
+}
+
+static Value mapList(VM* vm, Value listValue, Value function, size_t chunkSize) {
+	if (!IS_LIST(listValue)) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected a list to map");
+		return NULL_VAL;
+	}
+	if (!IS_CLOSURE(function)) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected a function to map with");
+		return NULL_VAL;
+	}
+
+	ObjList* list = AS_LIST(listValue);
+	ObjClosure* closure = AS_CLOSURE(function);
+	size_t length = list->items.length;
+
+	ValueArray items;
+	initValueArray(&items);
+	ObjList* results = newList(vm, items);
+	push(vm, OBJ_VAL(results));
+	for (size_t i = 0; i < length; i++) {
+		writeValueArray(vm, &results->items, NULL_VAL);
+	}
+
+	// A worker waiting on the pool could wait on a chunk queued behind itself
+	if (length == 0 || isTaskWorker()) {
+		bool mapped = mapRange(vm, closure, list, results, 0, length);
+		pop(vm);
+		return mapped ? OBJ_VAL(results) : NULL_VAL;
+	}
+
+	if (chunkSize == 0) {
+		size_t chunks = (taskPoolSize() + 1) * PARALLEL_CHUNKS_PER_THREAD;
+		chunkSize = (length + chunks - 1) / chunks;
+	}
+
+	ParallelJob* job = newJob(vm, closure, list, chunkSize);
+	if (job == NULL) {
+		pop(vm);
+		return NULL_VAL;
+	}
+
+	Task** tasks = malloc(sizeof(Task*) * job->chunkCount);
+	if (tasks == NULL) exit(1);
+	for (size_t i = 0; i < job->chunkCount; i++) {
+		tasks[i] = &job->chunks[i].task;
+	}
+	submitTasks(tasks, job->chunkCount);
+	free(tasks);
+
+	// The caller takes chunks from the front while it waits, as the workers take their own from the back
+	for (size_t i = 0; i < job->chunkCount && !atomic_load(&job->failed); i++) {
+		ParallelChunk* chunk = &job->chunks[i];
+		if (atomic_exchange(&chunk->claimed, true)) continue;
+
+		if (!mapRange(vm, closure, list, results, chunk->start, chunk->end)) {
+			atomic_store(&job->failed, true);
+		}
+	}
+
+	waitForJob(job);
+	if (!vm->hasException) collectResults(vm, job, results);
+	freeJob(job);
+
+	pop(vm);
+	return vm->hasException ? NULL_VAL : OBJ_VAL(results);
+}
+
+// map(list, function) calls function with each item of list, spread over the task pool, and returns what it gave for
+// each in a new list. The function and the globals it names are copied to the workers, and the items to and from them
+// as on a channel, so neither what it captured nor the globals change for anything but the caller's own share.
+static Value parallelMapNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return mapList(vm, args[0], args[1], 0);
+}
+
+// mapChunked(list, function, chunkSize) is map() with the list split into chunks of chunkSize items
+static Value parallelMapChunkedNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (!IS_NUMBER(args[2]) || AS_NUMBER(args[2]) < 1) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected chunk size to be a positive number");
+		return NULL_VAL;
+	}
+	return mapList(vm, args[0], args[1], (size_t)AS_NUMBER(args[2]));
+}
+
+static Value parallelWorkersNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return NUMBER_VAL((double)taskPoolSize());
+}
+
+void defineParallelModule(VM* vm) {
+	ObjInstance* parallel = newInstance(vm, vm->internalClasses[INTERNAL_CLASS_IMPORT]);
+	vm->builtinModules[BUILTIN_MODULE_PARALLEL] = parallel;
+
+	defineNative(vm, (Obj*)parallel, &parallel->fields, "map", parallelMapNative, 2);
+	defineNative(vm, (Obj*)parallel, &parallel->fields, "mapChunked", parallelMapChunkedNative, 3);
+	defineNative(vm, (Obj*)parallel, &parallel->fields, "workers", parallelWorkersNative, 0);
+}
+
+void bindParallelModule(VM* vm, Module* mod) {
+	tableSet(vm, &mod->globals, vm->internalStrings[INTERNAL_STR_PARALLEL], OBJ_VAL(vm->builtinModules[BUILTIN_MODULE_PARALLEL]));
+}
\ No newline at end of file
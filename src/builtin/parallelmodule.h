@@ -0,0 +1,5 @@
+#pragma once
+#include "../vm.h"
+
+void defineParallelModule(VM* vm);
+void bindParallelModule(VM* vm, Module* mod);
\ No newline at end of file
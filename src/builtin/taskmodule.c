@@ -0,0 +1,58 @@
+#include "taskmodule.h"
+#include "natives.h"
+#include "../vm.h"
+#include "../memory.h"
+#include "../scheduler.h"
+
+static Value taskIsDoneNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return BOOL_VAL(AS_TASK(bound)->state == TASK_DONE);
+}
+
+// result() returns what the finished task returned, or throws what it threw
+static Value taskResultNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	ObjTask* task = AS_TASK(bound);
+	if (task->state != TASK_DONE) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_VALUE], "The task has not finished");
+		return NULL_VAL;
+	}
+
+	if (task->failed) {
+		vm->exception = task->result;
+		vm->hasException = true;
+		return NULL_VAL;
+	}
+	return task->result;
+}
+
+// run(task) runs the queued tasks, in the order they became ready, until none are left, then gives the task's result
+static Value tasksRunNative(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	if (!IS_TASK(args[0])) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Expected a task, as returned by calling an async function");
+		return NULL_VAL;
+	}
+	if (vm->task != NULL) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_BASE], "Cannot run tasks from inside a task; await it instead");
+		return NULL_VAL;
+	}
+
+	// Running the tasks can grow the stack out from under args
+	Value task = args[0];
+	runTasks(vm);
+	if (vm->hasException) return NULL_VAL;
+
+	return taskResultNative(vm, task, 0, NULL);
+}
+
+void defineTaskModule(VM* vm) {
+	defineNative(vm, NULL, &vm->taskMethods, "isDone", taskIsDoneNative, 0);
+	defineNative(vm, NULL, &vm->taskMethods, "result", taskResultNative, 0);
+
+	ObjInstance* tasks = newInstance(vm, vm->internalClasses[INTERNAL_CLASS_IMPORT]);
+	vm->builtinModules[BUILTIN_MODULE_TASKS] = tasks;
+
+	defineNative(vm, (Obj*)tasks, &tasks->fields, "run", tasksRunNative, 1);
+}
+
+void bindTaskModule(VM* vm, Module* mod) {
+	tableSet(vm, &mod->globals, vm->internalStrings[INTERNAL_STR_TASKS], OBJ_VAL(vm->builtinModules[BUILTIN_MODULE_TASKS]));
+}
\ No newline at end of file
@@ -0,0 +1,5 @@
+#pragma once
+#include "../vm.h"
+
+void defineTaskModule(VM* vm);
+void bindTaskModule(VM* vm, Module* mod);
\ No newline at end of file
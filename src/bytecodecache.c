@@ -0,0 +1,545 @@
+#include "bytecodecache.h"
+#include "compiler.h"
+#include "disassemble.h"
+#include "memory.h"
+#include "object.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+// Bumped whenever the layout of a cache file, or the meaning of the bytecode in it, changes
+#define CACHE_FORMAT_VERSION 2
+
+#define HASH_SEED 14695981039346656037ull
+
+typedef enum CacheConstantType {
+	CACHE_CONSTANT_NUMBER,
+	CACHE_CONSTANT_STRING,
+	CACHE_CONSTANT_FUNCTION
+} CacheConstantType;
+
+// The operands which follow each opcode, as execute.h reads them; u16s are big endian
+typedef enum OperandLayout {
+	OPERANDS_NONE,
+	OPERANDS_CONSTANT, // u16 index of any constant
+	OPERANDS_NAME, // u16 index of a string constant
+	OPERANDS_NAME_BYTE, // u16 index of a string constant, then a u8 argument count
+	OPERANDS_LOCAL, // u16 stack slot
+	OPERANDS_UPVALUE, // u16 upvalue index
+	OPERANDS_SHORT, // u16 count
+	OPERANDS_BYTE, // u8 argument count
+	OPERANDS_JUMP, // u16 distance forward from the end of the instruction
+	OPERANDS_LOOP, // u16 distance back from the end of the instruction
+	OPERANDS_CLOSURE // u16 index of a function constant, then an (isLocal u8, index u8) pair per upvalue
+} OperandLayout;
+
+// What a cache file must have been made from to be used
+typedef struct CacheKey {
+	int64_t mtime;
+	uint64_t length;
+	uint64_t hash;
+} CacheKey;
+
+typedef struct CacheWriter {
+	uint8_t* bytes;
+	size_t length;
+	size_t capacity;
+} CacheWriter;
+
+typedef struct CacheReader {
+	const uint8_t* bytes;
+	size_t length;
+	size_t offset;
+	bool failed;
+} CacheReader;
+
+// 64-bit FNV-1a, continuing from hash
+static uint64_t extendHash(uint64_t hash, const void* bytes, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		hash ^= ((const uint8_t*)bytes)[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static uint64_t hashBytes(const void* bytes, size_t length) {
+	return extendHash(HASH_SEED, bytes, length);
+}
+
+static OperandLayout operandLayout(Opcode opcode) {
+	switch (opcode) {
+		case OP_USE_CONSTANT:
+			return OPERANDS_CONSTANT;
+		case OP_DEFINE_GLOBAL:
+		case OP_ACCESS_GLOBAL:
+		case OP_ASSIGN_GLOBAL:
+		case OP_CLASS:
+		case OP_METHOD:
+		case OP_ACCESS_PROPERTY:
+		case OP_ASSIGN_PROPERTY:
+		case OP_ASSIGN_PROPERTY_KV:
+		case OP_ACCESS_SUPER:
+		case OP_IMPORT:
+		case OP_EXPORT:
+			return OPERANDS_NAME;
+		case OP_NATIVE:
+		case OP_CLASS_NATIVE:
+		case OP_INVOKE:
+		case OP_SUPER_INVOKE:
+			return OPERANDS_NAME_BYTE;
+		case OP_ACCESS_LOCAL:
+		case OP_ASSIGN_LOCAL:
+			return OPERANDS_LOCAL;
+		case OP_ACCESS_UPVALUE:
+		case OP_ASSIGN_UPVALUE:
+			return OPERANDS_UPVALUE;
+		case OP_LIST:
+			return OPERANDS_SHORT;
+		case OP_CALL:
+			return OPERANDS_BYTE;
+		case OP_JUMP:
+		case OP_JUMP_FALSE:
+		case OP_JUMP_FALSE_SC:
+		case OP_JUMP_TRUE_SC:
+		case OP_TRY_BEGIN:
+			return OPERANDS_JUMP;
+		case OP_LOOP:
+			return OPERANDS_LOOP;
+		case OP_CLOSURE:
+			return OPERANDS_CLOSURE;
+		default:
+			return OPERANDS_NONE;
+	}
+}
+
+// Covers the name and operands of every opcode, so that a cache file stops loading when an instruction is added,
+// renumbered or given different operands, not only when the number of opcodes changes
+static uint64_t opcodeLayoutHash() {
+	uint64_t hash = HASH_SEED;
+	for (size_t i = 0; i < OPCODE_COUNT; i++) {
+		const char* name = opcodeName((Opcode)i);
+		uint8_t layout = (uint8_t)operandLayout((Opcode)i);
+		hash = extendHash(hash, name, strlen(name) + 1);
+		hash = extendHash(hash, &layout, 1);
+	}
+	return hash;
+}
+
+static bool keySource(const char* path, const char* source, CacheKey* key) {
+	struct stat status;
+	if (stat(path, &status) != 0) return false;
+
+	key->mtime = (int64_t)status.st_mtime;
+	key->length = strlen(source);
+	key->hash = hashBytes(source, key->length);
+	return true;
+}
+
+// Beside the script, script.fn has script.fnc; in a cache directory the name is qualified by a hash of the script's
+// path, as scripts in different directories may share a name
+static char* cachePath(VM* vm, const char* path) {
+	if (vm->bytecodeCacheDirectory == NULL) {
+		size_t length = strlen(path);
+		char* result = malloc(length + 2);
+		if (result == NULL) exit(1);
+		memcpy(result, path, length);
+		result[length] = 'c';
+		result[length + 1] = '\0';
+		return result;
+	}
+
+	const char* name = path;
+	for (const char* c = path; *c != '\0'; c++) {
+		if (*c == '/' || *c == '\\') name = c + 1;
+	}
+	const char* dot = strrchr(name, '.');
+	int stem = dot != NULL ? (int)(dot - name) : (int)strlen(name);
+
+	size_t size = strlen(vm->bytecodeCacheDirectory) + strlen(name) + 32;
+	char* result = malloc(size);
+	if (result == NULL) exit(1);
+	snprintf(result, size, "%s/%.*s.%016llx.fnc", vm->bytecodeCacheDirectory, stem, name, (unsigned long long)hashBytes(path, strlen(path)));
+	return result;
+}
+
+static void writeBytes(CacheWriter* writer, const void* bytes, size_t length) {
+	if (writer->capacity < writer->length + length) {
+		while (writer->capacity < writer->length + length) {
+			writer->capacity = GROW_CAPACITY(writer->capacity);
+		}
+		writer->bytes = realloc(writer->bytes, writer->capacity);
+		if (writer->bytes == NULL) exit(1);
+	}
+	memcpy(writer->bytes + writer->length, bytes, length);
+	writer->length += length;
+}
+
+static void writeUnsigned(CacheWriter* writer, uint64_t value, size_t size) {
+	uint8_t bytes[8];
+	for (size_t i = 0; i < size; i++) {
+		bytes[i] = (uint8_t)(value >> (i * 8));
+	}
+	writeBytes(writer, bytes, size);
+}
+
+static void writeString(CacheWriter* writer, ObjString* string) {
+	writeUnsigned(writer, string->length, 4);
+	writeBytes(writer, string->str, string->length);
+}
+
+static void writeFunction(CacheWriter* writer, ObjFunction* function) {
+	writeUnsigned(writer, function->arity, 4);
+	writeUnsigned(writer, function->upvalueCount, 4);
+	writeUnsigned(writer, function->isAsync, 1);
+	writeUnsigned(writer, function->name != NULL, 1);
+	if (function->name != NULL) writeString(writer, function->name);
+
+	Chunk* chunk = &function->chunk;
+	writeUnsigned(writer, chunk->bytecode.length, 4);
+	writeBytes(writer, chunk->bytecode.items, chunk->bytecode.length);
+	writeUnsigned(writer, chunk->lines.length, 4);
+	for (size_t i = 0; i < chunk->lines.length; i++) {
+		writeUnsigned(writer, chunk->lines.items[i], 8);
+	}
+
+	writeUnsigned(writer, chunk->constants.length, 4);
+	for (size_t i = 0; i < chunk->constants.length; i++) {
+		Value value = chunk->constants.items[i];
+
+		if (IS_NUMBER(value)) {
+			double number = AS_NUMBER(value);
+			uint64_t bits;
+			memcpy(&bits, &number, sizeof(bits));
+			writeUnsigned(writer, CACHE_CONSTANT_NUMBER, 1);
+			writeUnsigned(writer, bits, 8);
+		}
+		else if (IS_STRING(value)) {
+			writeUnsigned(writer, CACHE_CONSTANT_STRING, 1);
+			writeString(writer, AS_STRING(value));
+		}
+		else {
+			ASSERT(IS_FUNCTION(value), "The compiler only makes number, string and function constants");
+			writeUnsigned(writer, CACHE_CONSTANT_FUNCTION, 1);
+			writeFunction(writer, AS_FUNCTION(value));
+		}
+	}
+}
+
+static void writeHeader(CacheWriter* writer, CacheKey* key, uint64_t payloadHash) {
+	writeBytes(writer, "FNC", 4);
+	writeUnsigned(writer, CACHE_FORMAT_VERSION, 4);
+	writeUnsigned(writer, OPCODE_COUNT, 4);
+	writeUnsigned(writer, opcodeLayoutHash(), 8);
+	writeUnsigned(writer, (uint64_t)key->mtime, 8);
+	writeUnsigned(writer, key->length, 8);
+	writeUnsigned(writer, key->hash, 8);
+	writeUnsigned(writer, payloadHash, 8);
+}
+
+// The cache is only ever an optimisation, so failing to write one is not an error.
+// The file is written under a temporary name and renamed into place, so that no reader sees it half written.
+static void writeCache(VM* vm, const char* path, CacheKey* key, ObjFunction* function) {
+	CacheWriter payload = { NULL, 0, 0 };
+	writeFunction(&payload, function);
+
+	CacheWriter writer = { NULL, 0, 0 };
+	writeHeader(&writer, key, hashBytes(payload.bytes, payload.length));
+	writeBytes(&writer, payload.bytes, payload.length);
+	free(payload.bytes);
+
+	if (vm->bytecodeCacheDirectory != NULL) {
+#ifdef _WIN32
+		_mkdir(vm->bytecodeCacheDirectory);
+#else
+		mkdir(vm->bytecodeCacheDirectory, 0777);
+#endif
+	}
+
+	size_t size = strlen(path) + 32;
+	char* temporary = malloc(size);
+	if (temporary == NULL) exit(1);
+	snprintf(temporary, size, "%s.%llx.tmp", path, (unsigned long long)monotonicNanoseconds());
+
+	FILE* file = fopen(temporary, "wb");
+	if (file != NULL) {
+		bool written = fwrite(writer.bytes, 1, writer.length, file) == writer.length;
+		written = fclose(file) == 0 && written;
+
+#ifdef _WIN32
+		// rename() does not replace an existing file on Windows
+		if (written) remove(path);
+#endif
+		if (!written || rename(temporary, path) != 0) remove(temporary);
+	}
+
+	free(temporary);
+	free(writer.bytes);
+}
+
+static bool readBytes(CacheReader* reader, void* bytes, size_t length) {
+	if (reader->failed || reader->length - reader->offset < length) {
+		reader->failed = true;
+		return false;
+	}
+	memcpy(bytes, reader->bytes + reader->offset, length);
+	reader->offset += length;
+	return true;
+}
+
+static uint64_t readUnsigned(CacheReader* reader, size_t size) {
+	uint8_t bytes[8];
+	if (!readBytes(reader, bytes, size)) return 0;
+
+	uint64_t value = 0;
+	for (size_t i = 0; i < size; i++) {
+		value |= (uint64_t)bytes[i] << (i * 8);
+	}
+	return value;
+}
+
+// Checked before allocating for an array, so that a corrupt length fails rather than allocating wildly
+static bool hasBytes(CacheReader* reader, uint64_t length) {
+	if (reader->failed || reader->length - reader->offset < length) {
+		reader->failed = true;
+		return false;
+	}
+	return true;
+}
+
+static ObjString* readString(VM* vm, CacheReader* reader) {
+	size_t length = (size_t)readUnsigned(reader, 4);
+	if (!hasBytes(reader, length)) return NULL;
+
+	ObjString* string = copyString(vm, (const char*)reader->bytes + reader->offset, length);
+	reader->offset += length;
+	return string;
+}
+
+// Returns the size of the instruction at offset, or 0 if it is malformed or refers to something the function does not
+// have. If it jumps, target is set to the offset it jumps to.
+static size_t verifyInstruction(ObjFunction* function, size_t offset, size_t* target) {
+	Chunk* chunk = &function->chunk;
+	const uint8_t* code = chunk->bytecode.items;
+	size_t remaining = chunk->bytecode.length - offset;
+
+	if (code[offset] >= OPCODE_COUNT) return 0;
+	OperandLayout layout = operandLayout((Opcode)code[offset]);
+	if (layout == OPERANDS_NONE) return 1;
+	if (layout == OPERANDS_BYTE) return remaining >= 2 ? 2 : 0;
+
+	size_t size = layout == OPERANDS_NAME_BYTE ? 4 : 3;
+	if (remaining < size) return 0;
+	uint16_t operand = (uint16_t)((code[offset + 1] << 8) | code[offset + 2]);
+
+	switch (layout) {
+		case OPERANDS_CONSTANT:
+			return operand < chunk->constants.length ? size : 0;
+		case OPERANDS_NAME:
+		case OPERANDS_NAME_BYTE:
+			return operand < chunk->constants.length && IS_STRING(chunk->constants.items[operand]) ? size : 0;
+		case OPERANDS_LOCAL:
+			return operand < UINT8_COUNT ? size : 0;
+		case OPERANDS_UPVALUE:
+			return operand < function->upvalueCount ? size : 0;
+		case OPERANDS_JUMP:
+			*target = offset + size + operand;
+			return size;
+		case OPERANDS_LOOP:
+			if (operand > offset + size) return 0;
+			*target = offset + size - operand;
+			return size;
+		case OPERANDS_CLOSURE: {
+			if (operand >= chunk->constants.length || !IS_FUNCTION(chunk->constants.items[operand])) return 0;
+			ObjFunction* nested = AS_FUNCTION(chunk->constants.items[operand]);
+
+			size += nested->upvalueCount * 2;
+			if (remaining < size) return 0;
+			for (size_t i = 0; i < nested->upvalueCount; i++) {
+				bool isLocal = code[offset + 3 + i * 2] != 0;
+				uint8_t index = code[offset + 4 + i * 2];
+				if (!isLocal && index >= function->upvalueCount) return 0;
+			}
+			return size;
+		}
+		default:
+			return size;
+	}
+}
+
+// The payload hash is what rejects a damaged file. This checks what the hash cannot, a file written by a build whose
+// bytecode differs in a way the header misses: every operand must refer to something the function has, and ip must
+// stay within the bytecode. Like compiled bytecode, the shape of the stack at each instruction is trusted.
+static bool verifyFunction(ObjFunction* function) {
+	Chunk* chunk = &function->chunk;
+	size_t length = chunk->bytecode.length;
+
+	if (function->arity >= UINT8_COUNT || function->upvalueCount > UINT8_COUNT) return false;
+	// getLineOfInstruction() expects (index, line) pairs, the first of which covers the first instruction
+	if (length == 0 || chunk->lines.length < 2 || chunk->lines.length % 2 != 0 || chunk->lines.items[0] != 0) return false;
+
+	bool* starts = calloc(length, sizeof(bool));
+	if (starts == NULL) exit(1);
+
+	bool valid = true;
+	size_t last = 0;
+	for (size_t offset = 0; offset < length && valid; ) {
+		size_t target;
+		size_t size = verifyInstruction(function, offset, &target);
+		starts[offset] = true;
+		last = offset;
+		valid = size != 0;
+		offset += size;
+	}
+
+	// Jumps must land on an instruction, and the last instruction must return, so that ip never leaves the bytecode
+	for (size_t offset = 0; offset < length && valid; ) {
+		size_t target = SIZE_MAX;
+		offset += verifyInstruction(function, offset, &target);
+		if (target != SIZE_MAX) valid = target < length && starts[target];
+	}
+	valid = valid && chunk->bytecode.items[last] == OP_RETURN;
+
+	free(starts);
+	return valid;
+}
+
+// The function returned is not rooted; NULL if the file is malformed
+static ObjFunction* readFunction(VM* vm, CacheReader* reader) {
+	ObjFunction* function = newFunction(vm);
+	push(vm, OBJ_VAL(function));
+
+	function->arity = (size_t)readUnsigned(reader, 4);
+	function->upvalueCount = (size_t)readUnsigned(reader, 4);
+	function->isAsync = readUnsigned(reader, 1) != 0;
+	if (readUnsigned(reader, 1) != 0) {
+		function->name = readString(vm, reader);
+		if (function->name != NULL) writeBarrier(vm, (Obj*)function, OBJ_VAL(function->name));
+	}
+
+	Chunk* chunk = &function->chunk;
+	size_t bytecodeLength = (size_t)readUnsigned(reader, 4);
+	if (bytecodeLength != 0 && hasBytes(reader, bytecodeLength)) {
+		chunk->bytecode.items = GROW_ARRAY(vm, uint8_t, NULL, 0, bytecodeLength);
+		chunk->bytecode.capacity = bytecodeLength;
+		chunk->bytecode.length = bytecodeLength;
+		readBytes(reader, chunk->bytecode.items, bytecodeLength);
+	}
+
+	size_t linesLength = (size_t)readUnsigned(reader, 4);
+	if (linesLength != 0 && hasBytes(reader, (uint64_t)linesLength * 8)) {
+		chunk->lines.items = GROW_ARRAY(vm, size_t, NULL, 0, linesLength);
+		chunk->lines.capacity = linesLength;
+		chunk->lines.length = linesLength;
+		for (size_t i = 0; i < linesLength; i++) {
+			chunk->lines.items[i] = (size_t)readUnsigned(reader, 8);
+		}
+	}
+
+	// Every constant takes at least a byte
+	size_t constantCount = (size_t)readUnsigned(reader, 4);
+	hasBytes(reader, constantCount);
+	for (size_t i = 0; i < constantCount && !reader->failed; i++) {
+		Value value = NULL_VAL;
+
+		switch (readUnsigned(reader, 1)) {
+			case CACHE_CONSTANT_NUMBER: {
+				uint64_t bits = readUnsigned(reader, 8);
+				double number;
+				memcpy(&number, &bits, sizeof(number));
+				value = NUMBER_VAL(number);
+				break;
+			}
+			case CACHE_CONSTANT_STRING: {
+				ObjString* string = readString(vm, reader);
+				if (string != NULL) value = OBJ_VAL(string);
+				break;
+			}
+			case CACHE_CONSTANT_FUNCTION: {
+				ObjFunction* nested = readFunction(vm, reader);
+				if (nested != NULL) value = OBJ_VAL(nested);
+				break;
+			}
+			default: reader->failed = true; break;
+		}
+
+		push(vm, value);
+		writeValueArray(vm, &chunk->constants, value);
+		writeBarrier(vm, (Obj*)function, value);
+		pop(vm);
+	}
+
+	pop(vm);
+	return reader->failed || !verifyFunction(function) ? NULL : function;
+}
+
+static char* readCacheFile(const char* path, size_t* length) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return NULL;
+
+	fseek(file, 0L, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+
+	char* bytes = size > 0 ? malloc((size_t)size) : NULL;
+	if (bytes != NULL && fread(bytes, 1, (size_t)size, file) != (size_t)size) {
+		free(bytes);
+		bytes = NULL;
+	}
+	fclose(file);
+
+	*length = (size_t)size;
+	return bytes;
+}
+
+// Returns NULL if there is no cache file, it was not made from this source by this version of the VM, or it is damaged
+static ObjFunction* loadCache(VM* vm, const char* path, CacheKey* key) {
+	size_t length;
+	char* bytes = readCacheFile(path, &length);
+	if (bytes == NULL) return NULL;
+
+	CacheReader reader = { (const uint8_t*)bytes, length, 0, false };
+	char magic[4];
+	bool valid = readBytes(&reader, magic, 4)
+		&& memcmp(magic, "FNC", 4) == 0
+		&& readUnsigned(&reader, 4) == CACHE_FORMAT_VERSION
+		&& readUnsigned(&reader, 4) == OPCODE_COUNT
+		&& readUnsigned(&reader, 8) == opcodeLayoutHash()
+		&& (int64_t)readUnsigned(&reader, 8) == key->mtime
+		&& readUnsigned(&reader, 8) == key->length
+		&& readUnsigned(&reader, 8) == key->hash;
+
+	if (valid) {
+		uint64_t payloadHash = readUnsigned(&reader, 8);
+		valid = !reader.failed && payloadHash == hashBytes(reader.bytes + reader.offset, reader.length - reader.offset);
+	}
+
+	ObjFunction* function = NULL;
+	if (valid) {
+		function = readFunction(vm, &reader);
+		if (reader.offset != reader.length) function = NULL;
+	}
+
+	free(bytes);
+	return function;
+}
+
+ObjFunction* compileScript(VM* vm, const char* path, const char* source) {
+	CacheKey key;
+	if (!vm->bytecodeCache || !keySource(path, source, &key)) return compile(vm, source);
+
+	char* cached = cachePath(vm, path);
+	ObjFunction* function = loadCache(vm, cached, &key);
+
+	if (function == NULL) {
+		function = compile(vm, source);
+		if (function != NULL) writeCache(vm, cached, &key, function);
+	}
+
+	free(cached);
+	return function;
+}
\ No newline at end of file
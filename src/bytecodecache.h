@@ -0,0 +1,21 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// A bytecode cache file (.fnc) keeps a script compiled between runs, so that loading it again skips lexing and
+// compiling. It is only used while the script's modification time, length and hash all match those it was made from.
+// Integers are little endian; strings are a u32 length then their characters:
+//   header:   "FNC\0", format version u32, OPCODE_COUNT u32, opcode layout hash u64, mtime i64, source length u64,
+//             source hash u64, payload hash u64
+//   payload:  the script's function
+//   function: arity u32, upvalueCount u32, isAsync u8, has name u8, [name], bytecode length u32, bytecode,
+//             line table length u32, line table as u64s, constant count u32, constants
+//   constant: type u8, then a number as its u64 bits, a string, or a function
+// Every function nested in the script's is among the constants of the function it is nested in. The hashes are 64-bit
+// FNV-1a; the payload hash is of every byte after the header, and the opcode layout hash is of each opcode's name and
+// operands, as a change to those also makes older bytecode meaningless.
+// The upvalue descriptors of a closure are operands of its OP_CLOSURE, so they are part of the bytecode.
+
+// Returns the script's function, or NULL if it failed to compile. When the VM has a bytecode cache, a valid cache file
+// is loaded in place of compiling the source, and one is written once the source is compiled otherwise.
+ObjFunction* compileScript(VM* vm, const char* path, const char* source);
\ No newline at end of file
@@ -0,0 +1,616 @@
+#include "channel.h"
+#include "memory.h"
+#include "object.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// Strings at least this long have their characters shared with the receiver rather than copied
+#define CHANNEL_SHARED_STRING_MIN 1024
+// Lists and objects nested deeper than this are refused, as they are cloned recursively
+#define CHANNEL_MAX_DEPTH 512
+// Attempts a blocked sender or receiver makes, yielding between them, before sleeping until the channel changes
+#define CHANNEL_SPINS 64
+#define CACHE_LINE 64
+
+// ========= Messages =========
+
+typedef enum MessageTag {
+	MESSAGE_NULL,
+	MESSAGE_TRUE,
+	MESSAGE_FALSE,
+	MESSAGE_NUMBER,
+	MESSAGE_STRING,
+	MESSAGE_SHARED_STRING,
+	MESSAGE_LIST,
+	MESSAGE_OBJECT,
+	// A list or object seen earlier in the message, by the order it was first seen in
+	MESSAGE_REFERENCE
+} MessageTag;
+
+struct Message {
+	size_t length;
+	size_t capacity;
+	uint8_t* bytes;
+	// A reference to each string's characters shared through the message, released when it is freed
+	size_t sharedCount;
+	size_t sharedCapacity;
+	SharedChars** shared;
+};
+
+// Maps each list and object already written to the index it is referred back to by
+typedef struct SeenObjects {
+	size_t count;
+	size_t capacity;
+	Obj** keys;
+	size_t* indices;
+} SeenObjects;
+
+typedef struct Encoder {
+	VM* vm;
+	Message* message;
+	SeenObjects seen;
+} Encoder;
+
+static void writeBytes(Message* message, const void* bytes, size_t length) {
+	if (message->capacity < message->length + length) {
+		while (message->capacity < message->length + length) message->capacity = GROW_CAPACITY(message->capacity);
+		message->bytes = realloc(message->bytes, message->capacity);
+		if (message->bytes == NULL) exit(1);
+	}
+	memcpy(message->bytes + message->length, bytes, length);
+	message->length += length;
+}
+
+static void writeTag(Message* message, MessageTag tag) {
+	uint8_t byte = (uint8_t)tag;
+	writeBytes(message, &byte, 1);
+}
+
+static void writeSize(Message* message, size_t size) {
+	writeBytes(message, &size, sizeof(size_t));
+}
+
+static void addShared(Message* message, SharedChars* shared) {
+	if (message->sharedCapacity < message->sharedCount + 1) {
+		message->sharedCapacity = GROW_CAPACITY(message->sharedCapacity);
+		message->shared = realloc(message->shared, sizeof(SharedChars*) * message->sharedCapacity);
+		if (message->shared == NULL) exit(1);
+	}
+	message->shared[message->sharedCount++] = shared;
+}
+
+static size_t hashPointer(Obj* object) {
+	uintptr_t bits = (uintptr_t)object;
+	return (size_t)((bits >> 4) ^ (bits >> 16));
+}
+
+// Returns true, with its index, if the object was seen before; otherwise records it under the next index
+static bool seeObject(SeenObjects* seen, Obj* object, size_t* index) {
+	if (seen->count + 1 > seen->capacity * 3 / 4) {
+		size_t oldCapacity = seen->capacity;
+		Obj** oldKeys = seen->keys;
+		size_t* oldIndices = seen->indices;
+
+		seen->capacity = GROW_CAPACITY(oldCapacity);
+		seen->keys = calloc(seen->capacity, sizeof(Obj*));
+		seen->indices = malloc(sizeof(size_t) * seen->capacity);
+		if (seen->keys == NULL || seen->indices == NULL) exit(1);
+
+		for (size_t i = 0; i < oldCapacity; i++) {
+			if (oldKeys[i] == NULL) continue;
+			size_t slot = hashPointer(oldKeys[i]) & (seen->capacity - 1);
+			while (seen->keys[slot] != NULL) slot = (slot + 1) & (seen->capacity - 1);
+			seen->keys[slot] = oldKeys[i];
+			seen->indices[slot] = oldIndices[i];
+		}
+		free(oldKeys);
+		free(oldIndices);
+	}
+
+	size_t slot = hashPointer(object) & (seen->capacity - 1);
+	while (seen->keys[slot] != NULL) {
+		if (seen->keys[slot] == object) {
+			*index = seen->indices[slot];
+			return true;
+		}
+		slot = (slot + 1) & (seen->capacity - 1);
+	}
+
+	seen->keys[slot] = object;
+	seen->indices[slot] = seen->count++;
+	return false;
+}
+
+static void encodeString(Encoder* encoder, ObjString* string) {
+	if (string->length >= CHANNEL_SHARED_STRING_MIN) {
+		SharedChars* shared = shareString(string);
+		addShared(encoder->message, shared);
+		writeTag(encoder->message, MESSAGE_SHARED_STRING);
+		writeBytes(encoder->message, &shared, sizeof(SharedChars*));
+		writeSize(encoder->message, string->length);
+		writeBytes(encoder->message, &string->hash, sizeof(uint32_t));
+		return;
+	}
+
+	writeTag(encoder->message, MESSAGE_STRING);
+	writeSize(encoder->message, string->length);
+	writeBytes(encoder->message, string->str, string->length);
+}
+
+static bool encodeValue(Encoder* encoder, Value value, size_t depth) {
+	VM* vm = encoder->vm;
+	Message* message = encoder->message;
+
+	if (IS_NULL(value)) {
+		writeTag(message, MESSAGE_NULL);
+		return true;
+	}
+	if (IS_BOOL(value)) {
+		writeTag(message, AS_BOOL(value) ? MESSAGE_TRUE : MESSAGE_FALSE);
+		return true;
+	}
+	if (IS_NUMBER(value)) {
+		double number = AS_NUMBER(value);
+		writeTag(message, MESSAGE_NUMBER);
+		writeBytes(message, &number, sizeof(double));
+		return true;
+	}
+	if (IS_STRING(value)) {
+		encodeString(encoder, AS_STRING(value));
+		return true;
+	}
+
+	bool isList = IS_LIST(value);
+	bool isObject = IS_INSTANCE(value) && AS_INSTANCE(value)->clazz == vm->internalClasses[INTERNAL_CLASS_OBJECT] && AS_INSTANCE(value)->nativeData == NULL;
+	if (!isList && !isObject) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Only null, booleans, numbers, strings, lists and plain objects can be sent between isolates");
+		return false;
+	}
+	if (depth >= CHANNEL_MAX_DEPTH) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_VALUE], "Value is nested too deeply to be sent between isolates (%d levels)", CHANNEL_MAX_DEPTH);
+		return false;
+	}
+
+	size_t index;
+	if (seeObject(&encoder->seen, AS_OBJ(value), &index)) {
+		writeTag(message, MESSAGE_REFERENCE);
+		writeSize(message, index);
+		return true;
+	}
+
+	if (isList) {
+		ObjList* list = AS_LIST(value);
+		writeTag(message, MESSAGE_LIST);
+		writeSize(message, list->items.length);
+		for (size_t i = 0; i < list->items.length; i++) {
+			if (!encodeValue(encoder, list->items.items[i], depth + 1)) return false;
+		}
+		return true;
+	}
+
+	ObjInstance* instance = AS_INSTANCE(value);
+	writeTag(message, MESSAGE_OBJECT);
+	// The table's count takes in deleted entries, so the fields are counted as they are written and filled in after
+	size_t countOffset = message->length;
+	size_t count = 0;
+	writeSize(message, 0);
+	for (size_t i = 0; i < instance->fields.capacity; i++) {
+		Entry* entry = &instance->fields.entries[i];
+		if (entry->key == NULL) continue;
+		encodeString(encoder, entry->key);
+		if (!encodeValue(encoder, entry->value, depth + 1)) return false;
+		count++;
+	}
+	memcpy(message->bytes + countOffset, &count, sizeof(size_t));
+	return true;
+}
+
+static Message* newMessage(void) {
+	Message* message = malloc(sizeof(Message));
+	if (message == NULL) exit(1);
+	message->length = 0;
+	message->capacity = 0;
+	message->bytes = NULL;
+	message->sharedCount = 0;
+	message->sharedCapacity = 0;
+	message->shared = NULL;
+	return message;
+}
+
+static Message* finishEncoding(Encoder* encoder, bool encoded) {
+	free(encoder->seen.keys);
+	free(encoder->seen.indices);
+
+	if (!encoded) {
+		freeMessage(encoder->message);
+		return NULL;
+	}
+	return encoder->message;
+}
+
+Message* encodeMessage(VM* vm, Value value) {
+	Encoder encoder = { vm, newMessage(), { 0, 0, NULL, NULL } };
+	return finishEncoding(&encoder, encodeValue(&encoder, value, 0));
+}
+
+Message* encodeMessageItems(VM* vm, Value* items, size_t count) {
+	Encoder encoder = { vm, newMessage(), { 0, 0, NULL, NULL } };
+	// The list the decoder makes takes the first index references count by, though there is no object for it here
+	encoder.seen.count = 1;
+
+	writeTag(encoder.message, MESSAGE_LIST);
+	writeSize(encoder.message, count);
+	bool encoded = true;
+	for (size_t i = 0; i < count && encoded; i++) {
+		encoded = encodeValue(&encoder, items[i], 1);
+	}
+	return finishEncoding(&encoder, encoded);
+}
+
+void freeMessage(Message* message) {
+	for (size_t i = 0; i < message->sharedCount; i++) {
+		releaseSharedChars(message->shared[i]);
+	}
+	free(message->shared);
+	free(message->bytes);
+	free(message);
+}
+
+typedef struct Decoder {
+	VM* vm;
+	uint8_t* cursor;
+	// Every list and object made so far, in the order MESSAGE_REFERENCE counts them; on the stack, so they stay rooted
+	ObjList* objects;
+} Decoder;
+
+static void readBytes(Decoder* decoder, void* bytes, size_t length) {
+	memcpy(bytes, decoder->cursor, length);
+	decoder->cursor += length;
+}
+
+static size_t readSize(Decoder* decoder) {
+	size_t size;
+	readBytes(decoder, &size, sizeof(size_t));
+	return size;
+}
+
+static void addObject(Decoder* decoder, Obj* object) {
+	writeValueArray(decoder->vm, &decoder->objects->items, OBJ_VAL(object));
+	writeBarrier(decoder->vm, (Obj*)decoder->objects, OBJ_VAL(object));
+}
+
+// The value returned is not rooted
+static Value decodeValue(Decoder* decoder) {
+	VM* vm = decoder->vm;
+	MessageTag tag = (MessageTag)*decoder->cursor++;
+
+	switch (tag) {
+		case MESSAGE_NULL: return NULL_VAL;
+		case MESSAGE_TRUE: return BOOL_VAL(true);
+		case MESSAGE_FALSE: return BOOL_VAL(false);
+		case MESSAGE_NUMBER: {
+			double number;
+			readBytes(decoder, &number, sizeof(double));
+			return NUMBER_VAL(number);
+		}
+		case MESSAGE_STRING: {
+			size_t length = readSize(decoder);
+			ObjString* string = copyString(vm, (const char*)decoder->cursor, length);
+			decoder->cursor += length;
+			return OBJ_VAL(string);
+		}
+		case MESSAGE_SHARED_STRING: {
+			SharedChars* shared;
+			readBytes(decoder, &shared, sizeof(SharedChars*));
+			size_t length = readSize(decoder);
+			uint32_t hash;
+			readBytes(decoder, &hash, sizeof(uint32_t));
+
+			// The message keeps its own reference, released when it is freed
+			atomic_fetch_add_explicit(&shared->references, 1, memory_order_relaxed);
+			return OBJ_VAL(adoptSharedString(vm, shared, length, hash));
+		}
+		case MESSAGE_LIST: {
+			size_t length = readSize(decoder);
+			ValueArray items;
+			initValueArray(&items);
+			ObjList* list = newList(vm, items);
+			push(vm, OBJ_VAL(list));
+			addObject(decoder, (Obj*)list);
+			pop(vm);
+
+			for (size_t i = 0; i < length; i++) {
+				Value item = decodeValue(decoder);
+				push(vm, item);
+				writeValueArray(vm, &list->items, item);
+				writeBarrier(vm, (Obj*)list, item);
+				pop(vm);
+			}
+			return OBJ_VAL(list);
+		}
+		case MESSAGE_OBJECT: {
+			size_t count = readSize(decoder);
+			ObjInstance* instance = newInstance(vm, vm->internalClasses[INTERNAL_CLASS_OBJECT]);
+			push(vm, OBJ_VAL(instance));
+			addObject(decoder, (Obj*)instance);
+			pop(vm);
+
+			for (size_t i = 0; i < count; i++) {
+				push(vm, decodeValue(decoder));
+				push(vm, decodeValue(decoder));
+				tableSet(vm, &instance->fields, AS_STRING(peek(vm, 1)), peek(vm, 0));
+				writeBarrier(vm, (Obj*)instance, peek(vm, 1));
+				writeBarrier(vm, (Obj*)instance, peek(vm, 0));
+				pop(vm);
+				pop(vm);
+			}
+			return OBJ_VAL(instance);
+		}
+		case MESSAGE_REFERENCE: {
+			size_t index = readSize(decoder);
+			return decoder->objects->items.items[index];
+		}
+	}
+
+	return NULL_VAL;
+}
+
+Value readMessage(VM* vm, Message* message) {
+	ValueArray objects;
+	initValueArray(&objects);
+	Decoder decoder = { vm, message->bytes, newList(vm, objects) };
+	push(vm, OBJ_VAL(decoder.objects));
+
+	Value value = decodeValue(&decoder);
+
+	pop(vm);
+	return value;
+}
+
+Value decodeMessage(VM* vm, Message* message) {
+	Value value = readMessage(vm, message);
+	freeMessage(message);
+	return value;
+}
+
+// ========= Channels =========
+
+typedef struct ChannelSlot {
+	// Equal to the slot's position when it is free to send into, and one past it once a message is there to receive
+	atomic_size_t sequence;
+	Message* message;
+} ChannelSlot;
+
+// A bounded multi-producer, multi-consumer queue, after Dmitry Vyukov's
+struct Channel {
+	ChannelSlot* slots;
+	size_t mask;
+
+	// Each on a cache line of its own, so senders and receivers do not contend over one
+	char padBefore[CACHE_LINE];
+	atomic_size_t sendPosition;
+	char padBetween[CACHE_LINE];
+	atomic_size_t receivePosition;
+	char padAfter[CACHE_LINE];
+
+	atomic_bool closed;
+
+	// Only blocked senders and receivers take the lock; the rest check waiting, and wake them if it is set
+	atomic_size_t waiting;
+	mtx_t lock;
+	cnd_t changed;
+
+	// Guarded by the registry's lock
+	char* name;
+	size_t references;
+	struct Channel* next;
+};
+
+static once_flag registryOnce = ONCE_FLAG_INIT;
+static mtx_t registryLock;
+static Channel* channels = NULL;
+
+static void initRegistry(void) {
+	mtx_init(&registryLock, mtx_plain);
+}
+
+static Channel* newChannel(const char* name, size_t length, size_t capacity) {
+	size_t size = 2;
+	while (size < capacity) size *= 2;
+
+	Channel* channel = malloc(sizeof(Channel));
+	ChannelSlot* slots = malloc(sizeof(ChannelSlot) * size);
+	char* channelName = malloc(length + 1);
+	if (channel == NULL || slots == NULL || channelName == NULL) exit(1);
+
+	for (size_t i = 0; i < size; i++) {
+		atomic_init(&slots[i].sequence, i);
+		slots[i].message = NULL;
+	}
+	memcpy(channelName, name, length);
+	channelName[length] = '\0';
+
+	channel->slots = slots;
+	channel->mask = size - 1;
+	atomic_init(&channel->sendPosition, 0);
+	atomic_init(&channel->receivePosition, 0);
+	atomic_init(&channel->closed, false);
+	atomic_init(&channel->waiting, 0);
+	mtx_init(&channel->lock, mtx_plain);
+	cnd_init(&channel->changed);
+	channel->name = channelName;
+	channel->references = 1;
+	channel->next = NULL;
+	return channel;
+}
+
+Channel* openChannel(const char* name, size_t length, size_t capacity) {
+	call_once(&registryOnce, initRegistry);
+	mtx_lock(&registryLock);
+
+	Channel* channel = channels;
+	while (channel != NULL && (strlen(channel->name) != length || memcmp(channel->name, name, length) != 0)) {
+		channel = channel->next;
+	}
+
+	if (channel != NULL) {
+		channel->references++;
+	}
+	else {
+		channel = newChannel(name, length, capacity);
+		channel->next = channels;
+		channels = channel;
+	}
+
+	mtx_unlock(&registryLock);
+	return channel;
+}
+
+static bool trySend(Channel* channel, Message* message) {
+	size_t position = atomic_load_explicit(&channel->sendPosition, memory_order_relaxed);
+	while (true) {
+		ChannelSlot* slot = &channel->slots[position & channel->mask];
+		size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+		if (difference == 0) {
+			if (atomic_compare_exchange_weak_explicit(&channel->sendPosition, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+				slot->message = message;
+				atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+				return true;
+			}
+		}
+		else if (difference < 0) {
+			// The slot still holds the message sent a lap ago
+			return false;
+		}
+		else {
+			position = atomic_load_explicit(&channel->sendPosition, memory_order_relaxed);
+		}
+	}
+}
+
+static bool tryReceive(Channel* channel, Message** message) {
+	size_t position = atomic_load_explicit(&channel->receivePosition, memory_order_relaxed);
+	while (true) {
+		ChannelSlot* slot = &channel->slots[position & channel->mask];
+		size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+		if (difference == 0) {
+			if (atomic_compare_exchange_weak_explicit(&channel->receivePosition, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+				*message = slot->message;
+				atomic_store_explicit(&slot->sequence, position + channel->mask + 1, memory_order_release);
+				return true;
+			}
+		}
+		else if (difference < 0) {
+			// Nothing has been sent into the slot yet
+			return false;
+		}
+		else {
+			position = atomic_load_explicit(&channel->receivePosition, memory_order_relaxed);
+		}
+	}
+}
+
+// Called after every send and receive. Pairs with the fence in waitForChange(): either the waiter's retry sees what
+// changed, or this sees the waiter and wakes it.
+static void wakeWaiting(Channel* channel) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&channel->waiting, memory_order_relaxed) > 0) {
+		mtx_lock(&channel->lock);
+		cnd_broadcast(&channel->changed);
+		mtx_unlock(&channel->lock);
+	}
+}
+
+typedef bool (*ChannelAttempt)(Channel* channel, void* argument);
+
+static bool attemptSend(Channel* channel, void* argument) {
+	return trySend(channel, (Message*)argument);
+}
+
+static bool attemptReceive(Channel* channel, void* argument) {
+	return tryReceive(channel, (Message**)argument);
+}
+
+// Retries the attempt until it succeeds, returning true, or the channel is closed
+static bool waitForChange(Channel* channel, ChannelAttempt attempt, void* argument) {
+	for (size_t spins = 0; spins < CHANNEL_SPINS; spins++) {
+		if (attempt(channel, argument)) return true;
+		if (atomic_load(&channel->closed)) return false;
+		thrd_yield();
+	}
+
+	mtx_lock(&channel->lock);
+	atomic_fetch_add(&channel->waiting, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	bool done;
+	while (!(done = attempt(channel, argument)) && !atomic_load(&channel->closed)) {
+		cnd_wait(&channel->changed, &channel->lock);
+	}
+
+	atomic_fetch_sub(&channel->waiting, 1);
+	mtx_unlock(&channel->lock);
+	return done;
+}
+
+ChannelStatus channelSend(Channel* channel, Message* message, bool wait) {
+	if (atomic_load(&channel->closed)) return CHANNEL_CLOSED;
+
+	bool sent = trySend(channel, message);
+	if (!sent && wait) sent = waitForChange(channel, attemptSend, message);
+
+	if (sent) {
+		wakeWaiting(channel);
+		return CHANNEL_OK;
+	}
+	return atomic_load(&channel->closed) ? CHANNEL_CLOSED : CHANNEL_WOULD_BLOCK;
+}
+
+ChannelStatus channelReceive(Channel* channel, Message** message, bool wait) {
+	bool received = tryReceive(channel, message);
+	if (!received && wait) received = waitForChange(channel, attemptReceive, message);
+	// A message may have been sent just before the channel was closed
+	if (!received && atomic_load(&channel->closed)) received = tryReceive(channel, message);
+
+	if (received) {
+		wakeWaiting(channel);
+		return CHANNEL_OK;
+	}
+	return atomic_load(&channel->closed) ? CHANNEL_CLOSED : CHANNEL_WOULD_BLOCK;
+}
+
+void closeChannel(Channel* channel) {
+	atomic_store(&channel->closed, true);
+
+	mtx_lock(&channel->lock);
+	cnd_broadcast(&channel->changed);
+	mtx_unlock(&channel->lock);
+}
+
+void releaseChannel(Channel* channel) {
+	mtx_lock(&registryLock);
+	bool last = --channel->references == 0;
+	if (last) {
+		Channel** link = &channels;
+		while (*link != channel) link = &(*link)->next;
+		*link = channel->next;
+	}
+	mtx_unlock(&registryLock);
+
+	if (!last) return;
+
+	Message* message;
+	while (tryReceive(channel, &message)) freeMessage(message);
+
+	mtx_destroy(&channel->lock);
+	cnd_destroy(&channel->changed);
+	free(channel->slots);
+	free(channel->name);
+	free(channel);
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// Channels carry values between isolates through a bounded, lock-free queue which any number of isolates may send
+// to and receive from. A value is cloned into a message outside of any heap when sent, and out of it into the
+// receiver's heap, so no object is ever reachable from two VMs; only the characters of long strings are shared.
+
+typedef struct Channel Channel;
+typedef struct Message Message;
+
+typedef enum ChannelStatus {
+	CHANNEL_OK,
+	// Full when sending, or empty when receiving, and asked not to wait
+	CHANNEL_WOULD_BLOCK,
+	CHANNEL_CLOSED
+} ChannelStatus;
+
+// Channels are found by name, so isolates running the same script meet on the same one.
+// The first to open a name creates the channel, with its capacity rounded up to a power of two; the rest share it.
+Channel* openChannel(const char* name, size_t length, size_t capacity);
+// Frees the channel, and any messages left in it, once every isolate which opened it has released it
+void releaseChannel(Channel* channel);
+// Messages already sent can still be received, but no more can be sent, and those waiting are woken
+void closeChannel(Channel* channel);
+
+// Returns NULL, with an exception thrown, if the value holds anything but null, booleans, numbers, strings,
+// lists and plain objects. Lists and objects keep their identity within a message, so cycles are cloned too.
+Message* encodeMessage(VM* vm, Value value);
+// Encodes the items as if they were a list of their own
+Message* encodeMessageItems(VM* vm, Value* items, size_t count);
+// Builds the message's value in the VM's heap, and frees the message
+Value decodeMessage(VM* vm, Message* message);
+// Builds the message's value in the VM's heap, leaving the message to be read again, by this or any other VM
+Value readMessage(VM* vm, Message* message);
+void freeMessage(Message* message);
+
+// The message is the channel's on CHANNEL_OK, and still the caller's otherwise
+ChannelStatus channelSend(Channel* channel, Message* message, bool wait);
+// A closed channel gives CHANNEL_CLOSED only once it is empty
+ChannelStatus channelReceive(Channel* channel, Message** message, bool wait);
\ No newline at end of file
@@ -8,12 +8,15 @@ void initChunk(Chunk* chunk) {
 	initByteArray(&chunk->bytecode);
 	initValueArray(&chunk->constants);
 	initLineArray(&chunk->lines);
+	chunk->shared = false;
 }
 
 void freeChunk(VM* vm, Chunk* chunk) {
-	freeByteArray(vm, &chunk->bytecode);
+	if (!chunk->shared) {
+		freeByteArray(vm, &chunk->bytecode);
+		freeLineArray(vm, &chunk->lines);
+	}
 	freeValueArray(vm, &chunk->constants);
-	freeLineArray(vm, &chunk->lines);
 }
 
 void addLineToTable(VM* vm, LineArray* table, size_t index, size_t line) {
@@ -10,6 +10,8 @@ typedef struct Chunk {
 	ByteArray bytecode;
 	ValueArray constants;
 	LineArray lines;
+	// Set when the bytecode and lines belong to a code segment, which many VMs share, rather than to the chunk
+	bool shared;
 } Chunk;
 
 void initChunk(Chunk* chunk);
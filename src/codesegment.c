@@ -0,0 +1,238 @@
+#include "codesegment.h"
+#include "bytecodecache.h"
+#include "memory.h"
+#include "object.h"
+#include "file.h"
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+typedef enum SharedConstantType {
+	SHARED_CONSTANT_NUMBER,
+	SHARED_CONSTANT_STRING,
+	SHARED_CONSTANT_FUNCTION
+} SharedConstantType;
+
+typedef struct SharedConstant {
+	SharedConstantType type;
+	union {
+		double number;
+		struct {
+			SharedChars* chars;
+			size_t length;
+			uint32_t hash;
+		} string;
+		SharedFunction* function;
+	} as;
+} SharedConstant;
+
+struct SharedFunction {
+	size_t arity;
+	size_t upvalueCount;
+	bool isAsync;
+	// NULL for a script's top level
+	SharedChars* name;
+	size_t nameLength;
+	uint32_t nameHash;
+
+	uint8_t* bytecode;
+	size_t bytecodeLength;
+	size_t* lines;
+	size_t linesLength;
+	SharedConstant* constants;
+	size_t constantCount;
+};
+
+typedef struct SegmentScript {
+	char* path;
+	// NULL if the script failed to compile
+	SharedFunction* function;
+	struct SegmentScript* next;
+} SegmentScript;
+
+struct CodeSegment {
+	// Held while a script is looked up or compiled, so that a script imported by several VMs at once compiles once
+	mtx_t lock;
+	SegmentScript* scripts;
+};
+
+CodeSegment* newCodeSegment(void) {
+	CodeSegment* segment = malloc(sizeof(CodeSegment));
+	if (segment == NULL) exit(1);
+	mtx_init(&segment->lock, mtx_plain);
+	segment->scripts = NULL;
+	return segment;
+}
+
+static SharedChars* shareChars(const char* chars, size_t length) {
+	SharedChars* shared = malloc(sizeof(SharedChars) + length + 1);
+	if (shared == NULL) exit(1);
+	atomic_init(&shared->references, 1);
+	memcpy(shared->chars, chars, length);
+	shared->chars[length] = '\0';
+	return shared;
+}
+
+static void* copyOut(const void* items, size_t size) {
+	if (size == 0) return NULL;
+	void* copy = malloc(size);
+	if (copy == NULL) exit(1);
+	memcpy(copy, items, size);
+	return copy;
+}
+
+// Copies a function compiled into the VM's heap, and every function nested in it, out into the segment
+SharedFunction* shareFunction(ObjFunction* function) {
+	SharedFunction* shared = malloc(sizeof(SharedFunction));
+	if (shared == NULL) exit(1);
+
+	shared->arity = function->arity;
+	shared->upvalueCount = function->upvalueCount;
+	shared->isAsync = function->isAsync;
+	shared->name = NULL;
+	if (function->name != NULL) {
+		shared->name = shareChars(function->name->str, function->name->length);
+		shared->nameLength = function->name->length;
+		shared->nameHash = function->name->hash;
+	}
+
+	Chunk* chunk = &function->chunk;
+	shared->bytecode = copyOut(chunk->bytecode.items, chunk->bytecode.length);
+	shared->bytecodeLength = chunk->bytecode.length;
+	shared->lines = copyOut(chunk->lines.items, chunk->lines.length * sizeof(size_t));
+	shared->linesLength = chunk->lines.length;
+
+	shared->constantCount = chunk->constants.length;
+	shared->constants = malloc(sizeof(SharedConstant) * (chunk->constants.length + 1));
+	if (shared->constants == NULL) exit(1);
+
+	for (size_t i = 0; i < chunk->constants.length; i++) {
+		Value value = chunk->constants.items[i];
+		SharedConstant* constant = &shared->constants[i];
+
+		if (IS_NUMBER(value)) {
+			constant->type = SHARED_CONSTANT_NUMBER;
+			constant->as.number = AS_NUMBER(value);
+		}
+		else if (IS_STRING(value)) {
+			ObjString* string = AS_STRING(value);
+			constant->type = SHARED_CONSTANT_STRING;
+			constant->as.string.chars = shareChars(string->str, string->length);
+			constant->as.string.length = string->length;
+			constant->as.string.hash = string->hash;
+		}
+		else {
+			ASSERT(IS_FUNCTION(value), "The compiler only makes number, string and function constants");
+			constant->type = SHARED_CONSTANT_FUNCTION;
+			constant->as.function = shareFunction(AS_FUNCTION(value));
+		}
+	}
+
+	return shared;
+}
+
+void freeSharedFunction(SharedFunction* shared) {
+	for (size_t i = 0; i < shared->constantCount; i++) {
+		SharedConstant* constant = &shared->constants[i];
+		if (constant->type == SHARED_CONSTANT_STRING) releaseSharedChars(constant->as.string.chars);
+		else if (constant->type == SHARED_CONSTANT_FUNCTION) freeSharedFunction(constant->as.function);
+	}
+	if (shared->name != NULL) releaseSharedChars(shared->name);
+
+	free(shared->constants);
+	free(shared->bytecode);
+	free(shared->lines);
+	free(shared);
+}
+
+void freeCodeSegment(CodeSegment* segment) {
+	SegmentScript* script = segment->scripts;
+	while (script != NULL) {
+		SegmentScript* next = script->next;
+		if (script->function != NULL) freeSharedFunction(script->function);
+		free(script->path);
+		free(script);
+		script = next;
+	}
+
+	mtx_destroy(&segment->lock);
+	free(segment);
+}
+
+static ObjString* adoptChars(VM* vm, SharedChars* chars, size_t length, uint32_t hash) {
+	// The segment keeps its own reference, for the next VM
+	atomic_fetch_add_explicit(&chars->references, 1, memory_order_relaxed);
+	return adoptSharedString(vm, chars, length, hash);
+}
+
+ObjFunction* instantiateSharedFunction(VM* vm, SharedFunction* shared) {
+	ObjFunction* function = newFunction(vm);
+	push(vm, OBJ_VAL(function));
+
+	function->arity = shared->arity;
+	function->upvalueCount = shared->upvalueCount;
+	function->isAsync = shared->isAsync;
+	if (shared->name != NULL) {
+		function->name = adoptChars(vm, shared->name, shared->nameLength, shared->nameHash);
+		writeBarrier(vm, (Obj*)function, OBJ_VAL(function->name));
+	}
+
+	Chunk* chunk = &function->chunk;
+	chunk->shared = true;
+	chunk->bytecode.items = shared->bytecode;
+	chunk->bytecode.length = shared->bytecodeLength;
+	chunk->bytecode.capacity = shared->bytecodeLength;
+	chunk->lines.items = shared->lines;
+	chunk->lines.length = shared->linesLength;
+	chunk->lines.capacity = shared->linesLength;
+
+	for (size_t i = 0; i < shared->constantCount; i++) {
+		SharedConstant* constant = &shared->constants[i];
+		Value value;
+
+		switch (constant->type) {
+			case SHARED_CONSTANT_NUMBER: value = NUMBER_VAL(constant->as.number); break;
+			case SHARED_CONSTANT_STRING:
+				value = OBJ_VAL(adoptChars(vm, constant->as.string.chars, constant->as.string.length, constant->as.string.hash));
+				break;
+			case SHARED_CONSTANT_FUNCTION: value = OBJ_VAL(instantiateSharedFunction(vm, constant->as.function)); break;
+			default: value = NULL_VAL; break;
+		}
+
+		push(vm, value);
+		writeValueArray(vm, &chunk->constants, value);
+		writeBarrier(vm, (Obj*)function, value);
+		pop(vm);
+	}
+
+	pop(vm);
+	return function;
+}
+
+ObjFunction* loadScript(VM* vm, CodeSegment* segment, const char* path, const char* source) {
+	mtx_lock(&segment->lock);
+
+	SegmentScript* script = segment->scripts;
+	while (script != NULL && strcmp(script->path, path) != 0) {
+		script = script->next;
+	}
+
+	if (script == NULL) {
+		char* readSource = source == NULL ? readFile(path) : NULL;
+		ObjFunction* compiled = compileScript(vm, path, source != NULL ? source : readSource);
+		free(readSource);
+
+		script = malloc(sizeof(SegmentScript));
+		if (script == NULL) exit(1);
+		script->path = copyOut(path, strlen(path) + 1);
+		script->function = compiled != NULL ? shareFunction(compiled) : NULL;
+		script->next = segment->scripts;
+		segment->scripts = script;
+	}
+
+	mtx_unlock(&segment->lock);
+
+	// Scripts are never changed once added, so can be instantiated without the lock
+	if (script->function == NULL) return NULL;
+	return instantiateSharedFunction(vm, script->function);
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// A code segment holds scripts compiled once for every VM in the process to run: bytecode, line tables and the
+// characters of constant strings live outside of any heap, are never collected, and are never changed.
+// Each VM instantiates a script into functions of its own whose chunks point into the segment, so that only the
+// constants, which must be values in the VM's own heap, are built per VM. Scripts are found by path, and imports
+// are compiled into the segment the first time any VM imports them.
+
+typedef struct CodeSegment CodeSegment;
+// A function frozen out of a VM's heap, with every function nested in it, which any VM can instantiate
+typedef struct SharedFunction SharedFunction;
+
+CodeSegment* newCodeSegment(void);
+// Every VM which used the segment must have been freed first
+void freeCodeSegment(CodeSegment* segment);
+
+// Returns the script's function, or NULL if it failed to compile, in which case the errors are only reported once.
+// The source is only needed if the script is not in the segment yet, and is read from path if it is NULL.
+ObjFunction* loadScript(VM* vm, CodeSegment* segment, const char* path, const char* source);
+
+SharedFunction* shareFunction(ObjFunction* function);
+// The function returned is not rooted
+ObjFunction* instantiateSharedFunction(VM* vm, SharedFunction* shared);
+void freeSharedFunction(SharedFunction* shared);
\ No newline at end of file
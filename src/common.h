@@ -18,6 +18,7 @@
 //#define FELINE_DEBUG_TRACE_INSTRUCTIONS
 //#define FELINE_DEBUG_STRESS_GC
 //#define FELINE_DEBUG_LOG_GC
+//#define FELINE_DEBUG_GC_PAUSES
 
 #else
 
@@ -111,6 +111,7 @@ static void initCompiler(VM* vm, Compiler* compiler, FunctionType type) {
 
 	if (type != TYPE_SCRIPT) {
 		compiler->function->name = copyString(compiler->vm, compiler->previous.start, compiler->previous.length);
+		writeBarrier(vm, (Obj*)compiler->function, OBJ_VAL(compiler->function->name));
 	}
 
 	Local* local = &compiler->locals[compiler->localCount++];
@@ -206,6 +207,7 @@ static Chunk* currentChunk(Compiler* compiler) {
 
 static uint16_t makeConstant(Compiler* compiler, Value value) {
 	size_t constant = addConstant(compiler->vm, currentChunk(compiler), value, compiler->previous.line);
+	writeBarrier(compiler->vm, (Obj*)compiler->function, value);
 
 	if (constant > UINT16_MAX) {
 		error(compiler, "Too many constants in one code chunk - max is 65,536");
@@ -672,6 +674,15 @@ static void dot(Compiler* compiler, bool canAssign) {
 	}
 }
 
+static void await_(Compiler* compiler, bool canAssign) {
+	if (!compiler->function->isAsync) {
+		error(compiler, "Can only use 'await' inside an async function");
+	}
+
+	parsePrecedence(compiler, PREC_UNARY);
+	emitByte(compiler, OP_AWAIT);
+}
+
 static void unary(Compiler* compiler, bool canAssign) {
 	FelineTokenType opType = compiler->previous.type;
 
@@ -983,13 +994,17 @@ static void tryStatement(Compiler* compiler) {
 
 	compiler->inTryBlock = false;
 
-	size_t catchJump = emitJump(compiler, OP_JUMP);
-
 	emitByte(compiler, OP_TRY_END);
 
+	size_t catchJump = emitJump(compiler, OP_JUMP);
+
 	patchJump(compiler, tryBegin);
 
-	endScope(compiler);
+	// A throw has already reset the stack to where the block began, so its locals are dropped without popping
+	compiler->scopeDepth--;
+	while (compiler->localCount > 0 && compiler->locals[compiler->localCount - 1].depth > compiler->scopeDepth) {
+		compiler->localCount--;
+	}
 	// catch(e) ...
 
 	consume(compiler, TOKEN_CATCH, "Expected catch after try statement");
@@ -1088,10 +1103,11 @@ static void synchronize(Compiler* compiler) {
 	}
 }
 
-static void function(Compiler* outerCompiler, FunctionType type) {
+static void function(Compiler* outerCompiler, FunctionType type, bool isAsync) {
 	Compiler c;
 	Compiler* compiler = &c;
 	inheritCompiler(outerCompiler->vm, outerCompiler, compiler, type);
+	compiler->function->isAsync = isAsync;
 
 	beginScope(compiler);
 
@@ -1124,7 +1140,7 @@ static void function(Compiler* outerCompiler, FunctionType type) {
 	}
 }
 
-static void method(Compiler* compiler) {
+static void method(Compiler* compiler, bool isAsync) {
 	consume(compiler, TOKEN_IDENTIFIER, "Expected method name");
 	uint16_t constant = identifierConstant(compiler, &compiler->previous);
 
@@ -1134,7 +1150,13 @@ static void method(Compiler* compiler) {
 		type = TYPE_CONSTRUCTOR;
 	}
 
-	function(compiler, type);
+	Token name = compiler->previous;
+	function(compiler, type, isAsync);
+
+	// Only reported now, as compiling the body starts with a fresh error state
+	if (type == TYPE_CONSTRUCTOR && isAsync) {
+		errorAt(compiler, &name, "A constructor cannot be async");
+	}
 
 	emitOOInstruction(compiler, OP_METHOD, constant);
 }
@@ -1205,8 +1227,11 @@ static void classDeclaration(Compiler* compiler) {
 		if (match(compiler, TOKEN_NATIVE)) {
 			nativeMethod(compiler);
 		}
+		else if (match(compiler, TOKEN_ASYNC)) {
+			method(compiler, true);
+		}
 		else {
-			method(compiler);
+			method(compiler, false);
 		}
 	}
 
@@ -1219,12 +1244,12 @@ static void classDeclaration(Compiler* compiler) {
 	compiler->currentClass = compiler->currentClass->enclosing;
 }
 
-static void functionDeclaration(Compiler* compiler) {
+static void functionDeclaration(Compiler* compiler, bool isAsync) {
 	uint16_t global = parseVariable(compiler, "Expected function name");
 
 	markInitialized(compiler);
 
-	function(compiler, TYPE_FUNCTION);
+	function(compiler, TYPE_FUNCTION, isAsync);
 
 	defineVariable(compiler, global);
 }
@@ -1311,7 +1336,11 @@ static void declaration(Compiler* compiler) {
 		classDeclaration(compiler);
 	}
 	else if (match(compiler, TOKEN_FUNCTION)) {
-		functionDeclaration(compiler);
+		functionDeclaration(compiler, false);
+	}
+	else if (match(compiler, TOKEN_ASYNC)) {
+		consume(compiler, TOKEN_FUNCTION, "Expected 'function' after 'async'");
+		functionDeclaration(compiler, true);
 	}
 	else if (match(compiler, TOKEN_IMPORT)) {
 		importDeclaration(compiler);
@@ -1364,6 +1393,8 @@ ParseRule rules[] = {
 
 	[TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
 	[TOKEN_AS] = {NULL, NULL, PREC_NONE},
+	[TOKEN_ASYNC] = {NULL, NULL, PREC_NONE},
+	[TOKEN_AWAIT] = {await_, NULL, PREC_NONE},
 	[TOKEN_CATCH] = {NULL, NULL, PREC_NONE},
 	[TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
 	[TOKEN_CONTINUE] = {NULL, NULL, PREC_NONE},
@@ -1392,7 +1423,7 @@ ParseRule rules[] = {
 	[TOKEN_EOF] = {NULL, NULL, PREC_NONE}
 };
 
-static_assert(56 == TOKEN__COUNT, "Handling of tokens in rules[] does not handle all tokens exactly once");
+static_assert(58 == TOKEN__COUNT, "Handling of tokens in rules[] does not handle all tokens exactly once");
 
 static ParseRule* getRule(FelineTokenType type) {
 	return &rules[type];
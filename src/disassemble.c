@@ -130,6 +130,7 @@ size_t disassembleInstruction(VM* vm, Chunk* chunk, size_t offset) {
 
 		BYTE(CALL)
 		SIMPLE(RETURN)
+		SIMPLE(AWAIT)
 
 		NATIVE(NATIVE)
 
@@ -182,4 +183,70 @@ void disassemble(VM* vm, Chunk* chunk, const char* name) {
 		offset = disassembleInstruction(vm, chunk, offset);
 		printf("\n");
 	}
+}
+
+const char* opcodeName(Opcode opcode) {
+#define NAME(x) case OP_##x: return #x;
+	switch (opcode) {
+		NAME(USE_CONSTANT)
+		NAME(NULL)
+		NAME(TRUE)
+		NAME(FALSE)
+		NAME(POP)
+		NAME(DEFINE_GLOBAL)
+		NAME(ACCESS_GLOBAL)
+		NAME(ASSIGN_GLOBAL)
+		NAME(ACCESS_LOCAL)
+		NAME(ASSIGN_LOCAL)
+		NAME(ACCESS_UPVALUE)
+		NAME(ASSIGN_UPVALUE)
+		NAME(CLOSE_UPVALUE)
+		NAME(JUMP)
+		NAME(JUMP_FALSE)
+		NAME(JUMP_FALSE_SC)
+		NAME(JUMP_TRUE_SC)
+		NAME(LOOP)
+		NAME(ADD)
+		NAME(SUB)
+		NAME(MUL)
+		NAME(DIV)
+		NAME(NEGATE)
+		NAME(NOT)
+		NAME(EQUAL)
+		NAME(NOT_EQUAL)
+		NAME(LESS)
+		NAME(LESS_EQUAL)
+		NAME(GREATER)
+		NAME(GREATER_EQUAL)
+		NAME(CLOSURE)
+		NAME(CALL)
+		NAME(RETURN)
+		NAME(AWAIT)
+		NAME(NATIVE)
+		NAME(CLASS)
+		NAME(INHERIT)
+		NAME(METHOD)
+		NAME(ACCESS_PROPERTY)
+		NAME(ASSIGN_PROPERTY)
+		NAME(ASSIGN_PROPERTY_KV)
+		NAME(ACCESS_SUPER)
+		NAME(INVOKE)
+		NAME(SUPER_INVOKE)
+		NAME(OBJECT)
+		NAME(CREATE_OBJECT)
+		NAME(INSTANCEOF)
+		NAME(CLASS_NATIVE)
+		NAME(LIST)
+		NAME(ACCESS_SUBSCRIPT)
+		NAME(ASSIGN_SUBSCRIPT)
+		NAME(THROW)
+		NAME(TRY_BEGIN)
+		NAME(TRY_END)
+		NAME(BOUND_EXCEPTION)
+		NAME(IMPORT)
+		NAME(EXPORT)
+		NAME(PRINT)
+		default: return "UNKNOWN";
+	}
+#undef NAME
 }
\ No newline at end of file
@@ -2,7 +2,9 @@
 #include "common.h"
 #include "vm.h"
 #include "chunk.h"
+#include "opcode.h"
 
 
 void disassemble(VM* vm, Chunk* chunk, const char* name);
-size_t disassembleInstruction(VM* vm, Chunk* chunk, size_t offset);
\ No newline at end of file
+size_t disassembleInstruction(VM* vm, Chunk* chunk, size_t offset);
+const char* opcodeName(Opcode opcode);
\ No newline at end of file
@@ -0,0 +1,659 @@
+// For accept4() and pipe2(), which must be asked for before any system header
+#define _GNU_SOURCE
+#include "eventloop.h"
+#include "memory.h"
+#include "timer.h"
+#include "scheduler.h"
+#include "builtin/fibernatives.h"
+
+#ifdef __linux__
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+
+typedef enum IoOperation {
+	IO_READ,
+	IO_WRITE,
+	IO_ACCEPT,
+	IO_WAIT
+} IoOperation;
+
+typedef enum IoStatus {
+	IO_DONE,
+	IO_AGAIN,
+	IO_FAILED
+} IoStatus;
+
+struct IoWait {
+	IoOperation operation;
+	ObjInstance* handle;
+	// Whichever of these is waiting for the operation
+	ObjFiber* fiber;
+	ObjTask* task;
+	size_t maxBytes;
+	// What is left to write is data from offset on
+	ObjString* data;
+	size_t offset;
+
+	struct IoWait* previous;
+	struct IoWait* next;
+};
+
+typedef struct ReadyFiber {
+	ObjFiber* fiber;
+	Value value;
+	// Set to throw the value in the fiber rather than return it from the operation
+	bool raise;
+} ReadyFiber;
+
+typedef struct Timer {
+	uint64_t deadline;
+	// Timers due at the same time wake in the order they were set
+	uint64_t sequence;
+	// Whichever of these is sleeping
+	ObjFiber* fiber;
+	ObjTask* task;
+} Timer;
+
+struct EventLoop {
+	int epollFd;
+	int timerFd;
+
+	// A ring of fibers to run
+	ReadyFiber* ready;
+	size_t readyCapacity;
+	size_t readyFront;
+	size_t readyCount;
+
+	// A binary heap, by deadline
+	Timer* timers;
+	size_t timerCapacity;
+	size_t timerCount;
+	uint64_t nextSequence;
+
+	IoWait* waits;
+	size_t waitCount;
+	// How many of the waits and timers are for tasks, which the loop does not run
+	size_t taskWaitCount;
+
+	// The fiber being run, which set parked if it suspended itself on an operation rather than yielding
+	ObjFiber* current;
+	bool parked;
+	bool running;
+};
+
+static void throwIOError(VM* vm, int error) {
+	throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_IO], "%s", strerror(error));
+}
+
+// The loop resumes fibers with an exception instead of throwing one itself
+static Value takeException(VM* vm) {
+	Value exception = vm->exception;
+	vm->exception = NULL_VAL;
+	vm->hasException = false;
+	return exception;
+}
+
+static EventLoop* getEventLoop(VM* vm) {
+	if (vm->eventLoop != NULL) return vm->eventLoop;
+
+	int epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd < 0) {
+		throwIOError(vm, errno);
+		return NULL;
+	}
+
+	int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerFd < 0) {
+		int error = errno;
+		close(epollFd);
+		throwIOError(vm, error);
+		return NULL;
+	}
+
+	// The timer's events carry no handle
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+
+	EventLoop* loop = malloc(sizeof(EventLoop));
+	if (loop == NULL) exit(1);
+	loop->epollFd = epollFd;
+	loop->timerFd = timerFd;
+	loop->ready = NULL;
+	loop->readyCapacity = 0;
+	loop->readyFront = 0;
+	loop->readyCount = 0;
+	loop->timers = NULL;
+	loop->timerCapacity = 0;
+	loop->timerCount = 0;
+	loop->nextSequence = 0;
+	loop->waits = NULL;
+	loop->waitCount = 0;
+	loop->taskWaitCount = 0;
+	loop->current = NULL;
+	loop->parked = false;
+	loop->running = false;
+
+	vm->eventLoop = loop;
+	return loop;
+}
+
+// Whether the operation being made can suspend the calling fiber, rather than block
+static bool canPark(VM* vm) {
+	EventLoop* loop = vm->eventLoop;
+	return loop != NULL && loop->current != NULL && vm->fiber == loop->current && canSuspendFiber(vm);
+}
+
+static void park(VM* vm) {
+	vm->eventLoop->parked = true;
+	suspendFiber(vm);
+}
+
+// Allocates nothing from the VM's heap, so a value made for the fiber stays rooted from before it is queued
+static void makeReady(EventLoop* loop, ObjFiber* fiber, Value value, bool raise) {
+	if (loop->readyCount == loop->readyCapacity) {
+		size_t oldCapacity = loop->readyCapacity;
+		ReadyFiber* ready = malloc(sizeof(ReadyFiber) * GROW_CAPACITY(oldCapacity));
+		if (ready == NULL) exit(1);
+		for (size_t i = 0; i < loop->readyCount; i++) {
+			ready[i] = loop->ready[(loop->readyFront + i) % oldCapacity];
+		}
+		free(loop->ready);
+		loop->ready = ready;
+		loop->readyCapacity = GROW_CAPACITY(oldCapacity);
+		loop->readyFront = 0;
+	}
+
+	loop->ready[(loop->readyFront + loop->readyCount) % loop->readyCapacity] = (ReadyFiber) { fiber, value, raise };
+	loop->readyCount++;
+}
+
+/*
+  Timers
+*/
+
+static bool timerBefore(Timer* a, Timer* b) {
+	if (a->deadline != b->deadline) return a->deadline < b->deadline;
+	return a->sequence < b->sequence;
+}
+
+static void armTimer(EventLoop* loop) {
+	struct itimerspec spec = { 0 };
+
+	if (loop->timerCount > 0) {
+		uint64_t now = monotonicNanoseconds();
+		uint64_t deadline = loop->timers[0].deadline;
+		// A zero value would disarm it
+		uint64_t delay = deadline > now ? deadline - now : 1;
+		spec.it_value.tv_sec = (time_t)(delay / 1000000000);
+		spec.it_value.tv_nsec = (long)(delay % 1000000000);
+	}
+
+	timerfd_settime(loop->timerFd, 0, &spec, NULL);
+}
+
+static void addTimer(EventLoop* loop, uint64_t deadline, ObjFiber* fiber, ObjTask* task) {
+	if (loop->timerCount == loop->timerCapacity) {
+		loop->timerCapacity = GROW_CAPACITY(loop->timerCapacity);
+		loop->timers = realloc(loop->timers, sizeof(Timer) * loop->timerCapacity);
+		if (loop->timers == NULL) exit(1);
+	}
+
+	size_t i = loop->timerCount++;
+	loop->timers[i] = (Timer) { deadline, loop->nextSequence++, fiber, task };
+	if (task != NULL) loop->taskWaitCount++;
+
+	while (i > 0 && timerBefore(&loop->timers[i], &loop->timers[(i - 1) / 2])) {
+		Timer parent = loop->timers[(i - 1) / 2];
+		loop->timers[(i - 1) / 2] = loop->timers[i];
+		loop->timers[i] = parent;
+		i = (i - 1) / 2;
+	}
+}
+
+static void removeFirstTimer(EventLoop* loop) {
+	loop->timers[0] = loop->timers[--loop->timerCount];
+
+	size_t i = 0;
+	while (true) {
+		size_t smallest = i;
+		size_t left = i * 2 + 1;
+		size_t right = i * 2 + 2;
+		if (left < loop->timerCount && timerBefore(&loop->timers[left], &loop->timers[smallest])) smallest = left;
+		if (right < loop->timerCount && timerBefore(&loop->timers[right], &loop->timers[smallest])) smallest = right;
+		if (smallest == i) break;
+
+		Timer swap = loop->timers[smallest];
+		loop->timers[smallest] = loop->timers[i];
+		loop->timers[i] = swap;
+		i = smallest;
+	}
+}
+
+static void expireTimers(VM* vm, EventLoop* loop) {
+	uint64_t expirations;
+	while (read(loop->timerFd, &expirations, sizeof(expirations)) > 0);
+
+	uint64_t now = monotonicNanoseconds();
+	while (loop->timerCount > 0 && loop->timers[0].deadline <= now) {
+		Timer timer = loop->timers[0];
+		removeFirstTimer(loop);
+
+		if (timer.task != NULL) {
+			loop->taskWaitCount--;
+			completeOperationTask(vm, timer.task, NULL_VAL, false);
+		}
+		else {
+			makeReady(loop, timer.fiber, NULL_VAL, false);
+		}
+	}
+
+	armTimer(loop);
+}
+
+Value sleepFor(VM* vm, double milliseconds) {
+	uint64_t delay = milliseconds > 0 ? (uint64_t)(milliseconds * 1e6) : 0;
+
+	if (vm->task != NULL) {
+		EventLoop* loop = getEventLoop(vm);
+		if (loop == NULL) return NULL_VAL;
+
+		ObjTask* task = newOperationTask(vm);
+		addTimer(loop, monotonicNanoseconds() + delay, NULL, task);
+		armTimer(loop);
+		return OBJ_VAL(task);
+	}
+
+	if (canPark(vm)) {
+		EventLoop* loop = vm->eventLoop;
+		addTimer(loop, monotonicNanoseconds() + delay, vm->fiber, NULL);
+		armTimer(loop);
+		park(vm);
+		return NULL_VAL;
+	}
+
+	struct timespec remaining = { (time_t)(delay / 1000000000), (long)(delay % 1000000000) };
+	while (nanosleep(&remaining, &remaining) != 0 && errno == EINTR);
+	return NULL_VAL;
+}
+
+/*
+  Handles
+*/
+
+static void freeHandleData(InstanceData* data) {
+	IoHandle* handle = (IoHandle*)data;
+	if (handle->fd >= 0) close(handle->fd);
+	free(handle);
+}
+
+ObjInstance* newHandle(VM* vm, int fd, IoHandleKind kind) {
+	ObjInstance* instance = newInstance(vm, vm->internalClasses[INTERNAL_CLASS_HANDLE]);
+
+	IoHandle* handle = malloc(sizeof(IoHandle));
+	if (handle == NULL) exit(1);
+	handle->data.freeData = freeHandleData;
+	handle->fd = fd;
+	handle->kind = kind;
+	handle->registered = 0;
+	handle->reader = NULL;
+	handle->writer = NULL;
+
+	// Closing a descriptor is safe from the sweeper's thread
+	instance->nativeData = (InstanceData*)handle;
+	instance->obj.finalizeOnVMThread = false;
+	return instance;
+}
+
+static IoHandle* handleData(ObjInstance* instance) {
+	return (IoHandle*)instance->nativeData;
+}
+
+static bool isReader(IoOperation operation) {
+	return operation != IO_WRITE;
+}
+
+// Registers the descriptor for what its waiting fibers need, or removes it once there are none
+static bool updateRegistration(EventLoop* loop, IoHandle* handle) {
+	uint32_t events = (handle->reader != NULL ? EPOLLIN : 0) | (handle->writer != NULL ? EPOLLOUT : 0);
+	if (events == handle->registered) return true;
+
+	struct epoll_event event = { .events = events, .data.ptr = handle };
+	int result;
+	if (handle->registered == 0) result = epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, handle->fd, &event);
+	else if (events == 0) result = epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, handle->fd, &event);
+	else result = epoll_ctl(loop->epollFd, EPOLL_CTL_MOD, handle->fd, &event);
+
+	if (result != 0) return false;
+	handle->registered = events;
+	return true;
+}
+
+static IoStatus attempt(VM* vm, IoWait* wait, Value* result) {
+	IoHandle* handle = handleData(wait->handle);
+	ssize_t count;
+
+	switch (wait->operation) {
+		case IO_READ: {
+			char* buffer = malloc(wait->maxBytes);
+			if (buffer == NULL) exit(1);
+			do count = read(handle->fd, buffer, wait->maxBytes); while (count < 0 && errno == EINTR);
+
+			if (count > 0) *result = OBJ_VAL(copyString(vm, buffer, (size_t)count));
+			else *result = NULL_VAL;
+			free(buffer);
+			break;
+		}
+		case IO_WRITE: {
+			ObjString* data = wait->data;
+			count = 0;
+			while (wait->offset < data->length) {
+				count = write(handle->fd, data->str + wait->offset, data->length - wait->offset);
+				if (count < 0 && errno == EINTR) continue;
+				if (count < 0) break;
+				wait->offset += (size_t)count;
+			}
+			*result = NULL_VAL;
+			break;
+		}
+		case IO_ACCEPT: {
+			int fd;
+			do fd = accept4(handle->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC); while (fd < 0 && errno == EINTR);
+			count = fd;
+			if (fd >= 0) *result = OBJ_VAL(newHandle(vm, fd, IO_HANDLE_STREAM));
+			break;
+		}
+		case IO_WAIT: {
+			uint64_t value;
+			do count = read(handle->fd, &value, sizeof(value)); while (count < 0 && errno == EINTR);
+			*result = NULL_VAL;
+			break;
+		}
+		default:
+			errno = EINVAL;
+			return IO_FAILED;
+	}
+
+	if (count >= 0) return IO_DONE;
+	return errno == EAGAIN || errno == EWOULDBLOCK ? IO_AGAIN : IO_FAILED;
+}
+
+static void unlinkWait(EventLoop* loop, IoWait* wait) {
+	IoHandle* handle = handleData(wait->handle);
+	if (isReader(wait->operation)) handle->reader = NULL;
+	else handle->writer = NULL;
+	if (handle->fd >= 0) updateRegistration(loop, handle);
+
+	if (wait->previous != NULL) wait->previous->next = wait->next;
+	else loop->waits = wait->next;
+	if (wait->next != NULL) wait->next->previous = wait->previous;
+	loop->waitCount--;
+	if (wait->task != NULL) loop->taskWaitCount--;
+	free(wait);
+}
+
+static Value startOperation(VM* vm, IoWait* request) {
+	IoHandle* handle = handleData(request->handle);
+	if (handle->fd < 0) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_IO], "Handle is closed");
+		return NULL_VAL;
+	}
+	if ((isReader(request->operation) ? handle->reader : handle->writer) != NULL) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_IO], "Another fiber or task is already waiting to %s the handle", isReader(request->operation) ? "read from" : "write to");
+		return NULL_VAL;
+	}
+
+	while (true) {
+		Value result = NULL_VAL;
+		IoStatus status = attempt(vm, request, &result);
+		if (status == IO_DONE) {
+			if (vm->task == NULL) return result;
+
+			// A task is given one to await whether or not it had to wait
+			push(vm, result);
+			ObjTask* task = newOperationTask(vm);
+			completeOperationTask(vm, task, pop(vm), false);
+			return OBJ_VAL(task);
+		}
+		if (status == IO_FAILED) {
+			throwIOError(vm, errno);
+			return NULL_VAL;
+		}
+
+		if (vm->task == NULL && !canPark(vm)) {
+			struct pollfd poller = { handle->fd, isReader(request->operation) ? POLLIN : POLLOUT, 0 };
+			while (poll(&poller, 1, -1) < 0 && errno == EINTR);
+			continue;
+		}
+
+		EventLoop* loop = getEventLoop(vm);
+		if (loop == NULL) return NULL_VAL;
+		ObjTask* task = vm->task != NULL ? newOperationTask(vm) : NULL;
+
+		IoWait* wait = malloc(sizeof(IoWait));
+		if (wait == NULL) exit(1);
+		*wait = *request;
+		wait->fiber = task != NULL ? NULL : vm->fiber;
+		wait->task = task;
+
+		if (isReader(wait->operation)) handle->reader = wait;
+		else handle->writer = wait;
+		if (!updateRegistration(loop, handle)) {
+			int error = errno;
+			if (isReader(wait->operation)) handle->reader = NULL;
+			else handle->writer = NULL;
+			free(wait);
+			throwIOError(vm, error);
+			return NULL_VAL;
+		}
+
+		wait->previous = NULL;
+		wait->next = loop->waits;
+		if (loop->waits != NULL) loop->waits->previous = wait;
+		loop->waits = wait;
+		loop->waitCount++;
+
+		if (task != NULL) {
+			loop->taskWaitCount++;
+			return OBJ_VAL(task);
+		}
+		park(vm);
+		return NULL_VAL;
+	}
+}
+
+Value handleRead(VM* vm, ObjInstance* handle, size_t maxBytes) {
+	IoWait request = { .operation = IO_READ, .handle = handle, .maxBytes = maxBytes };
+	return startOperation(vm, &request);
+}
+
+Value handleWrite(VM* vm, ObjInstance* handle, ObjString* data) {
+	IoWait request = { .operation = IO_WRITE, .handle = handle, .data = data, .offset = 0 };
+	return startOperation(vm, &request);
+}
+
+Value handleAccept(VM* vm, ObjInstance* handle) {
+	IoWait request = { .operation = IO_ACCEPT, .handle = handle };
+	return startOperation(vm, &request);
+}
+
+Value handleWait(VM* vm, ObjInstance* handle) {
+	IoWait request = { .operation = IO_WAIT, .handle = handle };
+	return startOperation(vm, &request);
+}
+
+static void failWait(VM* vm, EventLoop* loop, IoWait* wait) {
+	Value error = takeException(vm);
+	if (wait->task != NULL) completeOperationTask(vm, wait->task, error, true);
+	else makeReady(loop, wait->fiber, error, true);
+	unlinkWait(loop, wait);
+}
+
+void closeHandle(VM* vm, ObjInstance* instance) {
+	IoHandle* handle = handleData(instance);
+	if (handle->fd < 0) return;
+
+	EventLoop* loop = vm->eventLoop;
+	IoWait* waits[] = { handle->reader, handle->writer };
+	for (size_t i = 0; i < 2; i++) {
+		if (waits[i] == NULL) continue;
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_IO], "Handle was closed");
+		failWait(vm, loop, waits[i]);
+	}
+
+	close(handle->fd);
+	handle->fd = -1;
+	handle->registered = 0;
+}
+
+/*
+  Running
+*/
+
+static void completeWait(VM* vm, EventLoop* loop, IoWait* wait) {
+	Value result = NULL_VAL;
+	IoStatus status = attempt(vm, wait, &result);
+
+	if (status == IO_DONE) {
+		if (wait->task != NULL) completeOperationTask(vm, wait->task, result, false);
+		else makeReady(loop, wait->fiber, result, false);
+		unlinkWait(loop, wait);
+	}
+	else if (status == IO_FAILED) {
+		throwIOError(vm, errno);
+		failWait(vm, loop, wait);
+	}
+}
+
+#define EVENT_BATCH 64
+
+static void pollEvents(VM* vm, EventLoop* loop, int timeout) {
+	struct epoll_event events[EVENT_BATCH];
+	int count = epoll_wait(loop->epollFd, events, EVENT_BATCH, timeout);
+
+	for (int i = 0; i < count; i++) {
+		IoHandle* handle = events[i].data.ptr;
+		if (handle == NULL) {
+			expireTimers(vm, loop);
+			continue;
+		}
+
+		// Errors and hangups are left for the operation itself to report
+		uint32_t flags = events[i].events;
+		if (handle->reader != NULL && (flags & (EPOLLIN | EPOLLHUP | EPOLLERR))) completeWait(vm, loop, handle->reader);
+		if (handle->writer != NULL && (flags & (EPOLLOUT | EPOLLHUP | EPOLLERR))) completeWait(vm, loop, handle->writer);
+	}
+}
+
+bool spawnFiber(VM* vm, ObjFiber* fiber) {
+	EventLoop* loop = getEventLoop(vm);
+	if (loop == NULL) return false;
+	makeReady(loop, fiber, NULL_VAL, false);
+	return true;
+}
+
+void runEventLoop(VM* vm) {
+	EventLoop* loop = getEventLoop(vm);
+	if (loop == NULL) return;
+	if (loop->running) {
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_BASE], "The event loop is already running");
+		return;
+	}
+
+	loop->running = true;
+	while (!vm->hasException) {
+		// Only those ready now are run before looking for events again, so a fiber which keeps yielding cannot starve I/O
+		for (size_t batch = loop->readyCount; batch > 0 && !vm->hasException; batch--) {
+			ReadyFiber next = loop->ready[loop->readyFront];
+			loop->readyFront = (loop->readyFront + 1) % loop->readyCapacity;
+			loop->readyCount--;
+
+			// Rooted through current until resumed
+			loop->current = next.fiber;
+			loop->parked = false;
+			resumeFiberFromNative(vm, next.fiber, next.value, next.raise);
+			loop->current = NULL;
+
+			// It yielded to the loop itself, rather than waiting on anything
+			if (!vm->hasException && !loop->parked && next.fiber->state != FIBER_DONE) {
+				makeReady(loop, next.fiber, NULL_VAL, false);
+			}
+		}
+		if (vm->hasException) break;
+
+		// Operations made by tasks are left for the scheduler to wait on
+		if (loop->readyCount == 0 && loop->waitCount + loop->timerCount == loop->taskWaitCount) break;
+		pollEvents(vm, loop, loop->readyCount > 0 ? 0 : -1);
+	}
+	loop->running = false;
+}
+
+bool pollTaskEvents(VM* vm) {
+	EventLoop* loop = vm->eventLoop;
+	if (loop == NULL || loop->taskWaitCount == 0) return false;
+
+	pollEvents(vm, loop, -1);
+	return true;
+}
+
+void markEventLoop(VM* vm) {
+	EventLoop* loop = vm->eventLoop;
+	if (loop == NULL) return;
+
+	for (size_t i = 0; i < loop->readyCount; i++) {
+		ReadyFiber* ready = &loop->ready[(loop->readyFront + i) % loop->readyCapacity];
+		markObject(vm, (Obj*)ready->fiber);
+		markValue(vm, ready->value);
+	}
+	for (size_t i = 0; i < loop->timerCount; i++) {
+		markObject(vm, (Obj*)loop->timers[i].fiber);
+		markObject(vm, (Obj*)loop->timers[i].task);
+	}
+	for (IoWait* wait = loop->waits; wait != NULL; wait = wait->next) {
+		markObject(vm, (Obj*)wait->fiber);
+		markObject(vm, (Obj*)wait->task);
+		markObject(vm, (Obj*)wait->handle);
+		markObject(vm, (Obj*)wait->data);
+	}
+	markObject(vm, (Obj*)loop->current);
+}
+
+void freeEventLoop(VM* vm) {
+	EventLoop* loop = vm->eventLoop;
+	if (loop == NULL) return;
+
+	IoWait* wait = loop->waits;
+	while (wait != NULL) {
+		IoWait* next = wait->next;
+		free(wait);
+		wait = next;
+	}
+
+	close(loop->epollFd);
+	close(loop->timerFd);
+	free(loop->ready);
+	free(loop->timers);
+	free(loop);
+	vm->eventLoop = NULL;
+}
+
+#else
+
+// The io module is left empty elsewhere, so the loop is never created
+
+void markEventLoop(VM* vm) {}
+
+void freeEventLoop(VM* vm) {}
+
+bool pollTaskEvents(VM* vm) {
+	return false;
+}
+
+#endif
\ No newline at end of file
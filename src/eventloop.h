@@ -0,0 +1,56 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// An event loop built on epoll, one for each VM and created the first time it is needed, which runs fibers.
+// An operation made by a fiber the loop is running suspends just that fiber, which the loop resumes with the result
+// once it is done. Made by a task, it instead returns a task for the operation, which the loop finishes once the
+// operation is done, for the caller to await. Made from anywhere else, the operation blocks, so the same code runs
+// with or without the loop.
+// Timers share one timerfd, armed for whichever is due first; events are eventfds. Only supported on Linux.
+
+typedef enum IoHandleKind {
+	// Regular files, which are always ready, so never wait in the loop
+	IO_HANDLE_FILE,
+	// Pipes and connected sockets
+	IO_HANDLE_STREAM,
+	IO_HANDLE_LISTENER,
+	IO_HANDLE_EVENT
+} IoHandleKind;
+
+typedef struct IoWait IoWait;
+
+// The native data of a Handle
+typedef struct IoHandle {
+	InstanceData data;
+	// -1 once closed
+	int fd;
+	IoHandleKind kind;
+	// The epoll events the descriptor is registered for; it is only registered while a fiber waits on it
+	uint32_t registered;
+	IoWait* reader;
+	IoWait* writer;
+} IoHandle;
+
+// Each of these returns the result, or the operation's task when made by a task, or NULL_VAL if it threw or
+// suspended the fiber
+ObjInstance* newHandle(VM* vm, int fd, IoHandleKind kind);
+// Returns null at the end of the stream
+Value handleRead(VM* vm, ObjInstance* handle, size_t maxBytes);
+// Returns once all of data has been written
+Value handleWrite(VM* vm, ObjInstance* handle, ObjString* data);
+Value handleAccept(VM* vm, ObjInstance* handle);
+Value handleWait(VM* vm, ObjInstance* handle);
+// Fibers waiting on the handle are resumed with an IOException
+void closeHandle(VM* vm, ObjInstance* handle);
+
+Value sleepFor(VM* vm, double milliseconds);
+// Queues the fiber to be run by the loop, for the first time or again
+bool spawnFiber(VM* vm, ObjFiber* fiber);
+// Runs queued fibers until none are left, nor waiting on anything; an exception one does not catch stops the loop
+void runEventLoop(VM* vm);
+// Waits for events, finishing the tasks of whichever operations are done; returns false if no task is waiting on one
+bool pollTaskEvents(VM* vm);
+
+void markEventLoop(VM* vm);
+void freeEventLoop(VM* vm);
\ No newline at end of file
@@ -0,0 +1,857 @@
+// The interpreter loop, included by vm.c once for each version of it.
+// EXECUTE_NAME names the function, and EXECUTE_PROFILE_OPCODES, if defined, builds the copy which counts every
+// instruction, so that the normal loop has nothing to check when opcode profiling is off.
+
+static InterpreterResult EXECUTE_NAME(VM* vm, size_t baseFrameIndex) {
+	CallFrame* frame = &vm->frames.items[vm->frames.length - 1];
+	Module* currentModule = frame->closure->owner;
+	// Only the frames of what was running when the loop started count towards baseFrameIndex
+	ObjFiber* baseFiber = vm->fiber;
+
+#define READ_BYTE() (*frame->ip++)
+#define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+// Profile samples are only taken at calls, returns and loop back-edges, which keeps the check off most instructions
+#define PROFILE_SAFEPOINT() do { if (atomic_load_explicit(&vm->profileSampleDue, memory_order_relaxed)) takeProfileSample(vm); } while (0)
+#define READ_CONSTANT() (frame->closure->function->chunk.constants.items[READ_SHORT()])
+#define READ_STRING() (AS_STRING(READ_CONSTANT()))
+
+#define BINARY_OP(valueType, op) do { \
+	if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
+		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Operands must be numbers"); \
+		break; \
+	} \
+	double b = AS_NUMBER(pop(vm)); \
+	double a = AS_NUMBER(pop(vm)); \
+	push(vm, valueType(a op b)); \
+} while(0)
+
+#ifdef FELINE_DEBUG_TRACE_INSTRUCTIONS
+	printf("=== EXECUTION ===\n");
+#endif
+
+	for (;;) {
+
+		if (vm->gcPendingOutOfMemory != 0) throwOutOfMemory(vm);
+
+		if (vm->hasException) {
+
+			ObjList* stackTrace;
+			ValueArray stackTraceArray;
+			if (IS_INSTANCE(vm->exception) && instanceof(AS_INSTANCE(vm->exception), vm->internalExceptions[INTERNAL_EXCEPTION_BASE])) {
+				Value v;
+				if (tableGet(&AS_INSTANCE(vm->exception)->fields, vm->internalStrings[INTERNAL_STR_STACKTRACE], &v)) {
+					if (IS_LIST(v)) {
+						stackTrace = AS_LIST(v);
+						goto previous_stack_trace_found;
+					}
+				}
+			}
+			initValueArray(&stackTraceArray);
+
+			stackTrace = newList(vm, stackTraceArray);
+		previous_stack_trace_found:
+
+			push(vm, OBJ_VAL(stackTrace));
+			while (vm->hasException) {
+
+				ObjFunction* function = frame->closure->function;
+				size_t instruction = frame->ip - function->chunk.bytecode.items - 1;
+
+				ObjString* tracer = makeStringf(vm, "[%s%s.fn:%zu] in %s", 
+					currentModule->directory->str, currentModule->name->str,
+					getLineOfInstruction(&function->chunk, instruction), function->name != NULL ? function->name->str : "<script>");
+				push(vm, OBJ_VAL(tracer));
+				writeValueArray(vm, &stackTrace->items, peek(vm, 0));
+				writeBarrier(vm, (Obj*)stackTrace, peek(vm, 0));
+				pop(vm);
+
+				if (frame->isTryBlock) {
+					frame->ip = frame->catchLocation;
+					frame->isTryBlock = false;
+					frame->catchLocation = NULL;
+
+					if (IS_INSTANCE(vm->exception) && instanceof(AS_INSTANCE(vm->exception), vm->internalExceptions[INTERNAL_EXCEPTION_BASE])) {
+						tableSet(vm, &AS_INSTANCE(vm->exception)->fields, vm->internalStrings[INTERNAL_STR_STACKTRACE], peek(vm, 0));
+						writeBarrier(vm, AS_OBJ(vm->exception), peek(vm, 0));
+					}
+
+					pop(vm);
+					vm->hasException = false;
+					// Reset to have a stack effect of 0
+					closeUpvalues(vm, &vm->stack.items[frame->tryStackOffset]);
+					vm->stack.length = frame->tryStackOffset;
+					break;
+				}
+
+				closeUpvalues(vm, &vm->stack.items[frame->slotsOffset]);
+
+				if (vm->tracer != NULL) traceExitFunction(vm);
+				vm->frames.length--;
+
+				if (vm->frames.length == 0 && vm->fiber != baseFiber) {
+					// Uncaught in the fiber, so it finishes and the exception carries on from where it was resumed
+					finishFiber(vm);
+					push(vm, OBJ_VAL(stackTrace));
+
+					frame = &vm->frames.items[vm->frames.length - 1];
+					currentModule = frame->closure->owner;
+					continue;
+				}
+
+				if (vm->frames.length == baseFrameIndex && vm->fiber == baseFiber) {
+					pop(vm); // Stack Trace
+					pop(vm); // The script function
+
+					if (baseFrameIndex != 0) {
+						if (IS_INSTANCE(vm->exception) && instanceof(AS_INSTANCE(vm->exception), vm->internalExceptions[INTERNAL_EXCEPTION_BASE])) {
+							tableSet(vm, &AS_INSTANCE(vm->exception)->fields, vm->internalStrings[INTERNAL_STR_STACKTRACE], OBJ_VAL(stackTrace));
+							writeBarrier(vm, AS_OBJ(vm->exception), OBJ_VAL(stackTrace));
+						}
+						return INTERPRETER_RUNTIME_ERROR;
+					}
+					
+					if (IS_INSTANCE(vm->exception) && instanceof(AS_INSTANCE(vm->exception), vm->internalExceptions[INTERNAL_EXCEPTION_BASE])) {
+						ObjInstance* exception = AS_INSTANCE(vm->exception);
+						printf("%s: ", exception->clazz->name->str);
+
+						Value reason;
+						if (tableGet(&exception->fields, vm->internalStrings[INTERNAL_STR_REASON], &reason)) {
+							printValue(vm, reason);
+							printf("\n");
+						}
+						else {
+							printf("Exception thrown without reason\n");
+						}
+					}
+					else {
+						printf("Exception: ");
+						printValue(vm, vm->exception);
+						printf("\n");
+					}
+					
+					for (size_t i = 0; i < stackTrace->items.length; i++) {
+						printf("%s\n", AS_CSTRING(stackTrace->items.items[i]));
+					}
+
+					return INTERPRETER_RUNTIME_ERROR;
+				}
+
+				vm->stack.length = frame->slotsOffset;
+				// Repush after adjustment to keep on the stack
+				push(vm, OBJ_VAL(stackTrace));
+
+				frame = &vm->frames.items[vm->frames.length - 1];
+				currentModule = frame->closure->owner;
+			}
+		}
+
+#ifdef FELINE_DEBUG_TRACE_INSTRUCTIONS
+		printf(" [ ");
+		for (size_t i = 0; i < vm->stack.length; i++) {
+			Value v = vm->stack.items[i];
+			printValue(vm, v);
+			if (i != vm->stack.length - 1) printf(", ");
+		}
+		printf(" ] ");
+		printf("\n");
+
+		disassembleInstruction(vm, &frame->closure->function->chunk, frame->ip - frame->closure->function->chunk.bytecode.items);
+		printf("\n");
+#endif
+
+#ifdef EXECUTE_PROFILE_OPCODES
+		profileOpcode(vm->opcodeProfile, *frame->ip);
+#endif
+
+		switch (READ_BYTE()) {
+			case OP_USE_CONSTANT: {
+				Value constant = READ_CONSTANT();
+				push(vm, constant);
+				break;
+			}
+
+			case OP_NULL: push(vm, NULL_VAL); break;
+			case OP_TRUE: push(vm, BOOL_VAL(true)); break;
+			case OP_FALSE: push(vm, BOOL_VAL(false)); break;
+
+			case OP_POP: pop(vm); break;
+
+			case OP_DEFINE_GLOBAL: {
+				ObjString* name = READ_STRING();
+				tableSet(vm, &currentModule->globals, name, peek(vm, 0));
+				pop(vm);
+				break;
+			}
+
+			case OP_ACCESS_GLOBAL: {
+				ObjString* name = READ_STRING();
+				Value value;
+				if (!tableGet(&currentModule->globals, name, &value)) {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_UNDEFINED_VARIABLE], "Undefined variable '%s'", name->str);
+					break;
+				}
+				push(vm, value);
+				break;
+			}
+
+			case OP_ASSIGN_GLOBAL: {
+				ObjString* name = READ_STRING();
+
+				if (tableSet(vm, &currentModule->globals, name, peek(vm, 0))) {
+					tableDelete(vm, &currentModule->globals, name);
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_UNDEFINED_VARIABLE], "Undefined variable '%s'", name->str);
+					break;
+				}
+
+				break;
+			}
+
+			case OP_ACCESS_LOCAL: {
+				uint16_t slot = READ_SHORT();
+				push(vm, (vm->stack.items + frame->slotsOffset)[slot]);
+				break;
+			}
+
+			case OP_ASSIGN_LOCAL: {
+				uint16_t slot = READ_SHORT();
+				(vm->stack.items + frame->slotsOffset)[slot] = peek(vm, 0);
+				break;
+			}
+
+			case OP_ACCESS_UPVALUE: {
+				uint8_t slot = (uint8_t)READ_SHORT();
+				push(vm, *frame->closure->upvalues[slot]->location);
+				break;
+			}
+
+			case OP_ASSIGN_UPVALUE: {
+				uint8_t slot = (uint8_t)READ_SHORT();
+				ObjUpvalue* upvalue = frame->closure->upvalues[slot];
+				*upvalue->location = peek(vm, 0);
+				writeBarrier(vm, (Obj*)upvalue, peek(vm, 0));
+				break;
+			}
+
+			case OP_CLOSE_UPVALUE: {
+				closeUpvalues(vm, &vm->stack.items[vm->stack.length - 1]);
+				pop(vm);
+				break;
+			}
+
+			case OP_JUMP: {
+				uint16_t jump = READ_SHORT();
+				frame->ip += jump;
+				break;
+			}
+
+			case OP_JUMP_FALSE: {
+				uint16_t jump = READ_SHORT();
+				if (isFalsey(vm, pop(vm))) frame->ip += jump;
+				break;
+			}
+			
+			// JUMP_FALSE removes the condition, whereas JUMP_FALSE_SC leaves it on the stack
+			case OP_JUMP_FALSE_SC: {
+				uint16_t jump = READ_SHORT();
+				if (isFalsey(vm, peek(vm, 0))) frame->ip += jump;
+				break;
+			}
+
+			case OP_JUMP_TRUE_SC: {
+				uint16_t jump = READ_SHORT();
+				if (!isFalsey(vm, peek(vm, 0))) frame->ip += jump;
+				break;
+			}
+
+			case OP_LOOP: {
+				uint16_t jump = READ_SHORT();
+				frame->ip -= jump;
+				PROFILE_SAFEPOINT();
+				break;
+			}
+
+			case OP_PRINT: {
+				Value value = pop(vm);
+				printValue(vm, value);
+				printf("\n");
+				break;
+			}
+
+			case OP_NEGATE: {
+				if (!IS_NUMBER(peek(vm, 0))) {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Operand must be a number");
+					break;
+				}
+				push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
+				break;
+			}
+
+			case OP_NOT: {
+				push(vm, BOOL_VAL(isFalsey(vm, pop(vm))));
+				break;
+			}
+
+			case OP_EQUAL: {
+				Value b = pop(vm);
+				Value a = pop(vm);
+				push(vm, BOOL_VAL(valuesEqual(vm, a, b)));
+				break;
+			}
+
+			case OP_NOT_EQUAL: {
+				Value b = pop(vm);
+				Value a = pop(vm);
+				push(vm, BOOL_VAL(!valuesEqual(vm, a, b)));
+				break;
+			}
+
+			case OP_LESS: BINARY_OP(BOOL_VAL, <); break;
+			case OP_LESS_EQUAL: BINARY_OP(BOOL_VAL, <=); break;
+			case OP_GREATER: BINARY_OP(BOOL_VAL, >); break;
+			case OP_GREATER_EQUAL: BINARY_OP(BOOL_VAL, >=); break;
+
+			case OP_ADD: {
+				if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
+					push(vm, OBJ_VAL(concatenate(vm)));
+				}
+				else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 0))) {
+					double b = AS_NUMBER(pop(vm));
+					double a = AS_NUMBER(pop(vm));
+					push(vm, NUMBER_VAL(a + b));
+				}
+				else {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Operands must be strings or numbers");
+					break;
+				}
+				break;
+			}
+			case OP_SUB: BINARY_OP(NUMBER_VAL, -); break;
+			case OP_MUL: BINARY_OP(NUMBER_VAL, *); break;
+			case OP_DIV: BINARY_OP(NUMBER_VAL, /); break;
+
+			case OP_CLOSURE: {
+				ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+				ObjClosure* closure = newClosure(vm, currentModule, function);
+				push(vm, OBJ_VAL(closure));
+
+				for (size_t i = 0; i < closure->upvalueCount; i++) {
+					uint8_t isLocal = READ_BYTE();
+					uint8_t index = READ_BYTE();
+					if (isLocal) {
+						closure->upvalues[i] = captureUpvalue(vm, &vm->stack.items[frame->slotsOffset + index]);
+					}
+					else {
+						closure->upvalues[i] = frame->closure->upvalues[index];
+					}
+					// Capturing may have collected, promoting the closure
+					writeBarrier(vm, (Obj*)closure, OBJ_VAL(closure->upvalues[i]));
+				}
+
+				break;
+			}
+
+			case OP_CALL: {
+				uint8_t argCount = READ_BYTE();
+				PROFILE_SAFEPOINT();
+				if (!callValue(vm, peek(vm, argCount), argCount)) {
+					break;
+				}
+				frame = &vm->frames.items[vm->frames.length - 1];
+				currentModule = frame->closure->owner;
+				break;
+			}
+
+			case OP_RETURN: {
+				PROFILE_SAFEPOINT();
+				Value result = pop(vm);
+
+				closeUpvalues(vm, &vm->stack.items[frame->slotsOffset]);
+
+				if (vm->tracer != NULL) traceExitFunction(vm);
+				vm->frames.length--;
+
+				if (vm->frames.length == 0 && vm->fiber != baseFiber) {
+					// The fiber's entry function returned, so resume() returns its result
+					finishFiber(vm);
+					push(vm, result);
+
+					frame = &vm->frames.items[vm->frames.length - 1];
+					currentModule = frame->closure->owner;
+					break;
+				}
+
+				if (vm->frames.length == baseFrameIndex && vm->fiber == baseFiber) {
+					pop(vm); // The script function
+
+					if (baseFrameIndex != 0) {
+						push(vm, result);
+					}
+
+					return INTERPRETER_OK;
+				}
+
+				vm->stack.length = frame->slotsOffset;
+
+				push(vm, result);
+
+				frame = &vm->frames.items[vm->frames.length - 1];
+				currentModule = frame->closure->owner;
+				break;
+			}
+
+			case OP_AWAIT: {
+				// Only an async function's own frame can await, and the scheduler runs each in a loop of its own
+				ASSERT(vm->task != NULL && vm->frames.length - 1 == baseFrameIndex, "Awaited outside of a task's frame");
+				if (awaitValue(vm)) return INTERPRETER_OK;
+				break;
+			}
+
+			case OP_NATIVE: {
+				ObjString* name = READ_STRING();
+				uint8_t arity = READ_BYTE();
+				
+				NativeLibrary library = loadNativeLibrary(vm, makeStringf(vm, "%s%s." NATIVE_LIBRARY_EXT, currentModule->directory->str, currentModule->name->str));
+
+				if (library == NULL) break;
+
+				NativeFunction function = loadNativeFunction(vm, library, makeStringf(vm, "feline_%s", name->str));
+
+				if (function == NULL) break;
+
+				ObjNative* native = newNative(vm, name, function, arity);
+
+				push(vm, OBJ_VAL(native));
+				break;
+			}
+
+			case OP_CLASS: {
+				push(vm, OBJ_VAL(newClass(vm, READ_STRING())));
+				break;
+			}
+
+			case OP_INHERIT: {
+				Value superclass = peek(vm, 1);
+
+				if (!IS_CLASS(superclass)) {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Superclass must be a class");
+					break;
+				}
+
+				ObjClass* subclass = AS_CLASS(peek(vm, 0));
+
+				inheritClasses(vm, subclass, AS_CLASS(superclass));
+				pop(vm);
+
+				break;
+			}
+
+			case OP_METHOD: {
+				defineMethod(vm, READ_STRING());
+				break;
+			}
+
+			case OP_ACCESS_PROPERTY: {
+				ObjString* name = READ_STRING();
+
+				if (IS_LIST(peek(vm, 0))) {
+					Value list = pop(vm);
+					accessPropertyPrimitive(vm, list, name, &vm->listMethods);
+					break;
+				}
+
+				if (IS_FIBER(peek(vm, 0))) {
+					Value fiber = pop(vm);
+					accessPropertyPrimitive(vm, fiber, name, &vm->fiberMethods);
+					break;
+				}
+
+				if (IS_TASK(peek(vm, 0))) {
+					Value task = pop(vm);
+					accessPropertyPrimitive(vm, task, name, &vm->taskMethods);
+					break;
+				}
+
+				if (!IS_INSTANCE(peek(vm, 0))) {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Only instances have properties");
+					break;
+				}
+
+				ObjInstance* instance = AS_INSTANCE(peek(vm, 0));
+
+				Value value;
+				if (tableGet(&instance->fields, name, &value)) {
+					pop(vm); // Pop the instance
+					push(vm, value);
+					break;
+				}
+
+				if (!bindMethod(vm, instance, instance->clazz, name)) {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_PROPERTY], "Undefined property '%s'", name->str);
+					break;
+				}
+
+				break;
+			}
+
+			case OP_ASSIGN_PROPERTY: {
+				if (!IS_INSTANCE(peek(vm, 1))) {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Only instances have fields");
+					break;
+				}
+
+				ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
+				tableSet(vm, &instance->fields, READ_STRING(), peek(vm, 0));
+				writeBarrier(vm, (Obj*)instance, peek(vm, 0));
+				Value value = pop(vm);
+				pop(vm);
+				push(vm, value);
+				break;
+			}
+
+			case OP_ASSIGN_PROPERTY_KV: {
+				if (!IS_INSTANCE(peek(vm, 1))) {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Only instances have fields");
+					break;
+				}
+
+				ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
+				tableSet(vm, &instance->fields, READ_STRING(), peek(vm, 0));
+				writeBarrier(vm, (Obj*)instance, peek(vm, 0));
+				pop(vm);
+				break;
+			}
+
+			case OP_ACCESS_SUPER: {
+				ObjString* name = READ_STRING();
+				ObjClass* superclass = AS_CLASS(pop(vm));
+
+				if (!bindMethod(vm, AS_INSTANCE(vm->stack.items[frame->slotsOffset]), superclass, name)) {
+					break;
+				}
+				break;
+			}
+
+			case OP_INVOKE: {
+				ObjString* method = READ_STRING();
+				uint8_t argCount = READ_BYTE();
+				PROFILE_SAFEPOINT();
+
+				if (!invoke(vm, method, argCount)) {
+					break;
+				}
+				frame = &vm->frames.items[vm->frames.length - 1];
+				currentModule = frame->closure->owner;
+				break;
+			}
+
+			case OP_SUPER_INVOKE: {
+				ObjString* method = READ_STRING();
+				uint8_t argCount = READ_BYTE();
+				PROFILE_SAFEPOINT();
+
+				ObjClass* superclass = AS_CLASS(pop(vm));
+
+				if (!invokeFromClass(vm, AS_INSTANCE(vm->stack.items[frame->slotsOffset]), superclass, method, argCount)) {
+					break;
+				}
+				frame = &vm->frames.items[vm->frames.length - 1];
+				currentModule = frame->closure->owner;
+				break;
+			}
+
+			case OP_OBJECT: {
+				push(vm, OBJ_VAL(vm->internalClasses[INTERNAL_CLASS_OBJECT]));
+				break;
+			}
+
+			case OP_CREATE_OBJECT: {
+				// This could maybe be re-written to do the creation itself
+				// Which may result in a speed-up in tight loops
+				// The class goes where a callee would be, for the instance to replace
+				push(vm, OBJ_VAL(vm->internalClasses[INTERNAL_CLASS_OBJECT]));
+				callValue(vm, peek(vm, 0), 0);
+				frame = &vm->frames.items[vm->frames.length - 1];
+				currentModule = frame->closure->owner;
+				break;
+			}
+
+			case OP_INSTANCEOF: {
+				Value superclass = pop(vm);
+				Value instance = pop(vm);
+
+				if (!IS_INSTANCE(instance)) {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Left-hand-side of instanceof must be an instance");
+					break;
+				}
+
+				if (!IS_CLASS(superclass)) {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Right-hand-side of instanceof must be a class");
+					break;
+				}
+
+				push(vm, BOOL_VAL(instanceof(AS_INSTANCE(instance), AS_CLASS(superclass))));
+				break;
+			}
+
+			case OP_CLASS_NATIVE: {
+				ObjClass* clazz = AS_CLASS(peek(vm, 0));
+				ObjString* name = READ_STRING();
+				uint8_t arity = READ_BYTE();
+
+				NativeLibrary library = loadNativeLibrary(vm, makeStringf(vm, "%s%s." NATIVE_LIBRARY_EXT, currentModule->directory->str, currentModule->name->str));
+
+				if (library == NULL) break;
+
+				NativeFunction function = loadNativeFunction(vm, library, makeStringf(vm, "feline_%s_%s", clazz->name->str, name->str));
+
+				if (function == NULL) break;
+
+				ObjNative* native = newNative(vm, name, function, arity);
+
+				push(vm, OBJ_VAL(native));
+				break;
+			}
+
+			case OP_LIST: {
+				uint16_t length = READ_SHORT();
+
+				ValueArray items;
+				initValueArray(&items);
+
+				ObjList* list = newList(vm, items);
+
+				push(vm, OBJ_VAL(list));
+
+				for (size_t i = 0; i < length; i++) {
+					writeValueArray(vm, &list->items, peek(vm, length - i));
+					writeBarrier(vm, (Obj*)list, peek(vm, length - i));
+				}
+				pop(vm);
+
+				vm->stack.length -= length;
+
+				push(vm, OBJ_VAL(list));
+				break;
+			}
+
+			case OP_ACCESS_SUBSCRIPT: {
+				Value index = peek(vm, 0);
+				Value indexee = peek(vm, 1);
+
+				if (IS_LIST(indexee)) {
+					ObjList* list = AS_LIST(indexee);
+
+					if (!IS_NUMBER(index)) {
+						throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_INDEX_RANGE], "List index must be a number");
+						break;
+					}
+
+					size_t realIndex;
+					if (!validateIndex(vm, list->items.length, AS_NUMBER(index), &realIndex)) {
+						break;
+					}
+
+					pop(vm);
+					pop(vm);
+					push(vm, list->items.items[realIndex]);
+
+				}
+				else if (IS_INSTANCE(indexee)) {
+					ObjInstance* instance = AS_INSTANCE(indexee);
+
+					if (!IS_STRING(index)) {
+						throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_PROPERTY], "Property name must be a string in subscript");
+						break;
+					}
+
+					ObjString* propertyName = AS_STRING(index);
+
+					Value value;
+					if (tableGet(&instance->fields, propertyName, &value)) {
+						pop(vm);
+						pop(vm);
+						push(vm, value);
+						break;
+					}
+
+					pop(vm); // Pop the propertyName off
+					if (!bindMethod(vm, instance, instance->clazz, propertyName)) {
+						push(vm, NULL_VAL);
+					}
+				}
+				else {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Invalid subscript target");
+					break;
+				}
+
+				break;
+			}
+
+			case OP_ASSIGN_SUBSCRIPT: {
+				Value value = peek(vm, 0);
+				Value index = peek(vm, 1);
+				Value indexee = peek(vm, 2);
+
+				if (IS_LIST(indexee)) {
+					ObjList* list = AS_LIST(indexee);
+
+					if (!IS_NUMBER(index)) {
+						throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "List index must be a number");
+						break;
+					}
+
+					size_t realIndex;
+					if (!validateIndex(vm, list->items.length, AS_NUMBER(index), &realIndex)) {
+						break;
+					}
+
+					list->items.items[realIndex] = value;
+					writeBarrier(vm, (Obj*)list, value);
+
+					pop(vm);
+					pop(vm);
+					pop(vm);
+					push(vm, value);
+				}
+				else if (IS_INSTANCE(indexee)) {
+					ObjInstance* instance = AS_INSTANCE(indexee);
+
+					if (!IS_STRING(index)) {
+						throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_PROPERTY], "Property name must be a string in subscript");
+						break;
+					}
+
+					ObjString* propertyName = AS_STRING(index);
+
+					tableSet(vm, &instance->fields, propertyName, value);
+					writeBarrier(vm, (Obj*)instance, value);
+					pop(vm);
+					pop(vm);
+					pop(vm);
+					push(vm, value);
+				}
+				else {
+					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Invalid subscript target");
+					break;
+				}
+
+				break;
+			}
+
+			case OP_THROW: {
+				vm->exception = pop(vm);
+				vm->hasException = true;
+				break;
+			}
+
+			case OP_TRY_BEGIN: {
+				uint16_t catchJump = READ_SHORT();
+				frame->catchLocation = frame->ip + catchJump;
+				frame->isTryBlock = true;
+				frame->tryStackOffset = vm->stack.length;
+				break;
+			}
+
+			case OP_TRY_END: {
+				frame->catchLocation = NULL;
+				frame->isTryBlock = false;
+				frame->tryStackOffset = 0;
+				break;
+			}
+
+			case OP_BOUND_EXCEPTION: {
+				push(vm, vm->exception);
+				break;
+			}
+
+			case OP_IMPORT: {
+				ObjString* givenPath = READ_STRING();
+				push(vm, OBJ_VAL(givenPath));
+
+				ObjString* realPath = makeStringf(vm, "%s%s.fn", vm->baseDirectory->str, givenPath->str);
+				pop(vm);
+
+				Value cachedImport;
+				if (tableGet(&vm->imports, realPath, &cachedImport)) {
+					push(vm, cachedImport);
+					break;
+				}
+
+				if (vm->tracer != NULL) traceBegin(vm, "import", "import", realPath->str);
+
+				push(vm, OBJ_VAL(realPath));
+
+				// The code segment reads the source itself, and only for the first VM to import it
+				ObjString* source = NULL;
+				if (vm->codeSegment == NULL) {
+					//TODO: Throw an error of failure instead of crashing
+					char* rawSource = readFile(realPath->str);
+					source = takeString(vm, rawSource, strlen(rawSource));
+				}
+				push(vm, source != NULL ? OBJ_VAL(source) : NULL_VAL);
+
+				Module* mod = ALLOCATE(vm, Module, 1);
+				initModule(vm, mod);
+				splitPathToNameAndDirectory(vm, mod, realPath->str);
+				tableSet(vm, &mod->globals, vm->internalStrings[INTERNAL_STR_THIS_MODULE], OBJ_VAL(mod->name));
+
+				if (vm->tracer != NULL) traceBegin(vm, "compile", "import", realPath->str);
+				ObjFunction* function = vm->codeSegment != NULL
+					? loadScript(vm, vm->codeSegment, realPath->str, NULL)
+					: compileScript(vm, realPath->str, source->str);
+				if (vm->tracer != NULL) traceEnd(vm);
+
+				pop(vm);
+
+				if (function == NULL) {
+					if (vm->tracer != NULL) traceEnd(vm);
+					return INTERPRETER_COMPILE_ERROR;
+				}
+
+				push(vm, OBJ_VAL(function));
+				ObjClosure* closure = newClosure(vm, mod, function);
+				pop(vm);
+				push(vm, OBJ_VAL(closure));
+
+				// Set the script as the execution context
+				callClosure(vm, closure, 0);
+
+				//TODO: Handle an error from runtime
+				InterpreterResult result = executeVM(vm, vm->frames.length - 1);
+				if (vm->tracer != NULL) traceEnd(vm);
+
+				if (result == INTERPRETER_RUNTIME_ERROR) {
+					break;
+				}
+
+				ObjInstance* importObj = newInstance(vm, vm->internalClasses[INTERNAL_CLASS_IMPORT]);
+				push(vm, OBJ_VAL(importObj));
+				tableSet(vm, &vm->imports, realPath, OBJ_VAL(importObj));
+				push(vm, OBJ_VAL(importObj));
+
+				tableAddAll(vm, &mod->exports, &importObj->fields);
+				rememberObject(vm, (Obj*)importObj);
+
+				pop(vm);
+				pop(vm);
+				push(vm, OBJ_VAL(importObj));
+
+				break;
+			}
+
+			case OP_EXPORT: {
+				ObjString* name = READ_STRING();
+				tableSet(vm, &currentModule->exports, name, peek(vm, 0));
+				pop(vm);
+				break;
+			}
+		}
+
+	}
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef PROFILE_SAFEPOINT
+#undef READ_CONSTANT
+#undef READ_STRING
+}
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "exports.h"
 #include "../object.h"
+#include "../memory.h"
 
 ObjClass* export_getInternalException(VM* vm, InternalExceptionType type) {
 	return vm->internalExceptions[type];
@@ -30,6 +31,7 @@ bool export_setInstanceField(VM* vm, ObjInstance* instance, const char* name, Va
 	ObjString* field = copyString(vm, name, strlen(name));
 	push(vm, OBJ_VAL(field));
 	bool newField = tableSet(vm, &instance->fields, field, value);
+	writeBarrier(vm, (Obj*)instance, value);
 	pop(vm);
 	return newField;
 }
@@ -44,6 +46,12 @@ size_t export_getStringLength(ObjString* string) {
 
 void export_setInstanceNativeData(ObjInstance* instance, InstanceData* data) {
 	instance->nativeData = data;
+	instance->obj.finalizeOnVMThread = false;
+}
+
+void export_setInstanceNativeDataSync(ObjInstance* instance, InstanceData* data) {
+	instance->nativeData = data;
+	instance->obj.finalizeOnVMThread = true;
 }
 
 InstanceData* export_getInstanceNativeData(ObjInstance* instance) {
@@ -14,4 +14,6 @@ FELINE_EXPORT bool export_setInstanceField(VM* vm, ObjInstance* instance, const
 FELINE_EXPORT char* export_getStringCharacters(ObjString* string);
 FELINE_EXPORT size_t export_getStringLength(ObjString* string);
 FELINE_EXPORT void export_setInstanceNativeData(ObjInstance* instance, InstanceData* data);
+// As export_setInstanceNativeData(), but data->freeData is run on the VM's thread rather than the sweeper's
+FELINE_EXPORT void export_setInstanceNativeDataSync(ObjInstance* instance, InstanceData* data);
 FELINE_EXPORT InstanceData* export_getInstanceNativeData(ObjInstance* instance);
\ No newline at end of file
@@ -60,32 +60,29 @@ void inplaceReplaceSlash(char* str) {
 
 void splitPathToNameAndDirectory(VM* vm, Module* mod, const char* path) {
 #ifdef _WIN32
-	size_t pathLength = strlen(path);
-	char* dir   = reallocate(vm, NULL, 0, _MAX_DIR);
-	char* fname = reallocate(vm, NULL, 0, _MAX_FNAME);
-	char* drive = reallocate(vm, NULL, 0, _MAX_DRIVE);
+	char dir[_MAX_DIR];
+	char fname[_MAX_FNAME];
+	char drive[_MAX_DRIVE];
 
 	_splitpath(path, drive, dir, fname, NULL);
 
 	inplaceReplaceSlash(dir);
 
 	mod->directory = makeStringf(vm, "%s%s", drive, dir);
-	mod->name = takeString(vm, fname, strlen(fname));
-
-	FREE_ARRAY(vm, char, dir, strlen(dir));
-	FREE_ARRAY(vm, char, drive, strlen(drive));
+	mod->name = copyString(vm, fname, strlen(fname));
 #else
 	char* dirPathCopy = strdup(path);
 
+	// The directory is kept with a trailing slash, as _splitpath() gives it on Windows
 	char* directory = dirname(dirPathCopy);
-	vm->directory = copyString(vm, directory, strlen(directory));
+	mod->directory = makeStringf(vm, "%s/", directory);
 
 	free(dirPathCopy);
 
 	char* fnamePathCopy = strdup(path);
 	char* fname = basename(fnamePathCopy);
 	strip_ext(fname);
-	vm->name = copyString(vm, fname, strlen(fname));
+	mod->name = copyString(vm, fname, strlen(fname));
 
 	free(fnamePathCopy);
 #endif
@@ -0,0 +1,172 @@
+#include "heap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#define ALLOCATE_PAGE() _aligned_malloc(HEAP_PAGE_SIZE, HEAP_PAGE_SIZE)
+#define FREE_PAGE(page) _aligned_free(page)
+#else
+#define ALLOCATE_PAGE() aligned_alloc(HEAP_PAGE_SIZE, HEAP_PAGE_SIZE)
+#define FREE_PAGE(page) free(page)
+#endif
+
+// Cells start after the page header, rounded up to a whole granule
+#define FIRST_CELL_GRANULE ((sizeof(HeapPage) + HEAP_SIZE_CLASS_STEP - 1) / HEAP_SIZE_CLASS_STEP)
+
+void initHeap(Heap* heap) {
+	heap->pages = NULL;
+	heap->pageCount = 0;
+	heap->youngPages = NULL;
+	heap->epoch = 0;
+
+	for (size_t i = 0; i < HEAP_SIZE_CLASSES; i++) {
+		heap->classPages[i] = NULL;
+		heap->classTails[i] = NULL;
+		heap->available[i] = NULL;
+		heap->cursors[i] = NULL;
+
+		memset(heap->cellStarts[i], 0, sizeof(heap->cellStarts[i]));
+
+		size_t cellGranules = i + 1;
+		for (size_t granule = FIRST_CELL_GRANULE; granule + cellGranules <= HEAP_GRANULES; granule += cellGranules) {
+			heap->cellStarts[i][granule / 64] |= (uint64_t)1 << (granule % 64);
+		}
+	}
+}
+
+void freeHeap(Heap* heap) {
+	HeapPage* page = heap->pages;
+	while (page != NULL) {
+		HeapPage* next = page->next;
+		FREE_PAGE(page);
+		page = next;
+	}
+	initHeap(heap);
+}
+
+size_t heapSizeClass(size_t size) {
+	if (size > HEAP_MAX_CELL_SIZE) {
+		fprintf(stderr, "Object of %zu bytes is too large for the heap\n", size);
+		exit(1);
+	}
+	return (size + HEAP_SIZE_CLASS_STEP - 1) / HEAP_SIZE_CLASS_STEP - 1;
+}
+
+HeapPage* heapAddPage(Heap* heap, size_t sizeClass) {
+	HeapPage* page = (HeapPage*)ALLOCATE_PAGE();
+
+	if (page == NULL) {
+		fprintf(stderr, "Failed to allocate heap page\n");
+		exit(1);
+	}
+
+	page->sizeClass = sizeClass;
+	page->cellSize = (sizeClass + 1) * HEAP_SIZE_CLASS_STEP;
+	atomic_init(&page->sweptEpoch, heap->epoch);
+	atomic_init(&page->claimedEpoch, heap->epoch);
+	page->freeHint = 0;
+	page->isAvailable = false;
+	page->isYoung = false;
+	page->nextAvailable = NULL;
+	page->nextYoung = NULL;
+	page->nextSwept = NULL;
+	memset(page->live, 0, sizeof(page->live));
+	for (size_t i = 0; i < HEAP_BITMAP_WORDS; i++) {
+		atomic_init(&page->marks[i], 0);
+	}
+
+	page->next = heap->pages;
+	heap->pages = page;
+	heap->pageCount++;
+
+	// Appended, so that a class's cursor never passes back over pages it has already filled
+	page->nextInClass = NULL;
+	if (heap->classTails[sizeClass] != NULL) {
+		heap->classTails[sizeClass]->nextInClass = page;
+	}
+	else {
+		heap->classPages[sizeClass] = page;
+	}
+	heap->classTails[sizeClass] = page;
+
+	page->isAvailable = true;
+	page->nextAvailable = heap->available[sizeClass];
+	heap->available[sizeClass] = page;
+
+	return page;
+}
+
+void* heapAllocateFromPage(Heap* heap, HeapPage* page) {
+	uint64_t* cellStarts = heap->cellStarts[page->sizeClass];
+
+	for (size_t i = page->freeHint; i < HEAP_BITMAP_WORDS; i++) {
+		uint64_t free = ~page->live[i] & cellStarts[i];
+		if (free != 0) {
+			size_t bit = countTrailingZeros(free);
+			page->live[i] |= (uint64_t)1 << bit;
+			page->freeHint = i;
+
+			if (!page->isYoung) {
+				page->isYoung = true;
+				page->nextYoung = heap->youngPages;
+				heap->youngPages = page;
+			}
+
+			return heapCellAt(page, i * 64 + bit);
+		}
+	}
+
+	page->freeHint = HEAP_BITMAP_WORDS;
+	return NULL;
+}
+
+void heapRemoveAvailable(Heap* heap, size_t sizeClass) {
+	HeapPage* page = heap->available[sizeClass];
+	heap->available[sizeClass] = page->nextAvailable;
+	page->isAvailable = false;
+	page->nextAvailable = NULL;
+}
+
+void heapPageSwept(Heap* heap, HeapPage* page) {
+	atomic_store_explicit(&page->sweptEpoch, heap->epoch, memory_order_relaxed);
+	page->freeHint = 0;
+	heapMakeAvailable(heap, page);
+}
+
+void heapMakeAvailable(Heap* heap, HeapPage* page) {
+	if (page->isAvailable) return;
+
+	uint64_t* cellStarts = heap->cellStarts[page->sizeClass];
+	for (size_t i = 0; i < HEAP_BITMAP_WORDS; i++) {
+		if ((~page->live[i] & cellStarts[i]) != 0) {
+			page->isAvailable = true;
+			page->nextAvailable = heap->available[page->sizeClass];
+			heap->available[page->sizeClass] = page;
+			return;
+		}
+	}
+}
+
+HeapPage* heapTakeYoungPages(Heap* heap) {
+	HeapPage* pages = heap->youngPages;
+	heap->youngPages = NULL;
+	return pages;
+}
+
+void heapClearMarks(Heap* heap) {
+	for (HeapPage* page = heap->pages; page != NULL; page = page->next) {
+		for (size_t i = 0; i < HEAP_BITMAP_WORDS; i++) {
+			atomic_store_explicit(&page->marks[i], 0, memory_order_relaxed);
+		}
+	}
+}
+
+void heapNewEpoch(Heap* heap) {
+	heap->epoch++;
+
+	for (size_t i = 0; i < HEAP_SIZE_CLASSES; i++) {
+		heap->cursors[i] = heap->classPages[i];
+	}
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include "common.h"
+#include <stdatomic.h>
+
+// Objects are carved out of pages, each of which holds cells of a single size class.
+// Pages are aligned to their size, so a cell's page can be found from its address.
+#define HEAP_PAGE_SIZE (64 * 1024)
+#define HEAP_SIZE_CLASS_STEP 16
+#define HEAP_SIZE_CLASSES 16
+#define HEAP_MAX_CELL_SIZE (HEAP_SIZE_CLASS_STEP * HEAP_SIZE_CLASSES)
+
+// Bitmaps hold one bit per HEAP_SIZE_CLASS_STEP bytes of the page; a cell uses the bit of its first granule
+#define HEAP_GRANULES (HEAP_PAGE_SIZE / HEAP_SIZE_CLASS_STEP)
+#define HEAP_BITMAP_WORDS (HEAP_GRANULES / 64)
+
+typedef struct HeapPage {
+	struct HeapPage* next;
+	struct HeapPage* nextInClass;
+	struct HeapPage* nextAvailable;
+	struct HeapPage* nextYoung;
+	// Pages swept off the VM's thread, waiting to be made available
+	struct HeapPage* nextSwept;
+	size_t sizeClass;
+	size_t cellSize;
+
+	// The page may hold garbage from before the last major marking until sweptEpoch reaches Heap.epoch.
+	// Whichever thread first sets claimedEpoch to the new epoch is the one to sweep it.
+	atomic_size_t sweptEpoch;
+	atomic_size_t claimedEpoch;
+	// Bitmap word from which to look for a free cell
+	size_t freeHint;
+	bool isAvailable;
+	bool isYoung;
+
+	uint64_t live[HEAP_BITMAP_WORDS];
+	// Atomic so mark threads can race to claim a cell
+	_Atomic uint64_t marks[HEAP_BITMAP_WORDS];
+} HeapPage;
+
+typedef struct Heap {
+	HeapPage* pages;
+	size_t pageCount;
+
+	HeapPage* classPages[HEAP_SIZE_CLASSES];
+	HeapPage* classTails[HEAP_SIZE_CLASSES];
+	// Swept pages which may have free cells
+	HeapPage* available[HEAP_SIZE_CLASSES];
+	// Where each class continues looking for pages to sweep lazily
+	HeapPage* cursors[HEAP_SIZE_CLASSES];
+	// Pages allocated into since the last minor collection
+	HeapPage* youngPages;
+
+	// Bumped once major marking finishes, leaving every page to be swept again before it is allocated into
+	size_t epoch;
+
+	// Which granules start a cell, for each class
+	uint64_t cellStarts[HEAP_SIZE_CLASSES][HEAP_BITMAP_WORDS];
+} Heap;
+
+void initHeap(Heap* heap);
+void freeHeap(Heap* heap);
+
+size_t heapSizeClass(size_t size);
+HeapPage* heapAddPage(Heap* heap, size_t sizeClass);
+// Returns NULL once the page is full
+void* heapAllocateFromPage(Heap* heap, HeapPage* page);
+void heapRemoveAvailable(Heap* heap, size_t sizeClass);
+// Records that the page has just been swept, making its free cells available
+void heapPageSwept(Heap* heap, HeapPage* page);
+// For pages swept by another thread, once the VM's thread has taken them back
+void heapMakeAvailable(Heap* heap, HeapPage* page);
+HeapPage* heapTakeYoungPages(Heap* heap);
+void heapClearMarks(Heap* heap);
+void heapNewEpoch(Heap* heap);
+
+static inline bool heapNeedsSweep(Heap* heap, HeapPage* page) {
+	return atomic_load_explicit(&page->sweptEpoch, memory_order_acquire) != heap->epoch;
+}
+
+// Returns whether the caller now owns sweeping the page for this epoch
+static inline bool heapClaimSweep(HeapPage* page, size_t epoch) {
+	size_t claimed = atomic_load_explicit(&page->claimedEpoch, memory_order_relaxed);
+	return claimed != epoch && atomic_compare_exchange_strong(&page->claimedEpoch, &claimed, epoch);
+}
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline size_t countTrailingZeros(uint64_t word) {
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return index;
+}
+#else
+#define countTrailingZeros(word) ((size_t)__builtin_ctzll(word))
+#endif
+
+static inline HeapPage* heapPageOf(void* cell) {
+	return (HeapPage*)((uintptr_t)cell & ~(uintptr_t)(HEAP_PAGE_SIZE - 1));
+}
+
+static inline size_t heapGranuleOf(HeapPage* page, void* cell) {
+	return ((char*)cell - (char*)page) / HEAP_SIZE_CLASS_STEP;
+}
+
+static inline void* heapCellAt(HeapPage* page, size_t granule) {
+	return (char*)page + granule * HEAP_SIZE_CLASS_STEP;
+}
+
+static inline bool heapIsMarked(void* cell) {
+	HeapPage* page = heapPageOf(cell);
+	size_t granule = heapGranuleOf(page, cell);
+	return (atomic_load_explicit(&page->marks[granule / 64], memory_order_relaxed) >> (granule % 64)) & 1;
+}
+
+// Not safe against other threads marking the same page; see heapTryMark()
+static inline void heapSetMark(void* cell) {
+	HeapPage* page = heapPageOf(cell);
+	size_t granule = heapGranuleOf(page, cell);
+	_Atomic uint64_t* word = &page->marks[granule / 64];
+	atomic_store_explicit(word, atomic_load_explicit(word, memory_order_relaxed) | ((uint64_t)1 << (granule % 64)), memory_order_relaxed);
+}
+
+// Returns whether this call was the one to set the mark
+static inline bool heapTryMark(void* cell) {
+	HeapPage* page = heapPageOf(cell);
+	size_t granule = heapGranuleOf(page, cell);
+	uint64_t bit = (uint64_t)1 << (granule % 64);
+	return (atomic_fetch_or_explicit(&page->marks[granule / 64], bit, memory_order_relaxed) & bit) == 0;
+}
@@ -0,0 +1,61 @@
+#include "isolate.h"
+#include "memory.h"
+#include "module.h"
+#include "file.h"
+#include "tracer.h"
+#include "bytecodecache.h"
+
+void initIsolate(Isolate* isolate, const char* path, const char* source, size_t index, size_t count) {
+	isolate->index = index;
+	isolate->count = count;
+	isolate->path = path;
+	isolate->source = source;
+	isolate->configure = NULL;
+	isolate->data = NULL;
+	isolate->codeSegment = NULL;
+	isolate->result = INTERPRETER_OK;
+}
+
+InterpreterResult runIsolate(Isolate* isolate) {
+	VM vm;
+	initVM(&vm);
+	vm.isolateIndex = isolate->index;
+	vm.isolateCount = isolate->count;
+	vm.codeSegment = isolate->codeSegment;
+	if (isolate->configure != NULL) isolate->configure(&vm, isolate->data);
+
+	Module* mainModule = ALLOCATE(&vm, Module, 1);
+	initModule(&vm, mainModule);
+
+	splitPathToNameAndDirectory(&vm, mainModule, isolate->path);
+	vm.baseDirectory = mainModule->directory;
+	ObjString* mainName = copyString(&vm, "$main", 5);
+	push(&vm, OBJ_VAL(mainName));
+	tableSet(&vm, &mainModule->globals, vm.internalStrings[INTERNAL_STR_THIS_MODULE], OBJ_VAL(mainName));
+	pop(&vm);
+
+	if (vm.tracer != NULL) traceBegin(&vm, "compile", "import", NULL);
+	ObjFunction* function = vm.codeSegment != NULL
+		? loadScript(&vm, vm.codeSegment, isolate->path, isolate->source)
+		: compileScript(&vm, isolate->path, isolate->source);
+	if (vm.tracer != NULL) traceEnd(&vm);
+
+	isolate->result = interpretFunction(&vm, function);
+	freeVM(&vm);
+
+	return isolate->result;
+}
+
+static int isolateThread(void* data) {
+	runIsolate((Isolate*)data);
+	return 0;
+}
+
+bool startIsolate(Isolate* isolate) {
+	return thrd_create(&isolate->thread, isolateThread, isolate) == thrd_success;
+}
+
+InterpreterResult joinIsolate(Isolate* isolate) {
+	thrd_join(isolate->thread, NULL);
+	return isolate->result;
+}
\ No newline at end of file
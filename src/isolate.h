@@ -0,0 +1,33 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+#include "codesegment.h"
+#include <threads.h>
+
+// An isolate runs a script in a VM of its own, with its own heap, so that several can run at once on different threads.
+// Nothing is shared between isolates but the source text and, when given one, the code segment, which are only read.
+
+// Called on the isolate's thread once its VM is initialised, before any module is created
+typedef void (*IsolateConfigure)(VM* vm, void* data);
+
+typedef struct Isolate {
+	// Bound as ISOLATE_INDEX and ISOLATE_COUNT in every module, so a script can tell which share of the work is its own
+	size_t index;
+	size_t count;
+	const char* path;
+	const char* source;
+	IsolateConfigure configure;
+	void* data;
+	// When set, the script and its imports are compiled once into here for every isolate rather than by each
+	CodeSegment* codeSegment;
+
+	thrd_t thread;
+	InterpreterResult result;
+} Isolate;
+
+void initIsolate(Isolate* isolate, const char* path, const char* source, size_t index, size_t count);
+// Runs the isolate's script to completion on the calling thread
+InterpreterResult runIsolate(Isolate* isolate);
+// Returns false if the thread could not be created
+bool startIsolate(Isolate* isolate);
+InterpreterResult joinIsolate(Isolate* isolate);
\ No newline at end of file
@@ -132,7 +132,18 @@ static Token number(Lexer* lexer) {
 
 static FelineTokenType identifierType(Lexer* lexer) {
 	switch (lexer->start[0]) {
-		case 'a': return checkKeyword(lexer, 1, 1, "s", TOKEN_AS);
+		case 'a': {
+			if (lexer->current - lexer->start > 1) {
+				switch (lexer->start[1]) {
+					case 's': {
+						if (lexer->current - lexer->start == 2) return TOKEN_AS;
+						return checkKeyword(lexer, 2, 3, "ync", TOKEN_ASYNC);
+					}
+					case 'w': return checkKeyword(lexer, 2, 3, "ait", TOKEN_AWAIT);
+				}
+			}
+			break;
+		}
 		case 'b': return checkKeyword(lexer, 1, 4, "reak", TOKEN_BREAK);
 		case 'c': {
 			if (lexer->current - lexer->start > 1) {
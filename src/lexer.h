@@ -29,6 +29,8 @@ typedef enum FelineTokenType {
 
 	TOKEN_IDENTIFIER,
 	TOKEN_AS,
+	TOKEN_ASYNC,
+	TOKEN_AWAIT,
 	TOKEN_BREAK,
 	TOKEN_CATCH,
 	TOKEN_CLASS,
@@ -1,46 +1,372 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "file.h"
 #include "memory.h"
 #include "opcode.h"
 #include "vm.h"
 #include "module.h"
+#include "allocprofile.h"
+#include "profiler.h"
+#include "opcodeprofile.h"
+#include "tracer.h"
+#include "isolate.h"
+#include "taskpool.h"
 
-static void runFile(const char* path) {
-	char* source = readFile(path);
-	VM vm;
-	initVM(&vm);
+// Settings which are left at zero keep the VM's default
+typedef struct Options {
+	size_t gcInitialHeap;
+	double gcGrowthFactor;
+	bool hasGCMaxHeap;
+	size_t gcMaxHeap;
+	bool hasGCPauseTarget;
+	size_t gcPauseTarget;
+	bool hasGCMarkThreads;
+	size_t gcMarkThreads;
+	const char* gcLog;
+	bool hasAllocProfile;
+	size_t allocProfileInterval;
+	size_t allocProfileTop;
+	const char* profile;
+	size_t profileInterval;
+	bool hasOpcodeProfile;
+	bool opcodeProfileCycles;
+	const char* trace;
+	size_t traceMinDuration;
+	size_t isolates;
+	size_t workers;
+	const char* bytecodeCache;
+} Options;
 
-	Module* mainModule = ALLOCATE(&vm, Module, 1);
-	initModule(&vm, mainModule);
+static void usage() {
+	fprintf(stderr, "Usage:\nfeline [options] [path]\n\n");
+	fprintf(stderr, "Options (each may also be set through the environment variable named in brackets):\n");
+	fprintf(stderr, "  --gc-initial-heap=SIZE       heap size before the first major collection [FELINE_GC_INITIAL_HEAP]\n");
+	fprintf(stderr, "  --gc-growth-factor=FACTOR    heap growth over the live heap before the next one [FELINE_GC_GROWTH_FACTOR]\n");
+	fprintf(stderr, "  --gc-max-heap=SIZE           heap size past which OutOfMemoryException is thrown, 0 for none [FELINE_GC_MAX_HEAP]\n");
+	fprintf(stderr, "  --gc-pause-target=MICROS     longest incremental pause, 0 to collect all at once [FELINE_GC_PAUSE_TARGET]\n");
+	fprintf(stderr, "  --gc-mark-threads=COUNT      threads helping to mark the heap in parallel, at most 64 and 0 by default [FELINE_GC_MARK_THREADS]\n");
+	fprintf(stderr, "  --gc-log=PATH                append a line of JSON to PATH for every major collection [FELINE_GC_LOG]\n");
+	fprintf(stderr, "  --alloc-profile=SIZE         report allocation sites at exit, sampled every SIZE bytes or 0 for all [FELINE_ALLOC_PROFILE]\n");
+	fprintf(stderr, "  --alloc-profile-top=COUNT    sites to list in the allocation report, 20 by default [FELINE_ALLOC_PROFILE_TOP]\n");
+	fprintf(stderr, "  --profile=PATH               sample the call stack, writing folded stacks to PATH at exit [FELINE_PROFILE]\n");
+	fprintf(stderr, "  --profile-interval=MICROS    time between profile samples, 1000 by default [FELINE_PROFILE_INTERVAL]\n");
+	fprintf(stderr, "  --opcode-profile=MODE        report instruction and pair counts at exit, MODE counts or cycles to time them too [FELINE_OPCODE_PROFILE]\n");
+	fprintf(stderr, "  --trace=PATH                 write calls, imports and GC pauses to PATH as Chrome trace events [FELINE_TRACE]\n");
+	fprintf(stderr, "  --trace-min-duration=MICROS leave out trace events shorter than this, 0 by default [FELINE_TRACE_MIN_DURATION]\n");
+	fprintf(stderr, "  --isolates=COUNT             run COUNT copies of the script at once, each in a VM and thread of its own [FELINE_ISOLATES]\n");
+	fprintf(stderr, "  --workers=COUNT              threads parallel.map() runs on, one fewer than the processors by default [FELINE_WORKERS]\n");
+	fprintf(stderr, "  --bytecode-cache=WHERE       keep compiled scripts in .fnc files beside them, in a directory, or off by default [FELINE_BYTECODE_CACHE]\n");
+	fprintf(stderr, "SIZE is in bytes, and may end in K, M or G. WHERE is beside, off, or the path of a directory.\n");
+	exit(1);
+}
 
-	splitPathToNameAndDirectory(&vm, mainModule, path);
-	vm.baseDirectory = mainModule->directory;
-	ObjString* mainName = copyString(&vm, "$main", 5);
-	push(&vm, OBJ_VAL(mainName));
-	tableSet(&vm, &mainModule->globals, vm.internalStrings[INTERNAL_STR_THIS_MODULE], OBJ_VAL(mainName));
-	pop(&vm);
-	InterpreterResult result = interpret(&vm, source);
-	freeVM(&vm);
+static bool parseSize(const char* text, size_t* size) {
+	char* end;
+	double value = strtod(text, &end);
+	if (end == text || value < 0) return false;
 
-	free(source);
+	switch (*end) {
+		case 'k': case 'K': value *= 1024.0; end++; break;
+		case 'm': case 'M': value *= 1024.0 * 1024.0; end++; break;
+		case 'g': case 'G': value *= 1024.0 * 1024.0 * 1024.0; end++; break;
+		default: break;
+	}
+	if (*end == 'b' || *end == 'B') end++;
+	if (*end != '\0') return false;
 
-	if (result == INTERPRETER_COMPILE_ERROR) exit(2);
-	if (result == INTERPRETER_RUNTIME_ERROR) exit(4);
+	*size = (size_t)value;
+	return true;
 }
 
-int main(int argc, const char** argv) {
-	
-	if (argc == 1) {
-		TODO("Implement REPL when no arguments are passed");
+static bool parseNumber(const char* text, double* number) {
+	char* end;
+	*number = strtod(text, &end);
+	return end != text && *end == '\0';
+}
+
+// Only digits, as a count of isolates or threads has no fraction, sign or exponent
+static bool parseCount(const char* text, size_t* count) {
+	if (*text < '0' || *text > '9') return false;
+
+	char* end;
+	errno = 0;
+	unsigned long long value = strtoull(text, &end, 10);
+	if (*end != '\0' || errno == ERANGE || value > SIZE_MAX) return false;
+
+	*count = (size_t)value;
+	return true;
+}
+
+// Returns false if name is not a recognised option, and exits if its value is malformed
+static bool setOption(Options* options, const char* name, const char* value) {
+	double number;
+
+	if (strcmp(name, "gc-initial-heap") == 0) {
+		if (!parseSize(value, &options->gcInitialHeap) || options->gcInitialHeap == 0) goto invalid;
+	}
+	else if (strcmp(name, "gc-growth-factor") == 0) {
+		if (!parseNumber(value, &number) || number <= 1.0) goto invalid;
+		options->gcGrowthFactor = number;
+	}
+	else if (strcmp(name, "gc-max-heap") == 0) {
+		if (!parseSize(value, &options->gcMaxHeap)) goto invalid;
+		options->hasGCMaxHeap = true;
+	}
+	else if (strcmp(name, "gc-pause-target") == 0) {
+		if (!parseNumber(value, &number) || number < 0) goto invalid;
+		options->hasGCPauseTarget = true;
+		options->gcPauseTarget = (size_t)number;
+	}
+	else if (strcmp(name, "gc-mark-threads") == 0) {
+		if (!parseCount(value, &options->gcMarkThreads) || options->gcMarkThreads > 64) goto invalid;
+		options->hasGCMarkThreads = true;
+	}
+	else if (strcmp(name, "alloc-profile") == 0) {
+		if (!parseSize(value, &options->allocProfileInterval)) goto invalid;
+		options->hasAllocProfile = true;
+	}
+	else if (strcmp(name, "alloc-profile-top") == 0) {
+		if (!parseCount(value, &options->allocProfileTop) || options->allocProfileTop == 0) goto invalid;
+	}
+	else if (strcmp(name, "profile") == 0) {
+		if (*value == '\0') goto invalid;
+		options->profile = value;
+	}
+	else if (strcmp(name, "profile-interval") == 0) {
+		if (!parseNumber(value, &number) || number < 1) goto invalid;
+		options->profileInterval = (size_t)number;
+	}
+	else if (strcmp(name, "opcode-profile") == 0) {
+		if (strcmp(value, "counts") == 0) options->opcodeProfileCycles = false;
+		else if (strcmp(value, "cycles") == 0) options->opcodeProfileCycles = true;
+		else goto invalid;
+		options->hasOpcodeProfile = true;
 	}
-	else if (argc == 2) {
-		runFile(argv[1]);
+	else if (strcmp(name, "trace") == 0) {
+		if (*value == '\0') goto invalid;
+		options->trace = value;
+	}
+	else if (strcmp(name, "trace-min-duration") == 0) {
+		if (!parseNumber(value, &number) || number < 0) goto invalid;
+		options->traceMinDuration = (size_t)number;
+	}
+	else if (strcmp(name, "isolates") == 0) {
+		if (!parseCount(value, &options->isolates) || options->isolates == 0) goto invalid;
+	}
+	else if (strcmp(name, "workers") == 0) {
+		if (!parseCount(value, &options->workers) || options->workers == 0) goto invalid;
+	}
+	else if (strcmp(name, "bytecode-cache") == 0) {
+		if (*value == '\0') goto invalid;
+		options->bytecodeCache = strcmp(value, "off") != 0 ? value : NULL;
+	}
+	else if (strcmp(name, "gc-log") == 0) {
+		if (*value == '\0') goto invalid;
+		options->gcLog = value;
 	}
 	else {
-		fprintf(stderr, "Usage:\nfeline [path]\n");
+		return false;
+	}
+	return true;
+
+invalid:
+	fprintf(stderr, "Invalid value '%s' for %s\n", value, name);
+	exit(1);
+}
+
+static void readEnvironment(Options* options) {
+	static const char* variables[][2] = {
+		{ "FELINE_GC_INITIAL_HEAP", "gc-initial-heap" },
+		{ "FELINE_GC_GROWTH_FACTOR", "gc-growth-factor" },
+		{ "FELINE_GC_MAX_HEAP", "gc-max-heap" },
+		{ "FELINE_GC_PAUSE_TARGET", "gc-pause-target" },
+		{ "FELINE_GC_MARK_THREADS", "gc-mark-threads" },
+		{ "FELINE_GC_LOG", "gc-log" },
+		{ "FELINE_ALLOC_PROFILE", "alloc-profile" },
+		{ "FELINE_ALLOC_PROFILE_TOP", "alloc-profile-top" },
+		{ "FELINE_PROFILE", "profile" },
+		{ "FELINE_PROFILE_INTERVAL", "profile-interval" },
+		{ "FELINE_OPCODE_PROFILE", "opcode-profile" },
+		{ "FELINE_TRACE", "trace" },
+		{ "FELINE_TRACE_MIN_DURATION", "trace-min-duration" },
+		{ "FELINE_ISOLATES", "isolates" },
+		{ "FELINE_WORKERS", "workers" },
+		{ "FELINE_BYTECODE_CACHE", "bytecode-cache" },
+	};
+
+	for (size_t i = 0; i < sizeof(variables) / sizeof(variables[0]); i++) {
+		const char* value = getenv(variables[i][0]);
+		if (value != NULL && *value != '\0') {
+			setOption(options, variables[i][1], value);
+		}
+	}
+}
+
+static void applyOptions(VM* vm, Options* options) {
+	if (options->gcInitialHeap != 0) {
+		vm->gcInitialHeap = options->gcInitialHeap;
+		vm->nextGC = options->gcInitialHeap;
+	}
+	if (options->gcGrowthFactor != 0) vm->gcGrowthFactor = options->gcGrowthFactor;
+	if (options->hasGCMaxHeap) vm->gcMaxHeap = options->gcMaxHeap;
+	if (options->hasGCPauseTarget) vm->gcPauseTarget = options->gcPauseTarget;
+	if (options->hasGCMarkThreads) vm->gcMarkThreads = options->gcMarkThreads;
+
+	if (vm->gcMaxHeap != 0 && vm->nextGC > vm->gcMaxHeap) {
+		vm->nextGC = vm->gcMaxHeap;
+	}
+
+	if (options->gcLog != NULL) {
+		vm->gcLog = fopen(options->gcLog, "a");
+		if (vm->gcLog == NULL) {
+			fprintf(stderr, "Could not open GC log '%s'\n", options->gcLog);
+			exit(1);
+		}
+	}
+
+	if (options->hasAllocProfile) {
+		startAllocationProfile(vm, options->allocProfileInterval, options->allocProfileTop != 0 ? options->allocProfileTop : 20);
+	}
+
+	if (options->profile != NULL && !startProfiler(vm, options->profile, options->profileInterval != 0 ? options->profileInterval : 1000)) {
+		fprintf(stderr, "Could not start the profiler\n");
 		exit(1);
 	}
 
+	if (options->hasOpcodeProfile) {
+		startOpcodeProfile(vm, options->opcodeProfileCycles);
+	}
+
+	if (options->bytecodeCache != NULL) {
+		vm->bytecodeCache = true;
+		vm->bytecodeCacheDirectory = strcmp(options->bytecodeCache, "beside") != 0 ? options->bytecodeCache : NULL;
+	}
+
+	if (options->trace != NULL && !startTracer(vm, options->trace, options->traceMinDuration)) {
+		fprintf(stderr, "Could not open trace file '%s'\n", options->trace);
+		exit(1);
+	}
+}
+
+static void configureIsolate(VM* vm, void* data) {
+	applyOptions(vm, (Options*)data);
+}
+
+// Each isolate writes files of its own, named with its index before the extension: trace.json becomes trace.1.json
+static const char* isolatePath(const char* path, size_t index) {
+	if (path == NULL) return NULL;
+
+	const char* slash = strrchr(path, '/');
+	const char* backslash = strrchr(path, '\\');
+	if (backslash > slash) slash = backslash;
+	const char* dot = strrchr(path, '.');
+	size_t stem = (dot != NULL && (slash == NULL || dot > slash)) ? (size_t)(dot - path) : strlen(path);
+
+	size_t size = strlen(path) + 32;
+	char* result = malloc(size);
+	if (result == NULL) exit(1);
+	snprintf(result, size, "%.*s.%zu%s", (int)stem, path, index, path + stem);
+	return result;
+}
+
+static void runFile(const char* path, Options* options) {
+	char* source = readFile(path);
+	size_t count = options->isolates != 0 ? options->isolates : 1;
+
+	Isolate* isolates = malloc(sizeof(Isolate) * count);
+	Options* isolateOptions = malloc(sizeof(Options) * count);
+	if (isolates == NULL || isolateOptions == NULL) exit(1);
+
+	setTaskPoolSize(options->workers);
+
+	// Isolates running the same script compile it, and what it imports, once between them
+	CodeSegment* segment = count > 1 ? newCodeSegment() : NULL;
+
+	for (size_t i = 0; i < count; i++) {
+		isolateOptions[i] = *options;
+		if (count > 1) {
+			isolateOptions[i].gcLog = isolatePath(options->gcLog, i);
+			isolateOptions[i].profile = isolatePath(options->profile, i);
+			isolateOptions[i].trace = isolatePath(options->trace, i);
+		}
+
+		initIsolate(&isolates[i], path, source, i, count);
+		isolates[i].configure = configureIsolate;
+		isolates[i].data = &isolateOptions[i];
+		isolates[i].codeSegment = segment;
+	}
+
+	// The first isolate runs on this thread, which spares a thread when there is only the one
+	for (size_t i = 1; i < count; i++) {
+		if (!startIsolate(&isolates[i])) {
+			fprintf(stderr, "Could not start isolate %zu\n", i);
+			exit(1);
+		}
+	}
+	runIsolate(&isolates[0]);
+
+	bool compileError = false;
+	bool runtimeError = false;
+	for (size_t i = 0; i < count; i++) {
+		InterpreterResult result = i == 0 ? isolates[0].result : joinIsolate(&isolates[i]);
+		if (result == INTERPRETER_COMPILE_ERROR) compileError = true;
+		if (result == INTERPRETER_RUNTIME_ERROR) runtimeError = true;
+
+		if (count > 1) {
+			free((char*)isolateOptions[i].gcLog);
+			free((char*)isolateOptions[i].profile);
+			free((char*)isolateOptions[i].trace);
+		}
+	}
+
+	stopTaskPool();
+	if (segment != NULL) freeCodeSegment(segment);
+	free(isolates);
+	free(isolateOptions);
+	free(source);
+
+	if (compileError) exit(2);
+	if (runtimeError) exit(4);
+}
+
+int main(int argc, const char** argv) {
+	Options options = { 0 };
+	readEnvironment(&options);
+
+	// Flags take precedence over the environment
+	const char* path = NULL;
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+
+		if (strncmp(arg, "--", 2) != 0) {
+			if (path != NULL) usage();
+			path = arg;
+			continue;
+		}
+
+		const char* equals = strchr(arg, '=');
+		if (equals == NULL) usage();
+
+		char name[64];
+		size_t length = equals - (arg + 2);
+		if (length >= sizeof(name)) usage();
+		memcpy(name, arg + 2, length);
+		name[length] = '\0';
+
+		if (!setOption(&options, name, equals + 1)) {
+			fprintf(stderr, "Unknown option '%s'\n", arg);
+			usage();
+		}
+	}
+
+	if (path == NULL) {
+		TODO("Implement REPL when no arguments are passed");
+		return 0;
+	}
+
+	runFile(path, &options);
+
 	return 0;
 }
\ No newline at end of file
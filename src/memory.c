@@ -1,33 +1,89 @@
 #include "memory.h"
 #include "object.h"
 #include "compiler.h"
+#include "timer.h"
+#include "parallelmark.h"
+#include "sweeper.h"
+#include "snapshot.h"
+#include "tracer.h"
+#include "eventloop.h"
 #include "ffi/ffi.h"
 #include <stdlib.h>
 #include <stdio.h>
 
-#define GC_HEAP_GROW_FACTOR 2
+#define GC_NURSERY_SIZE (256 * 1024)
+// Bytes allocated between incremental slices, and the fewest objects each slice traces or sweeps
+#define GC_STEP_SIZE (64 * 1024)
+#ifdef FELINE_DEBUG_STRESS_GC
+#define GC_STEP_WORK 16
+#else
+#define GC_STEP_WORK 8192
+#endif
+// Slices grow up to this much work while allocation keeps outrunning them
+#define GC_STEP_WORK_MAX (GC_STEP_WORK * 64)
+// How often, in objects, a slice checks whether it has run past the pause target
+#define GC_STEP_CLOCK_INTERVAL 256
+// Work charged for checking a page's bitmaps while sweeping, on top of each object freed
+#define GC_SWEEP_PAGE_WORK 16
+// Gray objects needed before waking the mark threads is worthwhile
+#ifdef FELINE_DEBUG_STRESS_GC
+#define GC_PARALLEL_MARK_MIN 1
+#else
+#define GC_PARALLEL_MARK_MIN 256
+#endif
+// Bytes allowed past gcMaxHeap for throwing OutOfMemoryException and running the code which catches it
+#define GC_OUT_OF_MEMORY_RESERVE (64 * 1024)
 
 static void freeObject(VM* vm, Obj* object);
+static size_t objectSize(Obj* object);
+static size_t sweepPage(VM* vm, HeapPage* page);
+static void releaseBytes(VM* vm, size_t size);
+static void startCycle(VM* vm);
+static void stepCycle(VM* vm);
+static void collectOnAllocation(VM* vm);
+static void heapLimitExceeded(VM* vm);
 
-void* reallocate(VM* vm, void* pointer, size_t oldCapacity, size_t newCapacity) {
-	vm->bytesAllocated += newCapacity - oldCapacity;
-
-	if (newCapacity > oldCapacity) {
+static void collectBeforeAllocation(VM* vm) {
 #ifdef FELINE_DEBUG_STRESS_GC
-		collectGarbage(vm);
+	// Every allocation either starts a major cycle or advances the one in progress
+	if (vm->gcPhase == GC_PHASE_IDLE) {
+		startCycle(vm);
+	}
+	else {
+		collectYoungGarbage(vm);
+		stepCycle(vm);
+	}
+#else
+	collectOnAllocation(vm);
 #endif
-		if (vm->bytesAllocated > vm->nextGC) {
-			collectGarbage(vm);
-		}
+
+	if (vm->gcMaxHeap != 0 && vm->bytesAllocated > vm->gcMaxHeap && vm->bytesAllocated > vm->gcReserveEnd) {
+		heapLimitExceeded(vm);
 	}
+}
 
+void* reallocate(VM* vm, void* pointer, size_t oldCapacity, size_t newCapacity) {
 	if (newCapacity == 0) {
+		releaseBytes(vm, oldCapacity);
 		free(pointer);
 		return NULL;
 	}
 
+	vm->bytesAllocated += newCapacity - oldCapacity;
+
+	if (newCapacity > oldCapacity) {
+		vm->gcCounters.totalAllocated += newCapacity - oldCapacity;
+		collectBeforeAllocation(vm);
+	}
+
 	void* result = realloc(pointer, newCapacity);
 
+	if (result == NULL && newCapacity > oldCapacity) {
+		// Whatever a full collection frees may be enough for the allocator to find room
+		collectGarbage(vm);
+		result = realloc(pointer, newCapacity);
+	}
+
 	if (result == NULL) {
 		fprintf(stderr, "Failed to allocate %zu bytes (from %zu bytes)\n", newCapacity, oldCapacity);
 		exit(1);
@@ -36,9 +92,87 @@ void* reallocate(VM* vm, void* pointer, size_t oldCapacity, size_t newCapacity)
 	return result;
 }
 
+void chargeBytes(VM* vm, size_t size) {
+	vm->bytesAllocated += size;
+	vm->gcCounters.totalAllocated += size;
+	collectBeforeAllocation(vm);
+}
+
+static void pushGray(VM* vm, Obj* object) {
+	if (vm->grayCapacity < vm->grayCount + 1) {
+		vm->grayCapacity = GROW_CAPACITY(vm->grayCapacity);
+		vm->grayStack = (Obj**)realloc(vm->grayStack, sizeof(Obj*) * vm->grayCapacity);
+
+		if (vm->grayStack == NULL) exit(1);
+	}
+
+	vm->grayStack[vm->grayCount++] = object;
+}
+
+void* allocateCell(VM* vm, size_t size) {
+	vm->bytesAllocated += size;
+	vm->gcCounters.totalAllocated += size;
+	collectBeforeAllocation(vm);
+
+	Heap* heap = &vm->heap;
+	size_t sizeClass = heapSizeClass(size);
+
+	while (true) {
+		HeapPage* page = heap->available[sizeClass];
+
+		if (page == NULL) {
+			if (collectBackgroundSweep(vm)) continue;
+
+			// Pages left unswept since marking finished may have room
+			page = heap->cursors[sizeClass];
+			if (page == NULL) {
+				heapAddPage(heap, sizeClass);
+				continue;
+			}
+
+			heap->cursors[sizeClass] = page->nextInClass;
+			// Marks do not tell what is garbage until marking has finished
+			if (heapNeedsSweep(heap, page) && vm->gcPhase != GC_PHASE_MARK && heapClaimSweep(page, heap->epoch)) {
+				sweepPage(vm, page);
+			}
+			continue;
+		}
+
+		if (heapNeedsSweep(heap, page)) {
+			// A page the sweeper thread has claimed comes back once it is done with it
+			if (vm->gcPhase == GC_PHASE_MARK || !heapClaimSweep(page, heap->epoch)) {
+				heapRemoveAvailable(heap, sizeClass);
+				continue;
+			}
+			sweepPage(vm, page);
+		}
+
+		void* cell = heapAllocateFromPage(heap, page);
+		if (cell == NULL) {
+			heapRemoveAvailable(heap, sizeClass);
+			continue;
+		}
+
+		// Objects allocated while marking are black, so the cycle in progress never frees them
+		if (vm->gcPhase == GC_PHASE_MARK) {
+			heapSetMark(cell);
+		}
+
+		return cell;
+	}
+}
+
 void markObject(VM* vm, Obj* object) {
 	if (object == NULL) return;
-	if (object->isMarked) return;
+	if (vm->heapSnapshot != NULL) {
+		snapshotReference(vm->heapSnapshot, object);
+	}
+	if (isMarked(object)) return;
+
+	if (vm->markingInParallel) {
+		markObjectParallel(vm, object);
+		return;
+	}
 
 #ifdef FELINE_DEBUG_LOG_GC
 	printf("%p mark ", (void*)object);
@@ -46,31 +180,71 @@ void markObject(VM* vm, Obj* object) {
 	printf("\n");
 #endif
 
-	object->isMarked = true;
+	heapSetMark(object);
+	pushGray(vm, object);
+}
 
-	if (vm->grayCapacity < vm->grayCount + 1) {
-		vm->grayCapacity = GROW_CAPACITY(vm->grayCapacity);
-		vm->grayStack = (Obj**)realloc(vm->grayStack, sizeof(Obj*) * vm->grayCapacity);
+void markValue(VM* vm, Value value) {
+	if (IS_OBJ(value)) markObject(vm, AS_OBJ(value));
+}
 
-		if (vm->grayStack == NULL) exit(1);
+void rememberObject(VM* vm, Obj* object) {
+	// Only old objects can hold references the next minor collection would not trace
+	if (!isMarked(object) || object->isRemembered) return;
+
+	object->isRemembered = true;
+
+	if (vm->gcPhase == GC_PHASE_MARK) {
+		// The object may already be black, so it is traced again; isRemembered is cleared once it is
+		pushGray(vm, object);
+		return;
 	}
 
-	vm->grayStack[vm->grayCount++] = object;
+	if (vm->rememberedCapacity < vm->rememberedCount + 1) {
+		vm->rememberedCapacity = GROW_CAPACITY(vm->rememberedCapacity);
+		vm->rememberedSet = (Obj**)realloc(vm->rememberedSet, sizeof(Obj*) * vm->rememberedCapacity);
+
+		if (vm->rememberedSet == NULL) exit(1);
+	}
+
+	vm->rememberedSet[vm->rememberedCount++] = object;
 }
 
-void markValue(VM* vm, Value value) {
-	if (IS_OBJ(value)) markObject(vm, AS_OBJ(value));
+void writeBarrierSlow(VM* vm, Obj* container, Obj* value) {
+	if (vm->gcPhase == GC_PHASE_MARK) {
+		markObject(vm, value);
+	}
+	else {
+		rememberObject(vm, container);
+	}
+}
+
+static void forgetRememberedSet(VM* vm) {
+	for (size_t i = 0; i < vm->rememberedCount; i++) {
+		vm->rememberedSet[i]->isRemembered = false;
+	}
+	vm->rememberedCount = 0;
+}
+
+// Attributes the roots marked after it to label, while tracing for a heap snapshot
+static inline void rootLabel(VM* vm, const char* label, ObjString* module) {
+	if (vm->heapSnapshot != NULL) {
+		snapshotRoots(vm->heapSnapshot, label, module);
+	}
 }
 
 static void markRoots(VM* vm) {
+	rootLabel(vm, "stack", NULL);
 	for (Value* slot = vm->stack.items; slot < &vm->stack.items[vm->stack.length]; slot++) {
 		markValue(vm, *slot);
 	}
 
+	rootLabel(vm, "frames", NULL);
 	for (size_t i = 0; i < vm->frames.length; i++) {
 		markObject(vm, (Obj*)vm->frames.items[i].closure);
 	}
 
+	rootLabel(vm, "openUpvalues", NULL);
 	for (ObjUpvalue* upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
 		markObject(vm, (Obj*)upvalue);
 	}
@@ -79,32 +253,63 @@ static void markRoots(VM* vm) {
 	Module* mod = vm->modules;
 
 	while (mod != NULL) {
+		rootLabel(vm, "globals", mod->name);
 		markTable(vm, &mod->globals);
+		rootLabel(vm, "exports", mod->name);
 		markTable(vm, &mod->exports);
+		rootLabel(vm, "module", mod->name);
 		markObject(vm, (Obj*)mod->name);
 		markObject(vm, (Obj*)mod->directory);
 		mod = mod->next;
 	}
 
+	rootLabel(vm, "nativeLibraries", NULL);
 	markTable(vm, &vm->nativeLibraries);
+	rootLabel(vm, "imports", NULL);
 	markTable(vm, &vm->imports);
+	rootLabel(vm, "listMethods", NULL);
 	markTable(vm, &vm->listMethods);
-	markObject(vm, (Obj*)&vm->baseDirectory);
+	rootLabel(vm, "fiberMethods", NULL);
+	markTable(vm, &vm->fiberMethods);
+	rootLabel(vm, "taskMethods", NULL);
+	markTable(vm, &vm->taskMethods);
+	rootLabel(vm, "fibers", NULL);
+	markObject(vm, (Obj*)vm->fiber);
+	markObject(vm, (Obj*)vm->fiberSwitch);
+	markObject(vm, (Obj*)vm->resumeFunction);
+	markObject(vm, (Obj*)vm->resumeTrampoline);
+	markEventLoop(vm);
+	rootLabel(vm, "tasks", NULL);
+	markObject(vm, (Obj*)vm->task);
+	markObject(vm, (Obj*)vm->readyTasks);
+	markObject(vm, (Obj*)vm->lastReadyTask);
+	rootLabel(vm, "baseDirectory", NULL);
+	markObject(vm, (Obj*)vm->baseDirectory);
 
+	rootLabel(vm, "compiler", NULL);
 	markCompilerRoots(vm);
 	
+	rootLabel(vm, "internalStrings", NULL);
 	for (size_t i = 0; i < INTERNAL_STR__COUNT; i++) {
 		markObject(vm, (Obj*)vm->internalStrings[i]);
 	}
 
+	rootLabel(vm, "internalExceptions", NULL);
 	for (size_t i = 0; i < INTERNAL_EXCEPTION__COUNT; i++) {
 		markObject(vm, (Obj*)vm->internalExceptions[i]);
 	}
 
+	rootLabel(vm, "internalClasses", NULL);
 	for (size_t i = 0; i < INTERNAL_CLASS__COUNT; i++) {
 		markObject(vm, (Obj*)vm->internalClasses[i]);
 	}
 
+	rootLabel(vm, "builtinModules", NULL);
+	for (size_t i = 0; i < BUILTIN_MODULE__COUNT; i++) {
+		markObject(vm, (Obj*)vm->builtinModules[i]);
+	}
+
+	rootLabel(vm, "exception", NULL);
 	markValue(vm, vm->exception);
 }
 
@@ -114,7 +319,7 @@ static void markArray(VM* vm, ValueArray* array) {
 	}
 }
 
-static void blackenObject(VM* vm, Obj* object) {
+void blackenObject(VM* vm, Obj* object) {
 #ifdef FELINE_DEBUG_LOG_GC
 	printf("%p blacken ", (void*)object);
 	printValue(vm, OBJ_VAL(object));
@@ -138,6 +343,8 @@ static void blackenObject(VM* vm, Obj* object) {
 		}
 		case OBJ_UPVALUE: {
 			markValue(vm, ((ObjUpvalue*)object)->closed);
+			markObject(vm, (Obj*)((ObjUpvalue*)object)->fiber);
+			markObject(vm, (Obj*)((ObjUpvalue*)object)->task);
 			break;
 		}
 		case OBJ_CLASS: {
@@ -164,7 +371,38 @@ static void blackenObject(VM* vm, Obj* object) {
 			markArray(vm, &list->items);
 			break;
 		}
-		case OBJ_NATIVE:
+		case OBJ_NATIVE: {
+			markObject(vm, (Obj*)((ObjNative*)object)->name);
+			break;
+		}
+		case OBJ_FIBER: {
+			ObjFiber* fiber = (ObjFiber*)object;
+			markObject(vm, (Obj*)fiber->entry);
+			markObject(vm, (Obj*)fiber->caller);
+			markArray(vm, &fiber->stack);
+			for (size_t i = 0; i < fiber->frames.length; i++) {
+				markObject(vm, (Obj*)fiber->frames.items[i].closure);
+			}
+			for (ObjUpvalue* upvalue = fiber->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+				markObject(vm, (Obj*)upvalue);
+			}
+			break;
+		}
+		case OBJ_TASK: {
+			ObjTask* task = (ObjTask*)object;
+			markObject(vm, (Obj*)task->frame.closure);
+			for (size_t i = 0; i < task->slotCount; i++) {
+				markValue(vm, task->slots[i]);
+			}
+			for (ObjUpvalue* upvalue = task->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+				markObject(vm, (Obj*)upvalue);
+			}
+			markValue(vm, task->result);
+			markObject(vm, (Obj*)task->awaiting);
+			markObject(vm, (Obj*)task->waiters);
+			markObject(vm, (Obj*)task->next);
+			break;
+		}
 		case OBJ_NATIVE_LIBRARY:
 		case OBJ_STRING: {
 			break;
@@ -172,132 +410,658 @@ static void blackenObject(VM* vm, Obj* object) {
 	}
 }
 
-static void traceReferences(VM* vm) {
-	while (vm->grayCount > 0) {
+// Returns the number of objects blackened
+static size_t traceGray(VM* vm, size_t budget) {
+	size_t work = 0;
+	while (vm->grayCount > 0 && work < budget) {
 		Obj* object = vm->grayStack[--vm->grayCount];
+		object->isRemembered = false;
 		blackenObject(vm, object);
+		work++;
 	}
+	return work;
 }
 
-static void sweep(VM* vm) {
-	Obj* previous = NULL;
-	Obj* object = vm->objects;
-	while (object != NULL) {
-		if (object->isMarked) {
-			object->isMarked = false;
-			previous = object;
-			object = object->next;
+static void traceReferences(VM* vm) {
+	if (vm->gcMarkThreads > 0 && vm->grayCount >= GC_PARALLEL_MARK_MIN) {
+		parallelTraceReferences(vm);
+	}
+	else {
+		traceGray(vm, SIZE_MAX);
+	}
+}
+
+// Marks are sticky: a surviving object stays marked, which is what makes it old.
+// Old objects are therefore skipped by markObject() during minor collections.
+// Frees every cell left unmarked since the page was last swept, returning how many there were.
+static size_t sweepDeadCells(VM* vm, HeapPage* page) {
+	size_t freed = 0;
+
+	for (size_t i = 0; i < HEAP_BITMAP_WORDS; i++) {
+		uint64_t dead = page->live[i] & ~atomic_load_explicit(&page->marks[i], memory_order_relaxed);
+		page->live[i] &= ~dead;
+
+		while (dead != 0) {
+			size_t bit = countTrailingZeros(dead);
+			dead &= dead - 1;
+			freeObject(vm, (Obj*)heapCellAt(page, i * 64 + bit));
+			freed++;
 		}
-		else {
-			Obj* unreached = object;
-			object = object->next;
+	}
 
-			if (previous != NULL) {
-				previous->next = object;
-			}
-			else {
-				vm->objects = object;
-			}
-			freeObject(vm, unreached);
+	return freed;
+}
+
+// The page must either be claimed for the current epoch, or already swept in it
+static size_t sweepPage(VM* vm, HeapPage* page) {
+	size_t freed = sweepDeadCells(vm, page);
+	heapPageSwept(&vm->heap, page);
+	return freed;
+}
+
+// Set on the sweeper thread while it sweeps a page, as only the VM's thread may touch bytesAllocated
+static _Thread_local size_t* sweeperFreedBytes = NULL;
+
+static void releaseBytes(VM* vm, size_t size) {
+	if (sweeperFreedBytes != NULL) {
+		*sweeperFreedBytes += size;
+	}
+	else {
+		vm->bytesAllocated -= size;
+	}
+}
+
+size_t sweepPageOffThread(VM* vm, HeapPage* page, size_t epoch) {
+	size_t freedBytes = 0;
+	sweeperFreedBytes = &freedBytes;
+	sweepDeadCells(vm, page);
+	sweeperFreedBytes = NULL;
+
+	page->freeHint = 0;
+	// Publishes the sweep, so the VM's thread may allocate in the page as soon as it sees the new epoch
+	atomic_store_explicit(&page->sweptEpoch, epoch, memory_order_release);
+	return freedBytes;
+}
+
+static void traceRememberedSet(VM* vm) {
+	for (size_t i = 0; i < vm->rememberedCount; i++) {
+		blackenObject(vm, vm->rememberedSet[i]);
+	}
+	forgetRememberedSet(vm);
+}
+
+static void logCycle(VM* vm);
+
+static void recordPause(VM* vm, const char* name, uint64_t start) {
+	uint64_t end = monotonicNanoseconds();
+	uint64_t nanos = end - start;
+	if (vm->tracer != NULL) traceComplete(vm, name, "gc", start, end);
+	uint64_t micros = nanos / 1000;
+
+	size_t bucket = 0;
+	while (bucket < GC_PAUSE_BUCKETS - 1 && micros >= ((uint64_t)1 << bucket)) {
+		bucket++;
+	}
+	vm->gcPauseHistogram[bucket]++;
+
+	vm->gcCounters.totalPauseNanos += nanos;
+	if (nanos > vm->gcCounters.maxPauseNanos) {
+		vm->gcCounters.maxPauseNanos = nanos;
+	}
+
+	vm->gcCyclePauseNanos += nanos;
+	if (vm->gcCycleToLog) {
+		vm->gcCycleToLog = false;
+		logCycle(vm);
+	}
+}
+
+static void youngCollection(VM* vm) {
+#ifdef FELINE_DEBUG_LOG_GC
+	printf("-- Minor GC Begin\n");
+#endif
+
+	markRoots(vm);
+	traceRememberedSet(vm);
+	traceReferences(vm);
+	tableRemoveWhite(vm, &vm->strings);
+
+	// Nursery garbage is freed straight away, while it is still in cache.
+	// Only pages allocated into since the last collection can hold any.
+	HeapPage* page = heapTakeYoungPages(&vm->heap);
+	while (page != NULL) {
+		HeapPage* next = page->nextYoung;
+		page->isYoung = false;
+		page->nextYoung = NULL;
+		// A page still unswept since marking was only allocated into while marking, so anything young on it is black.
+		// It can be left to the sweeper thread.
+		if (!heapNeedsSweep(&vm->heap, page) || heapClaimSweep(page, vm->heap.epoch)) {
+			sweepPage(vm, page);
 		}
+		page = next;
 	}
+	runVMThreadFinalizers(vm);
+
+	vm->nextMinorGC = vm->bytesAllocated + GC_NURSERY_SIZE;
+	vm->gcCounters.minorCollections++;
+	vm->gcCounters.liveBytes = vm->bytesAllocated;
+
+#ifdef FELINE_DEBUG_LOG_GC
+	printf("-- Minor GC End\n");
+	printf("   %zu bytes in use, next at %zu\n", vm->bytesAllocated, vm->nextMinorGC);
+#endif
 }
 
-void collectGarbage(VM* vm) {
+void collectYoungGarbage(VM* vm) {
+	// Marks belong to the major cycle until it has finished marking
+	if (vm->gcPhase == GC_PHASE_MARK) return;
+
+	uint64_t start = monotonicNanoseconds();
+	youngCollection(vm);
+	recordPause(vm, "minor GC", start);
+}
+
+// ========= Major Cycle =========
+
+static void startCycle(VM* vm) {
 #ifdef FELINE_DEBUG_LOG_GC
 	printf("-- GC Begin\n");
-	size_t before = vm->bytesAllocated;
 #endif
 
+	// A cycle finished and started within the same pause is logged without it
+	if (vm->gcCycleToLog) {
+		vm->gcCycleToLog = false;
+		logCycle(vm);
+	}
+	vm->gcCycleStartTime = monotonicNanoseconds();
+	vm->gcCyclePauseNanos = 0;
+
+	// Every object is traced from the roots, so what is remembered no longer matters
+	forgetRememberedSet(vm);
+	heapClearMarks(&vm->heap);
+	vm->gcPhase = GC_PHASE_MARK;
+
+	// Past this, the cycle is finished without further slicing
+	double limit = (double)vm->nextGC * vm->gcGrowthFactor;
+	vm->gcHeapLimit = limit >= (double)SIZE_MAX ? SIZE_MAX : (size_t)limit;
+	if (vm->gcMaxHeap != 0 && vm->gcHeapLimit > vm->gcMaxHeap) {
+		vm->gcHeapLimit = vm->gcMaxHeap > vm->nextGC ? vm->gcMaxHeap : vm->nextGC;
+	}
+	vm->gcCycleSlices = 0;
+	vm->gcCycleStartBytes = vm->bytesAllocated;
+	if (vm->gcStepWork < GC_STEP_WORK) {
+		vm->gcStepWork = GC_STEP_WORK;
+	}
+
+	markRoots(vm);
+}
+
+// Runs to completion: roots are not covered by the write barrier, so are scanned again before anything is freed
+static void finishMarking(VM* vm) {
 	markRoots(vm);
 	traceReferences(vm);
 	tableRemoveWhite(vm, &vm->strings);
-	sweep(vm);
+	// Nothing is freed while marking, so this is exactly what was allocated meanwhile
+	vm->gcFloatingBytes = vm->bytesAllocated - vm->gcCycleStartBytes;
+	// Garbage is now freed lazily, as allocation reaches each page, or by the remaining slices of the cycle
+	heapNewEpoch(&vm->heap);
+
+	vm->gcPhase = GC_PHASE_SWEEP;
+	vm->sweepCursor = vm->heap.pages;
+	startBackgroundSweep(vm);
+}
+
+// The next cycle starts once the heap has grown by gcGrowthFactor over what survived this one.
+// It is never due below gcInitialHeap, so a small heap is not collected over and over, nor above gcMaxHeap.
+static void paceNextCycle(VM* vm) {
+	// Objects allocated while marking were kept whether or not they are still reachable.
+	// Counting them as live would let a long cycle inflate the next one's heap, so they are assumed dead.
+	size_t live = vm->bytesAllocated;
+	if (live > vm->gcFloatingBytes) {
+		live -= vm->gcFloatingBytes;
+	}
+
+	double next = (double)live * vm->gcGrowthFactor;
+	vm->nextGC = next >= (double)SIZE_MAX ? SIZE_MAX : (size_t)next;
+
+	if (vm->nextGC < vm->gcInitialHeap) {
+		vm->nextGC = vm->gcInitialHeap;
+	}
+	if (vm->gcMaxHeap != 0 && vm->nextGC > vm->gcMaxHeap) {
+		vm->nextGC = vm->gcMaxHeap;
+	}
+	// Back under the limit, so exceeding it again throws straight away
+	if (vm->bytesAllocated <= vm->gcMaxHeap) {
+		vm->gcReserveEnd = 0;
+	}
+
+	// A cycle which used under a quarter of the slices its headroom allowed did more work per slice than it needed
+	size_t sliceBudget = (vm->gcHeapLimit - vm->nextGC) / GC_STEP_SIZE;
+	if (vm->gcCycleSlices < sliceBudget / 4 && vm->gcStepWork > GC_STEP_WORK) {
+		vm->gcStepWork /= 2;
+	}
+}
 
-	vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;
+static void finishCycle(VM* vm) {
+	vm->gcPhase = GC_PHASE_IDLE;
+	vm->sweepCursor = NULL;
+
+	paceNextCycle(vm);
+	vm->nextMinorGC = vm->bytesAllocated + GC_NURSERY_SIZE;
+
+	vm->gcCounters.majorCollections++;
+	vm->gcCounters.liveBytes = vm->bytesAllocated;
+	vm->gcCycleToLog = vm->gcLog != NULL;
 
 #ifdef FELINE_DEBUG_LOG_GC
 	printf("-- GC End\n");
-	printf("   collected %zu bytes (from %zu to %zu), next at %zu\n", before - vm->bytesAllocated, before, vm->bytesAllocated, vm->nextGC);
+	printf("   %zu bytes in use, next at %zu\n", vm->bytesAllocated, vm->nextGC);
 #endif
 }
 
-static void freeObject(VM* vm, Obj* object) {
-#ifdef FELINE_DEBUG_LOG_GC
-	printf("%p free type %d\n", (void*)object, object->type);
+// Returns the number of objects traced or swept
+static size_t cycleWork(VM* vm, size_t budget) {
+	size_t work = 0;
+
+	if (vm->gcPhase == GC_PHASE_MARK) {
+		if (budget == SIZE_MAX) {
+			traceReferences(vm);
+		}
+		else {
+			work = traceGray(vm, budget);
+		}
+
+		if (vm->grayCount == 0) {
+			finishMarking(vm);
+		}
+	}
+	else if (vm->gcPhase == GC_PHASE_SWEEP) {
+		// Pages added since marking finished are behind the cursor, and have nothing to sweep
+		while (vm->sweepCursor != NULL && work < budget) {
+			HeapPage* page = vm->sweepCursor;
+			if (heapNeedsSweep(&vm->heap, page) && heapClaimSweep(page, vm->heap.epoch)) {
+				work += sweepPage(vm, page);
+			}
+			work += GC_SWEEP_PAGE_WORK;
+			vm->sweepCursor = page->next;
+		}
+
+		// Every page has now been claimed by one thread or the other
+		if (vm->sweepCursor == NULL) {
+			finishBackgroundSweep(vm);
+			finishCycle(vm);
+		}
+	}
+
+	return work;
+}
+
+static void finishCycleNow(VM* vm) {
+	while (vm->gcPhase != GC_PHASE_IDLE) {
+		cycleWork(vm, SIZE_MAX);
+	}
+}
+
+// Advances the major cycle by one slice, bounded by both gcStepWork and the pause target
+static void stepCycle(VM* vm) {
+	uint64_t start = monotonicNanoseconds();
+	uint64_t deadline = start + (uint64_t)vm->gcPauseTarget * 1000;
+
+	collectBackgroundSweep(vm);
+	vm->gcCycleSlices++;
+
+	size_t work = 0;
+	while (vm->gcPhase != GC_PHASE_IDLE && work < vm->gcStepWork) {
+		size_t remaining = vm->gcStepWork - work;
+		work += cycleWork(vm, remaining < GC_STEP_CLOCK_INTERVAL ? remaining : GC_STEP_CLOCK_INTERVAL);
+		if (monotonicNanoseconds() >= deadline) break;
+	}
+
+	vm->nextGCStep = vm->bytesAllocated + GC_STEP_SIZE;
+	recordPause(vm, "major GC slice", start);
+}
+
+static void collectOnAllocation(VM* vm) {
+	if (vm->gcPhase == GC_PHASE_IDLE) {
+		if (vm->bytesAllocated > vm->nextGC) {
+			if (vm->gcPauseTarget == 0) {
+				collectGarbage(vm);
+				return;
+			}
+
+			uint64_t start = monotonicNanoseconds();
+			startCycle(vm);
+			vm->nextGCStep = vm->bytesAllocated + GC_STEP_SIZE;
+			recordPause(vm, "major GC start", start);
+		}
+		else if (vm->bytesAllocated > vm->nextMinorGC) {
+			collectYoungGarbage(vm);
+		}
+		return;
+	}
+
+	// The cycle is not keeping up with allocation, so it is finished without further slicing, and the next gets larger slices
+	if (vm->bytesAllocated > vm->gcHeapLimit) {
+		uint64_t start = monotonicNanoseconds();
+		if (vm->gcStepWork < GC_STEP_WORK_MAX) {
+			vm->gcStepWork *= 2;
+		}
+		finishCycleNow(vm);
+		recordPause(vm, "major GC finish", start);
+	}
+	else if (vm->bytesAllocated > vm->nextGCStep) {
+		stepCycle(vm);
+	}
+	else if (vm->gcPhase == GC_PHASE_SWEEP && vm->bytesAllocated > vm->nextMinorGC) {
+		collectYoungGarbage(vm);
+	}
+}
+
+void collectGarbage(VM* vm) {
+	uint64_t start = monotonicNanoseconds();
+
+	// A cycle already in progress may retain objects that died since it began
+	finishCycleNow(vm);
+
+	startCycle(vm);
+	finishCycleNow(vm);
+
+	recordPause(vm, "full GC", start);
+}
+
+// ========= Telemetry =========
+
+static void logCycle(VM* vm) {
+	uint64_t now = monotonicNanoseconds();
+
+	fprintf(vm->gcLog,
+		"{\"cycle\":%zu,\"timeMs\":%.3f,\"durationMs\":%.3f,\"pauseMs\":%.3f,\"slices\":%zu,"
+		"\"heapBefore\":%zu,\"heapAfter\":%zu,\"floatingBytes\":%zu,\"nextGC\":%zu,"
+		"\"minorCollections\":%zu,\"totalAllocated\":%zu}\n",
+		vm->gcCounters.majorCollections,
+		(double)(vm->gcCycleStartTime - vm->gcLogStartTime) / 1e6,
+		(double)(now - vm->gcCycleStartTime) / 1e6,
+		(double)vm->gcCyclePauseNanos / 1e6,
+		vm->gcCycleSlices,
+		vm->gcCycleStartBytes,
+		vm->gcCounters.liveBytes,
+		vm->gcFloatingBytes,
+		vm->nextGC,
+		vm->gcCounters.minorCollections,
+		vm->gcCounters.totalAllocated);
+	// Flushed every cycle, so the log can be followed while the script runs
+	fflush(vm->gcLog);
+}
+
+// Bytes an object owns outside of its own cell
+static size_t objectContentsSize(Obj* object) {
+	switch (object->type) {
+		case OBJ_STRING: return ((ObjString*)object)->length + 1;
+		case OBJ_FUNCTION: {
+			Chunk* chunk = &((ObjFunction*)object)->chunk;
+			if (chunk->shared) return chunk->constants.capacity * sizeof(Value);
+			return chunk->bytecode.capacity * sizeof(uint8_t) + chunk->constants.capacity * sizeof(Value) + chunk->lines.capacity * sizeof(size_t);
+		}
+		case OBJ_CLOSURE: return ((ObjClosure*)object)->upvalueCount * sizeof(ObjUpvalue*);
+		case OBJ_CLASS: return ((ObjClass*)object)->methods.capacity * sizeof(Entry);
+		case OBJ_INSTANCE: return ((ObjInstance*)object)->fields.capacity * sizeof(Entry);
+		case OBJ_LIST: return ((ObjList*)object)->items.capacity * sizeof(Value);
+		case OBJ_FIBER: {
+			ObjFiber* fiber = (ObjFiber*)object;
+			return fiber->stack.capacity * sizeof(Value) + fiber->frames.capacity * sizeof(CallFrame);
+		}
+		case OBJ_TASK: return ((ObjTask*)object)->slotCount * sizeof(Value);
+		case OBJ_UPVALUE:
+		case OBJ_NATIVE:
+		case OBJ_BOUND_METHOD:
+		case OBJ_NATIVE_LIBRARY: return 0;
+	}
+	return 0;
+}
+
+size_t objectFootprint(Obj* object) {
+	return objectSize(object) + objectContentsSize(object);
+}
+
+static void censusPage(VM* vm, HeapPage* page, GCStats* stats) {
+	// An unswept page is only read through its marks, which the sweeper thread leaves alone, and which tell what survived
+	bool useMarks = heapNeedsSweep(&vm->heap, page);
+
+	for (size_t i = 0; i < HEAP_BITMAP_WORDS; i++) {
+		uint64_t cells = useMarks ? atomic_load_explicit(&page->marks[i], memory_order_relaxed) : page->live[i];
+
+		while (cells != 0) {
+			size_t bit = countTrailingZeros(cells);
+			cells &= cells - 1;
+
+			Obj* object = (Obj*)heapCellAt(page, i * 64 + bit);
+			ObjTypeStats* type = &stats->objects[object->type];
+			type->count++;
+			type->bytes += objectFootprint(object);
+		}
+	}
+}
+
+void getGCStats(VM* vm, GCStats* stats) {
+	// Pages swept in the background are taken back first, so the heap size matches the census
+	collectBackgroundSweep(vm);
+
+	stats->counters = vm->gcCounters;
+	stats->heapBytes = vm->bytesAllocated;
+
+	stats->internedStrings = 0;
+	for (size_t i = 0; i < vm->strings.capacity; i++) {
+		if (vm->strings.entries[i].key != NULL) stats->internedStrings++;
+	}
+	stats->internTableCapacity = vm->strings.capacity;
+
+	for (size_t i = 0; i < OBJ_TYPE_COUNT; i++) {
+		stats->objects[i].count = 0;
+		stats->objects[i].bytes = 0;
+	}
+	for (HeapPage* page = vm->heap.pages; page != NULL; page = page->next) {
+		censusPage(vm, page, stats);
+	}
+}
+
+void traceHeapSnapshot(VM* vm, HeapSnapshot* snapshot) {
+	uint64_t start = monotonicNanoseconds();
+
+	// The snapshot is taken by a full collection, which cannot begin while another cycle is in progress
+	finishCycleNow(vm);
+
+	vm->heapSnapshot = snapshot;
+	startCycle(vm);
+	// Traced on this thread alone, so the references marked while an object is blackened are its own
+	while (vm->grayCount > 0) {
+		Obj* object = vm->grayStack[--vm->grayCount];
+		object->isRemembered = false;
+		snapshotBeginObject(snapshot, object);
+		blackenObject(vm, object);
+		snapshotEndObject(snapshot);
+	}
+	vm->heapSnapshot = NULL;
+
+	finishCycleNow(vm);
+	recordPause(vm, "heap snapshot", start);
+}
+
+// The allocation which exceeded the limit still succeeds, as its caller cannot handle failure;
+// the exception is raised once the current instruction has finished.
+static void heapLimitExceeded(VM* vm) {
+	// The exception is already on its way, and unwinding to a handler allocates too
+	if (vm->hasException || vm->gcPendingOutOfMemory != 0 || vm->internalExceptions[INTERNAL_EXCEPTION_OUT_OF_MEMORY] == NULL) return;
+
+	// Last chance: a cycle in progress may be holding on to garbage, and young objects are only freed in bulk
+	collectGarbage(vm);
+	if (vm->bytesAllocated <= vm->gcMaxHeap) return;
+
+	size_t inUse = vm->bytesAllocated;
+	vm->gcReserveEnd = inUse + GC_OUT_OF_MEMORY_RESERVE;
+	// Collecting again before the reserve runs out would only find the same live objects
+	vm->nextGC = vm->gcReserveEnd;
+
+	vm->gcPendingOutOfMemory = inUse;
+}
+
+void throwOutOfMemory(VM* vm) {
+	size_t inUse = vm->gcPendingOutOfMemory;
+	vm->gcPendingOutOfMemory = 0;
+	// Anything thrown since is already unwinding, which gives back the memory just the same
+	if (vm->hasException) return;
+
+	throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_OUT_OF_MEMORY], "Heap limit of %zu bytes exceeded (%zu bytes in use)", vm->gcMaxHeap, inUse);
+}
+
+#ifdef FELINE_DEBUG_GC_PAUSES
+void printGCPauses(VM* vm) {
+	printf("-- GC Pauses\n");
+	for (size_t i = 0; i < GC_PAUSE_BUCKETS; i++) {
+		if (vm->gcPauseHistogram[i] == 0) continue;
+		const char* bound = i == GC_PAUSE_BUCKETS - 1 ? ">=" : "< ";
+		uint64_t micros = (uint64_t)1 << (i == GC_PAUSE_BUCKETS - 1 ? i - 1 : i);
+		printf("   %s %8" PRIu64 "us: %" PRIu64 "\n", bound, micros, vm->gcPauseHistogram[i]);
+	}
+}
 #endif
 
+static void finalizeNativeData(VM* vm, ObjInstance* instance) {
+	InstanceData* data = instance->nativeData;
+
+	// Whichever thread found it unreachable, it waits its turn behind those found before it
+	if (vm->gcBackgroundSweep) {
+		queueFinalizer(vm, data, instance->obj.finalizeOnVMThread);
+	}
+	else {
+		data->freeData(data);
+	}
+}
+
+// Releases everything an object owns outside of its own cell
+static void freeObjectContents(VM* vm, Obj* object) {
 	switch (object->type) {
 		case OBJ_STRING: {
 			ObjString* string = (ObjString*)object;
-			FREE_ARRAY(vm, char, string->str, string->length + 1);
-			FREE(vm, ObjString, object);
+			if (string->shared != NULL) {
+				releaseBytes(vm, string->length + 1);
+				releaseSharedChars(string->shared);
+			}
+			else {
+				FREE_ARRAY(vm, char, string->str, string->length + 1);
+			}
 			break;
 		}
 		case OBJ_FUNCTION: {
 			ObjFunction* function = (ObjFunction*)object;
 			freeChunk(vm, &function->chunk);
-			FREE(vm, ObjFunction, object);
 			break;
 		}
 		case OBJ_CLOSURE: {
 			ObjClosure* closure = (ObjClosure*)object;
 			FREE_ARRAY(vm, ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-			FREE(vm, ObjClosure, object);
-			break;
-		}
-		case OBJ_UPVALUE: {
-			FREE(vm, ObjUpvalue, object);
-			break;
-		}
-		case OBJ_NATIVE: {
-			FREE(vm, ObjNative, object);
 			break;
 		}
 		case OBJ_CLASS: {
 			ObjClass* clazz = (ObjClass*)object;
 			freeTable(vm, &clazz->methods);
-			FREE(vm, ObjClass, object);
 			break;
 		}
 		case OBJ_INSTANCE: {
 			ObjInstance* instance = (ObjInstance*)object;
 
 			if (instance->nativeData != NULL) {
-				instance->nativeData->freeData(instance->nativeData);
+				finalizeNativeData(vm, instance);
 			}
 
 			freeTable(vm, &instance->fields);
-			FREE(vm, ObjInstance, object);
-			break;
-		}
-		case OBJ_BOUND_METHOD: {
-			FREE(vm, ObjBoundMethod, object);
 			break;
 		}
 		case OBJ_LIST: {
 			ObjList* list = (ObjList*)object;
 			freeValueArray(vm, &list->items);
-			FREE(vm, ObjList, object);
+			break;
+		}
+		case OBJ_FIBER: {
+			ObjFiber* fiber = (ObjFiber*)object;
+			freeValueArray(vm, &fiber->stack);
+			freeCallFrameArray(vm, &fiber->frames);
+			break;
+		}
+		case OBJ_TASK: {
+			ObjTask* task = (ObjTask*)object;
+			FREE_ARRAY(vm, Value, task->slots, task->slotCount);
 			break;
 		}
 		case OBJ_NATIVE_LIBRARY: {
 			ObjNativeLibrary* library = (ObjNativeLibrary*)object;
 			freeNativeLibrary(library->library);
-			FREE(vm, ObjNativeLibrary, object);
+			break;
+		}
+		case OBJ_UPVALUE:
+		case OBJ_NATIVE:
+		case OBJ_BOUND_METHOD: {
 			break;
 		}
 	}
 }
 
-void freeObjects(VM* vm) {
-	Obj* object = vm->objects;
+static size_t objectSize(Obj* object) {
+	switch (object->type) {
+		case OBJ_STRING: return sizeof(ObjString);
+		case OBJ_FUNCTION: return sizeof(ObjFunction);
+		case OBJ_CLOSURE: return sizeof(ObjClosure);
+		case OBJ_UPVALUE: return sizeof(ObjUpvalue);
+		case OBJ_NATIVE: return sizeof(ObjNative);
+		case OBJ_CLASS: return sizeof(ObjClass);
+		case OBJ_INSTANCE: return sizeof(ObjInstance);
+		case OBJ_BOUND_METHOD: return sizeof(ObjBoundMethod);
+		case OBJ_LIST: return sizeof(ObjList);
+		case OBJ_NATIVE_LIBRARY: return sizeof(ObjNativeLibrary);
+		case OBJ_FIBER: return sizeof(ObjFiber);
+		case OBJ_TASK: return sizeof(ObjTask);
+	}
+	return 0;
+}
+
+static void freeObject(VM* vm, Obj* object) {
+#ifdef FELINE_DEBUG_LOG_GC
+	printf("%p free type %d\n", (void*)object, object->type);
+#endif
 
-	while (object != NULL) {
-		Obj* next = object->next;
-		freeObject(vm, object);
-		object = next;
+	freeObjectContents(vm, object);
+	releaseBytes(vm, objectSize(object));
+}
+
+static void freeLiveObjects(VM* vm, bool libraries) {
+	for (HeapPage* page = vm->heap.pages; page != NULL; page = page->next) {
+		for (size_t i = 0; i < HEAP_BITMAP_WORDS; i++) {
+			uint64_t live = page->live[i];
+
+			while (live != 0) {
+				size_t bit = countTrailingZeros(live);
+				live &= live - 1;
+
+				Obj* object = (Obj*)heapCellAt(page, i * 64 + bit);
+				if ((object->type == OBJ_NATIVE_LIBRARY) == libraries) {
+					freeObjectContents(vm, object);
+				}
+			}
+		}
 	}
+}
+
+void freeObjects(VM* vm) {
+	// Finalizers still queued run first, and the rest then run here
+	freeSweeper(vm);
+	vm->gcBackgroundSweep = false;
+
+	// Cells are dropped along with their pages, so only what objects own outside the heap is released.
+	// Libraries go last, as freeing an instance's native data may call into one.
+	freeLiveObjects(vm, false);
+	freeLiveObjects(vm, true);
+	freeHeap(&vm->heap);
 
+	freeMarkPool(vm);
 	free(vm->grayStack);
+	free(vm->rememberedSet);
 }
\ No newline at end of file
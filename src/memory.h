@@ -12,9 +12,59 @@
 
 #define FREE(vm, type, pointer) reallocate(vm, pointer, sizeof(type), 0)
 
+typedef struct ObjTypeStats {
+	size_t count;
+	// Including what the objects own outside of their cells
+	size_t bytes;
+} ObjTypeStats;
+
+typedef struct GCStats {
+	GCCounters counters;
+	size_t heapBytes;
+	size_t internedStrings;
+	size_t internTableCapacity;
+	// Objects on the heap, less any the last major marking found dead which are yet to be swept
+	ObjTypeStats objects[OBJ_TYPE_COUNT];
+} GCStats;
+
 void* reallocate(VM* vm, void* pointer, size_t oldCapacity, size_t newCapacity);
+// Counts memory the VM did not allocate itself against its heap, as reallocate() would have, possibly collecting first
+void chargeBytes(VM* vm, size_t size);
+// Called by the interpreter between instructions once gcPendingOutOfMemory is set
+void throwOutOfMemory(VM* vm);
+// Objects live in the VM's heap pages rather than being allocated individually
+void* allocateCell(VM* vm, size_t size);
+// Sweeps a page the calling sweeper thread has claimed, returning the bytes freed
+size_t sweepPageOffThread(VM* vm, HeapPage* page, size_t epoch);
 
 void markObject(VM* vm, Obj* object);
 void markValue(VM* vm, Value value);
+void blackenObject(VM* vm, Obj* object);
+void rememberObject(VM* vm, Obj* object);
+void writeBarrierSlow(VM* vm, Obj* container, Obj* value);
+void collectYoungGarbage(VM* vm);
 void collectGarbage(VM* vm);
-void freeObjects(VM* vm);
\ No newline at end of file
+void freeObjects(VM* vm);
+// Walks the whole heap, so is meant for occasional use
+void getGCStats(VM* vm, GCStats* stats);
+// The object's cell, along with everything it owns outside of it
+size_t objectFootprint(Obj* object);
+// Runs a full collection, reporting the roots and every reachable object to the snapshot as they are traced
+void traceHeapSnapshot(VM* vm, HeapSnapshot* snapshot);
+
+#ifdef FELINE_DEBUG_GC_PAUSES
+void printGCPauses(VM* vm);
+#endif
+
+static inline bool isMarked(Obj* object) {
+	return heapIsMarked(object);
+}
+
+// Must follow any store of a value into a heap object.
+// While marking, the stored object is shaded so a black object never points to a white one.
+// Otherwise, an old object pointing into the nursery is remembered so that the next minor collection traces it.
+static inline void writeBarrier(VM* vm, Obj* container, Value value) {
+	if (IS_OBJ(value) && isMarked(container) && !isMarked(AS_OBJ(value))) {
+		writeBarrierSlow(vm, container, AS_OBJ(value));
+	}
+}
\ No newline at end of file
@@ -3,6 +3,20 @@
 #include "builtin/exception.h"
 #include "builtin/objectclass.h"
 #include "builtin/importclass.h"
+#include "builtin/channelclass.h"
+#include "builtin/gcmodule.h"
+#include "builtin/benchmodule.h"
+#include "builtin/parallelmodule.h"
+#include "builtin/fibernatives.h"
+#include "builtin/iomodule.h"
+#include "builtin/taskmodule.h"
+#include <string.h>
+
+static void defineNumber(VM* vm, Module* mod, const char* name, double number) {
+	push(vm, OBJ_VAL(copyString(vm, name, strlen(name))));
+	tableSet(vm, &mod->globals, AS_STRING(peek(vm, 0)), NUMBER_VAL(number));
+	pop(vm);
+}
 
 void initModule(VM* vm, Module* mod) {
 	mod->next = vm->modules;
@@ -12,11 +26,24 @@ void initModule(VM* vm, Module* mod) {
 	initTable(&mod->globals);
 	initTable(&mod->exports);
 
-	defineNative(vm, &mod->globals, "clock", clockNative, 0);
-	defineNative(vm, &mod->globals, "len", lenNative, 1);
+	defineNative(vm, NULL, &mod->globals, "clock", clockNative, 0);
+	defineNative(vm, NULL, &mod->globals, "nanoTime", nanoTimeNative, 0);
+	defineNative(vm, NULL, &mod->globals, "microTime", microTimeNative, 0);
+	defineNative(vm, NULL, &mod->globals, "len", lenNative, 1);
+	defineNative(vm, NULL, &mod->globals, "Fiber", fiberNative, 1);
+	defineNative(vm, NULL, &mod->globals, "yield", yieldNative, 1);
+
+	defineNumber(vm, mod, "ISOLATE_INDEX", (double)vm->isolateIndex);
+	defineNumber(vm, mod, "ISOLATE_COUNT", (double)vm->isolateCount);
 
 	bindObjectClass(vm, mod);
 	bindImportClass(vm, mod);
+	bindChannelClass(vm, mod);
+	bindGCModule(vm, mod);
+	bindBenchModule(vm, mod);
+	bindParallelModule(vm, mod);
+	bindIOModule(vm, mod);
+	bindTaskModule(vm, mod);
 
 	bindExceptionClasses(vm, mod);
 }
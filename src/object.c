@@ -1,6 +1,7 @@
 #include "object.h"
 #include "memory.h"
 #include "table.h"
+#include "allocprofile.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,12 +10,14 @@
 #define ALLOCATE_OBJ(vm, type, objectType) (type*)allocateObject(vm, sizeof(type), objectType);
 
 static Obj* allocateObject(VM* vm, size_t size, ObjType type) {
-	Obj* object = (Obj*)reallocate(vm, NULL, 0, size);
+	Obj* object = (Obj*)allocateCell(vm, size);
 	object->type = type;
-	object->isMarked = false;
+	object->isRemembered = false;
+	object->finalizeOnVMThread = false;
 
-	object->next = vm->objects;
-	vm->objects = object;
+	if (vm->allocProfiler != NULL) {
+		profileAllocation(vm, size, type);
+	}
 
 #ifdef FELINE_DEBUG_LOG_GC
 	printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -30,6 +33,7 @@ ObjFunction* newFunction(VM* vm) {
 	function->arity = 0;
 	function->upvalueCount = 0;
 	function->name = NULL;
+	function->isAsync = false;
 	initChunk(&function->chunk);
 	return function;
 }
@@ -58,13 +62,16 @@ ObjUpvalue* newUpvalue(VM* vm, Value* slot) {
 	upvalue->location = slot;
 	upvalue->closed = NULL_VAL;
 	upvalue->next = NULL;
+	upvalue->fiber = NULL;
+	upvalue->task = NULL;
 	return upvalue;
 }
 
 // ========= Native Functions =========
 
-ObjNative* newNative(VM* vm, NativeFunction function, size_t arity) {
+ObjNative* newNative(VM* vm, ObjString* name, NativeFunction function, size_t arity) {
 	ObjNative* native = ALLOCATE_OBJ(vm, ObjNative, OBJ_NATIVE);
+	native->name = name;
 	native->function = function;
 	native->arity = arity;
 	native->bound = NULL_VAL;
@@ -116,6 +123,45 @@ ObjNativeLibrary* newNativeLibrary(VM* vm, NativeLibrary library) {
 	return objLibrary;
 }
 
+// ========= Fibers =========
+
+ObjFiber* newFiber(VM* vm, ObjClosure* entry) {
+	ObjFiber* fiber = ALLOCATE_OBJ(vm, ObjFiber, OBJ_FIBER);
+	fiber->state = FIBER_NEW;
+	fiber->entry = entry;
+	initValueArray(&fiber->stack);
+	initCallFrameArray(&fiber->frames);
+	fiber->openUpvalues = NULL;
+	fiber->caller = NULL;
+
+	// push() expects there to be room for a value before it grows the stack, as the VM's own always has
+	push(vm, OBJ_VAL(fiber));
+	fiber->stack.items = GROW_ARRAY(vm, Value, NULL, 0, GROW_CAPACITY(0));
+	fiber->stack.capacity = GROW_CAPACITY(0);
+	pop(vm);
+	return fiber;
+}
+
+// ========= Tasks =========
+
+ObjTask* newTask(VM* vm, ObjClosure* closure) {
+	ObjTask* task = ALLOCATE_OBJ(vm, ObjTask, OBJ_TASK);
+	task->state = TASK_READY;
+	task->frame = (CallFrame) { 0 };
+	task->frame.closure = closure;
+	task->frame.ip = closure != NULL ? closure->function->chunk.bytecode.items : NULL;
+	task->slots = NULL;
+	task->slotCount = 0;
+	task->openUpvalues = NULL;
+	task->resumed = false;
+	task->failed = false;
+	task->result = NULL_VAL;
+	task->awaiting = NULL;
+	task->waiters = NULL;
+	task->next = NULL;
+	return task;
+}
+
 // ========= Strings =========
 
 static ObjString* allocateString(VM* vm, char* str, size_t length, uint32_t hash) {
@@ -123,6 +169,7 @@ static ObjString* allocateString(VM* vm, char* str, size_t length, uint32_t hash
 	string->length = length;
 	string->str = str;
 	string->hash = hash;
+	string->shared = NULL;
 
 	push(vm, OBJ_VAL(string));
 	tableSet(vm, &vm->strings, string, NULL_VAL);
@@ -131,7 +178,7 @@ static ObjString* allocateString(VM* vm, char* str, size_t length, uint32_t hash
 }
 
 // FNV-1a Hash Function
-static uint32_t hashString(const char* key, size_t length) {
+uint32_t hashString(const char* key, size_t length) {
 	uint32_t hash = 2166136261u;
 	for (size_t i = 0; i < length; i++) {
 		hash ^= (uint8_t)key[i];
@@ -164,6 +211,42 @@ ObjString* takeString(VM* vm, char* str, size_t length) {
 	return allocateString(vm, str, length, hash);
 }
 
+SharedChars* shareString(ObjString* string) {
+	if (string->shared == NULL) {
+		SharedChars* shared = malloc(sizeof(SharedChars) + string->length + 1);
+		if (shared == NULL) exit(1);
+		atomic_init(&shared->references, 1);
+		memcpy(shared->chars, string->str, string->length + 1);
+
+		// The VM still counts the bytes as the string's, and releases them when it is freed
+		free(string->str);
+		string->str = shared->chars;
+		string->shared = shared;
+	}
+
+	atomic_fetch_add_explicit(&string->shared->references, 1, memory_order_relaxed);
+	return string->shared;
+}
+
+ObjString* adoptSharedString(VM* vm, SharedChars* shared, size_t length, uint32_t hash) {
+	ObjString* interned = tableFindString(&vm->strings, shared->chars, length, hash);
+	if (interned != NULL) {
+		releaseSharedChars(shared);
+		return interned;
+	}
+
+	chargeBytes(vm, length + 1);
+	ObjString* string = allocateString(vm, shared->chars, length, hash);
+	string->shared = shared;
+	return string;
+}
+
+void releaseSharedChars(SharedChars* shared) {
+	if (atomic_fetch_sub_explicit(&shared->references, 1, memory_order_acq_rel) == 1) {
+		free(shared);
+	}
+}
+
 ObjString* makeStringf(VM* vm, const char* format, ...) {
 	va_list args;
 	va_start(args, format);
@@ -232,6 +315,14 @@ void printObject(VM* vm, Value value) {
 			printf("<native function>");
 			break;
 		}
+		case OBJ_FIBER: {
+			printf("<fiber>");
+			break;
+		}
+		case OBJ_TASK: {
+			printf("<task>");
+			break;
+		}
 		case OBJ_FUNCTION: {
 			printFunction(vm, AS_FUNCTION(value));
 			break;
@@ -250,4 +341,22 @@ void printObject(VM* vm, Value value) {
 			break;
 		}
 	}
+}
+
+const char* objTypeName(ObjType type) {
+	switch (type) {
+		case OBJ_STRING: return "string";
+		case OBJ_FUNCTION: return "function";
+		case OBJ_CLOSURE: return "closure";
+		case OBJ_UPVALUE: return "upvalue";
+		case OBJ_NATIVE: return "native";
+		case OBJ_CLASS: return "class";
+		case OBJ_INSTANCE: return "instance";
+		case OBJ_BOUND_METHOD: return "boundMethod";
+		case OBJ_LIST: return "list";
+		case OBJ_NATIVE_LIBRARY: return "nativeLibrary";
+		case OBJ_FIBER: return "fiber";
+		case OBJ_TASK: return "task";
+	}
+	return "unknown";
 }
\ No newline at end of file
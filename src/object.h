@@ -7,6 +7,7 @@
 #include "ffi/ffi.h"
 #include "ffi/felineffi.h"
 #include "module.h"
+#include <stdatomic.h>
 
 typedef enum ObjType {
 	OBJ_STRING,
@@ -18,13 +19,18 @@ typedef enum ObjType {
 	OBJ_INSTANCE,
 	OBJ_BOUND_METHOD,
 	OBJ_LIST,
-	OBJ_NATIVE_LIBRARY
+	OBJ_NATIVE_LIBRARY,
+	OBJ_FIBER,
+	OBJ_TASK
 } ObjType;
 
+#define OBJ_TYPE_COUNT (OBJ_TASK + 1)
+
 struct Obj {
 	ObjType type;
-	bool isMarked;
-	struct Obj* next;
+	bool isRemembered;
+	// Set on instances whose native data must be freed on the VM's thread rather than the sweeper's
+	bool finalizeOnVMThread;
 };
 
 typedef struct ObjFunction {
@@ -33,6 +39,8 @@ typedef struct ObjFunction {
 	size_t upvalueCount;
 	Chunk chunk;
 	ObjString* name;
+	// Calls make a task for the scheduler to run, rather than running the function
+	bool isAsync;
 } ObjFunction;
 
 typedef struct ObjUpvalue {
@@ -40,6 +48,10 @@ typedef struct ObjUpvalue {
 	Value* location;
 	Value closed;
 	struct ObjUpvalue* next;
+	// While open, the fiber whose stack location points into, which is kept alive for it; NULL for the VM's own stack
+	struct ObjFiber* fiber;
+	// Likewise the task whose saved slots it points into while the task is suspended
+	struct ObjTask* task;
 } ObjUpvalue;
 
 typedef struct ObjClosure {
@@ -50,8 +62,21 @@ typedef struct ObjClosure {
 	Module* owner;
 } ObjClosure;
 
+typedef struct CallFrame {
+	ObjClosure* closure;
+	uint8_t* ip;
+	size_t slotsOffset;
+
+	uint8_t* catchLocation;
+	size_t tryStackOffset;
+	bool isTryBlock;
+} CallFrame;
+
+DECLARE_DYNAMIC_ARRAY(CallFrame, CallFrame)
+
 typedef struct ObjNative {
 	Obj obj;
+	ObjString* name;
 	NativeFunction function;
 	size_t arity;
 	Value bound;
@@ -87,11 +112,71 @@ typedef struct ObjNativeLibrary {
 	NativeLibrary library;
 } ObjNativeLibrary;
 
+typedef enum FiberState {
+	FIBER_NEW,
+	FIBER_SUSPENDED,
+	// Either executing, or waiting on a fiber it resumed
+	FIBER_RUNNING,
+	FIBER_DONE
+} FiberState;
+
+// A call stack of its own, run on the VM's by swapping it in; while a fiber runs, it holds the state of whatever resumed it
+typedef struct ObjFiber {
+	Obj obj;
+	FiberState state;
+	ObjClosure* entry;
+	ValueArray stack;
+	CallFrameArray frames;
+	ObjUpvalue* openUpvalues;
+	// What resumed it, and is switched back to when it yields or finishes; NULL for the VM's own stack
+	struct ObjFiber* caller;
+} ObjFiber;
+
+typedef enum TaskState {
+	TASK_READY,
+	TASK_RUNNING,
+	// Suspended until the task it awaits has finished
+	TASK_WAITING,
+	TASK_DONE
+} TaskState;
+
+// A call to an async function, which the scheduler runs in turns. Only the function's own frame can await, so rather
+// than a stack of its own a suspended task keeps just that frame, and the slots it had on the VM's stack.
+// A task with no closure stands for an I/O operation instead, which the event loop finishes.
+typedef struct ObjTask {
+	Obj obj;
+	TaskState state;
+	// While suspended, its slotsOffset and tryStackOffset count from the start of slots, and ip is at the await
+	CallFrame frame;
+	Value* slots;
+	size_t slotCount;
+	// Upvalues still open over its locals, which point into slots while it is suspended
+	ObjUpvalue* openUpvalues;
+	// Set once the task is woken, so the await it stopped at takes its result rather than suspending again
+	bool resumed;
+	bool failed;
+	// What the function returned, or what it threw if it failed
+	Value result;
+	struct ObjTask* awaiting;
+	// Those awaiting this task, most recent first
+	struct ObjTask* waiters;
+	// The next task in the scheduler's queue, or in the waiters of the task this one awaits
+	struct ObjTask* next;
+} ObjTask;
+
+// Characters of a string which isolates share, each through a string of its own, rather than copying
+typedef struct SharedChars {
+	atomic_size_t references;
+	char chars[];
+} SharedChars;
+
 struct ObjString {
 	Obj obj;
 	size_t length;
 	char* str;
 	uint32_t hash;
+	// Set once str points into shared characters instead of a buffer the string owns
+	SharedChars* shared;
 };
 
 static inline bool isObjType(Value value, ObjType type) {
@@ -104,7 +189,7 @@ ObjClosure* newClosure(VM* vm, Module* mod, ObjFunction* function);
 
 ObjUpvalue* newUpvalue(VM* vm, Value* slot);
 
-ObjNative* newNative(VM* vm, NativeFunction function, size_t arity);
+ObjNative* newNative(VM* vm, ObjString* name, NativeFunction function, size_t arity);
 
 ObjClass* newClass(VM* vm, ObjString* name);
 
@@ -116,12 +201,23 @@ ObjList* newList(VM* vm, ValueArray items);
 
 ObjNativeLibrary* newNativeLibrary(VM* vm, NativeLibrary library);
 
+ObjFiber* newFiber(VM* vm, ObjClosure* entry);
+
+ObjTask* newTask(VM* vm, ObjClosure* closure);
+
+uint32_t hashString(const char* key, size_t length);
 FELINE_EXPORT ObjString* copyString(VM* vm, const char* str, size_t length);
 FELINE_EXPORT ObjString* takeString(VM* vm, char* str, size_t length);
 ObjString* makeStringf(VM* vm, const char* format, ...);
+// Moves the string's characters out to be shared, if they are not already, and takes a reference to them
+SharedChars* shareString(ObjString* string);
+// Gives a reference to shared characters over to a string in this VM, which is returned
+ObjString* adoptSharedString(VM* vm, SharedChars* shared, size_t length, uint32_t hash);
+void releaseSharedChars(SharedChars* shared);
 ObjString* makeStringvf(VM* vm, const char* format, va_list vsnargs);
 
 void printObject(VM* vm, Value value);
+const char* objTypeName(ObjType type);
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
@@ -134,6 +230,8 @@ void printObject(VM* vm, Value value);
 #define IS_BOUND_METHOD(value) isObjType(value, OBJ_BOUND_METHOD)
 #define IS_LIST(value) isObjType(value, OBJ_LIST)
 #define IS_NATIVE_LIBRARY(value) isObjType(value, OBJ_NATIVE_LIBRARY)
+#define IS_FIBER(value) isObjType(value, OBJ_FIBER)
+#define IS_TASK(value) isObjType(value, OBJ_TASK)
 
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->str)
@@ -145,4 +243,6 @@ void printObject(VM* vm, Value value);
 #define AS_INSTANCE(value) ((ObjInstance*)AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
 #define AS_LIST(value) ((ObjList*)AS_OBJ(value))
-#define AS_NATIVE_LIBRARY(value) (((ObjNativeLibrary*)AS_OBJ(value))->library)
\ No newline at end of file
+#define AS_NATIVE_LIBRARY(value) (((ObjNativeLibrary*)AS_OBJ(value))->library)
+#define AS_FIBER(value) ((ObjFiber*)AS_OBJ(value))
+#define AS_TASK(value) ((ObjTask*)AS_OBJ(value))
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "opcodeprofile.h"
+#include "disassemble.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define OPCODE_PROFILE_TOP_PAIRS 20
+
+void startOpcodeProfile(VM* vm, bool timing) {
+	OpcodeProfile* profile = (OpcodeProfile*)calloc(1, sizeof(OpcodeProfile));
+	if (profile == NULL) exit(1);
+
+	profile->timing = timing;
+	vm->opcodeProfile = profile;
+}
+
+// qsort() takes no context, so the comparators find the profile here; per thread, as isolates may report at once
+static _Thread_local OpcodeProfile* sortProfile;
+
+static int compareCounts(const void* a, const void* b) {
+	uint64_t left = sortProfile->counts[*(const size_t*)a];
+	uint64_t right = sortProfile->counts[*(const size_t*)b];
+	return (right > left) - (right < left);
+}
+
+static int comparePairs(const void* a, const void* b) {
+	size_t left = *(const size_t*)a;
+	size_t right = *(const size_t*)b;
+	uint64_t leftCount = sortProfile->pairs[left / OPCODE_COUNT][left % OPCODE_COUNT];
+	uint64_t rightCount = sortProfile->pairs[right / OPCODE_COUNT][right % OPCODE_COUNT];
+	return (rightCount > leftCount) - (rightCount < leftCount);
+}
+
+// The upper bound of the bucket holding the given fraction of an opcode's timed executions
+static uint64_t percentile(OpcodeProfile* profile, size_t opcode, double fraction) {
+	uint64_t total = 0;
+	for (size_t i = 0; i < OPCODE_PROFILE_BUCKETS; i++) {
+		total += profile->histogram[opcode][i];
+	}
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < OPCODE_PROFILE_BUCKETS; i++) {
+		seen += profile->histogram[opcode][i];
+		if (total != 0 && (double)seen >= fraction * (double)total) return (uint64_t)1 << i;
+	}
+	return 0;
+}
+
+static void printOpcodes(OpcodeProfile* profile) {
+	size_t order[OPCODE_COUNT];
+	uint64_t totalCount = 0;
+	uint64_t totalTicks = 0;
+	for (size_t i = 0; i < OPCODE_COUNT; i++) {
+		order[i] = i;
+		totalCount += profile->counts[i];
+		totalTicks += profile->ticks[i];
+	}
+	if (totalCount == 0) totalCount = 1;
+	if (totalTicks == 0) totalTicks = 1;
+
+	sortProfile = profile;
+	qsort(order, OPCODE_COUNT, sizeof(size_t), compareCounts);
+
+	if (profile->timing) {
+		fprintf(stderr, "  %-20s %14s %6s %16s %6s %8s %8s %8s\n", "opcode", "count", "%", "ticks", "%", "mean", "p50 <=", "p99 <=");
+	}
+	else {
+		fprintf(stderr, "  %-20s %14s %6s\n", "opcode", "count", "%");
+	}
+
+	for (size_t i = 0; i < OPCODE_COUNT; i++) {
+		size_t opcode = order[i];
+		uint64_t count = profile->counts[opcode];
+		if (count == 0) break;
+
+		if (profile->timing) {
+			fprintf(stderr, "  %-20s %14llu %5.1f%% %16llu %5.1f%% %8.1f %8llu %8llu\n", opcodeName((Opcode)opcode),
+				(unsigned long long)count, 100.0 * (double)count / (double)totalCount,
+				(unsigned long long)profile->ticks[opcode], 100.0 * (double)profile->ticks[opcode] / (double)totalTicks,
+				(double)profile->ticks[opcode] / (double)count,
+				(unsigned long long)percentile(profile, opcode, 0.5), (unsigned long long)percentile(profile, opcode, 0.99));
+		}
+		else {
+			fprintf(stderr, "  %-20s %14llu %5.1f%%\n", opcodeName((Opcode)opcode), (unsigned long long)count, 100.0 * (double)count / (double)totalCount);
+		}
+	}
+}
+
+static void printPairs(OpcodeProfile* profile) {
+	size_t* order = (size_t*)malloc(sizeof(size_t) * OPCODE_COUNT * OPCODE_COUNT);
+	if (order == NULL) exit(1);
+
+	uint64_t totalPairs = 0;
+	for (size_t i = 0; i < OPCODE_COUNT * OPCODE_COUNT; i++) {
+		order[i] = i;
+		totalPairs += profile->pairs[i / OPCODE_COUNT][i % OPCODE_COUNT];
+	}
+	if (totalPairs == 0) totalPairs = 1;
+
+	sortProfile = profile;
+	qsort(order, OPCODE_COUNT * OPCODE_COUNT, sizeof(size_t), comparePairs);
+
+	fprintf(stderr, "   Most common pairs:\n");
+	fprintf(stderr, "  %-20s %-20s %14s %6s\n", "first", "second", "count", "%");
+	for (size_t i = 0; i < OPCODE_PROFILE_TOP_PAIRS; i++) {
+		size_t first = order[i] / OPCODE_COUNT;
+		size_t second = order[i] % OPCODE_COUNT;
+		uint64_t count = profile->pairs[first][second];
+		if (count == 0) break;
+
+		fprintf(stderr, "  %-20s %-20s %14llu %5.1f%%\n", opcodeName((Opcode)first), opcodeName((Opcode)second),
+			(unsigned long long)count, 100.0 * (double)count / (double)totalPairs);
+	}
+
+	free(order);
+}
+
+void finishOpcodeProfile(VM* vm) {
+	OpcodeProfile* profile = vm->opcodeProfile;
+	if (profile == NULL) return;
+	vm->opcodeProfile = NULL;
+
+	fprintf(stderr, "-- Opcode Profile\n");
+	if (profile->timing) {
+		fprintf(stderr, "   Times are in ticks of the cycle counter, and include any natives an instruction calls\n");
+	}
+	printOpcodes(profile);
+	printPairs(profile);
+
+	free(profile);
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+#include "common.h"
+#include "opcode.h"
+#include "timer.h"
+#include "vm.h"
+
+// Counts every instruction run, and every pair of consecutive instructions, with the number of ticks
+// (see cycleCounter()) each took if timing is on. Only the profiled copy of the interpreter loop records anything,
+// and executeVM() only runs that copy once startOpcodeProfile() has been called.
+
+#define OPCODE_PROFILE_BUCKETS 32
+
+struct OpcodeProfile {
+	bool timing;
+	bool hasPrevious;
+	uint8_t previous;
+	uint64_t previousStart;
+
+	uint64_t counts[OPCODE_COUNT];
+	uint64_t ticks[OPCODE_COUNT];
+	// Bucket i holds the executions which took below 2^i ticks, and at least half that
+	uint64_t histogram[OPCODE_COUNT][OPCODE_PROFILE_BUCKETS];
+	uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT];
+};
+
+static inline size_t opcodeProfileBucket(uint64_t ticks) {
+	size_t bucket = 0;
+	while (ticks != 0 && bucket < OPCODE_PROFILE_BUCKETS - 1) {
+		ticks >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+// An instruction's time runs until the next one starts, so it includes any calls into natives it makes
+static inline void profileOpcode(OpcodeProfile* profile, uint8_t opcode) {
+	profile->counts[opcode]++;
+
+	if (profile->timing) {
+		uint64_t now = cycleCounter();
+		if (profile->hasPrevious) {
+			uint64_t elapsed = now - profile->previousStart;
+			profile->ticks[profile->previous] += elapsed;
+			profile->histogram[profile->previous][opcodeProfileBucket(elapsed)]++;
+		}
+		profile->previousStart = now;
+	}
+
+	if (profile->hasPrevious) {
+		profile->pairs[profile->previous][opcode]++;
+	}
+	profile->previous = opcode;
+	profile->hasPrevious = true;
+}
+
+void startOpcodeProfile(VM* vm, bool timing);
+// Prints the instructions by count, and the most common pairs, to stderr, and frees the profile
+void finishOpcodeProfile(VM* vm);
\ No newline at end of file
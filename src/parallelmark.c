@@ -0,0 +1,284 @@
+#include "parallelmark.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+// Objects moved between a worker's private stack and its stealable queue at a time
+#define MARK_PUBLISH_BATCH 64
+
+typedef struct MarkPool MarkPool;
+
+typedef struct MarkWorker {
+	MarkPool* pool;
+	thrd_t thread;
+
+	// Only ever touched by the owning thread
+	Obj** stack;
+	size_t count;
+	size_t capacity;
+
+	// Work other threads may steal, guarded by lock
+	mtx_t lock;
+	Obj** shared;
+	size_t sharedCapacity;
+	atomic_size_t sharedCount;
+} MarkWorker;
+
+struct MarkPool {
+	VM* vm;
+	// Worker 0 is the thread which started the trace
+	size_t workerCount;
+	MarkWorker* workers;
+
+	mtx_t lock;
+	cnd_t start;
+	cnd_t done;
+	size_t generation;
+	size_t finished;
+	bool shuttingDown;
+
+	atomic_size_t idle;
+};
+
+static _Thread_local MarkWorker* currentWorker = NULL;
+
+static void ensureCapacity(Obj*** items, size_t* capacity, size_t required) {
+	if (*capacity >= required) return;
+
+	while (*capacity < required) *capacity = GROW_CAPACITY(*capacity);
+	*items = (Obj**)realloc(*items, sizeof(Obj*) * *capacity);
+
+	if (*items == NULL) exit(1);
+}
+
+static void pushLocal(MarkWorker* worker, Obj* object) {
+	ensureCapacity(&worker->stack, &worker->capacity, worker->count + 1);
+	worker->stack[worker->count++] = object;
+}
+
+void markObjectParallel(VM* vm, Obj* object) {
+	// Whichever thread sets the bit owns the object
+	if (!heapTryMark(object)) return;
+
+	pushLocal(currentWorker, object);
+}
+
+// Moves the oldest half of the private stack to the shared queue, if it has run dry
+static void publish(MarkWorker* worker) {
+	if (worker->count < MARK_PUBLISH_BATCH * 2) return;
+	if (atomic_load_explicit(&worker->sharedCount, memory_order_relaxed) != 0) return;
+
+	size_t amount = worker->count / 2;
+
+	mtx_lock(&worker->lock);
+	size_t sharedCount = atomic_load_explicit(&worker->sharedCount, memory_order_relaxed);
+	ensureCapacity(&worker->shared, &worker->sharedCapacity, sharedCount + amount);
+	for (size_t i = 0; i < amount; i++) {
+		worker->shared[sharedCount + i] = worker->stack[i];
+	}
+	atomic_store_explicit(&worker->sharedCount, sharedCount + amount, memory_order_relaxed);
+	mtx_unlock(&worker->lock);
+
+	worker->count -= amount;
+	for (size_t i = 0; i < worker->count; i++) {
+		worker->stack[i] = worker->stack[i + amount];
+	}
+}
+
+// Takes up to half of victim's shared queue (or all of it, when victim is the thief) into thief's stack
+static bool steal(MarkWorker* thief, MarkWorker* victim) {
+	if (atomic_load_explicit(&victim->sharedCount, memory_order_relaxed) == 0) return false;
+
+	mtx_lock(&victim->lock);
+	size_t sharedCount = atomic_load_explicit(&victim->sharedCount, memory_order_relaxed);
+	size_t amount = victim == thief ? sharedCount : (sharedCount + 1) / 2;
+
+	ensureCapacity(&thief->stack, &thief->capacity, thief->count + amount);
+	for (size_t i = 0; i < amount; i++) {
+		thief->stack[thief->count++] = victim->shared[--sharedCount];
+	}
+	atomic_store_explicit(&victim->sharedCount, sharedCount, memory_order_relaxed);
+	mtx_unlock(&victim->lock);
+
+	return amount > 0;
+}
+
+static bool findWork(MarkWorker* worker) {
+	if (worker->count > 0) return true;
+	if (steal(worker, worker)) return true;
+
+	MarkPool* pool = worker->pool;
+	size_t self = worker - pool->workers;
+	for (size_t i = 1; i < pool->workerCount; i++) {
+		if (steal(worker, &pool->workers[(self + i) % pool->workerCount])) return true;
+	}
+	return false;
+}
+
+static bool anySharedWork(MarkPool* pool) {
+	for (size_t i = 0; i < pool->workerCount; i++) {
+		if (atomic_load_explicit(&pool->workers[i].sharedCount, memory_order_relaxed) != 0) return true;
+	}
+	return false;
+}
+
+// Work is only ever published by a worker which is not idle, so once every worker is idle no work is left
+static void drain(MarkWorker* worker) {
+	MarkPool* pool = worker->pool;
+
+	while (true) {
+		while (findWork(worker)) {
+			Obj* object = worker->stack[--worker->count];
+			object->isRemembered = false;
+			blackenObject(pool->vm, object);
+			publish(worker);
+		}
+
+		atomic_fetch_add(&pool->idle, 1);
+		while (true) {
+			if (atomic_load(&pool->idle) == pool->workerCount) return;
+
+			if (anySharedWork(pool)) {
+				atomic_fetch_sub(&pool->idle, 1);
+				break;
+			}
+			thrd_yield();
+		}
+	}
+}
+
+static int markThread(void* argument) {
+	MarkWorker* worker = (MarkWorker*)argument;
+	MarkPool* pool = worker->pool;
+	currentWorker = worker;
+
+	size_t generation = 0;
+
+	mtx_lock(&pool->lock);
+	while (true) {
+		while (pool->generation == generation && !pool->shuttingDown) {
+			cnd_wait(&pool->start, &pool->lock);
+		}
+		if (pool->shuttingDown) break;
+		generation = pool->generation;
+		mtx_unlock(&pool->lock);
+
+		drain(worker);
+
+		mtx_lock(&pool->lock);
+		pool->finished++;
+		cnd_signal(&pool->done);
+	}
+	mtx_unlock(&pool->lock);
+
+	return 0;
+}
+
+static void initWorker(MarkPool* pool, MarkWorker* worker) {
+	worker->pool = pool;
+	worker->stack = NULL;
+	worker->count = 0;
+	worker->capacity = 0;
+	worker->shared = NULL;
+	worker->sharedCapacity = 0;
+	atomic_init(&worker->sharedCount, 0);
+	mtx_init(&worker->lock, mtx_plain);
+}
+
+static void freeWorker(MarkWorker* worker) {
+	mtx_destroy(&worker->lock);
+	free(worker->stack);
+	free(worker->shared);
+}
+
+static MarkPool* newMarkPool(VM* vm) {
+	MarkPool* pool = (MarkPool*)malloc(sizeof(MarkPool));
+	if (pool == NULL) exit(1);
+
+	pool->vm = vm;
+	pool->workers = (MarkWorker*)malloc(sizeof(MarkWorker) * (vm->gcMarkThreads + 1));
+	if (pool->workers == NULL) exit(1);
+
+	mtx_init(&pool->lock, mtx_plain);
+	cnd_init(&pool->start);
+	cnd_init(&pool->done);
+	pool->generation = 0;
+	pool->finished = 0;
+	pool->shuttingDown = false;
+	atomic_init(&pool->idle, 0);
+
+	initWorker(pool, &pool->workers[0]);
+	pool->workerCount = 1;
+
+	// Marking still works with fewer helpers than asked for
+	for (size_t i = 1; i <= vm->gcMarkThreads; i++) {
+		MarkWorker* worker = &pool->workers[i];
+		initWorker(pool, worker);
+		if (thrd_create(&worker->thread, markThread, worker) != thrd_success) {
+			freeWorker(worker);
+			break;
+		}
+		pool->workerCount++;
+	}
+
+	return pool;
+}
+
+void parallelTraceReferences(VM* vm) {
+	if (vm->markPool == NULL) {
+		vm->markPool = newMarkPool(vm);
+	}
+	MarkPool* pool = vm->markPool;
+
+	// Deal the gray stack out between every worker
+	for (size_t i = 0; i < vm->grayCount; i++) {
+		pushLocal(&pool->workers[i % pool->workerCount], vm->grayStack[i]);
+	}
+	vm->grayCount = 0;
+
+	vm->markingInParallel = true;
+	currentWorker = &pool->workers[0];
+	atomic_store(&pool->idle, 0);
+
+	mtx_lock(&pool->lock);
+	pool->finished = 0;
+	pool->generation++;
+	cnd_broadcast(&pool->start);
+	mtx_unlock(&pool->lock);
+
+	drain(&pool->workers[0]);
+
+	mtx_lock(&pool->lock);
+	while (pool->finished < pool->workerCount - 1) {
+		cnd_wait(&pool->done, &pool->lock);
+	}
+	mtx_unlock(&pool->lock);
+
+	currentWorker = NULL;
+	vm->markingInParallel = false;
+}
+
+void freeMarkPool(VM* vm) {
+	MarkPool* pool = vm->markPool;
+	if (pool == NULL) return;
+
+	mtx_lock(&pool->lock);
+	pool->shuttingDown = true;
+	cnd_broadcast(&pool->start);
+	mtx_unlock(&pool->lock);
+
+	for (size_t i = 1; i < pool->workerCount; i++) {
+		thrd_join(pool->workers[i].thread, NULL);
+	}
+	for (size_t i = 0; i < pool->workerCount; i++) {
+		freeWorker(&pool->workers[i]);
+	}
+
+	cnd_destroy(&pool->start);
+	cnd_destroy(&pool->done);
+	mtx_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool);
+	vm->markPool = NULL;
+}
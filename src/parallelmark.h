@@ -0,0 +1,9 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// Drains the gray stack using VM.gcMarkThreads helper threads alongside the calling thread.
+// The mutator must be stopped for the duration.
+void parallelTraceReferences(VM* vm);
+void markObjectParallel(VM* vm, Obj* object);
+void freeMarkPool(VM* vm);
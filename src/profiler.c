@@ -0,0 +1,207 @@
+#include "profiler.h"
+#include "object.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <threads.h>
+
+#define PROFILE_MAX_LOAD 0.75
+
+typedef struct ProfileStack {
+	char* frames;
+	uint32_t hash;
+	size_t count;
+} ProfileStack;
+
+struct Profiler {
+	VM* vm;
+	const char* path;
+	size_t intervalMicros;
+
+	thrd_t thread;
+	atomic_bool stopping;
+
+	ProfileStack* stacks;
+	size_t stackCount;
+	size_t stackCapacity;
+	size_t samples;
+
+	// Reused for every sample
+	char* buffer;
+	size_t bufferCapacity;
+};
+
+static int watchThread(void* argument) {
+	Profiler* profiler = (Profiler*)argument;
+
+	struct timespec interval;
+	interval.tv_sec = (time_t)(profiler->intervalMicros / 1000000);
+	interval.tv_nsec = (long)(profiler->intervalMicros % 1000000) * 1000;
+
+	while (!atomic_load_explicit(&profiler->stopping, memory_order_relaxed)) {
+		thrd_sleep(&interval, NULL);
+		atomic_store_explicit(&profiler->vm->profileSampleDue, true, memory_order_relaxed);
+	}
+
+	return 0;
+}
+
+bool startProfiler(VM* vm, const char* path, size_t intervalMicros) {
+	Profiler* profiler = (Profiler*)malloc(sizeof(Profiler));
+	if (profiler == NULL) exit(1);
+
+	profiler->vm = vm;
+	profiler->path = path;
+	profiler->intervalMicros = intervalMicros == 0 ? 1 : intervalMicros;
+	atomic_init(&profiler->stopping, false);
+	profiler->stacks = NULL;
+	profiler->stackCount = 0;
+	profiler->stackCapacity = 0;
+	profiler->samples = 0;
+	profiler->buffer = NULL;
+	profiler->bufferCapacity = 0;
+
+	vm->profiler = profiler;
+
+	if (thrd_create(&profiler->thread, watchThread, profiler) != thrd_success) {
+		free(profiler);
+		vm->profiler = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static void append(Profiler* profiler, size_t* length, const char* format, ...) {
+	while (true) {
+		va_list args;
+		va_start(args, format);
+		int written = vsnprintf(profiler->buffer + *length, profiler->bufferCapacity - *length, format, args);
+		va_end(args);
+
+		if (written >= 0 && *length + (size_t)written < profiler->bufferCapacity) {
+			*length += (size_t)written;
+			return;
+		}
+
+		profiler->bufferCapacity *= 2;
+		profiler->buffer = (char*)realloc(profiler->buffer, profiler->bufferCapacity);
+		if (profiler->buffer == NULL) exit(1);
+	}
+}
+
+static uint32_t hashFrames(const char* frames, size_t length) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (uint8_t)frames[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+static ProfileStack* findStack(ProfileStack* stacks, size_t capacity, const char* frames, uint32_t hash) {
+	size_t index = hash & (capacity - 1);
+	while (true) {
+		ProfileStack* stack = &stacks[index];
+		if (stack->frames == NULL || (stack->hash == hash && strcmp(stack->frames, frames) == 0)) {
+			return stack;
+		}
+		index = (index + 1) & (capacity - 1);
+	}
+}
+
+static void growStacks(Profiler* profiler) {
+	size_t capacity = profiler->stackCapacity < 64 ? 64 : profiler->stackCapacity * 2;
+	ProfileStack* stacks = (ProfileStack*)calloc(capacity, sizeof(ProfileStack));
+	if (stacks == NULL) exit(1);
+
+	for (size_t i = 0; i < profiler->stackCapacity; i++) {
+		ProfileStack* stack = &profiler->stacks[i];
+		if (stack->frames == NULL) continue;
+		*findStack(stacks, capacity, stack->frames, stack->hash) = *stack;
+	}
+
+	free(profiler->stacks);
+	profiler->stacks = stacks;
+	profiler->stackCapacity = capacity;
+}
+
+void takeProfileSample(VM* vm) {
+	atomic_store_explicit(&vm->profileSampleDue, false, memory_order_relaxed);
+
+	Profiler* profiler = vm->profiler;
+	if (profiler == NULL) return;
+
+	if (profiler->buffer == NULL) {
+		profiler->bufferCapacity = 256;
+		profiler->buffer = (char*)malloc(profiler->bufferCapacity);
+		if (profiler->buffer == NULL) exit(1);
+	}
+
+	size_t length = 0;
+	profiler->buffer[0] = '\0';
+
+	for (size_t i = 0; i < vm->frames.length; i++) {
+		CallFrame* frame = &vm->frames.items[i];
+		ObjFunction* function = frame->closure->function;
+		Module* owner = frame->closure->owner;
+
+		size_t instruction = frame->ip - function->chunk.bytecode.items;
+		size_t line = getLineOfInstruction(&function->chunk, instruction > 0 ? instruction - 1 : 0);
+
+		// Semicolons separate frames in the folded format, and the last space on a line separates the count
+		append(profiler, &length, "%s%s (%s:%zu)", i == 0 ? "" : ";",
+			function->name != NULL ? function->name->str : "<script>",
+			owner != NULL && owner->name != NULL ? owner->name->str : "?", line);
+	}
+
+	if (profiler->stackCount + 1 > profiler->stackCapacity * PROFILE_MAX_LOAD) {
+		growStacks(profiler);
+	}
+
+	uint32_t hash = hashFrames(profiler->buffer, length);
+	ProfileStack* stack = findStack(profiler->stacks, profiler->stackCapacity, profiler->buffer, hash);
+	if (stack->frames == NULL) {
+		stack->frames = (char*)malloc(length + 1);
+		if (stack->frames == NULL) exit(1);
+		memcpy(stack->frames, profiler->buffer, length + 1);
+		stack->hash = hash;
+		stack->count = 0;
+		profiler->stackCount++;
+	}
+
+	stack->count++;
+	profiler->samples++;
+}
+
+void finishProfiler(VM* vm) {
+	Profiler* profiler = vm->profiler;
+	if (profiler == NULL) return;
+	vm->profiler = NULL;
+
+	atomic_store_explicit(&profiler->stopping, true, memory_order_relaxed);
+	thrd_join(profiler->thread, NULL);
+
+	FILE* file = fopen(profiler->path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Could not write profile to '%s'\n", profiler->path);
+	}
+	else {
+		for (size_t i = 0; i < profiler->stackCapacity; i++) {
+			ProfileStack* stack = &profiler->stacks[i];
+			if (stack->frames != NULL) {
+				fprintf(file, "%s %zu\n", stack->frames, stack->count);
+			}
+		}
+		fclose(file);
+		fprintf(stderr, "-- Profile\n   %zu samples of %zu stacks written to %s\n", profiler->samples, profiler->stackCount, profiler->path);
+	}
+
+	for (size_t i = 0; i < profiler->stackCapacity; i++) {
+		free(profiler->stacks[i].frames);
+	}
+	free(profiler->stacks);
+	free(profiler->buffer);
+	free(profiler);
+}
\ No newline at end of file
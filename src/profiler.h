@@ -0,0 +1,14 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// A watcher thread asks for a sample every interval; the interpreter takes it at its next call, return or loop
+// back-edge, where the frames are consistent, by walking vm->frames.
+// Stacks are counted in the folded format flamegraph tools read: one "outer;...;inner count" line per stack,
+// each frame written as "function (module:line)".
+
+// Returns false if the watcher thread could not be started
+bool startProfiler(VM* vm, const char* path, size_t intervalMicros);
+void takeProfileSample(VM* vm);
+// Writes the folded stacks and frees the profiler
+void finishProfiler(VM* vm);
\ No newline at end of file
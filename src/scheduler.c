@@ -0,0 +1,235 @@
+#include "scheduler.h"
+#include "memory.h"
+#include "tracer.h"
+#include "eventloop.h"
+#include <string.h>
+
+static void scheduleTask(VM* vm, ObjTask* task) {
+	task->state = TASK_READY;
+	task->next = NULL;
+
+	if (vm->lastReadyTask == NULL) {
+		vm->readyTasks = task;
+	}
+	else {
+		vm->lastReadyTask->next = task;
+		writeBarrier(vm, (Obj*)vm->lastReadyTask, OBJ_VAL(task));
+	}
+	vm->lastReadyTask = task;
+}
+
+bool startTask(VM* vm, ObjClosure* closure, uint8_t argCount) {
+	ObjTask* task = newTask(vm, closure);
+	push(vm, OBJ_VAL(task));
+
+	// The callee's slot and the arguments become the slots of its frame, as they would on the stack
+	size_t slotCount = (size_t)argCount + 1;
+	Value* slots = ALLOCATE(vm, Value, slotCount);
+	memcpy(slots, &vm->stack.items[vm->stack.length - 1 - slotCount], sizeof(Value) * slotCount);
+	task->slots = slots;
+	task->slotCount = slotCount;
+	rememberObject(vm, (Obj*)task);
+
+	pop(vm);
+	vm->stack.length -= slotCount;
+	push(vm, OBJ_VAL(task));
+
+	scheduleTask(vm, task);
+	return true;
+}
+
+static void suspendTask(VM* vm, ObjTask* task) {
+	CallFrame* frame = &vm->frames.items[vm->frames.length - 1];
+	size_t slotCount = vm->stack.length - frame->slotsOffset;
+
+	// Stays on the stack until it has been copied, so nothing in it can be collected in between
+	Value* slots = ALLOCATE(vm, Value, slotCount);
+	Value* base = &vm->stack.items[frame->slotsOffset];
+	memcpy(slots, base, sizeof(Value) * slotCount);
+	task->slots = slots;
+	task->slotCount = slotCount;
+
+	// Those open over its locals are the most recent, so are at the front of the list, and stay in order
+	ObjUpvalue** last = &task->openUpvalues;
+	while (vm->openUpvalues != NULL && vm->openUpvalues->location >= base) {
+		ObjUpvalue* upvalue = vm->openUpvalues;
+		vm->openUpvalues = upvalue->next;
+
+		upvalue->location = slots + (upvalue->location - base);
+		upvalue->task = task;
+		upvalue->next = NULL;
+		writeBarrier(vm, (Obj*)upvalue, OBJ_VAL(task));
+
+		*last = upvalue;
+		last = &upvalue->next;
+	}
+
+	task->frame = *frame;
+	// Back to the await, which runs again once the task is woken
+	task->frame.ip--;
+	if (task->frame.isTryBlock) task->frame.tryStackOffset -= frame->slotsOffset;
+	task->frame.slotsOffset = 0;
+	task->resumed = true;
+	rememberObject(vm, (Obj*)task);
+
+	if (vm->tracer != NULL) traceExitFunction(vm);
+	vm->stack.length = frame->slotsOffset;
+	vm->frames.length--;
+}
+
+// Pushes what the finished task returned, or throws what it threw
+static void takeResult(VM* vm, ObjTask* task) {
+	if (task->failed) {
+		vm->exception = task->result;
+		vm->hasException = true;
+	}
+	else {
+		push(vm, task->result);
+	}
+}
+
+bool awaitValue(VM* vm) {
+	ObjTask* task = vm->task;
+	Value awaited = peek(vm, 0);
+
+	if (task->resumed) {
+		task->resumed = false;
+		pop(vm);
+		if (IS_TASK(awaited)) takeResult(vm, AS_TASK(awaited));
+		else push(vm, awaited);
+		return false;
+	}
+
+	if (!IS_TASK(awaited)) {
+		scheduleTask(vm, task);
+		suspendTask(vm, task);
+		return true;
+	}
+
+	ObjTask* other = AS_TASK(awaited);
+	if (other->state == TASK_DONE) {
+		pop(vm);
+		takeResult(vm, other);
+		return false;
+	}
+
+	for (ObjTask* waiting = other; waiting != NULL; waiting = waiting->awaiting) {
+		if (waiting == task) {
+			throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_VALUE], "A task cannot await itself, nor a task which is awaiting it");
+			return false;
+		}
+	}
+
+	task->state = TASK_WAITING;
+	task->awaiting = other;
+	task->next = other->waiters;
+	other->waiters = task;
+	writeBarrier(vm, (Obj*)task, OBJ_VAL(other));
+	writeBarrier(vm, (Obj*)other, OBJ_VAL(task));
+
+	suspendTask(vm, task);
+	return true;
+}
+
+static void finishTask(VM* vm, ObjTask* task) {
+	task->state = TASK_DONE;
+	writeBarrier(vm, (Obj*)task, task->result);
+
+	// Woken in the order they started waiting
+	ObjTask* waiter = NULL;
+	while (task->waiters != NULL) {
+		ObjTask* next = task->waiters->next;
+		task->waiters->next = waiter;
+		waiter = task->waiters;
+		task->waiters = next;
+	}
+
+	while (waiter != NULL) {
+		ObjTask* next = waiter->next;
+		waiter->awaiting = NULL;
+		scheduleTask(vm, waiter);
+		waiter = next;
+	}
+}
+
+// Puts the task's frame back on top of the stack and runs it, until it suspends again or finishes
+static void runTask(VM* vm, ObjTask* task) {
+	ObjTask* outer = vm->task;
+	vm->task = task;
+	task->state = TASK_RUNNING;
+
+	size_t base = vm->stack.length;
+	for (size_t i = 0; i < task->slotCount; i++) {
+		push(vm, task->slots[i]);
+	}
+
+	Value* slots = &vm->stack.items[base];
+	if (task->openUpvalues != NULL) {
+		ObjUpvalue* last = NULL;
+		for (ObjUpvalue* upvalue = task->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+			upvalue->location = slots + (upvalue->location - task->slots);
+			upvalue->task = NULL;
+			upvalue->fiber = vm->fiber;
+			if (vm->fiber != NULL) writeBarrier(vm, (Obj*)upvalue, OBJ_VAL(vm->fiber));
+			last = upvalue;
+		}
+		last->next = vm->openUpvalues;
+		vm->openUpvalues = task->openUpvalues;
+		task->openUpvalues = NULL;
+	}
+
+	FREE_ARRAY(vm, Value, task->slots, task->slotCount);
+	task->slots = NULL;
+	task->slotCount = 0;
+
+	CallFrame frame = task->frame;
+	frame.slotsOffset = base;
+	if (frame.isTryBlock) frame.tryStackOffset += base;
+	writeCallFrameArray(vm, &vm->frames, frame);
+	if (vm->tracer != NULL) traceEnterFunction(vm, frame.closure);
+
+	executeVM(vm, vm->frames.length - 1);
+	vm->task = outer;
+
+	// Otherwise it suspended, and is queued or waiting
+	if (task->state != TASK_RUNNING) return;
+
+	if (vm->hasException) {
+		task->failed = true;
+		task->result = vm->exception;
+		vm->exception = NULL_VAL;
+		vm->hasException = false;
+	}
+	else {
+		task->result = pop(vm);
+	}
+	// A function returning into the scheduler leaves its locals behind
+	vm->stack.length = base;
+
+	finishTask(vm, task);
+}
+
+void runTasks(VM* vm) {
+	do {
+		while (vm->readyTasks != NULL) {
+			ObjTask* task = vm->readyTasks;
+			vm->readyTasks = task->next;
+			if (vm->readyTasks == NULL) vm->lastReadyTask = NULL;
+			task->next = NULL;
+
+			runTask(vm, task);
+		}
+	} while (pollTaskEvents(vm));
+}
+
+ObjTask* newOperationTask(VM* vm) {
+	ObjTask* task = newTask(vm, NULL);
+	task->state = TASK_WAITING;
+	return task;
+}
+
+void completeOperationTask(VM* vm, ObjTask* task, Value result, bool failed) {
+	task->result = result;
+	task->failed = failed;
+	finishTask(vm, task);
+}
\ No newline at end of file
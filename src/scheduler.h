@@ -0,0 +1,22 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// Async functions run as tasks, which are queued in the order they become ready and run one at a time by runTasks().
+// A task runs until it awaits something: a task which has not yet finished, which it then waits for, or any other
+// value, which puts it at the back of the queue so the others get a turn first.
+// I/O operations made by a task give a task of their own to await, which the event loop finishes once the operation
+// is done; while every task is waiting, the scheduler waits on the loop.
+
+// Used by calls to an async function, with the closure and its arguments on the stack, which are replaced by the task
+bool startTask(VM* vm, ObjClosure* closure, uint8_t argCount);
+// Used by OP_AWAIT, with the value on top of the stack. Returns true if the running task was suspended, in which case
+// its frame has been taken off the stack, and the interpreter loop, which the scheduler entered for it, returns.
+bool awaitValue(VM* vm);
+// Runs tasks until none are ready nor waiting on I/O; any left waiting after that could only be waiting on each other
+void runTasks(VM* vm);
+
+// The task for an operation, which is waiting until completeOperationTask() is called for it
+ObjTask* newOperationTask(VM* vm);
+// Finishes the operation's task with its result, or what it failed with, and wakes the tasks awaiting it
+void completeOperationTask(VM* vm, ObjTask* task, Value result, bool failed);
\ No newline at end of file
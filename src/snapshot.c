@@ -0,0 +1,134 @@
+#include "snapshot.h"
+#include "memory.h"
+#include "object.h"
+#include <stdio.h>
+#include <string.h>
+
+// Longest prefix of a string written as an object's name
+#define SNAPSHOT_NAME_LENGTH 40
+
+struct HeapSnapshot {
+	FILE* file;
+	bool inRoots;
+	bool inObjects;
+	bool firstEntry;
+	bool firstReference;
+};
+
+static void writeString(FILE* file, const char* str, size_t length) {
+	if (length > SNAPSHOT_NAME_LENGTH) {
+		length = SNAPSHOT_NAME_LENGTH;
+		// Never cut a UTF-8 sequence in two
+		while (length > 0 && ((unsigned char)str[length] & 0xC0) == 0x80) length--;
+	}
+
+	fputc('"', file);
+	for (size_t i = 0; i < length; i++) {
+		unsigned char c = (unsigned char)str[i];
+		if (c == '"' || c == '\\') {
+			fputc('\\', file);
+			fputc(c, file);
+		}
+		else if (c < 0x20) {
+			fprintf(file, "\\u%04x", c);
+		}
+		else {
+			fputc(c, file);
+		}
+	}
+	fputc('"', file);
+}
+
+static ObjString* objectName(Obj* object) {
+	switch (object->type) {
+		case OBJ_STRING: return (ObjString*)object;
+		case OBJ_FUNCTION: return ((ObjFunction*)object)->name;
+		case OBJ_CLOSURE: return ((ObjClosure*)object)->function->name;
+		case OBJ_CLASS: return ((ObjClass*)object)->name;
+		case OBJ_INSTANCE: return ((ObjInstance*)object)->clazz->name;
+		case OBJ_BOUND_METHOD: return ((ObjBoundMethod*)object)->method->function->name;
+		case OBJ_NATIVE: return ((ObjNative*)object)->name;
+		case OBJ_FIBER: return ((ObjFiber*)object)->entry->function->name;
+		case OBJ_TASK: {
+			ObjClosure* closure = ((ObjTask*)object)->frame.closure;
+			return closure != NULL ? closure->function->name : NULL;
+		}
+		case OBJ_UPVALUE:
+		case OBJ_LIST:
+		case OBJ_NATIVE_LIBRARY: return NULL;
+	}
+	return NULL;
+}
+
+static void beginEntry(HeapSnapshot* snapshot) {
+	fputs(snapshot->firstEntry ? "\n" : ",\n", snapshot->file);
+	snapshot->firstEntry = false;
+	snapshot->firstReference = true;
+}
+
+static void endRoots(HeapSnapshot* snapshot) {
+	if (snapshot->inRoots) {
+		fputs("]}", snapshot->file);
+		snapshot->inRoots = false;
+	}
+}
+
+void snapshotRoots(HeapSnapshot* snapshot, const char* label, ObjString* module) {
+	endRoots(snapshot);
+	beginEntry(snapshot);
+
+	fprintf(snapshot->file, "{\"label\":\"%s\"", label);
+	if (module != NULL) {
+		fputs(",\"module\":", snapshot->file);
+		writeString(snapshot->file, module->str, module->length);
+	}
+	fputs(",\"references\":[", snapshot->file);
+	snapshot->inRoots = true;
+}
+
+void snapshotBeginObject(HeapSnapshot* snapshot, Obj* object) {
+	if (!snapshot->inObjects) {
+		endRoots(snapshot);
+		fputs("\n],\"objects\":[", snapshot->file);
+		snapshot->inObjects = true;
+		snapshot->firstEntry = true;
+	}
+	beginEntry(snapshot);
+
+	fprintf(snapshot->file, "{\"id\":%" PRIuPTR ",\"type\":\"%s\",\"size\":%zu", (uintptr_t)object, objTypeName(object->type), objectFootprint(object));
+
+	ObjString* name = objectName(object);
+	if (name != NULL) {
+		fputs(",\"name\":", snapshot->file);
+		writeString(snapshot->file, name->str, name->length);
+	}
+	fputs(",\"references\":[", snapshot->file);
+}
+
+void snapshotReference(HeapSnapshot* snapshot, Obj* object) {
+	fprintf(snapshot->file, snapshot->firstReference ? "%" PRIuPTR : ",%" PRIuPTR, (uintptr_t)object);
+	snapshot->firstReference = false;
+}
+
+void snapshotEndObject(HeapSnapshot* snapshot) {
+	fputs("]}", snapshot->file);
+}
+
+bool writeHeapSnapshot(VM* vm, const char* path) {
+	FILE* file = fopen(path, "w");
+	if (file == NULL) return false;
+
+	HeapSnapshot snapshot = { file, false, false, true, true };
+
+	fputs("{\"version\":1,\"roots\":[", file);
+	traceHeapSnapshot(vm, &snapshot);
+
+	if (!snapshot.inObjects) {
+		endRoots(&snapshot);
+		fputs("\n],\"objects\":[", file);
+	}
+	fputs("\n]}\n", file);
+
+	bool written = !ferror(file);
+	return fclose(file) == 0 && written;
+}
\ No newline at end of file
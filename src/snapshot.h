@@ -0,0 +1,18 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// A heap snapshot is a JSON document of every reachable object, for finding what retains memory offline:
+// {"version":1,
+//  "roots":[{"label":"globals","module":"$main","references":[id,...]},...],
+//  "objects":[{"id":id,"type":"list","size":bytes,"name":"...","references":[id,...]},...]}
+// Ids are only meaningful within one snapshot. Sizes include what an object owns outside of its cell.
+
+// Runs a full collection to find what is reachable; returns false if the file could not be written
+bool writeHeapSnapshot(VM* vm, const char* path);
+
+// Called by the collector while it traces for a snapshot
+void snapshotRoots(HeapSnapshot* snapshot, const char* label, ObjString* module);
+void snapshotBeginObject(HeapSnapshot* snapshot, Obj* object);
+void snapshotReference(HeapSnapshot* snapshot, Obj* object);
+void snapshotEndObject(HeapSnapshot* snapshot);
\ No newline at end of file
@@ -0,0 +1,283 @@
+#include "sweeper.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+typedef struct Finalizer {
+	InstanceData* data;
+	bool onVMThread;
+} Finalizer;
+
+typedef struct FinalizerQueue {
+	Finalizer* items;
+	size_t head;
+	size_t count;
+	size_t capacity;
+} FinalizerQueue;
+
+struct Sweeper {
+	VM* vm;
+	thrd_t thread;
+
+	mtx_t lock;
+	cnd_t wake;
+	cnd_t idle;
+	bool shuttingDown;
+
+	// The next page to try to claim, or NULL once the sweeper has nothing left to sweep this epoch
+	HeapPage* cursor;
+	size_t epoch;
+	bool sweepingPage;
+
+	// Every finalizer, in the order their instances were found unreachable. The sweeper thread runs those at the head
+	// which it may, and the VM's thread those which must run on it, so neither runs while the other is running one.
+	FinalizerQueue finalizers;
+	bool finalizing;
+	// Set while the finalizer at the head must run on the VM's thread, and nothing else is running one
+	atomic_bool vmThreadTurn;
+
+	// Swept pages, and the bytes freed in them, waiting for the VM's thread to take them back
+	_Atomic(HeapPage*) sweptPages;
+	atomic_size_t freedBytes;
+};
+
+static void pushFinalizer(FinalizerQueue* queue, Finalizer finalizer) {
+	if (queue->head + queue->count == queue->capacity) {
+		if (queue->head > 0) {
+			memmove(queue->items, &queue->items[queue->head], sizeof(Finalizer) * queue->count);
+			queue->head = 0;
+		}
+		else {
+			queue->capacity = GROW_CAPACITY(queue->capacity);
+			queue->items = (Finalizer*)realloc(queue->items, sizeof(Finalizer) * queue->capacity);
+
+			if (queue->items == NULL) exit(1);
+		}
+	}
+
+	queue->items[queue->head + queue->count++] = finalizer;
+}
+
+static InstanceData* popFinalizer(FinalizerQueue* queue) {
+	InstanceData* data = queue->items[queue->head++].data;
+	if (--queue->count == 0) queue->head = 0;
+	return data;
+}
+
+// Whether the finalizer at the head of the queue can run now on the given thread; the lock must be held
+static bool canFinalize(Sweeper* sweeper, bool onVMThread) {
+	return sweeper->finalizers.count > 0 && !sweeper->finalizing
+		&& sweeper->finalizers.items[sweeper->finalizers.head].onVMThread == onVMThread;
+}
+
+// Runs the finalizer at the head of the queue with the lock released; the lock must be held
+static void runFinalizer(Sweeper* sweeper) {
+	InstanceData* data = popFinalizer(&sweeper->finalizers);
+	sweeper->finalizing = true;
+	mtx_unlock(&sweeper->lock);
+
+	data->freeData(data);
+
+	mtx_lock(&sweeper->lock);
+	sweeper->finalizing = false;
+	atomic_store_explicit(&sweeper->vmThreadTurn, canFinalize(sweeper, true), memory_order_relaxed);
+	// Wakes the other thread, in case the finalizer after this one is its to run
+	cnd_broadcast(&sweeper->idle);
+	cnd_signal(&sweeper->wake);
+}
+
+static void sweepClaimedPage(Sweeper* sweeper, HeapPage* page) {
+	size_t freed = sweepPageOffThread(sweeper->vm, page, sweeper->epoch);
+	atomic_fetch_add_explicit(&sweeper->freedBytes, freed, memory_order_relaxed);
+
+	HeapPage* head = atomic_load_explicit(&sweeper->sweptPages, memory_order_relaxed);
+	do {
+		page->nextSwept = head;
+	} while (!atomic_compare_exchange_weak_explicit(&sweeper->sweptPages, &head, page, memory_order_release, memory_order_relaxed));
+}
+
+static int sweepThread(void* argument) {
+	Sweeper* sweeper = (Sweeper*)argument;
+
+	mtx_lock(&sweeper->lock);
+	while (true) {
+		// Sweeping goes first, as the VM's thread may be waiting for it, while nothing waits on a finalizer
+		if (sweeper->cursor != NULL) {
+			// Pages are only ever added at the head of the list, so the rest of it stays put
+			HeapPage* page = sweeper->cursor;
+			sweeper->cursor = page->next;
+			sweeper->sweepingPage = true;
+			mtx_unlock(&sweeper->lock);
+
+			if (heapClaimSweep(page, sweeper->epoch)) {
+				sweepClaimedPage(sweeper, page);
+			}
+
+			mtx_lock(&sweeper->lock);
+			sweeper->sweepingPage = false;
+			cnd_broadcast(&sweeper->idle);
+		}
+		else if (canFinalize(sweeper, false)) {
+			runFinalizer(sweeper);
+		}
+		else if (sweeper->shuttingDown && sweeper->finalizers.count == 0) {
+			break;
+		}
+		else {
+			cnd_wait(&sweeper->wake, &sweeper->lock);
+		}
+	}
+	mtx_unlock(&sweeper->lock);
+
+	return 0;
+}
+
+static void initFinalizerQueue(FinalizerQueue* queue) {
+	queue->items = NULL;
+	queue->head = 0;
+	queue->count = 0;
+	queue->capacity = 0;
+}
+
+// Returns NULL if background sweeping is off, or the thread could not be started, in which case it is turned off
+static Sweeper* getSweeper(VM* vm) {
+	if (vm->sweeper != NULL || !vm->gcBackgroundSweep) return vm->sweeper;
+
+	Sweeper* sweeper = (Sweeper*)malloc(sizeof(Sweeper));
+	if (sweeper == NULL) exit(1);
+
+	sweeper->vm = vm;
+	mtx_init(&sweeper->lock, mtx_plain);
+	cnd_init(&sweeper->wake);
+	cnd_init(&sweeper->idle);
+	sweeper->shuttingDown = false;
+	sweeper->cursor = NULL;
+	sweeper->epoch = 0;
+	sweeper->sweepingPage = false;
+	initFinalizerQueue(&sweeper->finalizers);
+	sweeper->finalizing = false;
+	atomic_init(&sweeper->vmThreadTurn, false);
+	atomic_init(&sweeper->sweptPages, NULL);
+	atomic_init(&sweeper->freedBytes, 0);
+
+	if (thrd_create(&sweeper->thread, sweepThread, sweeper) != thrd_success) {
+		cnd_destroy(&sweeper->wake);
+		cnd_destroy(&sweeper->idle);
+		mtx_destroy(&sweeper->lock);
+		free(sweeper);
+		vm->gcBackgroundSweep = false;
+		return NULL;
+	}
+
+	vm->sweeper = sweeper;
+	return sweeper;
+}
+
+void startBackgroundSweep(VM* vm) {
+	Sweeper* sweeper = getSweeper(vm);
+	if (sweeper == NULL) return;
+
+	mtx_lock(&sweeper->lock);
+	sweeper->cursor = vm->heap.pages;
+	sweeper->epoch = vm->heap.epoch;
+	cnd_signal(&sweeper->wake);
+	mtx_unlock(&sweeper->lock);
+}
+
+// Runs the finalizers for the VM's thread at the head of the queue. When draining, it waits for the sweeper to run
+// those in between, until the queue is empty; otherwise it returns as soon as the head is the sweeper's.
+static void takeVMThreadTurn(Sweeper* sweeper, bool drain) {
+	mtx_lock(&sweeper->lock);
+	while (sweeper->finalizers.count > 0) {
+		if (canFinalize(sweeper, true)) {
+			runFinalizer(sweeper);
+		}
+		else if (drain) {
+			cnd_wait(&sweeper->idle, &sweeper->lock);
+		}
+		else {
+			break;
+		}
+	}
+	mtx_unlock(&sweeper->lock);
+}
+
+void runVMThreadFinalizers(VM* vm) {
+	Sweeper* sweeper = vm->sweeper;
+	if (sweeper != NULL && atomic_load_explicit(&sweeper->vmThreadTurn, memory_order_relaxed)) {
+		takeVMThreadTurn(sweeper, false);
+	}
+}
+
+bool collectBackgroundSweep(VM* vm) {
+	Sweeper* sweeper = vm->sweeper;
+	if (sweeper == NULL) return false;
+
+	runVMThreadFinalizers(vm);
+
+	if (atomic_load_explicit(&sweeper->sweptPages, memory_order_relaxed) == NULL) return false;
+
+	HeapPage* page = atomic_exchange_explicit(&sweeper->sweptPages, NULL, memory_order_acquire);
+	vm->bytesAllocated -= atomic_exchange_explicit(&sweeper->freedBytes, 0, memory_order_relaxed);
+
+	while (page != NULL) {
+		HeapPage* next = page->nextSwept;
+		page->nextSwept = NULL;
+		heapMakeAvailable(&vm->heap, page);
+		page = next;
+	}
+
+	return true;
+}
+
+void finishBackgroundSweep(VM* vm) {
+	Sweeper* sweeper = vm->sweeper;
+	if (sweeper == NULL) return;
+
+	mtx_lock(&sweeper->lock);
+	sweeper->cursor = NULL;
+	while (sweeper->sweepingPage) {
+		cnd_wait(&sweeper->idle, &sweeper->lock);
+	}
+	mtx_unlock(&sweeper->lock);
+
+	collectBackgroundSweep(vm);
+}
+
+void queueFinalizer(VM* vm, InstanceData* data, bool onVMThread) {
+	Sweeper* sweeper = getSweeper(vm);
+	if (sweeper == NULL) {
+		data->freeData(data);
+		return;
+	}
+
+	mtx_lock(&sweeper->lock);
+	pushFinalizer(&sweeper->finalizers, (Finalizer){ data, onVMThread });
+	atomic_store_explicit(&sweeper->vmThreadTurn, canFinalize(sweeper, true), memory_order_relaxed);
+	cnd_signal(&sweeper->wake);
+	mtx_unlock(&sweeper->lock);
+}
+
+void freeSweeper(VM* vm) {
+	Sweeper* sweeper = vm->sweeper;
+	if (sweeper == NULL) return;
+
+	// The thread only exits once the queue of finalizers is empty, which this thread helps it reach
+	mtx_lock(&sweeper->lock);
+	sweeper->cursor = NULL;
+	sweeper->shuttingDown = true;
+	cnd_signal(&sweeper->wake);
+	mtx_unlock(&sweeper->lock);
+
+	takeVMThreadTurn(sweeper, true);
+	thrd_join(sweeper->thread, NULL);
+
+	cnd_destroy(&sweeper->wake);
+	cnd_destroy(&sweeper->idle);
+	mtx_destroy(&sweeper->lock);
+	free(sweeper->finalizers.items);
+	free(sweeper);
+	vm->sweeper = NULL;
+}
\ No newline at end of file
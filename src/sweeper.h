@@ -0,0 +1,28 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// Once major marking has finished, a background thread sweeps pages alongside the mutator.
+// It races the VM's thread for each page, so whichever reaches a page first sweeps it.
+//
+// Native finalizers (InstanceData.freeData) also run on the sweeper thread, so an expensive one never stalls the mutator:
+// - They run one at a time, in the order their instances were found unreachable, whichever thread swept them.
+// - Native data set with export_setInstanceNativeDataSync() is freed on the VM's thread instead, once those before it
+//   have run: at the next minor collection, or the next time the VM's thread takes back swept pages, which may be
+//   after the collection which found it unreachable has ended.
+// - Native libraries are only unloaded by freeVM(), once every pending finalizer has run.
+// Without background sweeping, every finalizer runs on the VM's thread as its instance is swept.
+
+void startBackgroundSweep(VM* vm);
+// Takes back the pages the sweeper has finished with; returns whether there were any
+bool collectBackgroundSweep(VM* vm);
+// Runs the finalizers at the head of the queue which must run on the VM's thread, if any
+void runVMThreadFinalizers(VM* vm);
+// Stops the sweeper once the page it holds is done, then takes everything back
+void finishBackgroundSweep(VM* vm);
+
+// Used by either thread; onVMThread is for native data which must be freed on the VM's thread
+void queueFinalizer(VM* vm, InstanceData* data, bool onVMThread);
+
+// Runs every pending finalizer before returning
+void freeSweeper(VM* vm);
\ No newline at end of file
@@ -146,7 +146,7 @@ void markTable(VM* vm, Table* table) {
 void tableRemoveWhite(VM* vm, Table* table) {
 	for (size_t i = 0; i < table->capacity; i++) {
 		Entry* entry = &table->entries[i];
-		if (entry->key != NULL && !entry->key->obj.isMarked) {
+		if (entry->key != NULL && !isMarked(&entry->key->obj)) {
 			tableDelete(vm, table, entry->key);
 		}
 	}
@@ -0,0 +1,213 @@
+#include "taskpool.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct TaskWorker {
+	thrd_t thread;
+
+	// A ring of queued tasks, guarded by lock: the owner takes from the back, thieves from the front
+	mtx_t lock;
+	Task** tasks;
+	size_t capacity;
+	size_t front;
+	size_t count;
+} TaskWorker;
+
+typedef struct TaskPool {
+	size_t workerCount;
+	TaskWorker* workers;
+
+	mtx_t lock;
+	cnd_t wake;
+	// Submitted but not yet taken; only raised under lock, and before the tasks are queued, so none is missed
+	atomic_size_t queued;
+	size_t nextWorker;
+	bool stopping;
+} TaskPool;
+
+static TaskPool pool;
+static once_flag poolStarted = ONCE_FLAG_INIT;
+static atomic_bool running = false;
+static size_t requestedSize = 0;
+
+static _Thread_local TaskWorker* currentWorker = NULL;
+
+static size_t processorCount(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (size_t)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (size_t)count : 1;
+#endif
+}
+
+void setTaskPoolSize(size_t workers) {
+	requestedSize = workers;
+}
+
+size_t taskPoolSize(void) {
+	if (atomic_load(&running)) return pool.workerCount;
+	if (requestedSize != 0) return requestedSize;
+
+	// The thread which submits the tasks helps run them, so takes the last processor
+	size_t processors = processorCount();
+	return processors > 1 ? processors - 1 : 1;
+}
+
+bool isTaskWorker(void) {
+	return currentWorker != NULL;
+}
+
+static void queueTask(TaskWorker* worker, Task* task) {
+	mtx_lock(&worker->lock);
+	if (worker->count == worker->capacity) {
+		size_t oldCapacity = worker->capacity;
+		Task** tasks = malloc(sizeof(Task*) * GROW_CAPACITY(oldCapacity));
+		if (tasks == NULL) exit(1);
+		for (size_t i = 0; i < worker->count; i++) {
+			tasks[i] = worker->tasks[(worker->front + i) % oldCapacity];
+		}
+		free(worker->tasks);
+		worker->tasks = tasks;
+		worker->capacity = GROW_CAPACITY(oldCapacity);
+		worker->front = 0;
+	}
+	worker->tasks[(worker->front + worker->count) % worker->capacity] = task;
+	worker->count++;
+	mtx_unlock(&worker->lock);
+}
+
+static Task* takeTask(TaskWorker* worker, bool fromFront) {
+	mtx_lock(&worker->lock);
+	Task* task = NULL;
+	if (worker->count > 0) {
+		if (fromFront) {
+			task = worker->tasks[worker->front];
+			worker->front = (worker->front + 1) % worker->capacity;
+		}
+		else {
+			task = worker->tasks[(worker->front + worker->count - 1) % worker->capacity];
+		}
+		worker->count--;
+	}
+	mtx_unlock(&worker->lock);
+	return task;
+}
+
+static Task* findTask(TaskWorker* worker) {
+	Task* task = takeTask(worker, false);
+
+	size_t self = worker - pool.workers;
+	for (size_t i = 1; task == NULL && i < pool.workerCount; i++) {
+		task = takeTask(&pool.workers[(self + i) % pool.workerCount], true);
+	}
+
+	if (task != NULL) atomic_fetch_sub(&pool.queued, 1);
+	return task;
+}
+
+static int workerThread(void* argument) {
+	TaskWorker* worker = (TaskWorker*)argument;
+	currentWorker = worker;
+
+	VM vm;
+	initVM(&vm);
+
+	while (true) {
+		Task* task = findTask(worker);
+		if (task != NULL) {
+			task->run(&vm, task);
+			continue;
+		}
+
+		mtx_lock(&pool.lock);
+		while (atomic_load(&pool.queued) == 0 && !pool.stopping) {
+			cnd_wait(&pool.wake, &pool.lock);
+		}
+		bool stop = pool.stopping && atomic_load(&pool.queued) == 0;
+		mtx_unlock(&pool.lock);
+
+		if (stop) break;
+		// A task counted but not yet queued is moments away
+		thrd_yield();
+	}
+
+	freeVM(&vm);
+	return 0;
+}
+
+static void startPool(void) {
+	pool.workerCount = taskPoolSize();
+	pool.workers = malloc(sizeof(TaskWorker) * pool.workerCount);
+	if (pool.workers == NULL) exit(1);
+
+	mtx_init(&pool.lock, mtx_plain);
+	cnd_init(&pool.wake);
+	atomic_init(&pool.queued, 0);
+	pool.nextWorker = 0;
+	pool.stopping = false;
+
+	for (size_t i = 0; i < pool.workerCount; i++) {
+		TaskWorker* worker = &pool.workers[i];
+		mtx_init(&worker->lock, mtx_plain);
+		worker->tasks = NULL;
+		worker->capacity = 0;
+		worker->front = 0;
+		worker->count = 0;
+	}
+
+	for (size_t i = 0; i < pool.workerCount; i++) {
+		if (thrd_create(&pool.workers[i].thread, workerThread, &pool.workers[i]) != thrd_success) {
+			fprintf(stderr, "Could not start task pool worker %zu\n", i);
+			exit(1);
+		}
+	}
+
+	atomic_store(&running, true);
+}
+
+void submitTasks(Task** tasks, size_t count) {
+	call_once(&poolStarted, startPool);
+
+	mtx_lock(&pool.lock);
+	atomic_fetch_add(&pool.queued, count);
+	for (size_t i = 0; i < count; i++) {
+		queueTask(&pool.workers[pool.nextWorker], tasks[i]);
+		pool.nextWorker = (pool.nextWorker + 1) % pool.workerCount;
+	}
+	cnd_broadcast(&pool.wake);
+	mtx_unlock(&pool.lock);
+}
+
+void stopTaskPool(void) {
+	if (!atomic_load(&running)) return;
+
+	mtx_lock(&pool.lock);
+	pool.stopping = true;
+	cnd_broadcast(&pool.wake);
+	mtx_unlock(&pool.lock);
+
+	// Each may still look through the others' queues until it stops, so none is freed until all have
+	for (size_t i = 0; i < pool.workerCount; i++) {
+		thrd_join(pool.workers[i].thread, NULL);
+	}
+	for (size_t i = 0; i < pool.workerCount; i++) {
+		mtx_destroy(&pool.workers[i].lock);
+		free(pool.workers[i].tasks);
+	}
+
+	cnd_destroy(&pool.wake);
+	mtx_destroy(&pool.lock);
+	free(pool.workers);
+	atomic_store(&running, false);
+}
\ No newline at end of file
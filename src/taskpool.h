@@ -0,0 +1,27 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// A pool of worker threads shared by every isolate in the process, each of which owns a VM to run tasks in.
+// Tasks are queued on the workers in turn; a worker takes the newest of its own first, and when it has none left
+// steals the oldest of another's. The pool starts the first time tasks are submitted.
+
+typedef struct Task Task;
+
+// Runs on a worker's thread, in its VM
+typedef void (*TaskRun)(VM* vm, Task* task);
+
+// Embedded at the start of a larger struct, which the run function casts back to
+struct Task {
+	TaskRun run;
+};
+
+// Only has an effect before the pool has started; 0 picks one fewer than the processors, but at least one
+void setTaskPoolSize(size_t workers);
+size_t taskPoolSize(void);
+// True on the pool's own threads, where a task must not wait on others which could be queued behind it
+bool isTaskWorker(void);
+
+void submitTasks(Task** tasks, size_t count);
+// Waits for the workers to finish what is queued, then frees them and their VMs
+void stopTaskPool(void);
\ No newline at end of file
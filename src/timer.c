@@ -0,0 +1,31 @@
+#include "timer.h"
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+uint64_t monotonicNanoseconds(void) {
+	// Not cached in a static, which isolates on other threads would race to fill
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+
+	// Split to avoid overflowing the multiplication
+	uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+	uint64_t remainder = counter.QuadPart % frequency.QuadPart;
+	return seconds * 1000000000 + remainder * 1000000000 / frequency.QuadPart;
+}
+
+#else
+
+#include <time.h>
+
+uint64_t monotonicNanoseconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+#endif
\ No newline at end of file
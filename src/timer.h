@@ -0,0 +1,24 @@
+#pragma once
+#include "common.h"
+
+// Nanoseconds since an arbitrary fixed point; only differences between calls are meaningful.
+uint64_t monotonicNanoseconds(void);
+
+
+// A cheap, fine grained tick count for timing short stretches of code, such as a single instruction.
+// Ticks are CPU cycles where the timestamp counter can be read, and nanoseconds elsewhere.
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+static inline uint64_t cycleCounter(void) {
+	return __rdtsc();
+}
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+static inline uint64_t cycleCounter(void) {
+	return __rdtsc();
+}
+#else
+static inline uint64_t cycleCounter(void) {
+	return monotonicNanoseconds();
+}
+#endif
\ No newline at end of file
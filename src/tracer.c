@@ -0,0 +1,210 @@
+#include "tracer.h"
+#include "memory.h"
+#include "object.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum SpanType {
+	SPAN_FUNCTION,
+	SPAN_NATIVE,
+	SPAN_NAMED,
+} SpanType;
+
+typedef struct TraceSpan {
+	SpanType type;
+	uint64_t start;
+	// The closure or native being run, kept alive by its frame or the stack until the span ends
+	Obj* subject;
+	const char* name;
+	const char* category;
+	char* detail;
+} TraceSpan;
+
+struct Tracer {
+	FILE* file;
+	uint64_t startTime;
+	uint64_t minDuration;
+	bool firstEvent;
+
+	TraceSpan* spans;
+	size_t spanCount;
+	size_t spanCapacity;
+};
+
+static void writeString(FILE* file, const char* str) {
+	fputc('"', file);
+	for (const unsigned char* c = (const unsigned char*)str; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', file);
+			fputc(*c, file);
+		}
+		else if (*c < 0x20) {
+			fprintf(file, "\\u%04x", *c);
+		}
+		else {
+			fputc(*c, file);
+		}
+	}
+	fputc('"', file);
+}
+
+// Timestamps are in microseconds since the tracer started
+static void beginEvent(Tracer* tracer, const char* name, const char* category, uint64_t start, uint64_t end) {
+	FILE* file = tracer->file;
+	fputs(tracer->firstEvent ? "\n" : ",\n", file);
+	tracer->firstEvent = false;
+
+	fputs("{\"name\":", file);
+	writeString(file, name);
+	fputs(",\"cat\":", file);
+	writeString(file, category);
+	fprintf(file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1",
+		(double)(start - tracer->startTime) / 1000.0, (double)(end - start) / 1000.0);
+}
+
+bool startTracer(VM* vm, const char* path, size_t minDurationMicros) {
+	FILE* file = fopen(path, "w");
+	if (file == NULL) return false;
+
+	Tracer* tracer = (Tracer*)malloc(sizeof(Tracer));
+	if (tracer == NULL) exit(1);
+
+	tracer->file = file;
+	tracer->startTime = monotonicNanoseconds();
+	tracer->minDuration = (uint64_t)minDurationMicros * 1000;
+	tracer->firstEvent = true;
+	tracer->spans = NULL;
+	tracer->spanCount = 0;
+	tracer->spanCapacity = 0;
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+	vm->tracer = tracer;
+	return true;
+}
+
+static void pushSpan(Tracer* tracer, SpanType type, Obj* subject, const char* name, const char* category, const char* detail) {
+	if (tracer->spanCount == tracer->spanCapacity) {
+		tracer->spanCapacity = GROW_CAPACITY(tracer->spanCapacity);
+		tracer->spans = (TraceSpan*)realloc(tracer->spans, sizeof(TraceSpan) * tracer->spanCapacity);
+
+		if (tracer->spans == NULL) exit(1);
+	}
+
+	TraceSpan* span = &tracer->spans[tracer->spanCount++];
+	span->type = type;
+	span->subject = subject;
+	span->name = name;
+	span->category = category;
+	span->detail = NULL;
+
+	if (detail != NULL) {
+		span->detail = (char*)malloc(strlen(detail) + 1);
+		if (span->detail == NULL) exit(1);
+		strcpy(span->detail, detail);
+	}
+
+	// Taken last, so that the tracer's own work is not counted in the span
+	span->start = monotonicNanoseconds();
+}
+
+static void writeSpan(Tracer* tracer, TraceSpan* span, uint64_t end) {
+	FILE* file = tracer->file;
+
+	switch (span->type) {
+		case SPAN_FUNCTION: {
+			ObjClosure* closure = (ObjClosure*)span->subject;
+			Module* owner = closure->owner;
+			beginEvent(tracer, closure->function->name != NULL ? closure->function->name->str : "<script>", "function", span->start, end);
+
+			char module[512];
+			snprintf(module, sizeof(module), "%s%s.fn",
+				owner != NULL && owner->directory != NULL ? owner->directory->str : "",
+				owner != NULL && owner->name != NULL ? owner->name->str : "?");
+			fputs(",\"args\":{\"module\":", file);
+			writeString(file, module);
+			fputc('}', file);
+			break;
+		}
+		case SPAN_NATIVE: {
+			ObjNative* native = (ObjNative*)span->subject;
+			beginEvent(tracer, native->name != NULL ? native->name->str : "<native>", "native", span->start, end);
+			break;
+		}
+		case SPAN_NAMED: {
+			beginEvent(tracer, span->name, span->category, span->start, end);
+			if (span->detail != NULL) {
+				fputs(",\"args\":{\"detail\":", file);
+				writeString(file, span->detail);
+				fputc('}', file);
+			}
+			break;
+		}
+	}
+
+	fputc('}', file);
+}
+
+static void popSpan(Tracer* tracer, SpanType type) {
+	uint64_t end = monotonicNanoseconds();
+
+	// Spans nest, so a mismatch means a begin or end was missed; the span is dropped rather than mislabelled
+	if (tracer->spanCount == 0) return;
+	TraceSpan* span = &tracer->spans[--tracer->spanCount];
+
+	if (span->type == type && end - span->start >= tracer->minDuration) {
+		writeSpan(tracer, span, end);
+	}
+	free(span->detail);
+}
+
+void traceEnterFunction(VM* vm, ObjClosure* closure) {
+	pushSpan(vm->tracer, SPAN_FUNCTION, (Obj*)closure, NULL, NULL, NULL);
+}
+
+void traceExitFunction(VM* vm) {
+	popSpan(vm->tracer, SPAN_FUNCTION);
+}
+
+void traceEnterNative(VM* vm, ObjNative* native) {
+	pushSpan(vm->tracer, SPAN_NATIVE, (Obj*)native, NULL, NULL, NULL);
+}
+
+void traceExitNative(VM* vm) {
+	popSpan(vm->tracer, SPAN_NATIVE);
+}
+
+void traceBegin(VM* vm, const char* name, const char* category, const char* detail) {
+	pushSpan(vm->tracer, SPAN_NAMED, NULL, name, category, detail);
+}
+
+void traceEnd(VM* vm) {
+	popSpan(vm->tracer, SPAN_NAMED);
+}
+
+void traceComplete(VM* vm, const char* name, const char* category, uint64_t start, uint64_t end) {
+	Tracer* tracer = vm->tracer;
+	if (end - start < tracer->minDuration) return;
+
+	beginEvent(tracer, name, category, start, end);
+	fputc('}', tracer->file);
+}
+
+void finishTracer(VM* vm) {
+	Tracer* tracer = vm->tracer;
+	if (tracer == NULL) return;
+
+	uint64_t end = monotonicNanoseconds();
+	while (tracer->spanCount > 0) {
+		TraceSpan* span = &tracer->spans[--tracer->spanCount];
+		if (end - span->start >= tracer->minDuration) writeSpan(tracer, span, end);
+		free(span->detail);
+	}
+
+	fputs("\n]}\n", tracer->file);
+	fclose(tracer->file);
+	free(tracer->spans);
+	free(tracer);
+	vm->tracer = NULL;
+}
\ No newline at end of file
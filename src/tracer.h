@@ -0,0 +1,28 @@
+#pragma once
+#include "common.h"
+#include "vm.h"
+
+// Records calls to functions and natives, imports and the compiles they do, and GC pauses, as complete ("X") events
+// in the Chrome trace-event format, which chrome://tracing and Perfetto open.
+// Events are written as they end, so only those lasting at least the minimum duration are kept.
+// Nothing is recorded unless startTracer() has been called.
+
+// Returns false if the file could not be opened
+bool startTracer(VM* vm, const char* path, size_t minDurationMicros);
+
+// Called once a closure's frame has been pushed, and as a frame is popped, whether by returning or unwinding
+void traceEnterFunction(VM* vm, ObjClosure* closure);
+void traceExitFunction(VM* vm);
+
+void traceEnterNative(VM* vm, ObjNative* native);
+void traceExitNative(VM* vm);
+
+// A span named for what the VM is doing, such as an import, with detail copied into its arguments
+void traceBegin(VM* vm, const char* name, const char* category, const char* detail);
+void traceEnd(VM* vm);
+
+// An event which has already finished, such as a GC pause, between two monotonicNanoseconds() readings
+void traceComplete(VM* vm, const char* name, const char* category, uint64_t start, uint64_t end);
+
+// Ends any spans still open, finishes the file and frees the tracer
+void finishTracer(VM* vm);
\ No newline at end of file
@@ -3,9 +3,25 @@
 #include "object.h"
 #include "memory.h"
 #include "file.h"
+#include "codesegment.h"
+#include "bytecodecache.h"
 #include "builtin/objectclass.h"
 #include "builtin/importclass.h"
+#include "builtin/channelclass.h"
 #include "builtin/listnatives.h"
+#include "builtin/fibernatives.h"
+#include "builtin/gcmodule.h"
+#include "builtin/benchmodule.h"
+#include "builtin/parallelmodule.h"
+#include "builtin/iomodule.h"
+#include "builtin/taskmodule.h"
+#include "eventloop.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "allocprofile.h"
+#include "profiler.h"
+#include "opcodeprofile.h"
+#include "tracer.h"
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
@@ -29,25 +45,83 @@ void buildInternalStrings(VM* vm) {
 	vm->internalStrings[INTERNAL_STR_STACK_OVERFLOW_EXCEPTION] = copyString(vm, "StackOverflowException", 22);
 	vm->internalStrings[INTERNAL_STR_LINK_FAILURE_EXCEPTION] = copyString(vm, "LinkFailureException", 20);
 	vm->internalStrings[INTERNAL_STR_VALUE_EXCEPTION] = copyString(vm, "ValueException", 14);
+	vm->internalStrings[INTERNAL_STR_OUT_OF_MEMORY_EXCEPTION] = copyString(vm, "OutOfMemoryException", 20);
+	vm->internalStrings[INTERNAL_STR_IO_EXCEPTION] = copyString(vm, "IOException", 11);
 
 	vm->internalStrings[INTERNAL_STR_REASON] = copyString(vm, "reason", 6);
 
 	vm->internalStrings[INTERNAL_STR_OBJECT] = copyString(vm, "Object", 6);
 	vm->internalStrings[INTERNAL_STR_IMPORT] = copyString(vm, "Import", 6);
 	vm->internalStrings[INTERNAL_STR_THIS_MODULE] = copyString(vm, "THIS_MODULE", 11);
+	vm->internalStrings[INTERNAL_STR_GC] = copyString(vm, "gc", 2);
+	vm->internalStrings[INTERNAL_STR_BENCH] = copyString(vm, "bench", 5);
+	vm->internalStrings[INTERNAL_STR_CHANNEL] = copyString(vm, "Channel", 7);
+	vm->internalStrings[INTERNAL_STR_PARALLEL] = copyString(vm, "parallel", 8);
+	vm->internalStrings[INTERNAL_STR_IO] = copyString(vm, "io", 2);
+	vm->internalStrings[INTERNAL_STR_HANDLE] = copyString(vm, "Handle", 6);
+	vm->internalStrings[INTERNAL_STR_TASKS] = copyString(vm, "tasks", 5);
 }
 
 void initVM(VM* vm) {
-	vm->objects = NULL;
+	initHeap(&vm->heap);
+
+	vm->gcInitialHeap = 1024 * 1024;
+	vm->gcGrowthFactor = 2.0;
+	vm->gcMaxHeap = 0;
+	vm->gcPauseTarget = 1000;
 
 	vm->bytesAllocated = 0;
-	vm->nextGC = 1024 * 1024;
+	vm->nextGC = vm->gcInitialHeap;
+	vm->nextMinorGC = 256 * 1024;
+	vm->nextGCStep = 0;
+
+	vm->gcPhase = GC_PHASE_IDLE;
+	vm->gcHeapLimit = 0;
+	vm->gcStepWork = 0;
+	vm->gcCycleSlices = 0;
+	vm->gcCycleStartBytes = 0;
+	vm->gcFloatingBytes = 0;
+	vm->gcReserveEnd = 0;
+	vm->gcPendingOutOfMemory = 0;
+	vm->sweepCursor = NULL;
+	for (size_t i = 0; i < GC_PAUSE_BUCKETS; i++) vm->gcPauseHistogram[i] = 0;
+	vm->gcCounters = (GCCounters) { 0 };
+
+	vm->gcLog = NULL;
+	vm->gcLogStartTime = monotonicNanoseconds();
+	vm->gcCycleStartTime = 0;
+	vm->gcCyclePauseNanos = 0;
+	vm->gcCycleToLog = false;
+	vm->heapSnapshot = NULL;
+	vm->allocProfiler = NULL;
+	vm->profiler = NULL;
+	vm->opcodeProfile = NULL;
+	vm->tracer = NULL;
+	atomic_init(&vm->profileSampleDue, false);
 
 	vm->grayCount = 0;
 	vm->grayCapacity = 0;
 	vm->grayStack = NULL;
 
+	vm->gcMarkThreads = 0;
+	vm->markPool = NULL;
+	vm->markingInParallel = false;
+
+	vm->gcBackgroundSweep = true;
+	vm->sweeper = NULL;
+
+	vm->rememberedCount = 0;
+	vm->rememberedCapacity = 0;
+	vm->rememberedSet = NULL;
+
 	vm->openUpvalues = NULL;
+	vm->startTime = monotonicNanoseconds();
+	vm->isolateIndex = 0;
+	vm->isolateCount = 1;
+	vm->codeSegment = NULL;
+	vm->bytecodeCache = false;
+	vm->bytecodeCacheDirectory = NULL;
+
 	vm->lowestLevelCompiler = NULL;
 	
 	vm->baseDirectory = NULL;
@@ -56,6 +130,7 @@ void initVM(VM* vm) {
 	for (size_t i = 0; i < INTERNAL_STR__COUNT; i++) vm->internalStrings[i] = NULL;
 	for (size_t i = 0; i < INTERNAL_EXCEPTION__COUNT; i++) vm->internalExceptions[i] = NULL;
 	for (size_t i = 0; i < INTERNAL_CLASS__COUNT; i++) vm->internalClasses[i] = NULL;
+	for (size_t i = 0; i < BUILTIN_MODULE__COUNT; i++) vm->builtinModules[i] = NULL;
 
 	vm->hasException = false;
 	vm->exception = NULL_VAL;
@@ -66,6 +141,20 @@ void initVM(VM* vm) {
 	initTable(&vm->imports);
 
 	initTable(&vm->listMethods);
+	initTable(&vm->fiberMethods);
+	initTable(&vm->taskMethods);
+
+	vm->fiber = NULL;
+	vm->fiberSwitch = NULL;
+	vm->loopFiber = NULL;
+	vm->nativeDepth = 0;
+	vm->fiberSwitchRaises = false;
+	vm->resumeFunction = NULL;
+	vm->resumeTrampoline = NULL;
+	vm->eventLoop = NULL;
+	vm->task = NULL;
+	vm->readyTasks = NULL;
+	vm->lastReadyTask = NULL;
 
 	// Forces the stack to resize before anything else is allocated
 	// Allows for push() and pop() to be used to stop values being GC'd.
@@ -76,13 +165,29 @@ void initVM(VM* vm) {
 
 	defineObjectClass(vm);
 	defineImportClass(vm);
+	defineChannelClass(vm);
 
 	defineExceptionClasses(vm);
 
 	defineListNativeMethods(vm);
+	defineFiberNativeMethods(vm);
+	defineGCModule(vm);
+	defineBenchModule(vm);
+	defineParallelModule(vm);
+	defineIOModule(vm);
+	defineTaskModule(vm);
 }
 
 void freeVM(VM* vm) {
+#ifdef FELINE_DEBUG_GC_PAUSES
+	printGCPauses(vm);
+#endif
+	finishAllocationProfile(vm);
+	finishProfiler(vm);
+	finishOpcodeProfile(vm);
+	finishTracer(vm);
+	freeEventLoop(vm);
+
 	Module* mod = vm->modules;
 	while (mod != NULL) {
 		freeModule(vm, mod);
@@ -95,13 +200,33 @@ void freeVM(VM* vm) {
 	freeTable(vm, &vm->nativeLibraries);
 	freeTable(vm, &vm->imports);
 	freeTable(vm, &vm->listMethods);
+	freeTable(vm, &vm->fiberMethods);
+	freeTable(vm, &vm->taskMethods);
 	freeValueArray(vm, &vm->stack);
 	freeCallFrameArray(vm, &vm->frames);
 	freeObjects(vm);
+
+	if (vm->gcLog != NULL) {
+		fclose(vm->gcLog);
+		vm->gcLog = NULL;
+	}
 }
 
 void push(VM* vm, Value value) {
 	writeValueArray(vm, &vm->stack, value);
+
+	// Grow ahead of time, so a value being pushed is always rooted before a collection can run
+	if (vm->stack.length == vm->stack.capacity) {
+		size_t oldCapacity = vm->stack.capacity;
+		Value* oldItems = vm->stack.items;
+		vm->stack.capacity = GROW_CAPACITY(oldCapacity);
+		vm->stack.items = GROW_ARRAY(vm, Value, vm->stack.items, oldCapacity, vm->stack.capacity);
+
+		// Open upvalues point into the stack, so follow it if it moved
+		for (ObjUpvalue* upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+			upvalue->location = vm->stack.items + (upvalue->location - oldItems);
+		}
+	}
 }
 
 Value pop(VM* vm) {
@@ -115,6 +240,7 @@ Value peek(VM* vm, size_t distance) {
 void inheritClasses(VM* vm, ObjClass* subclass, ObjClass* superclass) {
 	tableAddAll(vm, &superclass->methods, &subclass->methods);
 	subclass->superclass = superclass;
+	rememberObject(vm, (Obj*)subclass);
 }
 
 bool instanceof(ObjInstance* instance, ObjClass* clazz) {
@@ -148,6 +274,7 @@ void throwException(VM* vm, ObjClass* exceptionType, const char* format, ...) {
 	push(vm, OBJ_VAL(exception));
 
 	tableSet(vm, &exception->fields, vm->internalStrings[INTERNAL_STR_REASON], peek(vm, 1));
+	writeBarrier(vm, (Obj*)exception, peek(vm, 1));
 
 	vm->exception = OBJ_VAL(exception);
 	vm->hasException = true;
@@ -181,6 +308,8 @@ static bool callClosure(VM* vm, ObjClosure* closure, uint8_t argCount) {
 		return false;
 	}
 
+	if (closure->function->isAsync) return startTask(vm, closure, argCount);
+
 	// TODO: Move this magic number somewhere else
 	// Despite the VM having a dynamic array of frames,
 	// We want to have stack overflows happen after a reasonable amount
@@ -199,9 +328,69 @@ static bool callClosure(VM* vm, ObjClosure* closure, uint8_t argCount) {
 	frame->isTryBlock = false;
 	frame->catchLocation = NULL;
 	frame->tryStackOffset = 0;
+
+	if (vm->tracer != NULL) traceEnterFunction(vm, closure);
 	return true;
 }
 
+static void swapFiberState(VM* vm, ObjFiber* fiber) {
+	ValueArray stack = vm->stack;
+	vm->stack = fiber->stack;
+	fiber->stack = stack;
+
+	CallFrameArray frames = vm->frames;
+	vm->frames = fiber->frames;
+	fiber->frames = frames;
+
+	ObjUpvalue* openUpvalues = vm->openUpvalues;
+	vm->openUpvalues = fiber->openUpvalues;
+	fiber->openUpvalues = openUpvalues;
+}
+
+// Finishes what resume() or yield() started, carrying the value the native returned over to the other stack
+static void switchFiber(VM* vm) {
+	ObjFiber* fiber = vm->fiberSwitch;
+
+	swapFiberState(vm, fiber);
+	// The stack it now holds changed without a write barrier
+	rememberObject(vm, (Obj*)fiber);
+
+	// Left on top of the stack it came from until it is rooted on the new one
+	Value value = fiber->stack.items[fiber->stack.length - 1];
+
+	if (vm->fiber == fiber && vm->frames.length == 0) {
+		// Resumed for the first time, so its entry function is called with the value, if it takes one
+		push(vm, OBJ_VAL(fiber->entry));
+		if (fiber->entry->function->arity == 1) push(vm, value);
+		callClosure(vm, fiber->entry, (uint8_t)fiber->entry->function->arity);
+	}
+	else {
+		push(vm, value);
+	}
+
+	fiber->stack.length--;
+	vm->fiberSwitch = NULL;
+
+	if (vm->fiberSwitchRaises && vm->fiber == fiber) {
+		vm->fiberSwitchRaises = false;
+		vm->exception = pop(vm);
+		vm->hasException = true;
+	}
+}
+
+// Called once the running fiber's entry function has returned or thrown, to go back to what resumed it.
+// The caller pushes the result there afterwards.
+static void finishFiber(VM* vm) {
+	ObjFiber* fiber = vm->fiber;
+	fiber->state = FIBER_DONE;
+	vm->fiber = fiber->caller;
+	fiber->caller = NULL;
+
+	swapFiberState(vm, fiber);
+	freeValueArray(vm, &fiber->stack);
+	freeCallFrameArray(vm, &fiber->frames);
+}
+
 bool callValue(VM* vm, Value callee, uint8_t argCount) {
 	if (IS_OBJ(callee)) {
 		switch (OBJ_TYPE(callee)) {
@@ -243,10 +432,15 @@ bool callValue(VM* vm, Value callee, uint8_t argCount) {
 					return false;
 				}
 
+				if (vm->tracer != NULL) traceEnterNative(vm, nativeObj);
+				vm->nativeDepth++;
 				Value result = native(vm, nativeObj->bound, argCount, &vm->stack.items[vm->stack.length - argCount]);
+				vm->nativeDepth--;
+				if (vm->tracer != NULL) traceExitNative(vm);
 				vm->stack.length -= (size_t)argCount + 1;
 				
 				push(vm, result);
+				if (vm->fiberSwitch != NULL) switchFiber(vm);
 				return true;
 			}
 			default: break; // Not a callable type
@@ -272,6 +466,7 @@ static ObjUpvalue* captureUpvalue(VM* vm, Value* local) {
 	ObjUpvalue* createdUpvalue = newUpvalue(vm, local);
 
 	createdUpvalue->next = upvalue;
+	createdUpvalue->fiber = vm->fiber;
 
 	if (prevUpvalue == NULL) {
 		vm->openUpvalues = createdUpvalue;
@@ -288,6 +483,8 @@ static void closeUpvalues(VM* vm, Value* last) {
 		ObjUpvalue* upvalue = vm->openUpvalues;
 		upvalue->closed = *upvalue->location;
 		upvalue->location = &upvalue->closed;
+		upvalue->fiber = NULL;
+		writeBarrier(vm, (Obj*)upvalue, upvalue->closed);
 		vm->openUpvalues = upvalue->next;
 	}
 }
@@ -296,6 +493,7 @@ static void defineMethod(VM* vm, ObjString* name) {
 	Value method = peek(vm, 0);
 	ObjClass* clazz = AS_CLASS(peek(vm, 1));
 	tableSet(vm, &clazz->methods, name, method);
+	writeBarrier(vm, (Obj*)clazz, method);
 	pop(vm);
 }
 
@@ -339,7 +537,7 @@ static bool invokeFromClass(VM* vm, ObjInstance* instance, ObjClass* clazz, ObjS
 
 static inline bool invokePrimitiveType(VM* vm, Value receiver, ObjString* name, uint8_t argCount, Table* methods) {
 	Value method;
-	if (!tableGet(&vm->listMethods, name, &method)) {
+	if (!tableGet(methods, name, &method)) {
 		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_PROPERTY], "Undefined method '%s'", name->str);
 		return false;
 	}
@@ -353,6 +551,8 @@ static bool invoke(VM* vm, ObjString* name, uint8_t argCount) {
 	Value receiver = peek(vm, argCount);
 
 	if (IS_LIST(receiver)) return invokePrimitiveType(vm, receiver, name, argCount, &vm->listMethods);
+	if (IS_FIBER(receiver)) return invokePrimitiveType(vm, receiver, name, argCount, &vm->fiberMethods);
+	if (IS_TASK(receiver)) return invokePrimitiveType(vm, receiver, name, argCount, &vm->taskMethods);
 
 	if (!IS_INSTANCE(receiver)) {
 		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Only instances have methods");
@@ -405,777 +605,41 @@ static bool validateIndex(VM* vm, size_t length, double index, size_t* realIndex
 	return true;
 }
 
-InterpreterResult executeVM(VM* vm, size_t baseFrameIndex) {
-	CallFrame* frame = &vm->frames.items[vm->frames.length - 1];
-	Module* currentModule = frame->closure->owner;
-
-#define READ_BYTE() (*frame->ip++)
-#define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define READ_CONSTANT() (frame->closure->function->chunk.constants.items[READ_SHORT()])
-#define READ_STRING() (AS_STRING(READ_CONSTANT()))
-
-#define BINARY_OP(valueType, op) do { \
-	if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
-		throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Operands must be numbers"); \
-		break; \
-	} \
-	double b = AS_NUMBER(pop(vm)); \
-	double a = AS_NUMBER(pop(vm)); \
-	push(vm, valueType(a op b)); \
-} while(0)
-
-#ifdef FELINE_DEBUG_TRACE_INSTRUCTIONS
-	printf("=== EXECUTION ===\n");
-#endif
-
-	for (;;) {
-
-		if (vm->hasException) {
-
-			ObjList* stackTrace;
-			ValueArray stackTraceArray;
-			if (IS_INSTANCE(vm->exception) && instanceof(AS_INSTANCE(vm->exception), vm->internalExceptions[INTERNAL_EXCEPTION_BASE])) {
-				Value v;
-				if (tableGet(&AS_INSTANCE(vm->exception)->fields, vm->internalStrings[INTERNAL_STR_STACKTRACE], &v)) {
-					if (IS_LIST(v)) {
-						stackTrace = AS_LIST(v);
-						goto previous_stack_trace_found;
-					}
-				}
-			}
-			initValueArray(&stackTraceArray);
-
-			stackTrace = newList(vm, stackTraceArray);
-		previous_stack_trace_found:
-
-			push(vm, OBJ_VAL(stackTrace));
-			while (vm->hasException) {
-
-				ObjFunction* function = frame->closure->function;
-				size_t instruction = frame->ip - function->chunk.bytecode.items - 1;
-
-				ObjString* tracer = makeStringf(vm, "[%s%s.fn:%zu] in %s", 
-					currentModule->directory->str, currentModule->name->str,
-					getLineOfInstruction(&function->chunk, instruction), function->name != NULL ? function->name->str : "<script>");
-				push(vm, OBJ_VAL(tracer));
-				writeValueArray(vm, &stackTrace->items, peek(vm, 0));
-				pop(vm);
-
-				if (frame->isTryBlock) {
-					frame->ip = frame->catchLocation;
-					frame->isTryBlock = false;
-					frame->catchLocation = NULL;
-
-					if (IS_INSTANCE(vm->exception) && instanceof(AS_INSTANCE(vm->exception), vm->internalExceptions[INTERNAL_EXCEPTION_BASE])) {
-						tableSet(vm, &AS_INSTANCE(vm->exception)->fields, vm->internalStrings[INTERNAL_STR_STACKTRACE], peek(vm, 0));
-					}
-
-					pop(vm);
-					vm->hasException = false;
-					// Reset to have a stack effect of 0
-					vm->stack.length = frame->tryStackOffset;
-					break;
-				}
-
-				closeUpvalues(vm, &vm->stack.items[frame->slotsOffset]);
-
-				vm->frames.length--;
-
-				if (vm->frames.length == baseFrameIndex) {
-					pop(vm); // Stack Trace
-					pop(vm); // The script function
-
-					if (baseFrameIndex != 0) {
-						if (IS_INSTANCE(vm->exception) && instanceof(AS_INSTANCE(vm->exception), vm->internalExceptions[INTERNAL_EXCEPTION_BASE])) {
-							tableSet(vm, &AS_INSTANCE(vm->exception)->fields, vm->internalStrings[INTERNAL_STR_STACKTRACE], OBJ_VAL(stackTrace));
-						}
-						return INTERPRETER_RUNTIME_ERROR;
-					}
-					
-					if (IS_INSTANCE(vm->exception) && instanceof(AS_INSTANCE(vm->exception), vm->internalExceptions[INTERNAL_EXCEPTION_BASE])) {
-						ObjInstance* exception = AS_INSTANCE(vm->exception);
-						printf("%s: ", exception->clazz->name->str);
-
-						Value reason;
-						if (tableGet(&exception->fields, vm->internalStrings[INTERNAL_STR_REASON], &reason)) {
-							printValue(vm, reason);
-							printf("\n");
-						}
-						else {
-							printf("Exception thrown without reason\n");
-						}
-					}
-					else {
-						printf("Exception: ");
-						printValue(vm, vm->exception);
-						printf("\n");
-					}
-					
-					for (size_t i = 0; i < stackTrace->items.length; i++) {
-						printf("%s\n", AS_CSTRING(stackTrace->items.items[i]));
-					}
-
-					return INTERPRETER_RUNTIME_ERROR;
-				}
-
-				vm->stack.length = frame->slotsOffset;
-				// Repush after adjustment to keep on the stack
-				push(vm, OBJ_VAL(stackTrace));
-
-				frame = &vm->frames.items[vm->frames.length - 1];
-				currentModule = frame->closure->owner;
-			}
-		}
-
-#ifdef FELINE_DEBUG_TRACE_INSTRUCTIONS
-		printf(" [ ");
-		for (size_t i = 0; i < vm->stack.length; i++) {
-			Value v = vm->stack.items[i];
-			printValue(vm, v);
-			if (i != vm->stack.length - 1) printf(", ");
-		}
-		printf(" ] ");
-		printf("\n");
-
-		disassembleInstruction(vm, &frame->closure->function->chunk, frame->ip - frame->closure->function->chunk.bytecode.items);
-		printf("\n");
-#endif
-
-		switch (READ_BYTE()) {
-			case OP_USE_CONSTANT: {
-				Value constant = READ_CONSTANT();
-				push(vm, constant);
-				break;
-			}
-
-			case OP_NULL: push(vm, NULL_VAL); break;
-			case OP_TRUE: push(vm, BOOL_VAL(true)); break;
-			case OP_FALSE: push(vm, BOOL_VAL(false)); break;
-
-			case OP_POP: pop(vm); break;
-
-			case OP_DEFINE_GLOBAL: {
-				ObjString* name = READ_STRING();
-				tableSet(vm, &currentModule->globals, name, peek(vm, 0));
-				pop(vm);
-				break;
-			}
-
-			case OP_ACCESS_GLOBAL: {
-				ObjString* name = READ_STRING();
-				Value value;
-				if (!tableGet(&currentModule->globals, name, &value)) {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_UNDEFINED_VARIABLE], "Undefined variable '%s'", name->str);
-					break;
-				}
-				push(vm, value);
-				break;
-			}
-
-			case OP_ASSIGN_GLOBAL: {
-				ObjString* name = READ_STRING();
-
-				if (tableSet(vm, &currentModule->globals, name, peek(vm, 0))) {
-					tableDelete(vm, &currentModule->globals, name);
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_UNDEFINED_VARIABLE], "Undefined variable '%s'", name->str);
-					break;
-				}
-
-				break;
-			}
-
-			case OP_ACCESS_LOCAL: {
-				uint16_t slot = READ_SHORT();
-				push(vm, (vm->stack.items + frame->slotsOffset)[slot]);
-				break;
-			}
-
-			case OP_ASSIGN_LOCAL: {
-				uint16_t slot = READ_SHORT();
-				(vm->stack.items + frame->slotsOffset)[slot] = peek(vm, 0);
-				break;
-			}
-
-			case OP_ACCESS_UPVALUE: {
-				uint8_t slot = (uint8_t)READ_SHORT();
-				push(vm, *frame->closure->upvalues[slot]->location);
-				break;
-			}
-
-			case OP_ASSIGN_UPVALUE: {
-				uint8_t slot = (uint8_t)READ_SHORT();
-				*frame->closure->upvalues[slot]->location = peek(vm, 0);
-				break;
-			}
-
-			case OP_CLOSE_UPVALUE: {
-				closeUpvalues(vm, &vm->stack.items[vm->stack.length - 1]);
-				pop(vm);
-				break;
-			}
-
-			case OP_JUMP: {
-				uint16_t jump = READ_SHORT();
-				frame->ip += jump;
-				break;
-			}
-
-			case OP_JUMP_FALSE: {
-				uint16_t jump = READ_SHORT();
-				if (isFalsey(vm, pop(vm))) frame->ip += jump;
-				break;
-			}
-			
-			// JUMP_FALSE removes the condition, whereas JUMP_FALSE_SC leaves it on the stack
-			case OP_JUMP_FALSE_SC: {
-				uint16_t jump = READ_SHORT();
-				if (isFalsey(vm, peek(vm, 0))) frame->ip += jump;
-				break;
-			}
-
-			case OP_JUMP_TRUE_SC: {
-				uint16_t jump = READ_SHORT();
-				if (!isFalsey(vm, peek(vm, 0))) frame->ip += jump;
-				break;
-			}
-
-			case OP_LOOP: {
-				uint16_t jump = READ_SHORT();
-				frame->ip -= jump;
-				break;
-			}
-
-			case OP_PRINT: {
-				Value value = pop(vm);
-				printValue(vm, value);
-				printf("\n");
-				break;
-			}
-
-			case OP_NEGATE: {
-				if (!IS_NUMBER(peek(vm, 0))) {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Operand must be a number");
-					break;
-				}
-				push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
-				break;
-			}
-
-			case OP_NOT: {
-				push(vm, BOOL_VAL(isFalsey(vm, pop(vm))));
-				break;
-			}
-
-			case OP_EQUAL: {
-				Value b = pop(vm);
-				Value a = pop(vm);
-				push(vm, BOOL_VAL(valuesEqual(vm, a, b)));
-				break;
-			}
-
-			case OP_NOT_EQUAL: {
-				Value b = pop(vm);
-				Value a = pop(vm);
-				push(vm, BOOL_VAL(!valuesEqual(vm, a, b)));
-				break;
-			}
-
-			case OP_LESS: BINARY_OP(BOOL_VAL, <); break;
-			case OP_LESS_EQUAL: BINARY_OP(BOOL_VAL, <=); break;
-			case OP_GREATER: BINARY_OP(BOOL_VAL, >); break;
-			case OP_GREATER_EQUAL: BINARY_OP(BOOL_VAL, >=); break;
-
-			case OP_ADD: {
-				if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
-					push(vm, OBJ_VAL(concatenate(vm)));
-				}
-				else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 0))) {
-					double b = AS_NUMBER(pop(vm));
-					double a = AS_NUMBER(pop(vm));
-					push(vm, NUMBER_VAL(a + b));
-				}
-				else {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Operands must be strings or numbers");
-					break;
-				}
-				break;
-			}
-			case OP_SUB: BINARY_OP(NUMBER_VAL, -); break;
-			case OP_MUL: BINARY_OP(NUMBER_VAL, *); break;
-			case OP_DIV: BINARY_OP(NUMBER_VAL, /); break;
-
-			case OP_CLOSURE: {
-				ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
-				ObjClosure* closure = newClosure(vm, currentModule, function);
-				push(vm, OBJ_VAL(closure));
-
-				for (size_t i = 0; i < closure->upvalueCount; i++) {
-					uint8_t isLocal = READ_BYTE();
-					uint8_t index = READ_BYTE();
-					if (isLocal) {
-						closure->upvalues[i] = captureUpvalue(vm, &vm->stack.items[frame->slotsOffset + index]);
-					}
-					else {
-						closure->upvalues[i] = frame->closure->upvalues[index];
-					}
-				}
-
-				break;
-			}
-
-			case OP_CALL: {
-				uint8_t argCount = READ_BYTE();
-				if (!callValue(vm, peek(vm, argCount), argCount)) {
-					break;
-				}
-				frame = &vm->frames.items[vm->frames.length - 1];
-				currentModule = frame->closure->owner;
-				break;
-			}
-
-			case OP_RETURN: {
-				Value result = pop(vm);
-
-				closeUpvalues(vm, &vm->stack.items[frame->slotsOffset]);
-
-				vm->frames.length--;
-
-				if (vm->frames.length == baseFrameIndex) {
-					pop(vm); // The script function
-
-					if (baseFrameIndex != 0) {
-						push(vm, result);
-					}
-
-					return INTERPRETER_OK;
-				}
-
-				vm->stack.length = frame->slotsOffset;
-
-				push(vm, result);
-
-				frame = &vm->frames.items[vm->frames.length - 1];
-				currentModule = frame->closure->owner;
-				break;
-			}
-
-			case OP_NATIVE: {
-				ObjString* name = READ_STRING();
-				uint8_t arity = READ_BYTE();
-				
-				NativeLibrary library = loadNativeLibrary(vm, makeStringf(vm, "%s%s." NATIVE_LIBRARY_EXT, currentModule->directory->str, currentModule->name->str));
-
-				if (library == NULL) break;
-
-				NativeFunction function = loadNativeFunction(vm, library, makeStringf(vm, "feline_%s", name->str));
-
-				if (function == NULL) break;
+#define EXECUTE_NAME runInterpreter
+#include "execute.h"
+#undef EXECUTE_NAME
 
-				ObjNative* native = newNative(vm, function, arity);
+#define EXECUTE_NAME runProfiledInterpreter
+#define EXECUTE_PROFILE_OPCODES
+#include "execute.h"
+#undef EXECUTE_PROFILE_OPCODES
+#undef EXECUTE_NAME
 
-				push(vm, OBJ_VAL(native));
-				break;
-			}
-
-			case OP_CLASS: {
-				push(vm, OBJ_VAL(newClass(vm, READ_STRING())));
-				break;
-			}
-
-			case OP_INHERIT: {
-				Value superclass = peek(vm, 1);
-
-				if (!IS_CLASS(superclass)) {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Superclass must be a class");
-					break;
-				}
-
-				ObjClass* subclass = AS_CLASS(peek(vm, 0));
-
-				inheritClasses(vm, subclass, AS_CLASS(superclass));
-				pop(vm);
-
-				break;
-			}
-
-			case OP_METHOD: {
-				defineMethod(vm, READ_STRING());
-				break;
-			}
-
-			case OP_ACCESS_PROPERTY: {
-				ObjString* name = READ_STRING();
-
-				if (IS_LIST(peek(vm, 0))) {
-					Value list = pop(vm);
-					accessPropertyPrimitive(vm, list, name, &vm->listMethods);
-					break;
-				}
-
-				if (!IS_INSTANCE(peek(vm, 0))) {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Only instances have properties");
-					break;
-				}
-
-				ObjInstance* instance = AS_INSTANCE(peek(vm, 0));
-
-				Value value;
-				if (tableGet(&instance->fields, name, &value)) {
-					pop(vm); // Pop the instance
-					push(vm, value);
-					break;
-				}
-
-				if (!bindMethod(vm, instance, instance->clazz, name)) {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_PROPERTY], "Undefined property '%s'", name->str);
-					break;
-				}
-
-				break;
-			}
-
-			case OP_ASSIGN_PROPERTY: {
-				if (!IS_INSTANCE(peek(vm, 1))) {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Only instances have fields");
-					break;
-				}
-
-				ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
-				tableSet(vm, &instance->fields, READ_STRING(), peek(vm, 0));
-				Value value = pop(vm);
-				pop(vm);
-				push(vm, value);
-				break;
-			}
-
-			case OP_ASSIGN_PROPERTY_KV: {
-				if (!IS_INSTANCE(peek(vm, 1))) {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Only instances have fields");
-					break;
-				}
-
-				ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
-				tableSet(vm, &instance->fields, READ_STRING(), peek(vm, 0));
-				pop(vm);
-				break;
-			}
-
-			case OP_ACCESS_SUPER: {
-				ObjString* name = READ_STRING();
-				ObjClass* superclass = AS_CLASS(pop(vm));
-
-				if (!bindMethod(vm, AS_INSTANCE(vm->stack.items[frame->slotsOffset]), superclass, name)) {
-					break;
-				}
-				break;
-			}
-
-			case OP_INVOKE: {
-				ObjString* method = READ_STRING();
-				uint8_t argCount = READ_BYTE();
-
-				if (!invoke(vm, method, argCount)) {
-					break;
-				}
-				frame = &vm->frames.items[vm->frames.length - 1];
-				currentModule = frame->closure->owner;
-				break;
-			}
-
-			case OP_SUPER_INVOKE: {
-				ObjString* method = READ_STRING();
-				uint8_t argCount = READ_BYTE();
-
-				ObjClass* superclass = AS_CLASS(pop(vm));
-
-				if (!invokeFromClass(vm, AS_INSTANCE(vm->stack.items[frame->slotsOffset]), superclass, method, argCount)) {
-					break;
-				}
-				frame = &vm->frames.items[vm->frames.length - 1];
-				currentModule = frame->closure->owner;
-				break;
-			}
-
-			case OP_OBJECT: {
-				push(vm, OBJ_VAL(vm->internalClasses[INTERNAL_CLASS_OBJECT]));
-				break;
-			}
-
-			case OP_CREATE_OBJECT: {
-				// This could maybe be re-written to do the creation itself
-				// Which may result in a speed-up in tight loops
-				callValue(vm, OBJ_VAL(vm->internalClasses[INTERNAL_CLASS_OBJECT]), 0);
-				frame = &vm->frames.items[vm->frames.length - 1];
-				currentModule = frame->closure->owner;
-				break;
-			}
-
-			case OP_INSTANCEOF: {
-				Value superclass = pop(vm);
-				Value instance = pop(vm);
-
-				if (!IS_INSTANCE(instance)) {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Left-hand-side of instanceof must be an instance");
-					break;
-				}
-
-				if (!IS_CLASS(superclass)) {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Right-hand-side of instanceof must be a class");
-					break;
-				}
-
-				push(vm, BOOL_VAL(instanceof(AS_INSTANCE(instance), AS_CLASS(superclass))));
-				break;
-			}
-
-			case OP_CLASS_NATIVE: {
-				ObjClass* clazz = AS_CLASS(peek(vm, 0));
-				ObjString* name = READ_STRING();
-				uint8_t arity = READ_BYTE();
-
-				NativeLibrary library = loadNativeLibrary(vm, makeStringf(vm, "%s%s." NATIVE_LIBRARY_EXT, currentModule->directory->str, currentModule->name->str));
-
-				if (library == NULL) break;
-
-				NativeFunction function = loadNativeFunction(vm, library, makeStringf(vm, "feline_%s_%s", clazz->name->str, name->str));
-
-				if (function == NULL) break;
-
-				ObjNative* native = newNative(vm, function, arity);
-
-				push(vm, OBJ_VAL(native));
-				break;
-			}
-
-			case OP_LIST: {
-				uint16_t length = READ_SHORT();
-
-				ValueArray items;
-				initValueArray(&items);
-
-				ObjList* list = newList(vm, items);
-
-				push(vm, OBJ_VAL(list));
-
-				for (size_t i = 0; i < length; i++) {
-					writeValueArray(vm, &list->items, peek(vm, length - i));
-				}
-				pop(vm);
-
-				vm->stack.length -= length;
-
-				push(vm, OBJ_VAL(list));
-				break;
-			}
-
-			case OP_ACCESS_SUBSCRIPT: {
-				Value index = peek(vm, 0);
-				Value indexee = peek(vm, 1);
-
-				if (IS_LIST(indexee)) {
-					ObjList* list = AS_LIST(indexee);
-
-					if (!IS_NUMBER(index)) {
-						throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_INDEX_RANGE], "List index must be a number");
-						break;
-					}
-
-					size_t realIndex;
-					if (!validateIndex(vm, list->items.length, AS_NUMBER(index), &realIndex)) {
-						break;
-					}
-
-					pop(vm);
-					pop(vm);
-					push(vm, list->items.items[realIndex]);
-
-				}
-				else if (IS_INSTANCE(indexee)) {
-					ObjInstance* instance = AS_INSTANCE(indexee);
-
-					if (!IS_STRING(index)) {
-						throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_PROPERTY], "Property name must be a string in subscript");
-						break;
-					}
-
-					ObjString* propertyName = AS_STRING(index);
-
-					Value value;
-					if (tableGet(&instance->fields, propertyName, &value)) {
-						pop(vm);
-						pop(vm);
-						push(vm, value);
-						break;
-					}
-
-					pop(vm); // Pop the propertyName off
-					if (!bindMethod(vm, instance, instance->clazz, propertyName)) {
-						push(vm, NULL_VAL);
-					}
-				}
-				else {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Invalid subscript target");
-					break;
-				}
-
-				break;
-			}
-
-			case OP_ASSIGN_SUBSCRIPT: {
-				Value value = peek(vm, 0);
-				Value index = peek(vm, 1);
-				Value indexee = peek(vm, 2);
-
-				if (IS_LIST(indexee)) {
-					ObjList* list = AS_LIST(indexee);
-
-					if (!IS_NUMBER(index)) {
-						throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "List index must be a number");
-						break;
-					}
-
-					size_t realIndex;
-					if (!validateIndex(vm, list->items.length, AS_NUMBER(index), &realIndex)) {
-						break;
-					}
-
-					list->items.items[realIndex] = value;
-
-					pop(vm);
-					pop(vm);
-					pop(vm);
-					push(vm, value);
-				}
-				else if (IS_INSTANCE(indexee)) {
-					ObjInstance* instance = AS_INSTANCE(indexee);
-
-					if (!IS_STRING(index)) {
-						throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_PROPERTY], "Property name must be a string in subscript");
-						break;
-					}
-
-					ObjString* propertyName = AS_STRING(index);
-
-					tableSet(vm, &instance->fields, propertyName, value);
-					pop(vm);
-					pop(vm);
-					pop(vm);
-					push(vm, value);
-				}
-				else {
-					throwException(vm, vm->internalExceptions[INTERNAL_EXCEPTION_TYPE], "Invalid subscript target");
-					break;
-				}
-
-				break;
-			}
-
-			case OP_THROW: {
-				vm->exception = pop(vm);
-				vm->hasException = true;
-				break;
-			}
-
-			case OP_TRY_BEGIN: {
-				uint16_t catchJump = READ_SHORT();
-				frame->catchLocation = frame->ip + catchJump;
-				frame->isTryBlock = true;
-				frame->tryStackOffset = vm->stack.length;
-				break;
-			}
-
-			case OP_TRY_END: {
-				frame->catchLocation = NULL;
-				frame->isTryBlock = false;
-				frame->tryStackOffset = 0;
-				break;
-			}
-
-			case OP_BOUND_EXCEPTION: {
-				push(vm, vm->exception);
-				break;
-			}
-
-			case OP_IMPORT: {
-				ObjString* givenPath = READ_STRING();
-				push(vm, OBJ_VAL(givenPath));
-
-				ObjString* realPath = makeStringf(vm, "%s%s.fn", vm->baseDirectory->str, givenPath->str);
-				pop(vm);
-
-				Value cachedImport;
-				if (tableGet(&vm->imports, realPath, &cachedImport)) {
-					push(vm, cachedImport);
-					break;
-				}
-
-				//TODO: Throw an error of failure instead of crashing
-				char* rawSource = readFile(realPath->str);
-
-				push(vm, OBJ_VAL(realPath));
-				ObjString* source = takeString(vm, rawSource, strlen(rawSource));
-				push(vm, OBJ_VAL(source));
-
-				Module* mod = ALLOCATE(vm, Module, 1);
-				initModule(vm, mod);
-				splitPathToNameAndDirectory(vm, mod, realPath->str);
-				tableSet(vm, &mod->globals, vm->internalStrings[INTERNAL_STR_THIS_MODULE], OBJ_VAL(mod->name));
-
-				ObjFunction* function = compile(vm, source->str);
-
-				pop(vm);
-
-				if (function == NULL) return INTERPRETER_COMPILE_ERROR;
-
-				push(vm, OBJ_VAL(function));
-				ObjClosure* closure = newClosure(vm, mod, function);
-				pop(vm);
-				push(vm, OBJ_VAL(closure));
-
-				// Set the script as the execution context
-				callClosure(vm, closure, 0);
-
-				//TODO: Handle an error from runtime
-				InterpreterResult result = executeVM(vm, vm->frames.length - 1);
-
-				if (result == INTERPRETER_RUNTIME_ERROR) {
-					break;
-				}
-
-				ObjInstance* importObj = newInstance(vm, vm->internalClasses[INTERNAL_CLASS_IMPORT]);
-				push(vm, OBJ_VAL(importObj));
-				tableSet(vm, &vm->imports, realPath, OBJ_VAL(importObj));
-				push(vm, OBJ_VAL(importObj));
-
-				tableAddAll(vm, &mod->exports, &importObj->fields);
-
-				pop(vm);
-				pop(vm);
-				push(vm, OBJ_VAL(importObj));
-
-				break;
-			}
+InterpreterResult executeVM(VM* vm, size_t baseFrameIndex) {
+	ObjFiber* loopFiber = vm->loopFiber;
+	size_t nativeDepth = vm->nativeDepth;
+	vm->loopFiber = vm->fiber;
+	vm->nativeDepth = 0;
 
-			case OP_EXPORT: {
-				ObjString* name = READ_STRING();
-				tableSet(vm, &currentModule->exports, name, peek(vm, 0));
-				pop(vm);
-				break;
-			}
-		}
+	InterpreterResult result = vm->opcodeProfile != NULL
+		? runProfiledInterpreter(vm, baseFrameIndex)
+		: runInterpreter(vm, baseFrameIndex);
 
-	}
-
-#undef READ_BYTE
-#undef READ_SHORT
-#undef READ_CONSTANT
-#undef READ_STRING
+	vm->loopFiber = loopFiber;
+	vm->nativeDepth = nativeDepth;
+	return result;
 }
 
 InterpreterResult interpret(VM* vm, const char* source) {
 
+	if (vm->tracer != NULL) traceBegin(vm, "compile", "import", NULL);
 	ObjFunction* function = compile(vm, source);
+	if (vm->tracer != NULL) traceEnd(vm);
+
+	return interpretFunction(vm, function);
+}
 
+InterpreterResult interpretFunction(VM* vm, ObjFunction* function) {
 	if (function == NULL) return INTERPRETER_COMPILE_ERROR;
 
 	push(vm, OBJ_VAL(function));
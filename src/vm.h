@@ -4,22 +4,21 @@
 #include "table.h"
 #include "object.h"
 #include "module.h"
+#include "heap.h"
 #include "builtin/exception.h"
 #include "ffi/felineffi.h"
+#include <stdio.h>
 
 typedef struct Compiler Compiler;
-
-typedef struct CallFrame {
-	ObjClosure* closure;
-	uint8_t* ip;
-	size_t slotsOffset;
-
-	uint8_t* catchLocation;
-	size_t tryStackOffset;
-	bool isTryBlock;
-} CallFrame;
-
-DECLARE_DYNAMIC_ARRAY(CallFrame, CallFrame)
+typedef struct MarkPool MarkPool;
+typedef struct Sweeper Sweeper;
+typedef struct HeapSnapshot HeapSnapshot;
+typedef struct AllocProfiler AllocProfiler;
+typedef struct Profiler Profiler;
+typedef struct OpcodeProfile OpcodeProfile;
+typedef struct Tracer Tracer;
+typedef struct CodeSegment CodeSegment;
+typedef struct EventLoop EventLoop;
 
 typedef enum InternalString {
 	INTERNAL_STR_NEW,
@@ -33,19 +32,61 @@ typedef enum InternalString {
 	INTERNAL_STR_STACK_OVERFLOW_EXCEPTION,
 	INTERNAL_STR_LINK_FAILURE_EXCEPTION,
 	INTERNAL_STR_VALUE_EXCEPTION,
+	INTERNAL_STR_OUT_OF_MEMORY_EXCEPTION,
+	INTERNAL_STR_IO_EXCEPTION,
 	INTERNAL_STR_REASON,
 	INTERNAL_STR_OBJECT,
 	INTERNAL_STR_IMPORT,
 	INTERNAL_STR_THIS_MODULE,
+	INTERNAL_STR_GC,
+	INTERNAL_STR_BENCH,
+	INTERNAL_STR_CHANNEL,
+	INTERNAL_STR_PARALLEL,
+	INTERNAL_STR_IO,
+	INTERNAL_STR_HANDLE,
+	INTERNAL_STR_TASKS,
 	INTERNAL_STR__COUNT
 } InternalString;
 
 typedef enum InternalClassType {
 	INTERNAL_CLASS_OBJECT,
 	INTERNAL_CLASS_IMPORT,
+	INTERNAL_CLASS_CHANNEL,
+	INTERNAL_CLASS_HANDLE,
 	INTERNAL_CLASS__COUNT
 } InternalClassType;
 
+// Namespaces of natives bound as globals in every module
+typedef enum BuiltinModule {
+	BUILTIN_MODULE_GC,
+	BUILTIN_MODULE_BENCH,
+	BUILTIN_MODULE_PARALLEL,
+	BUILTIN_MODULE_IO,
+	BUILTIN_MODULE_TASKS,
+	BUILTIN_MODULE__COUNT
+} BuiltinModule;
+
+typedef enum GCPhase {
+	GC_PHASE_IDLE,
+	GC_PHASE_MARK,
+	GC_PHASE_SWEEP
+} GCPhase;
+
+// Pauses are bucketed by powers of two microseconds: bucket i holds pauses shorter than 2^i us.
+#define GC_PAUSE_BUCKETS 20
+
+// Running totals kept by the collector; getGCStats() adds a census of the heap to these
+typedef struct GCCounters {
+	size_t majorCollections;
+	size_t minorCollections;
+	uint64_t totalPauseNanos;
+	uint64_t maxPauseNanos;
+	// Every byte ever allocated, including what has since been freed
+	size_t totalAllocated;
+	// Heap size once the last collection, major or minor, had finished
+	size_t liveBytes;
+} GCCounters;
+
 typedef struct VM {
 	ValueArray stack;
 	CallFrameArray frames;
@@ -55,6 +96,30 @@ typedef struct VM {
 	Table imports;
 
 	Table listMethods;
+	Table fiberMethods;
+	Table taskMethods;
+
+	// The fiber whose stack and frames are swapped in, or NULL when running on the VM's own
+	ObjFiber* fiber;
+	// Set by resume() and yield() for the switch to happen once they have returned into callValue()
+	ObjFiber* fiberSwitch;
+	// Fibers only switch from calls made by the innermost interpreter loop, and a fiber may only yield if that loop
+	// was not entered while it was running, which would leave it with a native frame on the C stack
+	ObjFiber* loopFiber;
+	size_t nativeDepth;
+	// Set while native code resumes a fiber to have the value thrown in it, rather than returned from its yield()
+	bool fiberSwitchRaises;
+	// Resumes a fiber from bytecode, for natives to call; the closure is remade for whichever module calls it
+	ObjFunction* resumeFunction;
+	ObjClosure* resumeTrampoline;
+	// Runs fibers which wait on I/O and timers; created the first time it is needed
+	EventLoop* eventLoop;
+
+	// The task whose frame is running, if any
+	ObjTask* task;
+	// Tasks ready to run, in the order they became ready, chained through their next
+	ObjTask* readyTasks;
+	ObjTask* lastReadyTask;
 
 	Value exception;
 	bool hasException;
@@ -65,17 +130,88 @@ typedef struct VM {
 	ObjString* internalStrings[INTERNAL_STR__COUNT];
 	ObjClass* internalExceptions[INTERNAL_EXCEPTION__COUNT];
 	ObjClass* internalClasses[INTERNAL_CLASS__COUNT];
+	ObjInstance* builtinModules[BUILTIN_MODULE__COUNT];
+
+	// The timer natives count from here
+	uint64_t startTime;
+	// Which of the isolates started together this VM is, and how many there are; 0 of 1 when run alone
+	size_t isolateIndex;
+	size_t isolateCount;
+	// Scripts are loaded from here, when set, rather than compiled into this VM's heap
+	CodeSegment* codeSegment;
+	// Scripts are compiled through .fnc files which keep their bytecode between runs, when set; the files are kept
+	// in bytecodeCacheDirectory, or beside each script when it is NULL
+	bool bytecodeCache;
+	const char* bytecodeCacheDirectory;
 
 	Compiler* lowestLevelCompiler;
 	ObjUpvalue* openUpvalues;
 	
 	size_t bytesAllocated;
 	size_t nextGC;
+	size_t nextMinorGC;
+	size_t nextGCStep;
+
+	// Bytes the heap may reach before the first major collection, and below which none is ever due
+	size_t gcInitialHeap;
+	// How far the heap may grow over what survived the last major collection before the next is due
+	double gcGrowthFactor;
+	// Bytes the heap is kept under by collecting early, past which OutOfMemoryException is thrown; 0 leaves it unbounded
+	size_t gcMaxHeap;
+	// Microseconds a single incremental slice may run for; 0 collects the old generation all at once
+	size_t gcPauseTarget;
+
+	GCPhase gcPhase;
+	size_t gcHeapLimit;
+	size_t gcStepWork;
+	size_t gcCycleSlices;
+	size_t gcCycleStartBytes;
+	size_t gcFloatingBytes;
+	// While OutOfMemoryException is thrown and handled, the heap may run past gcMaxHeap up to here
+	size_t gcReserveEnd;
+	// The bytes in use when the heap passed gcMaxHeap, or 0; OutOfMemoryException is thrown between instructions,
+	// as whatever was allocating may be halfway through growing a structure
+	size_t gcPendingOutOfMemory;
+	HeapPage* sweepCursor;
+	uint64_t gcPauseHistogram[GC_PAUSE_BUCKETS];
+	GCCounters gcCounters;
+
+	// A JSON object is written here for every major cycle, if set; owned by the VM
+	FILE* gcLog;
+	uint64_t gcLogStartTime;
+	uint64_t gcCycleStartTime;
+	uint64_t gcCyclePauseNanos;
+	// Set once a cycle has finished, so its line is written with the pause which finished it
+	bool gcCycleToLog;
+	// Set while tracing for a heap snapshot, which is told of every reference marked
+	HeapSnapshot* heapSnapshot;
+	// Told of every object allocated, if set
+	AllocProfiler* allocProfiler;
+	// Set by the profiler's thread when it wants a sample of the call stack
+	Profiler* profiler;
+	atomic_bool profileSampleDue;
+	// Set when instructions are being counted, which runs the profiled copy of the interpreter loop
+	OpcodeProfile* opcodeProfile;
+	// Told of every call, import and GC pause, if set
+	Tracer* tracer;
 	
-	Obj* objects;
+	Heap heap;
 	size_t grayCount;
 	size_t grayCapacity;
 	Obj** grayStack;
+
+	// Helper threads used to drain the gray stack while the mutator is stopped; 0 marks on this thread alone
+	size_t gcMarkThreads;
+	MarkPool* markPool;
+	bool markingInParallel;
+
+	// Sweeps pages and runs native finalizers on a background thread; when false, both happen on this one
+	bool gcBackgroundSweep;
+	Sweeper* sweeper;
+
+	size_t rememberedCount;
+	size_t rememberedCapacity;
+	Obj** rememberedSet;
 } VM;
 
 typedef enum InterpreterResult {
@@ -96,4 +232,5 @@ bool callValue(VM* vm, Value callee, uint8_t argCount);
 void inheritClasses(VM* vm, ObjClass* subclass, ObjClass* superclass);
 
 InterpreterResult executeVM(VM* vm, size_t baseFrameIndex);
-InterpreterResult interpret(VM* vm, const char* source);
\ No newline at end of file
+InterpreterResult interpret(VM* vm, const char* source);
+InterpreterResult interpretFunction(VM* vm, ObjFunction* function);
\ No newline at end of file
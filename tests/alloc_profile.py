@@ -0,0 +1,101 @@
+"""Checks the report --alloc-profile prints at exit, both recording every allocation and sampling them.
+
+Usage: python tests/alloc_profile.py path/to/feline
+"""
+
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+POINTS = 5000
+
+SCRIPT = """class Point {
+	new(x) { this.x = x; }
+}
+function makePoints() {
+	var points = [];
+	for (var i = 0; i < %d; i = i + 1) points.push(Point(i));
+	return points;
+}
+var kept = makePoints();
+print len(kept);
+""" % POINTS
+
+SITE = "script.fn:6 in makePoints"
+HEADINGS = ["bytes", "%", "objects", "%", "type", "site"]
+ROW = re.compile(r"^  +(\d+) +(\d+\.\d)% +(\d+) +(\d+\.\d)%  (\w+) +(.+)$")
+
+
+def parseTable(lines, title):
+	"""Returns the rows of the table with the title, as (bytes, objects, type, site), or a string saying what is wrong."""
+	if title not in lines:
+		return "no %s table" % title
+	start = lines.index(title)
+	if lines[start + 1].split() != HEADINGS:
+		return "the %s table has headings %s" % (title, lines[start + 1].split())
+
+	rows = []
+	for line in lines[start + 2:]:
+		match = ROW.match(line)
+		if match is None:
+			break
+		rows.append((int(match.group(1)), int(match.group(3)), match.group(5), match.group(6)))
+	return rows
+
+
+def check(feline, directory, flags, sampled, top):
+	"""Returns what is wrong with the report, or None if nothing is."""
+	result = subprocess.run([feline] + flags + ["script.fn"], capture_output=True, text=True, cwd=directory, timeout=60)
+	if result.returncode != 0 or result.stdout != "%d\n" % POINTS:
+		return "status %d\n%s%s" % (result.returncode, result.stdout, result.stderr)
+
+	lines = result.stderr.splitlines()
+	if "-- Allocation Profile" not in lines:
+		return "no report\n" + result.stderr
+	summary = lines[lines.index("-- Allocation Profile") + 1]
+	if re.match(r"^   \d+ objects, \d+ bytes, ", summary) is None or ("sampled" in summary) != sampled:
+		return "summary: " + summary
+
+	for title, column in (("   By bytes:", 0), ("   By count:", 1)):
+		rows = parseTable(lines, title)
+		if isinstance(rows, str):
+			return rows + "\n" + result.stderr
+		if len(rows) == 0 or len(rows) > top:
+			return "%d rows in the %s table" % (len(rows), title)
+		if [row[column] for row in rows] != sorted((row[column] for row in rows), reverse=True):
+			return "the %s table is out of order" % title
+
+		# The points are most of what the script allocates, so they come first
+		points = rows[0]
+		if points[2] != "instance" or not points[3].endswith(SITE):
+			return "the %s table starts with %s" % (title, points)
+		if (not sampled and points[1] != POINTS) or abs(points[1] - POINTS) > POINTS / 2:
+			return "%d points counted" % points[1]
+	return None
+
+
+def main():
+	if len(sys.argv) != 2:
+		print(__doc__)
+		sys.exit(1)
+
+	feline = os.path.abspath(sys.argv[1])
+	directory = tempfile.mkdtemp()
+	try:
+		with open(os.path.join(directory, "script.fn"), "w") as file:
+			file.write(SCRIPT)
+		failure = check(feline, directory, ["--alloc-profile=0", "--alloc-profile-top=5"], False, 5)
+		failure = failure or check(feline, directory, ["--alloc-profile=4K"], True, 20)
+	finally:
+		shutil.rmtree(directory)
+
+	if failure is not None:
+		print(failure)
+		sys.exit(1)
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,152 @@
+"""Checks that the bytecode cache writes .fnc files, loads them in place of compiling, and compiles again when one is stale or damaged.
+
+Usage: python tests/bytecode_cache.py path/to/feline
+"""
+
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+HEADER = 52
+PAYLOAD_HASH = 44
+VERSION = 4
+
+MAIN = """import greeting as greeting;
+var word = "hello";
+function twice(n) { return n * 2; }
+print word;
+print twice(21);
+print greeting.text;
+"""
+
+GREETING = """var text = "module";
+export text as text;
+"""
+
+EXPECTED = "hello\n42\nmodule\n"
+
+
+def fnv(data):
+	"""64-bit FNV-1a, as the payload hash is."""
+	hash = 14695981039346656037
+	for byte in data:
+		hash = ((hash ^ byte) * 1099511628211) & 0xFFFFFFFFFFFFFFFF
+	return hash
+
+
+def withPayloadHash(data):
+	"""Returns the cache file with its payload hash made to match its payload."""
+	return data[:PAYLOAD_HASH] + struct.pack("<Q", fnv(data[HEADER:])) + data[HEADER:]
+
+
+class Test:
+	def __init__(self, feline, directory):
+		self.feline = feline
+		self.directory = directory
+		self.failures = []
+
+	def path(self, name):
+		return os.path.join(self.directory, name)
+
+	def read(self, name):
+		with open(self.path(name), "rb") as file:
+			return file.read()
+
+	def write(self, name, data, mtime=None):
+		with open(self.path(name), "wb") as file:
+			file.write(data)
+		if mtime is not None:
+			os.utime(self.path(name), (mtime, mtime))
+
+	def run(self, what, expected, *flags):
+		result = subprocess.run([self.feline, "--bytecode-cache=beside"] + list(flags) + [self.path("main.fn")],
+			capture_output=True, text=True, cwd=self.directory, timeout=60)
+		if result.returncode != 0 or result.stdout != expected:
+			self.failures.append("%s: status %d\n%s%s" % (what, result.returncode, result.stdout, result.stderr))
+
+	def check(self, what, passed):
+		if not passed:
+			self.failures.append(what)
+
+	def isValid(self, name):
+		data = self.read(name)
+		return data[:4] == b"FNC\0" and len(data) > HEADER and struct.unpack_from("<Q", data, PAYLOAD_HASH)[0] == fnv(data[HEADER:])
+
+	def fallsBack(self, what, damaged):
+		"""Damages main.fnc, then checks that the script is compiled again and its cache rewritten."""
+		good = self.read("main.fnc")
+		self.write("main.fnc", damaged)
+		self.run(what, EXPECTED)
+		self.check(what + ": cache not rewritten", self.read("main.fnc") == good)
+
+	def all(self):
+		self.write("main.fn", MAIN.encode())
+		self.write("greeting.fn", GREETING.encode())
+
+		self.run("first run", EXPECTED)
+		self.check("main.fnc not written", os.path.exists(self.path("main.fnc")) and self.isValid("main.fnc"))
+		self.check("greeting.fnc not written", os.path.exists(self.path("greeting.fnc")) and self.isValid("greeting.fnc"))
+		if self.failures:
+			return
+		written = self.read("main.fnc")
+		module = self.read("greeting.fnc")
+
+		# A cache file whose constants differ from the source's shows that it, rather than the source, is run
+		self.write("main.fnc", withPayloadHash(written.replace(b"hello", b"howdy")))
+		self.write("greeting.fnc", withPayloadHash(module.replace(b"module", b"cached")))
+		self.run("reload", "howdy\n42\ncached\n")
+		self.write("main.fnc", written)
+		self.write("greeting.fnc", module)
+
+		# A stale cache is ignored and replaced, even if the source keeps its length and modification time
+		mtime = os.stat(self.path("main.fn")).st_mtime
+		self.write("main.fn", MAIN.replace("hello", "hullo").encode(), mtime)
+		self.run("changed source", "hullo\n42\nmodule\n")
+		self.check("stale cache not rewritten", b"hullo" in self.read("main.fnc") and self.isValid("main.fnc"))
+		self.write("main.fn", MAIN.encode())
+		self.run("source restored", EXPECTED)
+
+		# Damaged or foreign cache files are ignored and replaced
+		good = self.read("main.fnc")
+		self.fallsBack("flipped payload byte", good[:-1] + bytes([good[-1] ^ 0xFF]))
+		self.fallsBack("truncated header", good[:HEADER // 2])
+		self.fallsBack("truncated payload", withPayloadHash(good[:HEADER] + good[HEADER:-3]))
+		self.fallsBack("other format version", good[:VERSION] + struct.pack("<I", 0xFFFF) + good[VERSION + 4:])
+		self.fallsBack("empty file", b"")
+
+		# Bytecode the VM could not run is rejected even if the hash matches. The first "twice" is the name of the
+		# global; the second is the function's own, followed by its bytecode's length and then its first opcode.
+		bytecode = good.find(b"twice", good.find(b"twice") + 1) + len(b"twice") + 4
+		self.fallsBack("unknown opcode", withPayloadHash(good[:bytecode] + b"\xFF" + good[bytecode + 1:]))
+
+		# A cache directory holds the files instead
+		cache = self.path("cache")
+		os.mkdir(cache)
+		self.run("cache directory", EXPECTED, "--bytecode-cache=" + cache)
+		self.check("cache directory not used", len([name for name in os.listdir(cache) if name.endswith(".fnc")]) == 2)
+
+		self.run("cache off", EXPECTED, "--bytecode-cache=off")
+
+
+def main():
+	if len(sys.argv) != 2:
+		print(__doc__)
+		sys.exit(1)
+
+	directory = tempfile.mkdtemp()
+	try:
+		test = Test(os.path.abspath(sys.argv[1]), directory)
+		test.all()
+	finally:
+		shutil.rmtree(directory)
+
+	for failure in test.failures:
+		print(failure)
+	sys.exit(1 if test.failures else 0)
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,84 @@
+"""Checks that --gc-log appends a line of JSON, with every field, for each major collection.
+
+Usage: python tests/gc_log.py path/to/feline
+"""
+
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+SCRIPT = """var kept = [];
+for (var i = 0; i < 200000; i = i + 1) {
+	var pair = [i, [i]];
+	if (i < 50000) kept.push(pair);
+}
+print gc.stats().majorCollections;
+"""
+
+FIELDS = ["cycle", "timeMs", "durationMs", "pauseMs", "slices", "heapBefore", "heapAfter", "floatingBytes", "nextGC",
+	"minorCollections", "totalAllocated"]
+
+
+def check(lines, majorCollections):
+	"""Returns what is wrong with the log, or None if nothing is.
+	Collections while the VM starts, before the log is open, are left out of it, as may be the last if the script
+	ends before the next pause logs it."""
+	if len(lines) == 0:
+		return "nothing logged for %d major collections" % majorCollections
+
+	previous = None
+	for number, line in enumerate(lines, 1):
+		try:
+			cycle = json.loads(line)
+		except ValueError as error:
+			return "line %d is not JSON: %s\n%s" % (number, error, line)
+		if sorted(cycle) != sorted(FIELDS):
+			return "line %d has fields %s" % (number, sorted(cycle))
+		if any(not isinstance(value, (int, float)) or value < 0 for value in cycle.values()):
+			return "line %d has a value which is not a count\n%s" % (number, line)
+		if previous is not None and cycle["cycle"] != previous["cycle"] + 1:
+			return "line %d is of cycle %d after %d" % (number, cycle["cycle"], previous["cycle"])
+		if cycle["pauseMs"] > cycle["durationMs"] or cycle["slices"] < 1:
+			return "line %d pauses for longer than the cycle takes\n%s" % (number, line)
+		if previous is not None and (cycle["timeMs"] < previous["timeMs"] or cycle["totalAllocated"] < previous["totalAllocated"]):
+			return "line %d goes back in time or allocation" % number
+		previous = cycle
+
+	if previous["cycle"] < majorCollections - 1:
+		return "the last cycle logged is %d of %d" % (previous["cycle"], majorCollections)
+	return None
+
+
+def main():
+	if len(sys.argv) != 2:
+		print(__doc__)
+		sys.exit(1)
+
+	directory = tempfile.mkdtemp()
+	try:
+		script = os.path.join(directory, "script.fn")
+		log = os.path.join(directory, "gc.log")
+		with open(script, "w") as file:
+			file.write(SCRIPT)
+
+		result = subprocess.run([os.path.abspath(sys.argv[1]), "--gc-initial-heap=256K", "--gc-log=" + log, script],
+			capture_output=True, text=True, timeout=60)
+		if result.returncode != 0:
+			print("status %d\n%s%s" % (result.returncode, result.stdout, result.stderr))
+			sys.exit(1)
+
+		with open(log) as file:
+			failure = check(file.read().splitlines(), int(result.stdout))
+	finally:
+		shutil.rmtree(directory)
+
+	if failure is not None:
+		print(failure)
+		sys.exit(1)
+
+
+if __name__ == "__main__":
+	main()
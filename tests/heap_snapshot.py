@@ -0,0 +1,114 @@
+"""Checks that gc.snapshot() writes JSON which tools/heap_analyze.py can read, and that what it finds retains what it should.
+
+Usage: python tests/heap_snapshot.py path/to/feline
+"""
+
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+TOOLS = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), "tools")
+sys.path.insert(0, TOOLS)
+import heap_analyze
+
+LEAVES = 500
+
+SCRIPT = """class Leaf {
+	new(i) { this.values = [i, i + 1]; }
+}
+class Holder {
+	new() { this.leaves = []; }
+}
+var holder = Holder();
+gc.snapshot("before.json");
+for (var i = 0; i < %d; i = i + 1) holder.leaves.push(Leaf(i));
+gc.snapshot("after.json");
+""" % LEAVES
+
+
+def checkShape(snapshot):
+	"""Returns what is wrong with the snapshot's fields, or None if nothing is."""
+	for key in ("version", "roots", "objects"):
+		if key not in snapshot:
+			return "no %s" % key
+
+	ids = set()
+	for obj in snapshot["objects"]:
+		for key in ("id", "type", "size", "references"):
+			if key not in obj:
+				return "an object has no %s: %s" % (key, obj)
+		if obj["size"] <= 0:
+			return "an object has no size: %s" % obj
+		ids.add(obj["id"])
+
+	for holder in snapshot["roots"] + snapshot["objects"]:
+		for id in holder["references"]:
+			if id not in ids:
+				return "a reference to %d, which is not in the snapshot, from %s" % (id, holder.get("label", holder.get("id")))
+	return None
+
+
+def checkRetained(graph):
+	"""Returns what is wrong with what the analyzer finds, or None if nothing is."""
+	holders = [node for node in range(len(graph.types)) if graph.types[node] == "instance" and graph.labels[node] == "Holder"]
+	leaves = [node for node in range(len(graph.types)) if graph.types[node] == "instance" and graph.labels[node] == "Leaf"]
+	if len(holders) != 1 or len(leaves) != LEAVES:
+		return "%d holders and %d leaves" % (len(holders), len(leaves))
+
+	idom, order = heap_analyze.dominators(graph)
+	retained = heap_analyze.retainedSizes(graph, idom, order)
+
+	# Each leaf and its list are only reachable through the holder
+	leafBytes = 0
+	for leaf in leaves:
+		node = leaf
+		while node != 0 and node != holders[0]:
+			node = idom[node]
+		if node == 0:
+			return "a leaf is not dominated by the holder"
+		leafBytes += retained[leaf]
+		if retained[leaf] <= graph.sizes[leaf]:
+			return "a leaf does not retain its list"
+	if retained[holders[0]] <= leafBytes:
+		return "the holder retains %d bytes, not more than its leaves' %d" % (retained[holders[0]], leafBytes)
+	return None
+
+
+def main():
+	if len(sys.argv) != 2:
+		print(__doc__)
+		sys.exit(1)
+
+	directory = tempfile.mkdtemp()
+	try:
+		with open(os.path.join(directory, "script.fn"), "w") as file:
+			file.write(SCRIPT)
+		result = subprocess.run([os.path.abspath(sys.argv[1]), "script.fn"], capture_output=True, text=True, cwd=directory, timeout=60)
+		if result.returncode != 0:
+			print("status %d\n%s%s" % (result.returncode, result.stdout, result.stderr))
+			sys.exit(1)
+
+		before = os.path.join(directory, "before.json")
+		after = os.path.join(directory, "after.json")
+		failure = checkShape(heap_analyze.load(before)) or checkShape(heap_analyze.load(after))
+		failure = failure or checkRetained(heap_analyze.Graph(heap_analyze.load(after)))
+
+		if failure is None:
+			analysis = subprocess.run([sys.executable, os.path.join(TOOLS, "heap_analyze.py"), after, "--compare", before],
+				capture_output=True, text=True, timeout=60)
+			sections = ["Objects by type", "Growth since the earlier snapshot", "Largest retainers", "Dominator tree", 'instance "Holder"']
+			missing = [section for section in sections if section not in analysis.stdout]
+			if analysis.returncode != 0 or missing:
+				failure = "heap_analyze.py printed no %s\n%s%s" % (", ".join(missing), analysis.stdout, analysis.stderr)
+	finally:
+		shutil.rmtree(directory)
+
+	if failure is not None:
+		print(failure)
+		sys.exit(1)
+
+
+if __name__ == "__main__":
+	main()
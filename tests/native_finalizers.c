@@ -0,0 +1,69 @@
+// Native library for native_finalizers.fn, which tests/run.py builds into native_finalizers.dll.
+// Tracked instances are given native data which counts its finalizers, and notes any which ran at the same time as
+// another, or which were meant for the VM's thread but ran on another.
+
+#include "felineffi.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+
+typedef struct Tracked {
+	InstanceData data;
+	bool sync;
+} Tracked;
+
+static atomic_int running;
+static atomic_int finalized;
+static atomic_int overlaps;
+static atomic_int misplaced;
+
+// Set on the VM's thread, which is the only one that calls the natives below
+static _Thread_local bool onVMThread;
+
+static void freeTracked(InstanceData* data) {
+	Tracked* tracked = (Tracked*)data;
+
+	if (atomic_fetch_add(&running, 1) != 0) atomic_fetch_add(&overlaps, 1);
+	if (tracked->sync && !onVMThread) atomic_fetch_add(&misplaced, 1);
+
+	// Takes a while, so that another finalizer started too soon overlaps it
+	volatile int spin = 0;
+	for (int i = 0; i < 20000; i++) spin += i;
+
+	atomic_fetch_add(&finalized, 1);
+	atomic_fetch_sub(&running, 1);
+	free(tracked);
+}
+
+// track(object, sync)
+FELINE_EXPORT Value feline_track(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	onVMThread = true;
+	if (!feline_isInstance(args[0]) || !IS_BOOL(args[1])) {
+		feline_throwException(vm, feline_getInternalException(vm, INTERNAL_EXCEPTION_TYPE), "Expected an object and a boolean");
+		return NULL_VAL;
+	}
+
+	Tracked* tracked = malloc(sizeof(Tracked));
+	if (tracked == NULL) exit(1);
+	tracked->data.freeData = freeTracked;
+	tracked->sync = AS_BOOL(args[1]);
+
+	if (tracked->sync) {
+		feline_setInstanceNativeDataSync(feline_asInstance(args[0]), (InstanceData*)tracked);
+	}
+	else {
+		feline_setInstanceNativeData(feline_asInstance(args[0]), (InstanceData*)tracked);
+	}
+	return NULL_VAL;
+}
+
+FELINE_EXPORT Value feline_finalized(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return NUMBER_VAL(atomic_load(&finalized));
+}
+
+FELINE_EXPORT Value feline_overlaps(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return NUMBER_VAL(atomic_load(&overlaps));
+}
+
+FELINE_EXPORT Value feline_misplaced(VM* vm, Value bound, uint8_t argCount, Value* args) {
+	return NUMBER_VAL(atomic_load(&misplaced));
+}
\ No newline at end of file
@@ -0,0 +1,103 @@
+"""Checks the report --opcode-profile prints at exit, in both counts and cycles modes.
+
+Usage: python tests/opcode_profile.py path/to/feline
+"""
+
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+SCRIPT = """var total = 0;
+for (var i = 0; i < 1000; i = i + 1) total = total + i;
+print total;
+"""
+
+COUNTS = ["opcode", "count", "%"]
+CYCLES = COUNTS + ["ticks", "%", "mean", "p50", "<=", "p99", "<="]
+PAIRS = ["first", "second", "count", "%"]
+
+
+def table(lines, start, headings):
+	"""Returns the rows under the headings at lines[start], split into columns, or None if the headings differ."""
+	if start >= len(lines) or lines[start].split() != headings:
+		return None
+	rows = []
+	for line in lines[start + 1:]:
+		columns = line.split()
+		if len(columns) == 0 or not re.match(r"^[A-Z_]+$", columns[0]):
+			break
+		rows.append(columns)
+	return rows
+
+
+def check(result, mode):
+	"""Returns what is wrong with the report, or None if nothing is."""
+	if result.returncode != 0 or result.stdout != "499500\n":
+		return "status %d\n%s%s" % (result.returncode, result.stdout, result.stderr)
+
+	lines = result.stderr.splitlines()
+	if "-- Opcode Profile" not in lines:
+		return "no report\n" + result.stderr
+	start = lines.index("-- Opcode Profile") + 1
+	if mode == "cycles":
+		if "cycle counter" not in lines[start]:
+			return "no note on the units of time\n" + result.stderr
+		start += 1
+
+	opcodes = table(lines, start, CYCLES if mode == "cycles" else COUNTS)
+	if not opcodes:
+		return "no opcode table\n" + result.stderr
+	counts = {row[0]: int(row[1]) for row in opcodes}
+	if [int(row[1]) for row in opcodes] != sorted(counts.values(), reverse=True):
+		return "the opcode table is out of order\n" + result.stderr
+	# The loop's condition is tested once more than its body runs
+	if counts.get("LESS") != 1001 or counts.get("PRINT") != 1:
+		return "LESS ran %s times and PRINT %s\n%s" % (counts.get("LESS"), counts.get("PRINT"), result.stderr)
+	if abs(sum(float(row[2].rstrip("%")) for row in opcodes) - 100) > 1:
+		return "the shares of the opcodes do not add up\n" + result.stderr
+
+	if mode == "cycles":
+		for row in opcodes:
+			ticks, mean, p50, p99 = int(row[3]), float(row[5]), int(row[6]), int(row[7])
+			if ticks < 0 or mean < 0 or p50 > p99:
+				return "impossible timings for %s\n%s" % (row[0], result.stderr)
+
+	start += len(opcodes) + 2
+	if lines[start - 1].strip() != "Most common pairs:":
+		return "no pairs\n" + result.stderr
+	pairs = table(lines, start, PAIRS)
+	if not pairs:
+		return "no pair table\n" + result.stderr
+	for first, second, count, _ in pairs:
+		if int(count) > min(counts.get(first, 0), counts.get(second, 0)):
+			return "%s then %s runs more often than one of them\n%s" % (first, second, result.stderr)
+	return None
+
+
+def main():
+	if len(sys.argv) != 2:
+		print(__doc__)
+		sys.exit(1)
+
+	directory = tempfile.mkdtemp()
+	try:
+		with open(os.path.join(directory, "script.fn"), "w") as file:
+			file.write(SCRIPT)
+		failure = None
+		for mode in ("counts", "cycles"):
+			result = subprocess.run([os.path.abspath(sys.argv[1]), "--opcode-profile=" + mode, "script.fn"],
+				capture_output=True, text=True, cwd=directory, timeout=60)
+			failure = failure or check(result, mode)
+	finally:
+		shutil.rmtree(directory)
+
+	if failure is not None:
+		print(failure)
+		sys.exit(1)
+
+
+if __name__ == "__main__":
+	main()
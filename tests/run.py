@@ -0,0 +1,102 @@
+"""Runs the tests in tests/ and reports any whose output differs from what is expected.
+
+Usage: python tests/run.py path/to/feline [name ...]
+
+Each test is a script, name.fn, beside the output it must print, name.expected. A first line of the form
+// flags: --option=value ...
+gives options to run the script with. A test which should fail, like one of compile errors, says so with
+// status: N
+(after any flags line) and expects what it prints to stderr after what it prints to stdout.
+A test which needs more than one run of a script, name.py, is given the path to feline and passes if it exits with 0.
+Tests are named without .fn or .py, and by default every one runs.
+A test with natives has their library's source beside it, name.c, which is built into name.dll before it runs;
+CC and CFLAGS are used, if set, when building other than on Windows.
+"""
+
+import os
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+FLAGS = "// flags:"
+STATUS = "// status:"
+
+
+def testNames():
+	scripts = [name[:-3] for name in os.listdir(HERE) if name.endswith(".fn")]
+	drivers = [name[:-3] for name in os.listdir(HERE) if name.endswith(".py") and name != "run.py"]
+	return sorted(scripts + drivers)
+
+
+def buildNatives(name):
+	"""Returns None once name.dll is up to date with name.c, if there is one, or what the compiler printed if it failed."""
+	source = os.path.join(HERE, name + ".c")
+	library = os.path.join(HERE, name + ".dll")
+	if not os.path.exists(source) or (os.path.exists(library) and os.path.getmtime(library) >= os.path.getmtime(source)):
+		return None
+
+	root = os.path.dirname(HERE)
+	if os.name == "nt":
+		command = ["cl", "/nologo", "/LD", "/std:c11", "/experimental:c11atomics", "/I" + root, source, "/Fe" + library]
+	else:
+		command = [os.environ.get("CC", "cc"), "-shared", "-fPIC", "-I" + root] + os.environ.get("CFLAGS", "").split()
+		command += [source, "-o", library]
+
+	result = subprocess.run(command, capture_output=True, text=True, cwd=HERE)
+	if result.returncode == 0:
+		return None
+	return "could not build %s.c\n%s%s" % (name, result.stdout, result.stderr)
+
+
+def run(feline, name):
+	"""Returns None if the test passed, or what it printed if it did not."""
+	driver = os.path.join(HERE, name + ".py")
+	if os.path.exists(driver):
+		result = subprocess.run([sys.executable, driver, feline], capture_output=True, text=True, cwd=HERE, timeout=300)
+		return None if result.returncode == 0 else "status %d\n%s%s" % (result.returncode, result.stdout, result.stderr)
+
+	failure = buildNatives(name)
+	if failure is not None:
+		return failure
+
+	path = os.path.join(HERE, name + ".fn")
+	with open(path) as script:
+		line = script.readline()
+		flags = []
+		if line.startswith(FLAGS):
+			flags = line[len(FLAGS):].split()
+			line = script.readline()
+		status = int(line[len(STATUS):]) if line.startswith(STATUS) else 0
+
+	result = subprocess.run([feline] + flags + [path], capture_output=True, text=True, cwd=HERE, timeout=60)
+	output = result.stdout + result.stderr if status != 0 else result.stdout
+	with open(os.path.join(HERE, name + ".expected")) as expected:
+		if output == expected.read() and result.returncode == status:
+			return None
+	return "status %d\n%s%s" % (result.returncode, result.stdout, result.stderr)
+
+
+def main():
+	args = sys.argv[1:]
+	if len(args) < 1:
+		print(__doc__)
+		sys.exit(1)
+
+	feline = args[0]
+	names = args[1:] or testNames()
+	failed = 0
+	for name in names:
+		output = run(feline, name)
+		if output is None:
+			print("ok     %s" % name)
+		else:
+			failed += 1
+			print("FAILED %s" % name)
+			print(output)
+
+	print("%d of %d passed" % (len(names) - failed, len(names)))
+	sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,82 @@
+"""Checks that --profile writes the stacks it samples as folded stacks, which flamegraph tools read.
+
+Usage: python tests/stack_profile.py path/to/feline
+"""
+
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+SCRIPT = """function leaf(n) {
+	var total = 0;
+	for (var i = 0; i < n; i = i + 1) total = total + i;
+	return total;
+}
+function middle() { return leaf(1000000); }
+function spin() {
+	var total = 0;
+	for (var k = 0; k < 5; k = k + 1) total = total + middle();
+	return total;
+}
+print spin() > 0;
+"""
+
+FRAME = re.compile(r"^\S+ \(script:\d+\)$")
+LEAF = ["<script> (script:12)", "spin (script:9)", "middle (script:6)", "leaf (script:3)"]
+
+
+def check(result, folded):
+	"""Returns what is wrong with the profile, or None if nothing is."""
+	summary = re.search(r"(\d+) samples of (\d+) stacks written to ", result.stderr)
+	if summary is None:
+		return "no summary\n" + result.stderr
+
+	stacks = {}
+	for line in folded.splitlines():
+		stack, _, count = line.rpartition(" ")
+		frames = stack.split(";")
+		if not count.isdigit() or int(count) <= 0 or not all(FRAME.match(frame) for frame in frames):
+			return "not a folded stack: " + line
+		if stack in stacks:
+			return "a stack is written twice: " + stack
+		stacks[stack] = int(count)
+
+	if sum(stacks.values()) != int(summary.group(1)) or len(stacks) != int(summary.group(2)):
+		return "%d samples of %d stacks, not as the summary says: %s" % (sum(stacks.values()), len(stacks), summary.group(0))
+
+	# Nearly all of the time is spent in the innermost loop
+	inLeaf = stacks.get(";".join(LEAF), 0)
+	if inLeaf < sum(stacks.values()) / 2:
+		return "only %d of the samples are in leaf\n%s" % (inLeaf, folded)
+	return None
+
+
+def main():
+	if len(sys.argv) != 2:
+		print(__doc__)
+		sys.exit(1)
+
+	directory = tempfile.mkdtemp()
+	try:
+		with open(os.path.join(directory, "script.fn"), "w") as file:
+			file.write(SCRIPT)
+		result = subprocess.run([os.path.abspath(sys.argv[1]), "--profile=script.folded", "--profile-interval=100", "script.fn"],
+			capture_output=True, text=True, cwd=directory, timeout=120)
+		if result.returncode != 0 or result.stdout != "true\n":
+			failure = "status %d\n%s%s" % (result.returncode, result.stdout, result.stderr)
+		else:
+			with open(os.path.join(directory, "script.folded")) as file:
+				failure = check(result, file.read())
+	finally:
+		shutil.rmtree(directory)
+
+	if failure is not None:
+		print(failure)
+		sys.exit(1)
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,127 @@
+"""Checks that --trace writes Chrome trace events for calls, natives, imports and GC pauses, properly nested.
+
+Usage: python tests/trace_events.py path/to/feline
+"""
+
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+PUSHES = 20000
+
+HELPER = """var text = "x";
+export text as text;
+"""
+
+SCRIPT = """import helper as helper;
+function work(n) {
+	var list = [];
+	for (var i = 0; i < n; i = i + 1) list.push([i]);
+	return len(list);
+}
+print work(%d) + len(helper.text);
+gc.snapshot("heap.json");
+""" % PUSHES
+
+FIELDS = ["name", "cat", "ph", "ts", "dur", "pid", "tid"]
+# Times are in microseconds to three places, so an end may be rounded past that of the span holding it
+SLACK = 0.002
+
+
+def load(path):
+	"""Returns the events in the trace, or a string saying what is wrong with it."""
+	try:
+		with open(path) as file:
+			trace = json.load(file)
+	except ValueError as error:
+		return "the trace is not JSON: %s" % error
+	if not isinstance(trace, dict) or not isinstance(trace.get("traceEvents"), list):
+		return "the trace has no traceEvents list"
+
+	for event in trace["traceEvents"]:
+		if any(field not in event for field in FIELDS) or event["ph"] != "X" or event["ts"] < 0 or event["dur"] < 0:
+			return "not a complete event: %s" % event
+	return trace["traceEvents"]
+
+
+def checkNesting(events):
+	"""Returns a pair of events on one thread which overlap without one holding the other, or None."""
+	threads = {}
+	for event in events:
+		threads.setdefault((event["pid"], event["tid"]), []).append(event)
+
+	for thread in threads.values():
+		thread.sort(key=lambda event: (event["ts"], -event["dur"]))
+		spans = []
+		for event in thread:
+			while spans and spans[-1]["ts"] + spans[-1]["dur"] <= event["ts"] + SLACK:
+				spans.pop()
+			if spans and event["ts"] + event["dur"] > spans[-1]["ts"] + spans[-1]["dur"] + SLACK:
+				return "%s overlaps %s" % (event, spans[-1])
+			spans.append(event)
+	return None
+
+
+def check(events):
+	"""Returns what is wrong with a full trace of the script, or None if nothing is."""
+	named = lambda category, name: [event for event in events if event["cat"] == category and event["name"] == name]
+
+	works = named("function", "work")
+	pushes = named("native", "push")
+	if len(works) != 1 or len(pushes) != PUSHES:
+		return "%d calls of work and %d of push" % (len(works), len(pushes))
+	work = works[0]
+	if any(push["ts"] < work["ts"] or push["ts"] + push["dur"] > work["ts"] + work["dur"] + SLACK for push in pushes):
+		return "a push is outside the call of work"
+
+	imports = named("import", "import")
+	if not any(event.get("args", {}).get("detail", "").endswith("helper.fn") for event in imports):
+		return "no import of helper: %s" % imports
+	if not named("gc", "heap snapshot"):
+		return "no pause for the heap snapshot"
+	return checkNesting(events)
+
+
+def run(feline, directory, flags):
+	result = subprocess.run([feline, "--trace=trace.json"] + flags + ["main.fn"], capture_output=True, text=True, cwd=directory, timeout=120)
+	if result.returncode != 0 or result.stdout != "%d\n" % (PUSHES + 1):
+		return "status %d\n%s%s" % (result.returncode, result.stdout, result.stderr)
+	return load(os.path.join(directory, "trace.json"))
+
+
+def main():
+	if len(sys.argv) != 2:
+		print(__doc__)
+		sys.exit(1)
+
+	feline = os.path.abspath(sys.argv[1])
+	directory = tempfile.mkdtemp()
+	try:
+		with open(os.path.join(directory, "helper.fn"), "w") as file:
+			file.write(HELPER)
+		with open(os.path.join(directory, "main.fn"), "w") as file:
+			file.write(SCRIPT)
+
+		events = run(feline, directory, [])
+		failure = events if isinstance(events, str) else check(events)
+
+		# Leaving out short events keeps only those at least as long as the minimum
+		if failure is None:
+			events = run(feline, directory, ["--trace-min-duration=1000"])
+			if isinstance(events, str):
+				failure = events
+			elif any(event["dur"] < 1000 for event in events):
+				failure = "an event shorter than the minimum duration was kept"
+	finally:
+		shutil.rmtree(directory)
+
+	if failure is not None:
+		print(failure)
+		sys.exit(1)
+
+
+if __name__ == "__main__":
+	main()
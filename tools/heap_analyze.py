@@ -0,0 +1,241 @@
+"""Finds what retains memory in a heap snapshot written by gc.snapshot(path).
+
+Usage: python tools/heap_analyze.py snapshot.json [--top N] [--depth N] [--min-percent P] [--compare older.json]
+
+An object's retained size is what would be freed if it were unreachable: its own size, plus that of every
+object which can only be reached through it. These are found from the dominator tree of the heap graph, in which
+an object's parent is the nearest object that every path from the roots to it passes through.
+
+--top          the number of largest retainers to list (default 20)
+--depth        how deep to print the dominator tree (default 4)
+--min-percent  the smallest share of the heap a dominator tree entry must retain to be printed (default 1)
+--compare      an earlier snapshot of the same process, to report which types of object have grown since
+"""
+
+import json
+import sys
+from collections import defaultdict
+
+
+class Graph:
+	"""Node 0 is a synthetic root above every root group; the groups come next, then the objects."""
+
+	def __init__(self, snapshot):
+		self.labels = ["(roots)"]
+		self.types = ["(roots)"]
+		self.sizes = [0]
+		self.edges = [[]]
+
+		for root in snapshot["roots"]:
+			label = root["label"] if "module" not in root else "%s of %s" % (root["label"], root["module"])
+			self.edges[0].append(len(self.labels))
+			self.labels.append(label)
+			self.types.append("(root)")
+			self.sizes.append(0)
+			self.edges.append(root["references"])
+
+		indices = {}
+		for obj in snapshot["objects"]:
+			indices[obj["id"]] = len(self.labels)
+			self.labels.append(obj.get("name", ""))
+			self.types.append(obj["type"])
+			self.sizes.append(obj["size"])
+			self.edges.append(obj["references"])
+
+		# References are written as ids; every one of them is to an object in the snapshot
+		for node in range(len(self.edges)):
+			if node == 0:
+				continue
+			self.edges[node] = [indices[id] for id in self.edges[node] if id in indices]
+
+		self.rootCount = len(snapshot["roots"])
+
+	def describe(self, node):
+		if node <= self.rootCount:
+			return "[%s]" % self.labels[node]
+		name = self.labels[node]
+		return "%s %s" % (self.types[node], json.dumps(name)) if name else self.types[node]
+
+
+def dominators(graph):
+	"""Cooper, Harvey and Kennedy's iterative algorithm, over a reverse postorder found without recursion."""
+	count = len(graph.edges)
+	order = []
+	visited = [False] * count
+	visited[0] = True
+	stack = [(0, iter(graph.edges[0]))]
+	while stack:
+		node, children = stack[-1]
+		for child in children:
+			if not visited[child]:
+				visited[child] = True
+				stack.append((child, iter(graph.edges[child])))
+				break
+		else:
+			stack.pop()
+			order.append(node)
+	order.reverse()
+
+	position = [-1] * count
+	for index, node in enumerate(order):
+		position[node] = index
+
+	predecessors = [[] for _ in range(count)]
+	for node in order:
+		for child in graph.edges[node]:
+			predecessors[child].append(node)
+
+	idom = [-1] * count
+	idom[0] = 0
+
+	def intersect(a, b):
+		while a != b:
+			while position[a] > position[b]:
+				a = idom[a]
+			while position[b] > position[a]:
+				b = idom[b]
+		return a
+
+	changed = True
+	while changed:
+		changed = False
+		for node in order[1:]:
+			newIdom = -1
+			for predecessor in predecessors[node]:
+				if idom[predecessor] == -1:
+					continue
+				newIdom = predecessor if newIdom == -1 else intersect(predecessor, newIdom)
+			if idom[node] != newIdom:
+				idom[node] = newIdom
+				changed = True
+
+	return idom, order
+
+
+def retainedSizes(graph, idom, order):
+	retained = list(graph.sizes)
+	# Children come after their dominators in reverse postorder, so walking it backwards sums subtrees bottom up
+	for node in reversed(order[1:]):
+		retained[idom[node]] += retained[node]
+	return retained
+
+
+def formatBytes(size):
+	for unit in ("B", "KB", "MB"):
+		if size < 1024:
+			return "%.1f %s" % (size, unit) if unit != "B" else "%d B" % size
+		size /= 1024.0
+	return "%.1f GB" % size
+
+
+def typeTotals(graph):
+	totals = defaultdict(lambda: [0, 0])
+	for node in range(graph.rootCount + 1, len(graph.sizes)):
+		totals[graph.types[node]][0] += 1
+		totals[graph.types[node]][1] += graph.sizes[node]
+	return totals
+
+
+def printSummary(graph):
+	totals = typeTotals(graph)
+	print("Objects by type")
+	print("  %-14s %10s %12s" % ("type", "count", "size"))
+	for type, (count, size) in sorted(totals.items(), key=lambda item: -item[1][1]):
+		print("  %-14s %10d %12s" % (type, count, formatBytes(size)))
+	print("  %-14s %10d %12s" % ("total", sum(t[0] for t in totals.values()), formatBytes(sum(t[1] for t in totals.values()))))
+	print()
+
+
+def dominatorPath(graph, idom, node):
+	path = []
+	while node != 0:
+		path.append(graph.describe(node))
+		node = idom[node]
+	# A long chain, such as a linked list, is shortened to its nearest links and the root it hangs from
+	if len(path) > 6:
+		path = path[:4] + ["..."] + path[-1:]
+	return " <- ".join(path)
+
+
+def printTopRetainers(graph, idom, retained, top):
+	objects = [node for node in range(graph.rootCount + 1, len(graph.sizes)) if idom[node] != -1]
+	objects.sort(key=lambda node: -retained[node])
+
+	print("Largest retainers")
+	print("  %12s %12s  %s" % ("retained", "own size", "object <- dominators"))
+	for node in objects[:top]:
+		print("  %12s %12s  %s" % (formatBytes(retained[node]), formatBytes(graph.sizes[node]), dominatorPath(graph, idom, node)))
+	print()
+
+
+def printDominatorTree(graph, idom, retained, depth, minPercent):
+	children = defaultdict(list)
+	for node in range(1, len(idom)):
+		if idom[node] != -1:
+			children[idom[node]].append(node)
+
+	total = retained[0] or 1
+	threshold = total * minPercent / 100.0
+
+	print("Dominator tree (entries retaining at least %g%% of %s)" % (minPercent, formatBytes(total)))
+	stack = [(node, 0) for node in sorted(children[0], key=lambda node: retained[node])]
+	while stack:
+		node, level = stack.pop()
+		if retained[node] < threshold:
+			continue
+		print("  %s%s  %s (%.1f%%)" % ("  " * level, graph.describe(node), formatBytes(retained[node]), 100.0 * retained[node] / total))
+		if level + 1 < depth:
+			stack.extend((child, level + 1) for child in sorted(children[node], key=lambda child: retained[child]))
+	print()
+
+
+def printGrowth(graph, older):
+	now = typeTotals(graph)
+	before = typeTotals(older)
+
+	print("Growth since the earlier snapshot")
+	print("  %-14s %10s %12s" % ("type", "count", "size"))
+	types = sorted(set(now) | set(before), key=lambda type: -(now[type][1] - before[type][1]))
+	for type in types:
+		countChange = now[type][0] - before[type][0]
+		sizeChange = now[type][1] - before[type][1]
+		if countChange == 0 and sizeChange == 0:
+			continue
+		sign = "+" if sizeChange >= 0 else "-"
+		print("  %-14s %+10d %12s" % (type, countChange, sign + formatBytes(abs(sizeChange))))
+	print()
+
+
+def load(path):
+	# Names are cut at a byte limit, so a malformed string should not stop the analysis
+	with open(path, encoding="utf-8", errors="replace") as file:
+		return json.load(file)
+
+
+def main():
+	args = sys.argv[1:]
+	options = {"--top": 20, "--depth": 4, "--min-percent": 1.0, "--compare": None}
+	for name in list(options):
+		if name in args:
+			index = args.index(name)
+			value = args[index + 1]
+			options[name] = value if name == "--compare" else type(options[name])(value)
+			del args[index:index + 2]
+
+	if len(args) != 1:
+		print(__doc__)
+		sys.exit(1)
+
+	graph = Graph(load(args[0]))
+	idom, order = dominators(graph)
+	retained = retainedSizes(graph, idom, order)
+
+	printSummary(graph)
+	if options["--compare"] is not None:
+		printGrowth(graph, Graph(load(options["--compare"])))
+	printTopRetainers(graph, idom, retained, options["--top"])
+	printDominatorTree(graph, idom, retained, options["--depth"], options["--min-percent"])
+
+
+if __name__ == "__main__":
+	main()